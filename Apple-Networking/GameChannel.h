@@ -0,0 +1,111 @@
+/*
+
+Disclaimer: IMPORTANT:  This Apple software is supplied to you by Apple Inc.
+("Apple") in consideration of your agreement to the following terms, and your
+use, installation, modification or redistribution of this Apple software
+constitutes acceptance of these terms.  If you do not agree with these terms,
+please do not use, install, modify or redistribute this Apple software.
+
+In consideration of your agreement to abide by the following terms, and subject
+to these terms, Apple grants you a personal, non-exclusive license, under
+Apple's copyrights in this original Apple software (the "Apple Software"), to
+use, reproduce, modify and redistribute the Apple Software, with or without
+modifications, in source and/or binary forms; provided that if you redistribute
+the Apple Software in its entirety and without modifications, you must retain
+this notice and the following text and disclaimers in all such redistributions
+of the Apple Software.
+Neither the name, trademarks, service marks or logos of Apple Inc. may be used
+to endorse or promote products derived from the Apple Software without specific
+prior written permission from Apple.  Except as expressly stated in this notice,
+no other rights or licenses, express or implied, are granted by Apple herein,
+including but not limited to any patent rights that may be infringed by your
+derivative works or by other works in which the Apple Software may be
+incorporated.
+
+The Apple Software is provided by Apple on an "AS IS" basis.  APPLE MAKES NO
+WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE IMPLIED
+WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE, REGARDING THE APPLE SOFTWARE OR ITS USE AND OPERATION ALONE OR IN
+COMBINATION WITH YOUR PRODUCTS.
+
+IN NO EVENT SHALL APPLE BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ARISING IN ANY WAY OUT OF THE USE, REPRODUCTION, MODIFICATION AND/OR
+DISTRIBUTION OF THE APPLE SOFTWARE, HOWEVER CAUSED AND WHETHER UNDER THEORY OF
+CONTRACT, TORT (INCLUDING NEGLIGENCE), STRICT LIABILITY OR OTHERWISE, EVEN IF
+APPLE HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+Copyright (C) 2008 Apple Inc. All Rights Reserved.
+
+*/
+
+#import <Foundation/Foundation.h>
+
+#import "GamePeer.h"
+
+//CLASSES:
+
+@class GameChannel;
+
+//PROTOCOLS:
+
+@protocol GameChannelDelegate <NSObject>
+- (BOOL) gameChannel:(GameChannel*)channel sendDatagram:(NSData*)datagram;
+- (void) gameChannel:(GameChannel*)channel didReceiveData:(NSData*)data;
+- (void) gameChannel:(GameChannel*)channel didReceiveProbeReply:(UInt32)sequence sendTime:(CFAbsoluteTime)sendTime;
+- (void) gameChannel:(GameChannel*)channel didReceiveSnapshotData:(NSData*)data;
+- (void) gameChannel:(GameChannel*)channel didReceiveSnapshotAck:(UInt32)identifier;
+- (void) gameChannelDidTimeOut:(GameChannel*)channel; //Called after a reliable datagram went unacknowledged for too many retransmissions - The channel is invalidated
+@end
+
+//CLASS INTERFACES:
+
+/*
+This class implements the delivery modes of GamePeer that run over UDP.
+Each datagram starts with a small header: unreliable datagrams only carry their type, sequenced ones add a sequence number, and reliable ones also carry an acknowledgement of the latest datagrams received from the remote peer.
+Reliable datagrams are retransmitted selectively when they time out or when later ones are acknowledged, and the number of datagrams in flight is limited by an AIMD congestion window.
+The number of reliable datagrams waiting for room in the window is limited, and the channel gives up on the remote peer if one of them is retransmitted too many times without being acknowledged.
+The GameChannel instance must be used from a single thread whose runloop will be used for its retransmission timer.
+*/
+@interface GameChannel : NSObject
+{
+@private
+	id<GameChannelDelegate>		_delegate;
+	NSTimer*					_timer;
+	BOOL						_invalidated;
+	
+	UInt16						_sequencedSendNext;
+	UInt16						_sequencedReceiveLast;
+	BOOL						_sequencedReceivedAny;
+	
+	UInt16						_reliableSendNext;
+	UInt16						_reliableSendBase;
+	void*						_reliableSlots;
+	NSMutableArray*				_reliableQueue;
+	double						_congestionWindow;
+	CFAbsoluteTime				_lastWindowDecrease;
+	CFTimeInterval				_smoothedRoundTripTime;
+	CFTimeInterval				_roundTripTimeVariance;
+	CFTimeInterval				_retransmissionTimeOut;
+	
+	UInt16						_reliableReceiveNext;
+	UInt16						_reliableReceivedHighest;
+	UInt32						_reliableReceivedBits;
+	BOOL						_reliableReceivedAny;
+	NSMutableDictionary*		_reliableReceiveBuffer;
+}
++ (NSData*) unreliableDatagramWithData:(NSData*)data; //Can be sent to any number of peers
++ (NSData*) snapshotDatagramWithData:(NSData*)data; //Can be sent to any number of peers
+
+@property(nonatomic, assign) id<GameChannelDelegate> delegate;
+- (void) invalidate;
+
+- (BOOL) sendData:(NSData*)data mode:(GameDeliveryMode)mode; //"mode" cannot be kGameDeliveryMode_Reliable - Returns NO if too many reliable datagrams are already pending
+- (void) receiveDatagram:(NSData*)datagram;
+- (BOOL) sendProbe:(UInt32)sequence; //Probes are replied to automatically by the remote channel
+- (BOOL) sendSnapshotAck:(UInt32)identifier;
+
+@property(nonatomic, readonly) NSUInteger pendingReliableCount; //Reliable datagrams not acknowledged yet or waiting for room in the congestion window
+@property(nonatomic, readonly) NSTimeInterval smoothedRoundTripTime; //Estimated from acknowledgements - 0.0 until the first one is received
+@end
@@ -0,0 +1,560 @@
+/*
+
+Disclaimer: IMPORTANT:  This Apple software is supplied to you by Apple Inc.
+("Apple") in consideration of your agreement to the following terms, and your
+use, installation, modification or redistribution of this Apple software
+constitutes acceptance of these terms.  If you do not agree with these terms,
+please do not use, install, modify or redistribute this Apple software.
+
+In consideration of your agreement to abide by the following terms, and subject
+to these terms, Apple grants you a personal, non-exclusive license, under
+Apple's copyrights in this original Apple software (the "Apple Software"), to
+use, reproduce, modify and redistribute the Apple Software, with or without
+modifications, in source and/or binary forms; provided that if you redistribute
+the Apple Software in its entirety and without modifications, you must retain
+this notice and the following text and disclaimers in all such redistributions
+of the Apple Software.
+Neither the name, trademarks, service marks or logos of Apple Inc. may be used
+to endorse or promote products derived from the Apple Software without specific
+prior written permission from Apple.  Except as expressly stated in this notice,
+no other rights or licenses, express or implied, are granted by Apple herein,
+including but not limited to any patent rights that may be infringed by your
+derivative works or by other works in which the Apple Software may be
+incorporated.
+
+The Apple Software is provided by Apple on an "AS IS" basis.  APPLE MAKES NO
+WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE IMPLIED
+WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE, REGARDING THE APPLE SOFTWARE OR ITS USE AND OPERATION ALONE OR IN
+COMBINATION WITH YOUR PRODUCTS.
+
+IN NO EVENT SHALL APPLE BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ARISING IN ANY WAY OUT OF THE USE, REPRODUCTION, MODIFICATION AND/OR
+DISTRIBUTION OF THE APPLE SOFTWARE, HOWEVER CAUSED AND WHETHER UNDER THEORY OF
+CONTRACT, TORT (INCLUDING NEGLIGENCE), STRICT LIABILITY OR OTHERWISE, EVEN IF
+APPLE HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+Copyright (C) 2008 Apple Inc. All Rights Reserved.
+
+*/
+
+#import "GameChannel.h"
+#import "GameTelemetry.h"
+#import "Game_Internal.h"
+
+//CONSTANTS:
+
+#define kPacketType_Unreliable				0x00
+#define kPacketType_Sequenced				0x01
+#define kPacketType_Reliable				0x02
+#define kPacketType_Ack						0x03
+#define kPacketType_Probe					0x04
+#define kPacketType_ProbeReply				0x05
+#define kPacketType_Snapshot				0x06
+#define kPacketType_SnapshotAck				0x07
+#define kPacketTypeMask						0x7F
+#define kPacketFlag_HasAck					0x80
+
+#define kAckSize							6 //Latest sequence received and bitfield of the 32 ones before it
+#define kSequencedHeaderSize				3
+#define kReliableHeaderSize					(3 + kAckSize)
+
+#define kWindowSize							32 //Must not exceed the number of sequences covered by an acknowledgement
+#define kMinCongestionWindow				2.0
+#define kInitialCongestionWindow			4.0
+#define kFastRetransmitThreshold			3
+#define kMaxOutOfOrderDatagrams				256
+#define kMaxQueuedDatagrams					1024 //Reliable datagrams waiting for room in the congestion window
+#define kMaxTransmissions					10 //About 15 seconds at the maximum retransmission timeout
+#define kInitialRetransmissionTimeOut		0.2
+#define kMinRetransmissionTimeOut			0.05
+#define kMaxRetransmissionTimeOut			2.0
+#define kTimerInterval						0.01
+
+//STRUCTURES:
+
+typedef struct {
+	NSData*					data;
+	CFAbsoluteTime			sendTime;
+	NSUInteger				transmissions;
+	UInt16					sequence;
+	BOOL					used;
+} ReliableSlot;
+
+//FUNCTIONS:
+
+static inline BOOL _IsNewerSequence(UInt16 sequence, UInt16 reference)
+{
+	UInt16					delta = sequence - reference;
+	
+	return ((delta != 0) && (delta < 0x8000) ? YES : NO);
+}
+
+static inline void _WriteUInt16(UInt8* bytes, UInt16 value)
+{
+	bytes[0] = value >> 8;
+	bytes[1] = value;
+}
+
+static inline UInt16 _ReadUInt16(const UInt8* bytes)
+{
+	return (bytes[0] << 8) | bytes[1];
+}
+
+static inline void _WriteUInt32(UInt8* bytes, UInt32 value)
+{
+	bytes[0] = value >> 24;
+	bytes[1] = value >> 16;
+	bytes[2] = value >> 8;
+	bytes[3] = value;
+}
+
+static inline UInt32 _ReadUInt32(const UInt8* bytes)
+{
+	return ((UInt32)bytes[0] << 24) | ((UInt32)bytes[1] << 16) | ((UInt32)bytes[2] << 8) | bytes[3];
+}
+
+//CLASS IMPLEMENTATION:
+
+@implementation GameChannel
+
+@synthesize delegate=_delegate;
+
++ (NSData*) unreliableDatagramWithData:(NSData*)data
+{
+	NSMutableData*			datagram = [NSMutableData dataWithCapacity:(1 + [data length])];
+	UInt8					type = kPacketType_Unreliable;
+	
+	[datagram appendBytes:&type length:1];
+	[datagram appendData:data];
+	
+	return datagram;
+}
+
++ (NSData*) snapshotDatagramWithData:(NSData*)data
+{
+	NSMutableData*			datagram = [NSMutableData dataWithCapacity:(1 + [data length])];
+	UInt8					type = kPacketType_Snapshot;
+	
+	[datagram appendBytes:&type length:1];
+	[datagram appendData:data];
+	
+	return datagram;
+}
+
+- (id) init
+{
+	if((self = [super init])) {
+		_reliableSlots = calloc(kWindowSize, sizeof(ReliableSlot));
+		_reliableQueue = [NSMutableArray new];
+		_reliableReceiveBuffer = [NSMutableDictionary new];
+		_congestionWindow = kInitialCongestionWindow;
+		_retransmissionTimeOut = kInitialRetransmissionTimeOut;
+	}
+	
+	return self;
+}
+
+- (void) dealloc
+{
+	[self invalidate];
+	
+	free(_reliableSlots);
+	[_reliableReceiveBuffer release];
+	[_reliableQueue release];
+	
+	[super dealloc];
+}
+
+- (void) invalidate
+{
+	ReliableSlot*			slots = (ReliableSlot*)_reliableSlots;
+	NSUInteger				i;
+	
+	if(_invalidated == NO) {
+		_invalidated = YES;
+	
+		[_timer invalidate]; //NOTE: The timer retains us
+		[_timer release];
+		_timer = nil;
+	
+		for(i = 0; i < kWindowSize; ++i) {
+			[slots[i].data release];
+			slots[i].data = nil;
+			slots[i].used = NO;
+		}
+		[_reliableQueue removeAllObjects];
+		[_reliableReceiveBuffer removeAllObjects];
+	}
+}
+
+- (NSUInteger) pendingReliableCount
+{
+	ReliableSlot*			slots = (ReliableSlot*)_reliableSlots;
+	NSUInteger				count = [_reliableQueue count];
+	UInt16					sequence;
+	
+	for(sequence = _reliableSendBase; sequence != _reliableSendNext; ++sequence) {
+		if(slots[sequence % kWindowSize].used)
+		count += 1;
+	}
+	
+	return count;
+}
+
+- (NSTimeInterval) smoothedRoundTripTime
+{
+	return _smoothedRoundTripTime;
+}
+
+- (void) _writeAckToBytes:(UInt8*)bytes
+{
+	_WriteUInt16(bytes, _reliableReceivedHighest);
+	_WriteUInt32(bytes + 2, _reliableReceivedBits);
+}
+
+- (void) _sendAck
+{
+	NSMutableData*			datagram = [NSMutableData dataWithLength:(1 + kAckSize)];
+	UInt8*					bytes = [datagram mutableBytes];
+	
+	bytes[0] = kPacketType_Ack | kPacketFlag_HasAck;
+	[self _writeAckToBytes:&bytes[1]];
+	
+	[_delegate gameChannel:self sendDatagram:datagram];
+}
+
+/* Acknowledgements are refreshed on every transmission so that retransmitted datagrams carry the latest ones */
+- (BOOL) _transmitSlot:(ReliableSlot*)slot
+{
+	NSMutableData*			datagram = [NSMutableData dataWithCapacity:(kReliableHeaderSize + [slot->data length])];
+	UInt8					header[kReliableHeaderSize];
+	
+	header[0] = kPacketType_Reliable | (_reliableReceivedAny ? kPacketFlag_HasAck : 0);
+	_WriteUInt16(&header[1], slot->sequence);
+	[self _writeAckToBytes:&header[3]];
+	[datagram appendBytes:header length:kReliableHeaderSize];
+	[datagram appendData:slot->data];
+	
+	slot->sendTime = CFAbsoluteTimeGetCurrent();
+	slot->transmissions += 1;
+	
+	return [_delegate gameChannel:self sendDatagram:datagram];
+}
+
+- (void) _updateTimer
+{
+	BOOL					needed = (!_invalidated && (_reliableSendBase != _reliableSendNext));
+	
+	if(needed && (_timer == nil))
+	_timer = [[NSTimer scheduledTimerWithTimeInterval:kTimerInterval target:self selector:@selector(_timer:) userInfo:nil repeats:YES] retain];
+	else if(!needed && _timer) {
+		[_timer invalidate];
+		[_timer release];
+		_timer = nil;
+	}
+}
+
+/* Datagrams waiting in the queue are only sent when there is room in the congestion window */
+- (void) _flushReliableQueue
+{
+	ReliableSlot*			slots = (ReliableSlot*)_reliableSlots;
+	ReliableSlot*			slot;
+	
+	while([_reliableQueue count] && ((UInt16)(_reliableSendNext - _reliableSendBase) < (NSUInteger)_congestionWindow)) {
+		slot = &slots[_reliableSendNext % kWindowSize];
+		slot->data = [[_reliableQueue objectAtIndex:0] retain];
+		[_reliableQueue removeObjectAtIndex:0];
+		slot->sequence = _reliableSendNext;
+		slot->transmissions = 0;
+		slot->used = YES;
+		_reliableSendNext += 1;
+	
+		if(![self _transmitSlot:slot])
+		REPORT_ERROR(@"Failed sending reliable datagram #%i", slot->sequence); //NOTE: It will be retransmitted
+	}
+	
+	[self _updateTimer];
+}
+
+- (void) _updateRoundTripTime:(CFTimeInterval)sample
+{
+	if(_smoothedRoundTripTime <= 0.0) {
+		_smoothedRoundTripTime = sample;
+		_roundTripTimeVariance = sample / 2.0;
+	}
+	else {
+		_roundTripTimeVariance = 0.75 * _roundTripTimeVariance + 0.25 * fabs(_smoothedRoundTripTime - sample);
+		_smoothedRoundTripTime = 0.875 * _smoothedRoundTripTime + 0.125 * sample;
+	}
+	
+	_retransmissionTimeOut = MIN(MAX(_smoothedRoundTripTime + 4.0 * _roundTripTimeVariance, kMinRetransmissionTimeOut), kMaxRetransmissionTimeOut);
+}
+
+- (void) _decreaseCongestionWindow:(CFAbsoluteTime)now
+{
+	//NOTE: Losses are only reacted to once per round trip as they tend to come in bursts
+	if(now - _lastWindowDecrease < MAX(_smoothedRoundTripTime, kMinRetransmissionTimeOut))
+	return;
+	
+	_congestionWindow = MAX(_congestionWindow / 2.0, kMinCongestionWindow);
+	_lastWindowDecrease = now;
+}
+
+- (void) _processAck:(UInt16)ack bits:(UInt32)bits
+{
+	ReliableSlot*			slots = (ReliableSlot*)_reliableSlots;
+	CFAbsoluteTime			now = CFAbsoluteTimeGetCurrent();
+	ReliableSlot*			slot;
+	UInt16					sequence;
+	NSUInteger				i;
+	
+	for(i = 0; i <= 32; ++i) {
+		if(i && !(bits & (1U << (i - 1))))
+		continue;
+	
+		sequence = ack - i;
+		slot = &slots[sequence % kWindowSize];
+		if(slot->used && (slot->sequence == sequence)) {
+			if(slot->transmissions == 1) //NOTE: Samples from retransmitted datagrams are ambiguous (Karn's algorithm)
+			[self _updateRoundTripTime:(now - slot->sendTime)];
+			[slot->data release];
+			slot->data = nil;
+			slot->used = NO;
+			_congestionWindow = MIN(_congestionWindow + 1.0 / _congestionWindow, kWindowSize);
+		}
+	}
+	while((_reliableSendBase != _reliableSendNext) && !slots[_reliableSendBase % kWindowSize].used)
+	_reliableSendBase += 1;
+	
+	//NOTE: Datagrams far enough behind an acknowledged one were most likely lost so retransmit them without waiting for the timeout
+	for(sequence = _reliableSendBase; sequence != _reliableSendNext; ++sequence) {
+		slot = &slots[sequence % kWindowSize];
+		if(slot->used && _IsNewerSequence(ack, sequence) && ((UInt16)(ack - sequence) >= kFastRetransmitThreshold) && (now - slot->sendTime >= _smoothedRoundTripTime)) {
+			[self _decreaseCongestionWindow:now];
+			[self _transmitSlot:slot];
+		}
+	}
+	
+	[self _flushReliableQueue];
+}
+
+- (void) _timer:(NSTimer*)timer
+{
+	ReliableSlot*			slots = (ReliableSlot*)_reliableSlots;
+	CFAbsoluteTime			now = CFAbsoluteTimeGetCurrent();
+	BOOL					timedOut = NO;
+	ReliableSlot*			slot;
+	UInt16					sequence;
+	
+	for(sequence = _reliableSendBase; sequence != _reliableSendNext; ++sequence) {
+		slot = &slots[sequence % kWindowSize];
+		if(slot->used && (now - slot->sendTime >= _retransmissionTimeOut)) {
+			if(slot->transmissions >= kMaxTransmissions) {
+				REPORT_ERROR(@"Giving up on reliable datagram #%i after %i transmissions", slot->sequence, (int)slot->transmissions);
+				[[self retain] autorelease]; //NOTE: The delegate may release us
+				[self invalidate];
+				[_delegate gameChannelDidTimeOut:self];
+				return;
+			}
+			[self _transmitSlot:slot];
+			timedOut = YES;
+		}
+	}
+	
+	if(timedOut) {
+		_congestionWindow = kMinCongestionWindow;
+		_lastWindowDecrease = now;
+		_retransmissionTimeOut = MIN(_retransmissionTimeOut * 2.0, kMaxRetransmissionTimeOut);
+	}
+}
+
+- (void) _recordReliableSequence:(UInt16)sequence
+{
+	UInt16					delta;
+	
+	if(_reliableReceivedAny == NO) {
+		_reliableReceivedHighest = sequence;
+		_reliableReceivedBits = 0;
+		_reliableReceivedAny = YES;
+	}
+	else if(_IsNewerSequence(sequence, _reliableReceivedHighest)) {
+		delta = sequence - _reliableReceivedHighest;
+		_reliableReceivedBits = (delta < 32 ? _reliableReceivedBits << delta : 0);
+		if(delta <= 32)
+		_reliableReceivedBits |= 1U << (delta - 1);
+		_reliableReceivedHighest = sequence;
+	}
+	else {
+		delta = _reliableReceivedHighest - sequence;
+		if((delta >= 1) && (delta <= 32))
+		_reliableReceivedBits |= 1U << (delta - 1);
+	}
+}
+
+- (void) _receiveReliableData:(NSData*)data sequence:(UInt16)sequence
+{
+	NSNumber*				key;
+	NSData*					next;
+	
+	[self _recordReliableSequence:sequence];
+	[self _sendAck]; //NOTE: Duplicates are acknowledged again in case the previous acknowledgement was lost
+	
+	if(sequence == _reliableReceiveNext) {
+		_reliableReceiveNext += 1;
+		[_delegate gameChannel:self didReceiveData:data];
+	
+		while(!_invalidated && (next = [_reliableReceiveBuffer objectForKey:(key = [NSNumber numberWithUnsignedShort:_reliableReceiveNext])])) {
+			[next retain];
+			[_reliableReceiveBuffer removeObjectForKey:key];
+			_reliableReceiveNext += 1;
+			[_delegate gameChannel:self didReceiveData:next];
+			[next release];
+		}
+	}
+	else if(_IsNewerSequence(sequence, _reliableReceiveNext) && ((UInt16)(sequence - _reliableReceiveNext) < kMaxOutOfOrderDatagrams))
+	[_reliableReceiveBuffer setObject:data forKey:[NSNumber numberWithUnsignedShort:sequence]];
+}
+
+- (BOOL) sendData:(NSData*)data mode:(GameDeliveryMode)mode
+{
+	NSMutableData*			datagram;
+	UInt8					header[kSequencedHeaderSize];
+	
+	if(_invalidated || !data)
+	return NO;
+	
+	switch(mode) {
+	
+		case kGameDeliveryMode_Unreliable:
+		return [_delegate gameChannel:self sendDatagram:[GameChannel unreliableDatagramWithData:data]];
+	
+		case kGameDeliveryMode_UnreliableSequenced:
+		header[0] = kPacketType_Sequenced;
+		_WriteUInt16(&header[1], _sequencedSendNext);
+		_sequencedSendNext += 1;
+		datagram = [NSMutableData dataWithCapacity:(kSequencedHeaderSize + [data length])];
+		[datagram appendBytes:header length:kSequencedHeaderSize];
+		[datagram appendData:data];
+		return [_delegate gameChannel:self sendDatagram:datagram];
+	
+		case kGameDeliveryMode_ReliableOrdered:
+		if([_reliableQueue count] >= kMaxQueuedDatagrams)
+		return NO;
+		[_reliableQueue addObject:[[data copy] autorelease]];
+		[self _flushReliableQueue];
+		return YES;
+	
+		default:
+		break;
+	
+	}
+	
+	return NO;
+}
+
+- (BOOL) sendProbe:(UInt32)sequence
+{
+	UInt8					bytes[1 + kGameProbeSize];
+	
+	if(_invalidated)
+	return NO;
+	
+	bytes[0] = kPacketType_Probe;
+	GameProbeWrite(&bytes[1], sequence, CFAbsoluteTimeGetCurrent());
+	
+	return [_delegate gameChannel:self sendDatagram:[NSData dataWithBytes:bytes length:sizeof(bytes)]];
+}
+
+- (BOOL) sendSnapshotAck:(UInt32)identifier
+{
+	UInt8					bytes[5];
+	
+	if(_invalidated)
+	return NO;
+	
+	bytes[0] = kPacketType_SnapshotAck;
+	_WriteUInt32(&bytes[1], identifier);
+	
+	return [_delegate gameChannel:self sendDatagram:[NSData dataWithBytes:bytes length:sizeof(bytes)]];
+}
+
+- (void) receiveDatagram:(NSData*)datagram
+{
+	const UInt8*			bytes = [datagram bytes];
+	NSUInteger				length = [datagram length];
+	UInt16					sequence;
+	UInt32					probeSequence;
+	CFAbsoluteTime			probeTime;
+	NSMutableData*			reply;
+	
+	if(_invalidated || (length < 1))
+	return;
+	
+	[[self retain] autorelease]; //NOTE: The delegate may release us while we are processing the datagram
+	
+	switch(bytes[0] & kPacketTypeMask) {
+	
+		case kPacketType_Unreliable:
+		[_delegate gameChannel:self didReceiveData:[datagram subdataWithRange:NSMakeRange(1, length - 1)]];
+		break;
+	
+		case kPacketType_Sequenced:
+		if(length < kSequencedHeaderSize)
+		break;
+		sequence = _ReadUInt16(&bytes[1]);
+		if(!_sequencedReceivedAny || _IsNewerSequence(sequence, _sequencedReceiveLast)) { //NOTE: Late or duplicated datagrams are dropped
+			_sequencedReceiveLast = sequence;
+			_sequencedReceivedAny = YES;
+			[_delegate gameChannel:self didReceiveData:[datagram subdataWithRange:NSMakeRange(kSequencedHeaderSize, length - kSequencedHeaderSize)]];
+		}
+		break;
+	
+		case kPacketType_Reliable:
+		if(length < kReliableHeaderSize)
+		break;
+		if(bytes[0] & kPacketFlag_HasAck)
+		[self _processAck:_ReadUInt16(&bytes[3]) bits:_ReadUInt32(&bytes[5])];
+		if(!_invalidated)
+		[self _receiveReliableData:[datagram subdataWithRange:NSMakeRange(kReliableHeaderSize, length - kReliableHeaderSize)] sequence:_ReadUInt16(&bytes[1])];
+		break;
+	
+		case kPacketType_Ack:
+		if((length >= 1 + kAckSize) && (bytes[0] & kPacketFlag_HasAck))
+		[self _processAck:_ReadUInt16(&bytes[1]) bits:_ReadUInt32(&bytes[3])];
+		break;
+	
+		case kPacketType_Probe:
+		if(length >= 1 + kGameProbeSize) {
+			reply = [NSMutableData dataWithBytes:bytes length:(1 + kGameProbeSize)];
+			((UInt8*)[reply mutableBytes])[0] = kPacketType_ProbeReply;
+			[_delegate gameChannel:self sendDatagram:reply];
+		}
+		break;
+	
+		case kPacketType_ProbeReply:
+		if(length >= 1 + kGameProbeSize) {
+			GameProbeRead(&bytes[1], &probeSequence, &probeTime);
+			[_delegate gameChannel:self didReceiveProbeReply:probeSequence sendTime:probeTime];
+		}
+		break;
+	
+		case kPacketType_Snapshot:
+		[_delegate gameChannel:self didReceiveSnapshotData:[datagram subdataWithRange:NSMakeRange(1, length - 1)]];
+		break;
+	
+		case kPacketType_SnapshotAck:
+		if(length >= 5)
+		[_delegate gameChannel:self didReceiveSnapshotAck:_ReadUInt32(&bytes[1])];
+		break;
+	
+		default:
+		REPORT_ERROR(@"Received datagram of unknown type %i", bytes[0]);
+		break;
+	
+	}
+}
+
+@end
@@ -60,6 +60,7 @@ Copyright (C) 2008 Apple Inc. All Rights Reserved.
 - (void) gameClient:(GameClient*)client didConnectToServer:(GamePeer*)server;
 - (void) gameClient:(GameClient*)client didReceiveData:(NSData*)data fromServer:(GamePeer*)server immediate:(BOOL)immediate; //UDP delivery was used instead of TCP if "immediate" is YES
 - (void) gameClient:(GameClient*)client didDisconnectFromServer:(GamePeer*)server;
+- (void) gameClient:(GameClient*)client didReceiveSnapshot:(NSData*)snapshot fromServer:(GamePeer*)server; //Sent by -[GameServer sendSnapshotToAllClients:] - Late snapshots are dropped
 @end
 
 //CLASS INTERFACES:
@@ -67,7 +68,7 @@ Copyright (C) 2008 Apple Inc. All Rights Reserved.
 /*
 This class implements the client side of a multiplayer game.
 It can be connected to one or more servers which are represented as instances of the GamePeer class.
-You can then communicate with the servers using either TCP (for reliability) or UDP (for speed) protocols.
+You can then communicate with the servers using either TCP (for reliability) or UDP (for speed) protocols, the latter optionally with sequencing or reliable ordered delivery.
 Servers can be automatically found on the local network using Bonjour.
 */
 @interface GameClient : NSObject
@@ -104,4 +105,5 @@ Servers can be automatically found on the local network using Bonjour.
 
 - (NSTimeInterval) measureRoundTripLatencyToServer:(GamePeer*)server; //Returns < 0.0 on error
 - (BOOL) sendData:(NSData*)data toServer:(GamePeer*)server immediate:(BOOL)immediate; //UDP will be used instead of TCP if "immediate" is YES
+- (BOOL) sendData:(NSData*)data toServer:(GamePeer*)server mode:(GameDeliveryMode)mode;
 @end
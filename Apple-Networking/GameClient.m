@@ -168,6 +168,7 @@ static void _DictionaryApplierFunction(const void* key, const void* value, void*
 	SET_DELEGATE_METHOD_BIT(4, gameClient:didConnectToServer:);
 	SET_DELEGATE_METHOD_BIT(5, gameClient:didReceiveData:fromServer:immediate:);
 	SET_DELEGATE_METHOD_BIT(6, gameClient:didDisconnectFromServer:);
+	SET_DELEGATE_METHOD_BIT(7, gameClient:didReceiveSnapshot:fromServer:);
 }
 
 - (BOOL) startDiscoveringServersWithIdentifier:(NSString*)identifier
@@ -250,12 +251,17 @@ static void _DictionaryApplierFunction(const void* key, const void* value, void*
 	return (server && [_connectedServers containsObject:server] ? [server measureRoundTripLatency] : -1.0);
 }
 
-- (BOOL) sendData:(NSData*)data toServer:(GamePeer*)server immediate:(BOOL)immediate
+- (BOOL) sendData:(NSData*)data toServer:(GamePeer*)server mode:(GameDeliveryMode)mode
 {
 	if(!server || ![_connectedServers containsObject:server])
 	return NO;
 	
-	return [server sendData:data immediate:immediate];
+	return [server sendData:data mode:mode];
+}
+
+- (BOOL) sendData:(NSData*)data toServer:(GamePeer*)server immediate:(BOOL)immediate
+{
+	return [self sendData:data toServer:server mode:(immediate ? kGameDeliveryMode_Unreliable : kGameDeliveryMode_Reliable)];
 }
 
 - (NSString*) description
@@ -320,6 +326,12 @@ static void _DictionaryApplierFunction(const void* key, const void* value, void*
 	[_delegate gameClient:self didReceiveData:data fromServer:peer immediate:immediate];
 }
 
+- (void) gamePeer:(GamePeer*)peer didReceiveSnapshot:(NSData*)snapshot
+{
+	if(TEST_DELEGATE_METHOD_BIT(7))
+	[_delegate gameClient:self didReceiveSnapshot:snapshot fromServer:peer];
+}
+
 @end
 
 @implementation GameClient (NetServiceBrowserDelegate)
@@ -45,7 +45,28 @@ Copyright (C) 2008 Apple Inc. All Rights Reserved.
 
 //CLASSES:
 
-@class UDPSocket, TCPConnection;
+@class UDPSocket, TCPConnection, GameChannel, GameTelemetry, GameSnapshotHistory;
+
+//CONSTANTS:
+
+typedef enum {
+	kGameDeliveryMode_Reliable = 0, //TCP
+	kGameDeliveryMode_Unreliable, //UDP
+	kGameDeliveryMode_UnreliableSequenced, //UDP - Datagrams older than the latest one received are dropped
+	kGameDeliveryMode_ReliableOrdered //UDP - Datagrams are acknowledged, retransmitted if lost and delivered in order
+} GameDeliveryMode;
+
+typedef struct {
+	NSTimeInterval			roundTripTime; //Exponentially weighted moving average - 0.0 until the first probe is replied to
+	NSTimeInterval			jitter; //Smoothed variation between consecutive round trip times
+	double					lossRate; //Fraction of the latest probes that were not replied to
+	NSTimeInterval			minimumRoundTripTime;
+	NSTimeInterval			maximumRoundTripTime;
+	NSTimeInterval			medianRoundTripTime;
+	NSTimeInterval			percentile99RoundTripTime;
+	NSUInteger				probesSent;
+	NSUInteger				repliesReceived;
+} GameLinkStatistics;
 
 //CLASS INTERFACES:
 
@@ -64,6 +85,16 @@ If you obtainted a GamePeer instance from a GameServer, then it represents a rem
 	struct sockaddr*		_address;
 	UDPSocket*				_socket;
 	TCPConnection*			_connection;
+	GameChannel*			_channel;
+	UDPSocket*				_datagramSocket;
+	GameTelemetry*			_reliableTelemetry;
+	GameTelemetry*			_immediateTelemetry;
+	CFRunLoopTimerRef		_probeTimer;
+	GameSnapshotHistory*	_snapshotHistory;
+	UInt32					_lastSnapshot;
+	BOOL					_receivedSnapshot;
+	UInt32					_acknowledgedSnapshot;
+	BOOL					_snapshotAcknowledged;
 	id						_plist;
 	id						_delegate;
 	BOOL					_disconnecting;
@@ -78,4 +109,9 @@ If you obtainted a GamePeer instance from a GameServer, then it represents a rem
 @property(nonatomic, readonly, getter=isConnecting) BOOL connecting;
 @property(nonatomic, readonly, getter=isConnected) BOOL connected;
 @property(nonatomic, readonly) id infoPlist; //Only valid if connected
+
+@property(nonatomic, readonly) NSTimeInterval roundTripTime; //Measured without blocking by periodic UDP probes while connected
+@property(nonatomic, readonly) NSTimeInterval jitter; //Measured without blocking by periodic UDP probes while connected
+@property(nonatomic, readonly) double packetLossRate; //Measured without blocking by periodic UDP probes while connected
+- (GameLinkStatistics) linkStatistics:(BOOL)immediate; //Snapshot of the statistics for UDP if "immediate" is YES or TCP otherwise
 @end
@@ -46,17 +46,40 @@ Copyright (C) 2008 Apple Inc. All Rights Reserved.
 #import "GameClient.h"
 #import "TCPConnection.h"
 #import "UDPSocket.h"
+#import "GameChannel.h"
+#import "GameTelemetry.h"
+#import "GameSnapshot.h"
 #import "NetUtilities.h"
 #import "Game_Internal.h"
 
 //CONSTANTS:
 
 #define kResolveTimeOut				5.0
-#define kMagic						0xABCD1234
+#define kMagic						0xABCD1235
+#define kMessageHeaderSize			5 //Magic and message type
+#define kFieldHeaderSize			5 //Field tag and length
+#define kDefaultHandshakeCapacity	256
+#define kProbeInterval				1.0
+#define kMaxSnapshotSize			65536
+
+typedef enum {
+	kMessageType_None = 0, //Not a control message
+	kMessageType_Ping,
+	kMessageType_Handshake,
+	kMessageType_Probe,
+	kMessageType_ProbeReply
+} MessageType;
+
+typedef enum {
+	kField_UniqueID = 'i',
+	kField_Name = 'n',
+	kField_InfoPlist = 'p'
+} Field;
 
 //CLASS INTERFACES:
 
-@interface GamePeer (Internal) <UDPSocketDelegate, TCPConnectionDelegate>
+@interface GamePeer (Internal) <UDPSocketDelegate, TCPConnectionDelegate, GameChannelDelegate>
+- (void) _sendProbes;
 @end
 
 //FUNCTIONS:
@@ -79,11 +102,68 @@ NSString* _ApplicationProtocolFromGameIdentifier(NSString* string)
 	return [NSString stringWithFormat:@"GAME-%08X", hash];
 }
 
+static inline void _WriteUInt32(UInt8* bytes, UInt32 value)
+{
+	bytes[0] = value >> 24;
+	bytes[1] = value >> 16;
+	bytes[2] = value >> 8;
+	bytes[3] = value;
+}
+
+static inline UInt32 _ReadUInt32(const UInt8* bytes)
+{
+	return ((UInt32)bytes[0] << 24) | ((UInt32)bytes[1] << 16) | ((UInt32)bytes[2] << 8) | bytes[3];
+}
+
+/* Control messages are prefixed by a magic number followed by their type - Returns kMessageType_None for regular data without allocating anything */
+static NSInteger _MessageTypeFromData(NSData* data)
+{
+	const UInt8*				bytes = [data bytes];
+	
+	if(([data length] < kMessageHeaderSize) || (_ReadUInt32(bytes) != kMagic) || (bytes[4] == kMessageType_None))
+	return kMessageType_None;
+	
+	return bytes[4];
+}
+
+static NSData* _PingData()
+{
+	static const UInt8			bytes[kMessageHeaderSize] = {(kMagic >> 24) & 0xFF, (kMagic >> 16) & 0xFF, (kMagic >> 8) & 0xFF, kMagic & 0xFF, kMessageType_Ping};
+	static NSData*				data = nil;
+	
+	if(data == nil)
+	data = [[NSData alloc] initWithBytesNoCopy:(void*)bytes length:kMessageHeaderSize freeWhenDone:NO];
+	
+	return data;
+}
+
+/* Fields are encoded as a tag byte followed by a big-endian 32 bits length and the field bytes */
+static void _AppendField(NSMutableData* data, Field field, const void* bytes, NSUInteger length)
+{
+	UInt8						header[kFieldHeaderSize];
+	
+	header[0] = field;
+	_WriteUInt32(&header[1], length);
+	[data appendBytes:header length:kFieldHeaderSize];
+	if(length)
+	[data appendBytes:bytes length:length];
+}
+
+/* The probe timer does not retain the peer so that it can be released while connected - The timer is invalidated in -disconnect which -dealloc always calls */
+static void _ProbeTimerCallBack(CFRunLoopTimerRef timer, void* info)
+{
+	NSAutoreleasePool*			localPool = [NSAutoreleasePool new];
+	
+	[(GamePeer*)info _sendProbes];
+	
+	[localPool release];
+}
+
 //CLASS IMPLEMENTATIONS:
 
 @implementation GamePeer
 
-@synthesize server=_server, infoPlist=_plist, uniqueID=_uniqueID, name=_name, local=_local, delegate=_delegate, service=_service;
+@synthesize server=_server, infoPlist=_plist, uniqueID=_uniqueID, name=_name, local=_local, delegate=_delegate, service=_service, datagramSocket=_datagramSocket;
 
 - (id) initWithCFNetService:(CFNetServiceRef)netService
 {
@@ -144,6 +224,9 @@ NSString* _ApplicationProtocolFromGameIdentifier(NSString* string)
 {
 	[self disconnect];
 	
+	[_snapshotHistory release];
+	[_immediateTelemetry release];
+	[_reliableTelemetry release];
 	[_plist release];
 	[_name release];
 	[_uniqueID release];
@@ -167,9 +250,22 @@ NSString* _ApplicationProtocolFromGameIdentifier(NSString* string)
 	return YES;
 }
 
+- (BOOL) sendData:(NSData*)data mode:(GameDeliveryMode)mode
+{
+	if(mode == kGameDeliveryMode_Reliable)
+	return [_connection sendData:data];
+	
+	return [_channel sendData:data mode:mode];
+}
+
 - (BOOL) sendData:(NSData*)data immediate:(BOOL)immediate
 {
-	return (immediate ? (_socket != (id)kCFNull) && [_socket sendData:data toRemoteAddress:_address] : [_connection sendData:data]);
+	return [self sendData:data mode:(immediate ? kGameDeliveryMode_Unreliable : kGameDeliveryMode_Reliable)];
+}
+
+- (void) receiveDatagram:(NSData*)datagram
+{
+	[_channel receiveDatagram:datagram];
 }
 
 - (void) disconnect
@@ -180,6 +276,16 @@ NSString* _ApplicationProtocolFromGameIdentifier(NSString* string)
 	if(_disconnecting == NO) {
 		_disconnecting = YES;
 		
+		if(_probeTimer) {
+			CFRunLoopTimerInvalidate(_probeTimer);
+			CFRelease(_probeTimer);
+			_probeTimer = NULL;
+		}
+		[_channel invalidate];
+		[_channel setDelegate:nil];
+		[_channel autorelease]; //NOTE: Ensure GameChannel is not de-alloced immediately as -disconnect might be called from inside one of its delegate calls
+		_channel = nil;
+		_datagramSocket = nil;
 		if(_socket != (id)kCFNull) {
 			[_socket invalidate];
 			[_socket setDelegate:nil];
@@ -225,45 +331,131 @@ NSString* _ApplicationProtocolFromGameIdentifier(NSString* string)
 	return (_socket ? YES : NO);
 }
 
+- (GameTelemetry*) telemetry:(BOOL)immediate
+{
+	return (immediate ? _immediateTelemetry : _reliableTelemetry);
+}
+
+- (BOOL) getAcknowledgedSnapshot:(UInt32*)identifier
+{
+	if(_snapshotAcknowledged)
+	*identifier = _acknowledgedSnapshot;
+	
+	return _snapshotAcknowledged;
+}
+
+- (GameLinkStatistics) linkStatistics:(BOOL)immediate
+{
+	GameTelemetry*				telemetry = [self telemetry:immediate];
+	GameLinkStatistics			statistics;
+	
+	if(telemetry)
+	return [telemetry statistics];
+	
+	bzero(&statistics, sizeof(GameLinkStatistics));
+	return statistics;
+}
+
+- (NSTimeInterval) roundTripTime
+{
+	return [self linkStatistics:YES].roundTripTime;
+}
+
+- (NSTimeInterval) jitter
+{
+	return [self linkStatistics:YES].jitter;
+}
+
+- (double) packetLossRate
+{
+	return [self linkStatistics:YES].lossRate;
+}
+
 - (NSString*) description
 {
 	return [NSString stringWithFormat:@"<%@ = 0x%08X | ID = %@ | address = %@ | local = %i | name = \"%@\" | connected = %i>", [self class], (long)self, [self uniqueID], [self address], [self isLocal], [self name], [self isConnected]];
 }
 
-- (NSData*) _dataFromDictionary:(NSDictionary*)dictionary
+- (NSData*) _handshakeData
 {
-	NSMutableData*				data = [NSMutableData data];
-	int							magic = NSSwapHostIntToBig(kMagic);
+	NSMutableData*				data = [NSMutableData dataWithCapacity:kDefaultHandshakeCapacity];
+	id							plist = [_delegate gamePeerWillSendInfoPlist:self];
+	UInt8						header[kMessageHeaderSize];
+	const char*					string;
 	
-	[data appendBytes:&magic length:sizeof(int)];
-	[data appendData:[NSPropertyListSerialization dataFromPropertyList:dictionary format:NSPropertyListBinaryFormat_v1_0 errorDescription:NULL]];
+	_WriteUInt32(header, kMagic);
+	header[4] = kMessageType_Handshake;
+	[data appendBytes:header length:kMessageHeaderSize];
+	string = [HostGetUniqueID() UTF8String];
+	_AppendField(data, kField_UniqueID, string, strlen(string));
+	string = [[_delegate gamePeerWillSendName:self] UTF8String];
+	_AppendField(data, kField_Name, string, (string ? strlen(string) : 0));
+	if(plist) {
+		plist = [NSPropertyListSerialization dataFromPropertyList:plist format:NSPropertyListBinaryFormat_v1_0 errorDescription:NULL]; //NOTE: The info plist can contain arbitrary objects so it remains encoded as a plist
+		_AppendField(data, kField_InfoPlist, [plist bytes], [plist length]);
+	}
 	
 	return data;
 }
 
-- (NSDictionary*) _dictionaryFromData:(NSData*)data
+- (BOOL) _readHandshakeData:(NSData*)data
 {
-	NSDictionary*				dictionary = nil;
+	const UInt8*				bytes = [data bytes];
+	NSUInteger					length = [data length],
+								offset = kMessageHeaderSize,
+								size;
+	NSString*					uniqueID = nil;
+	NSString*					name = nil;
+	id							plist = nil;
 	NSString*					error;
 	
-	if(([data length] > sizeof(int)) && (NSSwapBigIntToHost(*((int*)[data bytes])) == kMagic)) {
-		dictionary = [NSPropertyListSerialization propertyListFromData:[data subdataWithRange:NSMakeRange(sizeof(int), [data length] - sizeof(int))] mutabilityOption:NSPropertyListImmutable format:NULL errorDescription:&error];
-		if(dictionary == nil)
-		REPORT_ERROR(@"Failed de-serializing dictionary: \"%@\"", error);
+	if(_MessageTypeFromData(data) != kMessageType_Handshake)
+	return NO;
+	
+	while(offset + kFieldHeaderSize <= length) {
+		size = _ReadUInt32(&bytes[offset + 1]);
+		if(size > length - offset - kFieldHeaderSize)
+		break;
+		switch(bytes[offset]) {
+			
+			case kField_UniqueID:
+			uniqueID = [[[NSString alloc] initWithBytes:&bytes[offset + kFieldHeaderSize] length:size encoding:NSUTF8StringEncoding] autorelease];
+			break;
+			
+			case kField_Name:
+			name = [[[NSString alloc] initWithBytes:&bytes[offset + kFieldHeaderSize] length:size encoding:NSUTF8StringEncoding] autorelease];
+			break;
+			
+			case kField_InfoPlist:
+			plist = [NSPropertyListSerialization propertyListFromData:[data subdataWithRange:NSMakeRange(offset + kFieldHeaderSize, size)] mutabilityOption:NSPropertyListImmutable format:NULL errorDescription:&error];
+			if(plist == nil)
+			REPORT_ERROR(@"Failed de-serializing info plist: \"%@\"", error);
+			break;
+			
+			default: //NOTE: Skip unknown fields so that new ones can be added later
+			break;
+			
+		}
+		offset += kFieldHeaderSize + size;
+	}
+	if((offset != length) || ![uniqueID length] || ![name length]) {
+		REPORT_ERROR(@"Received invalid handshake of %lu bytes", (unsigned long)length);
+		return NO;
 	}
 	
-	return dictionary;
+	[_uniqueID release];
+	_uniqueID = [uniqueID copy];
+	[_name release];
+	_name = [name copy];
+	[_plist release];
+	_plist = [plist retain];
+	
+	return YES;
 }
 
-- (void) _finishConnecting:(NSDictionary*)dictionary
+- (void) _finishConnecting
 {
-	[_uniqueID release];
-	_uniqueID = [[dictionary objectForKey:@"id"] copy];
-	[_name release];
-	_name = [[dictionary objectForKey:@"name"] copy];
-	_plist = [[dictionary objectForKey:@"info"] retain];
-	if(![_uniqueID length] || ![_name length])
-	[NSException raise:NSInternalInconsistencyException format:@""];
+	CFRunLoopTimerContext		context = {0, self, NULL, NULL, NULL};
 	
 	if(_server == YES) {
 		_socket = [[UDPSocket alloc] initWithPort:[_connection localPort]];
@@ -276,36 +468,102 @@ NSString* _ApplicationProtocolFromGameIdentifier(NSString* string)
 	}
 	else
 	_socket = (id)kCFNull;
+	_channel = [GameChannel new];
+	[_channel setDelegate:self];
+	
+	if(_reliableTelemetry == nil)
+	_reliableTelemetry = [GameTelemetry new];
+	if(_immediateTelemetry == nil)
+	_immediateTelemetry = [GameTelemetry new];
+	_probeTimer = CFRunLoopTimerCreate(kCFAllocatorDefault, CFAbsoluteTimeGetCurrent() + kProbeInterval, kProbeInterval, 0, 0, _ProbeTimerCallBack, &context);
+	CFRunLoopAddTimer(CFRunLoopGetCurrent(), _probeTimer, kCFRunLoopDefaultMode);
 	
 	[_delegate gamePeerDidConnect:self];
 }
 
+/* Probes are sent over both TCP and UDP and simply echoed back by the remote peer so they do not block anything */
+- (void) _sendProbes
+{
+	UInt8						bytes[kMessageHeaderSize + kGameProbeSize];
+	
+	_WriteUInt32(bytes, kMagic);
+	bytes[4] = kMessageType_Probe;
+	GameProbeWrite(&bytes[kMessageHeaderSize], [_reliableTelemetry nextProbeSequence], CFAbsoluteTimeGetCurrent());
+	if(![_connection sendData:[NSData dataWithBytes:bytes length:sizeof(bytes)]])
+	REPORT_ERROR(@"Failed sending probe to connection", NULL);
+	
+	if(![_channel sendProbe:[_immediateTelemetry nextProbeSequence]])
+	REPORT_ERROR(@"Failed sending probe to channel", NULL);
+}
+
+- (void) _processControlData:(NSData*)data type:(NSInteger)type
+{
+	const UInt8*				bytes = [data bytes];
+	NSMutableData*				reply;
+	UInt32						sequence;
+	CFAbsoluteTime				time;
+	
+	switch(type) {
+		
+		case kMessageType_Handshake:
+		if(_socket == nil) {
+			if([self _readHandshakeData:data])
+			[self _finishConnecting];
+			else
+			[self disconnect];
+		}
+		else
+		REPORT_ERROR(@"Received unexpected handshake", NULL);
+		break;
+		
+		case kMessageType_Ping:
+		if(![_connection sendData:data])
+		REPORT_ERROR(@"Failed replying to ping", NULL);
+		break;
+		
+		case kMessageType_Probe:
+		if([data length] < kMessageHeaderSize + kGameProbeSize)
+		break;
+		reply = [NSMutableData dataWithData:data];
+		((UInt8*)[reply mutableBytes])[4] = kMessageType_ProbeReply;
+		if(![_connection sendData:reply])
+		REPORT_ERROR(@"Failed replying to probe", NULL);
+		break;
+		
+		case kMessageType_ProbeReply:
+		if([data length] < kMessageHeaderSize + kGameProbeSize)
+		break;
+		GameProbeRead(&bytes[kMessageHeaderSize], &sequence, &time);
+		[_reliableTelemetry recordReplyForProbe:sequence sendTime:time];
+		break;
+		
+		default:
+		REPORT_ERROR(@"Received unexpected message of type %i", type);
+		break;
+		
+	}
+}
+
 - (NSTimeInterval) measureRoundTripLatency
 {
 	CFTimeInterval				time;
 	NSData*						data;
-	NSDictionary*				dictionary;
-	
-	data = [self _dataFromDictionary:[NSDictionary dictionary]];
+	NSInteger					type;
 	
 	time = CFAbsoluteTimeGetCurrent();
-	if(![_connection sendData:data])
+	if(![_connection sendData:_PingData()])
 	return -1.0;
 	do {
 		data = [_connection receiveData];
 		if(data == nil)
 		return -1.0;
 		
-		dictionary = [self _dictionaryFromData:data];
-		if(dictionary) {
-			if([dictionary count]) {
-				REPORT_ERROR(@"Received unexpected dictionary: \"%@\"", dictionary);
-				dictionary = nil;
-			}
-		}
-		else
+		type = _MessageTypeFromData(data);
+		if(type == kMessageType_None)
 		[_delegate gamePeer:self didReceiveData:data immediate:NO];
-	} while(dictionary == nil);
+		else if(type != kMessageType_Ping)
+		[self _processControlData:data type:type];
+	} while(type != kMessageType_Ping);
 	time = CFAbsoluteTimeGetCurrent() - time;
 	
 	return time;
@@ -318,8 +576,6 @@ NSString* _ApplicationProtocolFromGameIdentifier(NSString* string)
 
 - (void) connectionDidOpen:(TCPConnection*)connection
 {
-	NSDictionary*				dictionary;
-	NSData*						data;
 	const struct sockaddr*		address;
 	
 	if(_address == NULL) {
@@ -334,29 +590,22 @@ NSString* _ApplicationProtocolFromGameIdentifier(NSString* string)
 		_local = IPAddressIsLocal(_address);
 	}
 	
-	dictionary = [NSMutableDictionary new];
-	[(NSMutableDictionary*)dictionary setObject:HostGetUniqueID() forKey:@"id"];
-	[(NSMutableDictionary*)dictionary setObject:[_delegate gamePeerWillSendName:self] forKey:@"name"];
-	[(NSMutableDictionary*)dictionary setValue:[_delegate gamePeerWillSendInfoPlist:self] forKey:@"info"];
-	data = [self _dataFromDictionary:dictionary];
-	[dictionary release];
-	
 	if(_server == NO) {
-		dictionary = [self _dictionaryFromData:[_connection receiveData]];
-		if(dictionary == nil) {
-			REPORT_ERROR(@"Failed receiving dictionary from connection", NULL);
+		if(![self _readHandshakeData:[_connection receiveData]]) {
+			REPORT_ERROR(@"Failed receiving handshake from connection", NULL);
 			[self disconnect];
 			return;
 		}
 	}
 	
-	if(![_connection sendData:data]) {
-		REPORT_ERROR(@"Failed sending dictionary to connection", NULL);
+	if(![_connection sendData:[self _handshakeData]]) {
+		REPORT_ERROR(@"Failed sending handshake to connection", NULL);
 		[self disconnect];
+		return;
 	}
 	
 	if(_server == NO)
-	[self _finishConnecting:dictionary];
+	[self _finishConnecting];
 }
 
 - (void) connectionDidClose:(TCPConnection*)connection
@@ -366,18 +615,10 @@ NSString* _ApplicationProtocolFromGameIdentifier(NSString* string)
 
 - (void) connection:(TCPConnection*)connection didReceiveData:(NSData*)data
 {
-	NSDictionary*				dictionary;
+	NSInteger					type = _MessageTypeFromData(data);
 	
-	if((dictionary = [self _dictionaryFromData:data])) {
-		if(_socket == nil)
-		[self _finishConnecting:dictionary];
-		else if(![dictionary count]) {
-			if(![_connection sendData:data])
-			REPORT_ERROR(@"Failed sending dictionary: \"%@\"", dictionary);
-		}
-		else
-		REPORT_ERROR(@"Received unexpected dictionary: \"%@\"", dictionary);
-	}
+	if(type != kMessageType_None)
+	[self _processControlData:data type:type];
 	else
 	[_delegate gamePeer:self didReceiveData:data immediate:NO];
 }
@@ -392,9 +633,82 @@ NSString* _ApplicationProtocolFromGameIdentifier(NSString* string)
 	const struct sockaddr*				remoteAddress = [_connection remoteSocketAddress];
 	
 	if(address && remoteAddress && (address->sa_len == remoteAddress->sa_len) && !bcmp(address, remoteAddress, address->sa_len))
-	[_delegate gamePeer:self didReceiveData:data immediate:YES];
+	[_channel receiveDatagram:data];
 	else
 	REPORT_ERROR(@"Received UDP data from unknown sender at \"%@\"", IPAddressToString(address, NO, NO));
 }
 
+- (BOOL) gameChannel:(GameChannel*)channel sendDatagram:(NSData*)datagram
+{
+	UDPSocket*							socket = (_socket != (id)kCFNull ? _socket : _datagramSocket); //NOTE: Clients of a GameServer share its UDP socket
+	
+	return [socket sendData:datagram toRemoteAddress:_address];
+}
+
+- (void) gameChannel:(GameChannel*)channel didReceiveData:(NSData*)data
+{
+	[_delegate gamePeer:self didReceiveData:data immediate:YES];
+}
+
+- (void) gameChannel:(GameChannel*)channel didReceiveProbeReply:(UInt32)sequence sendTime:(CFAbsoluteTime)sendTime
+{
+	[_immediateTelemetry recordReplyForProbe:sequence sendTime:sendTime];
+}
+
+/* Snapshots are either full or a delta against one we acknowledged previously - See -[GameServer sendSnapshotToAllClients:] */
+- (void) gameChannel:(GameChannel*)channel didReceiveSnapshotData:(NSData*)data
+{
+	const UInt8*						bytes = [data bytes];
+	NSUInteger							length = [data length];
+	UInt32								identifier,
+										baseIdentifier,
+										snapshotLength;
+	NSData*								snapshot = nil;
+	NSData*								base;
+	
+	if(length < kGameSnapshotHeaderSize)
+	return;
+	identifier = _ReadUInt32(bytes);
+	baseIdentifier = _ReadUInt32(&bytes[4]);
+	snapshotLength = _ReadUInt32(&bytes[8]);
+	if(_receivedSnapshot && ((SInt32)(identifier - _lastSnapshot) <= 0)) //NOTE: Late or duplicated snapshots are dropped
+	return;
+	
+	if((bytes[12] == kGameSnapshotEncoding_Full) && (snapshotLength == length - kGameSnapshotHeaderSize))
+	snapshot = [data subdataWithRange:NSMakeRange(kGameSnapshotHeaderSize, snapshotLength)];
+	else if((bytes[12] == kGameSnapshotEncoding_Delta) && (snapshotLength <= kMaxSnapshotSize)) {
+		base = [_snapshotHistory snapshotForIdentifier:baseIdentifier];
+		if(base)
+		snapshot = GameSnapshotDecodeDelta(base, &bytes[kGameSnapshotHeaderSize], length - kGameSnapshotHeaderSize, snapshotLength);
+	}
+	if(snapshot == nil) {
+		REPORT_ERROR(@"Failed decoding snapshot #%u against snapshot #%u", identifier, baseIdentifier); //NOTE: Without an acknowledgement the server will keep using an older base
+		return;
+	}
+	
+	if(_snapshotHistory == nil)
+	_snapshotHistory = [GameSnapshotHistory new];
+	[_snapshotHistory setSnapshot:snapshot forIdentifier:identifier];
+	_lastSnapshot = identifier;
+	_receivedSnapshot = YES;
+	if(![_channel sendSnapshotAck:identifier])
+	REPORT_ERROR(@"Failed acknowledging snapshot #%u", identifier);
+	
+	[_delegate gamePeer:self didReceiveSnapshot:snapshot];
+}
+
+- (void) gameChannelDidTimeOut:(GameChannel*)channel
+{
+	REPORT_ERROR(@"Reliable UDP channel to %@ timed out", self);
+	[self disconnect];
+}
+
+- (void) gameChannel:(GameChannel*)channel didReceiveSnapshotAck:(UInt32)identifier
+{
+	if(!_snapshotAcknowledged || ((SInt32)(identifier - _acknowledgedSnapshot) > 0)) {
+		_acknowledgedSnapshot = identifier;
+		_snapshotAcknowledged = YES;
+	}
+}
+
 @end
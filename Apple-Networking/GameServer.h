@@ -46,7 +46,7 @@ Copyright (C) 2008 Apple Inc. All Rights Reserved.
 
 //CLASSES:
 
-@class GameServer, TCPServer, UDPSocket;
+@class GameServer, TCPServer, UDPSocket, GameSnapshotHistory;
 
 //PROTOCOLS:
 
@@ -67,7 +67,7 @@ Copyright (C) 2008 Apple Inc. All Rights Reserved.
 /*
 This class implements the server side of a multiplayer game.
 It can be connected to one or more clients which are represented as instances of the GamePeer class.
-You can then communicate with the clients using either TCP (for reliability) or UDP (for speed) protocols.
+You can then communicate with the clients using either TCP (for reliability) or UDP (for speed) protocols, the latter optionally with sequencing or reliable ordered delivery.
 The server can be registered for automatic discovery by GameClients on the local network using Bonjour.
 */
 @interface GameServer : NSObject
@@ -81,6 +81,8 @@ The server can be registered for automatic discovery by GameClients on the local
 	UDPSocket*					_socket;
 	CFMutableDictionaryRef		_activeClients;
 	NSMutableSet*				_connectedClients;
+	GameSnapshotHistory*		_snapshotHistory;
+	UInt32						_nextSnapshot;
 	
 	BOOL						_advertising;
 }
@@ -99,6 +101,10 @@ The server can be registered for automatic discovery by GameClients on the local
 - (void) disconnectFromClient:(GamePeer*)client;
 
 - (NSTimeInterval) measureRoundTripLatencyToClient:(GamePeer*)client; //Returns < 0.0 on error
+- (GameLinkStatistics) linkStatisticsForAllClients:(BOOL)immediate; //Loss rate is averaged across all connected clients, round trip time and jitter across the ones that replied to probes, with percentiles computed over all their samples
 - (BOOL) sendData:(NSData*)data toClient:(GamePeer*)client immediate:(BOOL)immediate; //UDP will be used instead of TCP if "immediate" is YES
 - (BOOL) sendDataToAllClients:(NSData*)data immediate:(BOOL)immediate; //UDP will be used instead of TCP if "immediate" is YES
+- (BOOL) sendData:(NSData*)data toClient:(GamePeer*)client mode:(GameDeliveryMode)mode;
+- (BOOL) sendDataToAllClients:(NSData*)data mode:(GameDeliveryMode)mode;
+- (BOOL) sendSnapshotToAllClients:(NSData*)snapshot; //Sent over UDP as a delta against the latest snapshot each client acknowledged, or in full if there is none recent enough - The snapshot must fit in a datagram
 @end
@@ -43,6 +43,9 @@ Copyright (C) 2008 Apple Inc. All Rights Reserved.
 #import "GameServer.h"
 #import "TCPServer.h"
 #import "UDPSocket.h"
+#import "GameChannel.h"
+#import "GameTelemetry.h"
+#import "GameSnapshot.h"
 #import "NetUtilities.h"
 #import "Game_Internal.h"
 
@@ -97,18 +100,20 @@ Copyright (C) 2008 Apple Inc. All Rights Reserved.
 	
 	[self stopAdvertisingToClients];
 	
+	//NOTE: Clients share our UDP socket without retaining it so they must be disconnected first
+	for(peer in _connectedClients) {
+		[peer setDelegate:nil];
+		[peer disconnect];
+	}
+	[_connectedClients release];
+	
 	[_socket setDelegate:nil];
 	[_socket release];
 	
 	[_server stop];
 	[_server setDelegate:nil];
 	[_server release];
-	
-	for(peer in _connectedClients) {
-		[peer setDelegate:nil];
-		[peer disconnect];
-	}
-	[_connectedClients release];
+	[_snapshotHistory release];
 	
 	if(_activeClients)
 	CFRelease(_activeClients);
@@ -198,34 +203,163 @@ Copyright (C) 2008 Apple Inc. All Rights Reserved.
 	return (client && [_connectedClients containsObject:client] ? [client measureRoundTripLatency] : -1.0);
 }
 
-- (BOOL) sendDataToAllClients:(NSData*)data immediate:(BOOL)immediate
+- (GameLinkStatistics) linkStatisticsForAllClients:(BOOL)immediate
 {
-	GamePeer*			peer;
-	BOOL				success = YES;
+	GameTelemetry*			merged = [GameTelemetry new];
+	NSUInteger				clientCount = 0,
+							count = 0;
+	GameLinkStatistics		statistics,
+							clientStatistics;
+	GamePeer*				peer;
 	
+	bzero(&statistics, sizeof(GameLinkStatistics));
 	for(peer in _connectedClients) {
-		if(immediate) {
-			if(![_socket sendData:data toRemoteAddress:[peer socketAddress]])
+		clientStatistics = [peer linkStatistics:immediate];
+		statistics.probesSent += clientStatistics.probesSent;
+		statistics.repliesReceived += clientStatistics.repliesReceived;
+		statistics.lossRate += clientStatistics.lossRate; //NOTE: Clients which never replied must still count as their loss rate is likely 100%
+		clientCount += 1;
+		if(clientStatistics.repliesReceived == 0)
+		continue;
+		
+		statistics.roundTripTime += clientStatistics.roundTripTime;
+		statistics.jitter += clientStatistics.jitter;
+		statistics.minimumRoundTripTime = (count ? MIN(statistics.minimumRoundTripTime, clientStatistics.minimumRoundTripTime) : clientStatistics.minimumRoundTripTime);
+		statistics.maximumRoundTripTime = MAX(statistics.maximumRoundTripTime, clientStatistics.maximumRoundTripTime);
+		[merged mergeHistogramFromTelemetry:[peer telemetry:immediate]];
+		count += 1;
+	}
+	if(clientCount)
+	statistics.lossRate /= (double)clientCount;
+	if(count) {
+		statistics.roundTripTime /= (double)count;
+		statistics.jitter /= (double)count;
+		statistics.medianRoundTripTime = [merged roundTripTimeAtPercentile:50.0];
+		statistics.percentile99RoundTripTime = [merged roundTripTimeAtPercentile:99.0];
+	}
+	[merged release];
+	
+	return statistics;
+}
+
+- (BOOL) sendDataToAllClients:(NSData*)data mode:(GameDeliveryMode)mode
+{
+	NSUInteger				count = [_connectedClients count],
+							i = 0;
+	const struct sockaddr**	addresses;
+	GamePeer*				peer;
+	BOOL					success = YES;
+	
+	//NOTE: Unreliable datagrams are identical for all clients so they can be sent in a single batch
+	if(mode == kGameDeliveryMode_Unreliable) {
+		if(count == 0)
+		return YES;
+		addresses = malloc(count * sizeof(const struct sockaddr*));
+		for(peer in _connectedClients)
+		addresses[i++] = [peer socketAddress];
+		success = ([_socket sendData:[GameChannel unreliableDatagramWithData:data] toRemoteAddresses:addresses count:count] == count);
+		free(addresses);
+	}
+	else {
+		for(peer in _connectedClients) {
+			if(![peer sendData:data mode:mode])
 			success = NO;
 		}
-		else {
-			if(![peer sendData:data immediate:NO])
-			success = NO;
+	}
+	
+	return success;
+}
+
+- (BOOL) sendDataToAllClients:(NSData*)data immediate:(BOOL)immediate
+{
+	return [self sendDataToAllClients:data mode:(immediate ? kGameDeliveryMode_Unreliable : kGameDeliveryMode_Reliable)];
+}
+
+- (BOOL) sendSnapshotToAllClients:(NSData*)snapshot
+{
+	UInt32					identifier = _nextSnapshot,
+							baseIdentifier;
+	NSMutableDictionary*	groups = [NSMutableDictionary dictionary];
+	NSMutableData*			data;
+	NSData*					base;
+	NSData*					delta;
+	NSMutableArray*			peers;
+	id						key;
+	GamePeer*				peer;
+	UInt8					header[kGameSnapshotHeaderSize];
+	const struct sockaddr**	addresses;
+	NSUInteger				count;
+	BOOL					success = YES;
+	
+	if(snapshot == nil)
+	return NO;
+	if(_snapshotHistory == nil)
+	_snapshotHistory = [GameSnapshotHistory new];
+	_nextSnapshot += 1;
+	
+	//NOTE: Clients that acknowledged the same snapshot get the same delta so they are grouped to encode it only once and send it in a single batch
+	for(peer in _connectedClients) {
+		if(![peer getAcknowledgedSnapshot:&baseIdentifier] || (identifier - baseIdentifier > kGameSnapshotHistorySize / 2)) //NOTE: Limiting the base age guarantees clients still have it in their history
+		key = [NSNull null];
+		else
+		key = [NSNumber numberWithUnsignedInt:baseIdentifier];
+		peers = [groups objectForKey:key];
+		if(peers == nil) {
+			peers = [NSMutableArray new];
+			[groups setObject:peers forKey:key];
+			[peers release];
 		}
+		[peers addObject:peer];
+	}
+	
+	for(key in groups) {
+		peers = [groups objectForKey:key];
+		baseIdentifier = (key != [NSNull null] ? [key unsignedIntValue] : 0);
+		base = (key != [NSNull null] ? [_snapshotHistory snapshotForIdentifier:baseIdentifier] : nil);
+		delta = (base ? GameSnapshotEncodeDelta(base, snapshot) : nil);
+		
+		header[0] = identifier >> 24;
+		header[1] = identifier >> 16;
+		header[2] = identifier >> 8;
+		header[3] = identifier;
+		header[4] = baseIdentifier >> 24;
+		header[5] = baseIdentifier >> 16;
+		header[6] = baseIdentifier >> 8;
+		header[7] = baseIdentifier;
+		header[8] = [snapshot length] >> 24;
+		header[9] = [snapshot length] >> 16;
+		header[10] = [snapshot length] >> 8;
+		header[11] = [snapshot length];
+		header[12] = (delta ? kGameSnapshotEncoding_Delta : kGameSnapshotEncoding_Full);
+		data = [NSMutableData dataWithCapacity:(kGameSnapshotHeaderSize + [(delta ? delta : snapshot) length])];
+		[data appendBytes:header length:kGameSnapshotHeaderSize];
+		[data appendData:(delta ? delta : snapshot)];
+		
+		count = 0;
+		addresses = malloc([peers count] * sizeof(const struct sockaddr*));
+		for(peer in peers)
+		addresses[count++] = [peer socketAddress];
+		if([_socket sendData:[GameChannel snapshotDatagramWithData:data] toRemoteAddresses:addresses count:count] != count)
+		success = NO;
+		free(addresses);
 	}
 	
+	[_snapshotHistory setSnapshot:snapshot forIdentifier:identifier];
+	
 	return success;
 }
 
-- (BOOL) sendData:(NSData*)data toClient:(GamePeer*)client immediate:(BOOL)immediate
+- (BOOL) sendData:(NSData*)data toClient:(GamePeer*)client mode:(GameDeliveryMode)mode
 {
 	if(!client || ![_connectedClients containsObject:client])
 	return NO;
 	
-	if(immediate)
-	return [_socket sendData:data toRemoteAddress:[client socketAddress]];
-	else
-	return [client sendData:data immediate:NO];
+	return [client sendData:data mode:mode];
+}
+
+- (BOOL) sendData:(NSData*)data toClient:(GamePeer*)client immediate:(BOOL)immediate
+{
+	return [self sendData:data toClient:client mode:(immediate ? kGameDeliveryMode_Unreliable : kGameDeliveryMode_Reliable)];
 }
 
 - (NSString*) description
@@ -244,6 +378,7 @@ Copyright (C) 2008 Apple Inc. All Rights Reserved.
 	peer = [[GamePeer alloc] initWithConnection:connection];
 	if(peer) {
 		[peer setDelegate:self];
+		[peer setDatagramSocket:_socket];
 		CFDictionaryAddValue(_activeClients, connection, peer);
 		[peer release];
 	}
@@ -320,7 +455,12 @@ Copyright (C) 2008 Apple Inc. All Rights Reserved.
 - (void) gamePeer:(GamePeer*)peer didReceiveData:(NSData*)data immediate:(BOOL)immediate
 {
 	if(TEST_DELEGATE_METHOD_BIT(5))
-	[_delegate gameServer:self didReceiveData:data fromClient:peer immediate:NO];
+	[_delegate gameServer:self didReceiveData:data fromClient:peer immediate:immediate];
+}
+
+- (void) gamePeer:(GamePeer*)peer didReceiveSnapshot:(NSData*)snapshot
+{
+	REPORT_ERROR(@"Received unexpected snapshot from %@", peer);
 }
 
 @end
@@ -332,17 +472,15 @@ Copyright (C) 2008 Apple Inc. All Rights Reserved.
 	GamePeer*				peer;
 	const struct sockaddr*	peerAddress;
 	
-	if(TEST_DELEGATE_METHOD_BIT(5)) {
-		for(peer in _connectedClients) {
-			peerAddress = [peer socketAddress];
-			if((address->sa_family == peerAddress->sa_family) && (address->sa_len == peerAddress->sa_len) && (bcmp(address, peerAddress, address->sa_len) == 0)) {
-				[_delegate gameServer:self didReceiveData:data fromClient:peer immediate:YES];
-				return;
-			}
+	for(peer in _connectedClients) {
+		peerAddress = [peer socketAddress];
+		if((address->sa_family == peerAddress->sa_family) && (address->sa_len == peerAddress->sa_len) && (bcmp(address, peerAddress, address->sa_len) == 0)) {
+			[peer receiveDatagram:data]; //NOTE: Acknowledgements must be processed even if the delegate does not care about the data
+			return;
 		}
-		
-		REPORT_ERROR(@"Received UDP data from unknown client at \"%@\"", IPAddressToString(address, NO, NO));
 	}
+	
+	REPORT_ERROR(@"Received UDP data from unknown client at \"%@\"", IPAddressToString(address, NO, NO));
 }
 
 @end
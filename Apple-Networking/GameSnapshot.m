@@ -0,0 +1,197 @@
+/*
+
+Disclaimer: IMPORTANT:  This Apple software is supplied to you by Apple Inc.
+("Apple") in consideration of your agreement to the following terms, and your
+use, installation, modification or redistribution of this Apple software
+constitutes acceptance of these terms.  If you do not agree with these terms,
+please do not use, install, modify or redistribute this Apple software.
+
+In consideration of your agreement to abide by the following terms, and subject
+to these terms, Apple grants you a personal, non-exclusive license, under
+Apple's copyrights in this original Apple software (the "Apple Software"), to
+use, reproduce, modify and redistribute the Apple Software, with or without
+modifications, in source and/or binary forms; provided that if you redistribute
+the Apple Software in its entirety and without modifications, you must retain
+this notice and the following text and disclaimers in all such redistributions
+of the Apple Software.
+Neither the name, trademarks, service marks or logos of Apple Inc. may be used
+to endorse or promote products derived from the Apple Software without specific
+prior written permission from Apple.  Except as expressly stated in this notice,
+no other rights or licenses, express or implied, are granted by Apple herein,
+including but not limited to any patent rights that may be infringed by your
+derivative works or by other works in which the Apple Software may be
+incorporated.
+
+The Apple Software is provided by Apple on an "AS IS" basis.  APPLE MAKES NO
+WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE IMPLIED
+WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE, REGARDING THE APPLE SOFTWARE OR ITS USE AND OPERATION ALONE OR IN
+COMBINATION WITH YOUR PRODUCTS.
+
+IN NO EVENT SHALL APPLE BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ARISING IN ANY WAY OUT OF THE USE, REPRODUCTION, MODIFICATION AND/OR
+DISTRIBUTION OF THE APPLE SOFTWARE, HOWEVER CAUSED AND WHETHER UNDER THEORY OF
+CONTRACT, TORT (INCLUDING NEGLIGENCE), STRICT LIABILITY OR OTHERWISE, EVEN IF
+APPLE HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+Copyright (C) 2008 Apple Inc. All Rights Reserved.
+
+*/
+
+#import "GameSnapshot.h"
+
+//CONSTANTS:
+
+#define kMinZeroRun							4 //Shorter runs of unchanged bytes are cheaper to keep in the literals
+
+//FUNCTIONS:
+
+static inline UInt8 _XORByte(const UInt8* snapshot, const UInt8* base, NSUInteger baseLength, NSUInteger index)
+{
+	return (index < baseLength ? snapshot[index] ^ base[index] : snapshot[index]);
+}
+
+static inline UInt8* _WriteVarInt(UInt8* bytes, NSUInteger value)
+{
+	while(value >= 0x80) {
+		*bytes++ = (value & 0x7F) | 0x80;
+		value >>= 7;
+	}
+	*bytes++ = value;
+	
+	return bytes;
+}
+
+static inline BOOL _ReadVarInt(const UInt8** bytes, const UInt8* end, NSUInteger* value)
+{
+	NSUInteger						shift = 0;
+	
+	*value = 0;
+	while(*bytes < end) {
+		*value |= (NSUInteger)(**bytes & 0x7F) << shift;
+		if(!(*(*bytes)++ & 0x80))
+		return YES;
+		shift += 7;
+		if(shift >= sizeof(NSUInteger) * 8)
+		break;
+	}
+	
+	return NO;
+}
+
+/* The delta is a sequence of [unchanged byte count][changed byte count][changed bytes XOR'ed with the base] - Trailing unchanged bytes are implicit */
+NSData* GameSnapshotEncodeDelta(NSData* base, NSData* snapshot)
+{
+	const UInt8*					snapshotBytes = [snapshot bytes];
+	const UInt8*					baseBytes = [base bytes];
+	NSUInteger						length = [snapshot length],
+									baseLength = [base length],
+									start,
+									literalStart,
+									zeros,
+									i = 0;
+	NSMutableData*					data;
+	UInt8*							bytes;
+	UInt8*							output;
+	
+	//NOTE: Worst case is a single literal run preceded by two varints
+	data = [NSMutableData dataWithLength:(length + 2 * 10)];
+	bytes = [data mutableBytes];
+	output = bytes;
+	while(i < length) {
+		start = i;
+		while((i < length) && !_XORByte(snapshotBytes, baseBytes, baseLength, i))
+		++i;
+		if(i == length)
+		break;
+		zeros = i - start;
+	
+		literalStart = i;
+		while(i < length) {
+			if(_XORByte(snapshotBytes, baseBytes, baseLength, i)) {
+				++i;
+				continue;
+			}
+			for(start = i; (i < length) && (i - start < kMinZeroRun) && !_XORByte(snapshotBytes, baseBytes, baseLength, i); ++i)
+			;
+			if((i - start == kMinZeroRun) || (i == length)) {
+				i = start;
+				break;
+			}
+		}
+	
+		if((output - bytes) + (i - literalStart) >= length) //NOTE: The delta is not worth it unless it is smaller than the snapshot
+		return nil;
+		output = _WriteVarInt(output, zeros);
+		output = _WriteVarInt(output, i - literalStart);
+		for(; literalStart < i; ++literalStart)
+		*output++ = _XORByte(snapshotBytes, baseBytes, baseLength, literalStart);
+		if(output - bytes >= length)
+		return nil;
+	}
+	[data setLength:(output - bytes)];
+	
+	return data;
+}
+
+NSData* GameSnapshotDecodeDelta(NSData* base, const void* bytes, NSUInteger length, NSUInteger snapshotLength)
+{
+	const UInt8*					input = bytes;
+	const UInt8*					end = input + length;
+	const UInt8*					baseBytes = [base bytes];
+	NSUInteger						baseLength = [base length],
+									offset = 0,
+									zeros,
+									count;
+	NSMutableData*					data;
+	UInt8*							output;
+	
+	data = [NSMutableData dataWithLength:snapshotLength];
+	output = [data mutableBytes];
+	bcopy(baseBytes, output, MIN(baseLength, snapshotLength)); //NOTE: Bytes past the end of the base are already zero
+	while(input < end) {
+		if(!_ReadVarInt(&input, end, &zeros) || !_ReadVarInt(&input, end, &count))
+		return nil;
+		if((zeros > snapshotLength - offset) || (count > snapshotLength - offset - zeros) || (count > (NSUInteger)(end - input)))
+		return nil;
+		offset += zeros;
+		for(; count > 0; --count, ++offset)
+		output[offset] ^= *input++;
+	}
+	
+	return data;
+}
+
+//CLASS IMPLEMENTATION:
+
+@implementation GameSnapshotHistory
+
+- (void) dealloc
+{
+	NSUInteger						i;
+	
+	for(i = 0; i < kGameSnapshotHistorySize; ++i)
+	[_snapshots[i] release];
+	
+	[super dealloc];
+}
+
+- (void) setSnapshot:(NSData*)snapshot forIdentifier:(UInt32)identifier
+{
+	NSUInteger						index = identifier % kGameSnapshotHistorySize;
+	
+	[_snapshots[index] release];
+	_snapshots[index] = [snapshot copy];
+	_identifiers[index] = identifier;
+}
+
+- (NSData*) snapshotForIdentifier:(UInt32)identifier
+{
+	NSUInteger						index = identifier % kGameSnapshotHistorySize;
+	
+	return (_snapshots[index] && (_identifiers[index] == identifier) ? _snapshots[index] : nil);
+}
+
+@end
@@ -0,0 +1,93 @@
+/*
+
+Disclaimer: IMPORTANT:  This Apple software is supplied to you by Apple Inc.
+("Apple") in consideration of your agreement to the following terms, and your
+use, installation, modification or redistribution of this Apple software
+constitutes acceptance of these terms.  If you do not agree with these terms,
+please do not use, install, modify or redistribute this Apple software.
+
+In consideration of your agreement to abide by the following terms, and subject
+to these terms, Apple grants you a personal, non-exclusive license, under
+Apple's copyrights in this original Apple software (the "Apple Software"), to
+use, reproduce, modify and redistribute the Apple Software, with or without
+modifications, in source and/or binary forms; provided that if you redistribute
+the Apple Software in its entirety and without modifications, you must retain
+this notice and the following text and disclaimers in all such redistributions
+of the Apple Software.
+Neither the name, trademarks, service marks or logos of Apple Inc. may be used
+to endorse or promote products derived from the Apple Software without specific
+prior written permission from Apple.  Except as expressly stated in this notice,
+no other rights or licenses, express or implied, are granted by Apple herein,
+including but not limited to any patent rights that may be infringed by your
+derivative works or by other works in which the Apple Software may be
+incorporated.
+
+The Apple Software is provided by Apple on an "AS IS" basis.  APPLE MAKES NO
+WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE IMPLIED
+WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE, REGARDING THE APPLE SOFTWARE OR ITS USE AND OPERATION ALONE OR IN
+COMBINATION WITH YOUR PRODUCTS.
+
+IN NO EVENT SHALL APPLE BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ARISING IN ANY WAY OUT OF THE USE, REPRODUCTION, MODIFICATION AND/OR
+DISTRIBUTION OF THE APPLE SOFTWARE, HOWEVER CAUSED AND WHETHER UNDER THEORY OF
+CONTRACT, TORT (INCLUDING NEGLIGENCE), STRICT LIABILITY OR OTHERWISE, EVEN IF
+APPLE HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+Copyright (C) 2008 Apple Inc. All Rights Reserved.
+
+*/
+
+#import <Foundation/Foundation.h>
+
+#import "GamePeer.h"
+
+//CONSTANTS:
+
+#define kGameProbeSize						12 //Big-endian 32 bits sequence number followed by the big-endian sending time
+#define kGameTelemetryWindow				64 //Number of latest probes used to compute the loss rate
+#define kGameTelemetryBucketCount			200
+
+//CLASS INTERFACES:
+
+/*
+This class accumulates the round trip times measured by periodic probes over a single transport.
+Round trip times are smoothed with an EWMA, jitter is computed as in RFC 3550 and samples are also recorded in a log-linear histogram with 12.5% precision in the spirit of HDR histograms.
+*/
+@interface GameTelemetry : NSObject
+{
+@private
+	UInt32							_nextSequence;
+	UInt64							_replyBits; //Bit N is set if probe "_nextSequence - 1 - N" was replied to
+	NSUInteger						_probesSent;
+	NSUInteger						_repliesReceived;
+	NSTimeInterval					_roundTripTime;
+	NSTimeInterval					_lastRoundTripTime;
+	NSTimeInterval					_jitter;
+	NSTimeInterval					_minimumRoundTripTime;
+	NSTimeInterval					_maximumRoundTripTime;
+	UInt32							_histogram[kGameTelemetryBucketCount];
+	NSUInteger						_sampleCount;
+}
+- (UInt32) nextProbeSequence; //Also counts the probe as sent
+- (void) recordReplyForProbe:(UInt32)sequence sendTime:(CFAbsoluteTime)sendTime;
+
+- (void) mergeHistogramFromTelemetry:(GameTelemetry*)telemetry;
+- (NSTimeInterval) roundTripTimeAtPercentile:(double)percentile; //"percentile" is in [0, 100] - Returns 0.0 if there are no samples
+
+@property(nonatomic, readonly) GameLinkStatistics statistics;
+@end
+
+//FUNCTIONS:
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+void GameProbeWrite(UInt8* bytes, UInt32 sequence, CFAbsoluteTime time); //"bytes" must have room for kGameProbeSize bytes
+void GameProbeRead(const UInt8* bytes, UInt32* sequence, CFAbsoluteTime* time);
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,196 @@
+/*
+
+Disclaimer: IMPORTANT:  This Apple software is supplied to you by Apple Inc.
+("Apple") in consideration of your agreement to the following terms, and your
+use, installation, modification or redistribution of this Apple software
+constitutes acceptance of these terms.  If you do not agree with these terms,
+please do not use, install, modify or redistribute this Apple software.
+
+In consideration of your agreement to abide by the following terms, and subject
+to these terms, Apple grants you a personal, non-exclusive license, under
+Apple's copyrights in this original Apple software (the "Apple Software"), to
+use, reproduce, modify and redistribute the Apple Software, with or without
+modifications, in source and/or binary forms; provided that if you redistribute
+the Apple Software in its entirety and without modifications, you must retain
+this notice and the following text and disclaimers in all such redistributions
+of the Apple Software.
+Neither the name, trademarks, service marks or logos of Apple Inc. may be used
+to endorse or promote products derived from the Apple Software without specific
+prior written permission from Apple.  Except as expressly stated in this notice,
+no other rights or licenses, express or implied, are granted by Apple herein,
+including but not limited to any patent rights that may be infringed by your
+derivative works or by other works in which the Apple Software may be
+incorporated.
+
+The Apple Software is provided by Apple on an "AS IS" basis.  APPLE MAKES NO
+WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE IMPLIED
+WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE, REGARDING THE APPLE SOFTWARE OR ITS USE AND OPERATION ALONE OR IN
+COMBINATION WITH YOUR PRODUCTS.
+
+IN NO EVENT SHALL APPLE BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ARISING IN ANY WAY OUT OF THE USE, REPRODUCTION, MODIFICATION AND/OR
+DISTRIBUTION OF THE APPLE SOFTWARE, HOWEVER CAUSED AND WHETHER UNDER THEORY OF
+CONTRACT, TORT (INCLUDING NEGLIGENCE), STRICT LIABILITY OR OTHERWISE, EVEN IF
+APPLE HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+Copyright (C) 2008 Apple Inc. All Rights Reserved.
+
+*/
+
+#import "GameTelemetry.h"
+#import "Game_Internal.h"
+
+//CONSTANTS:
+
+#define kInFlightProbes						2 //Latest probes not considered lost yet when computing the loss rate
+#define kLinearBucketCount					16
+#define kSubBucketBits						3
+#define kMaxMagnitude						26 //Samples are clamped to ~134 seconds
+
+//FUNCTIONS:
+
+void GameProbeWrite(UInt8* bytes, UInt32 sequence, CFAbsoluteTime time)
+{
+	CFSwappedFloat64				swapped = CFConvertDoubleHostToSwapped(time);
+	
+	bytes[0] = sequence >> 24;
+	bytes[1] = sequence >> 16;
+	bytes[2] = sequence >> 8;
+	bytes[3] = sequence;
+	bcopy(&swapped, &bytes[4], sizeof(CFSwappedFloat64));
+}
+
+void GameProbeRead(const UInt8* bytes, UInt32* sequence, CFAbsoluteTime* time)
+{
+	CFSwappedFloat64				swapped;
+	
+	*sequence = ((UInt32)bytes[0] << 24) | ((UInt32)bytes[1] << 16) | ((UInt32)bytes[2] << 8) | bytes[3];
+	bcopy(&bytes[4], &swapped, sizeof(CFSwappedFloat64));
+	*time = CFConvertDoubleSwappedToHost(swapped);
+}
+
+/* Values below 16 microseconds get their own bucket, then each power of two is split into 8 linear sub-buckets */
+static NSUInteger _BucketFromMicroseconds(UInt64 value)
+{
+	NSUInteger						magnitude = 0;
+	
+	if(value < kLinearBucketCount)
+	return value;
+	
+	while((value >> (magnitude + 1)) && (magnitude < kMaxMagnitude))
+	magnitude += 1;
+	if(value >> (magnitude + 1))
+	return kGameTelemetryBucketCount - 1;
+	
+	return kLinearBucketCount + (magnitude - 4) * (1 << kSubBucketBits) + ((value >> (magnitude - kSubBucketBits)) & ((1 << kSubBucketBits) - 1));
+}
+
+static double _MicrosecondsFromBucket(NSUInteger bucket)
+{
+	NSUInteger						magnitude,
+									subBucket;
+	
+	if(bucket < kLinearBucketCount)
+	return bucket;
+	
+	magnitude = (bucket - kLinearBucketCount) / (1 << kSubBucketBits) + 4;
+	subBucket = (bucket - kLinearBucketCount) % (1 << kSubBucketBits);
+	
+	return (double)(((1 << kSubBucketBits) + subBucket) << (magnitude - kSubBucketBits)) + (double)(1 << (magnitude - kSubBucketBits)) / 2.0; //NOTE: Middle of the bucket
+}
+
+//CLASS IMPLEMENTATION:
+
+@implementation GameTelemetry
+
+- (UInt32) nextProbeSequence
+{
+	_replyBits <<= 1;
+	_probesSent += 1;
+	
+	return _nextSequence++;
+}
+
+- (void) recordReplyForProbe:(UInt32)sequence sendTime:(CFAbsoluteTime)sendTime
+{
+	UInt32							age = _nextSequence - 1 - sequence;
+	NSTimeInterval					sample = CFAbsoluteTimeGetCurrent() - sendTime;
+	
+	if((age >= kGameTelemetryWindow) || (_replyBits & (1ULL << age)) || (sample < 0.0)) //NOTE: Ignore replies too old, duplicated or forged
+	return;
+	_replyBits |= 1ULL << age;
+	_repliesReceived += 1;
+	
+	if(_sampleCount == 0) {
+		_roundTripTime = sample;
+		_minimumRoundTripTime = sample;
+		_maximumRoundTripTime = sample;
+	}
+	else {
+		_roundTripTime += (sample - _roundTripTime) / 8.0;
+		_jitter += (fabs(sample - _lastRoundTripTime) - _jitter) / 16.0;
+		_minimumRoundTripTime = MIN(_minimumRoundTripTime, sample);
+		_maximumRoundTripTime = MAX(_maximumRoundTripTime, sample);
+	}
+	_lastRoundTripTime = sample;
+	
+	_histogram[_BucketFromMicroseconds(sample * 1000000.0)] += 1;
+	_sampleCount += 1;
+}
+
+- (void) mergeHistogramFromTelemetry:(GameTelemetry*)telemetry
+{
+	NSUInteger						i;
+	
+	for(i = 0; i < kGameTelemetryBucketCount; ++i)
+	_histogram[i] += telemetry->_histogram[i];
+	_sampleCount += telemetry->_sampleCount;
+}
+
+- (NSTimeInterval) roundTripTimeAtPercentile:(double)percentile
+{
+	NSUInteger						count = 0,
+									target,
+									i;
+	
+	if(_sampleCount == 0)
+	return 0.0;
+	
+	target = MAX(ceil(MIN(MAX(percentile, 0.0), 100.0) / 100.0 * _sampleCount), 1);
+	for(i = 0; i < kGameTelemetryBucketCount; ++i) {
+		count += _histogram[i];
+		if(count >= target)
+		break;
+	}
+	
+	return _MicrosecondsFromBucket(MIN(i, kGameTelemetryBucketCount - 1)) / 1000000.0;
+}
+
+- (GameLinkStatistics) statistics
+{
+	NSUInteger						count = MIN(_probesSent, kGameTelemetryWindow);
+	UInt64							mask;
+	GameLinkStatistics				statistics;
+	
+	bzero(&statistics, sizeof(GameLinkStatistics));
+	statistics.roundTripTime = _roundTripTime;
+	statistics.jitter = _jitter;
+	statistics.minimumRoundTripTime = _minimumRoundTripTime;
+	statistics.maximumRoundTripTime = _maximumRoundTripTime;
+	statistics.medianRoundTripTime = [self roundTripTimeAtPercentile:50.0];
+	statistics.percentile99RoundTripTime = [self roundTripTimeAtPercentile:99.0];
+	statistics.probesSent = _probesSent;
+	statistics.repliesReceived = _repliesReceived;
+	
+	if(count > kInFlightProbes) {
+		mask = (count < 64 ? (1ULL << count) - 1 : ~0ULL) & ~((1ULL << kInFlightProbes) - 1);
+		statistics.lossRate = (double)((count - kInFlightProbes) - __builtin_popcountll(_replyBits & mask)) / (double)(count - kInFlightProbes);
+	}
+	
+	return statistics;
+}
+
+@end
@@ -71,7 +71,8 @@ Copyright (C) 2008 Apple Inc. All Rights Reserved.
 - (void) gamePeerDidFailConnecting:(GamePeer*)peer;
 - (void) gamePeerDidConnect:(GamePeer*)peer;
 - (void) gamePeerDidDisconnect:(GamePeer*)peer;
-- (void) gamePeer:(GamePeer*)peer didReceiveData:(NSData*)data immediate:(BOOL)immediate;
+- (void) gamePeer:(GamePeer*)peer didReceiveData:(NSData*)data immediate:(BOOL)immediate; //UDP delivery was used instead of TCP if "immediate" is YES
+- (void) gamePeer:(GamePeer*)peer didReceiveSnapshot:(NSData*)snapshot;
 @end
 
 //PROTOTYPES:
@@ -84,12 +85,17 @@ extern NSString* _ApplicationProtocolFromGameIdentifier(NSString* string);
 @property(nonatomic, assign) id<GamePeerDelegate> delegate;
 @property(nonatomic, readonly, getter=isService) BOOL service;
 @property(nonatomic, readonly) const struct sockaddr* socketAddress;
+@property(nonatomic, assign) UDPSocket* datagramSocket; //Used by GamePeers representing clients of a GameServer instead of their own UDP socket
 
 - (id) initWithCFNetService:(CFNetServiceRef)netService;
 - (id) initWithName:(NSString*)name address:(const struct sockaddr*)address;
 - (id) initWithConnection:(TCPConnection*)connection;
 - (BOOL) connect;
 - (BOOL) sendData:(NSData*)data immediate:(BOOL)immediate;
+- (BOOL) sendData:(NSData*)data mode:(GameDeliveryMode)mode;
+- (void) receiveDatagram:(NSData*)datagram;
 - (void) disconnect;
 - (NSTimeInterval) measureRoundTripLatency;
+- (GameTelemetry*) telemetry:(BOOL)immediate; //May be nil if the peer never connected
+- (BOOL) getAcknowledgedSnapshot:(UInt32*)identifier; //Returns NO if no snapshot was acknowledged yet
 @end
@@ -50,7 +50,7 @@ Copyright (C) 2008 Apple Inc. All Rights Reserved.
 
 //CLASSES:
 
-@class TCPConnection;
+@class TCPConnection, TCPConnectionBuffer;
 
 //PROTOCOLS:
 
@@ -81,6 +81,12 @@ The TCPConnection instance will use the current runloop at its time of creation.
 	struct sockaddr*			_localAddress;
 	struct sockaddr*			_remoteAddress;
 	BOOL						_invalidating;
+	CFSocketNativeHandle		_socket;
+	NSUInteger					_batchLevel;
+	NSMutableData*				_batchBuffer;
+	TCPConnectionBuffer*		_receiveBuffer;
+	NSUInteger					_receiveOffset;
+	NSUInteger					_receiveLength;
 }
 - (id) initWithSocketHandle:(int)socket; //Acquires ownership of the socket
 - (id) initWithRemoteAddress:(const struct sockaddr*)address;
@@ -107,6 +113,8 @@ The TCPConnection instance will use the current runloop at its time of creation.
 @property(nonatomic, readonly) const struct sockaddr* remoteSocketAddress;
 
 - (BOOL) sendData:(NSData*)data; //Blocking - Must be called from same thread the connection was created on
-- (BOOL) hasDataAvailable; //Non-blocking - Must be called from same thread the connection was created on
-- (NSData*) receiveData; //Blocking - Must be called from same thread the connection was created on
+- (void) beginBatchSending; //Data passed to -sendData: is then buffered until the matching -endBatchSending - Calls can be nested
+- (BOOL) endBatchSending; //Blocking - Sends all buffered data at once when the outermost batch ends - Must be called from same thread the connection was created on
+- (BOOL) hasDataAvailable; //Non-blocking - Returns YES if -receiveData will not block i.e. a complete frame has been received or the connection was closed - Must be called from same thread the connection was created on
+- (NSData*) receiveData; //Blocking - Must be called from same thread the connection was created on - The returned data may share its storage with the receive buffer so copy it if you need to keep it for long
 @end
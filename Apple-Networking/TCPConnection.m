@@ -41,7 +41,11 @@ Copyright (C) 2008 Apple Inc. All Rights Reserved.
 */
 
 #import <unistd.h>
+#import <poll.h>
+#import <sys/uio.h>
+#import <libkern/OSAtomic.h>
 #import <netinet/in.h>
+#import <netinet/tcp.h>
 #if !TARGET_OS_IPHONE && !TARGET_IPHONE_SIMULATOR
 #import <netinet6/in6.h>
 #endif
@@ -54,6 +58,8 @@ Copyright (C) 2008 Apple Inc. All Rights Reserved.
 
 #define kMagic						0x1234ABCD
 #define kOpenedMax					3
+#define kMaxBatchSize				(64 * 1024)
+#define kReceiveBufferSize			(64 * 1024)
 
 //STRUCTURE:
 
@@ -64,6 +70,31 @@ typedef struct {
 
 //CLASS INTERFACES:
 
+/* Immutable slice of a receive buffer which is kept alive for as long as the slice is */
+/* The receive buffer keeps an explicit count of the frames sharing its storage as these can be released from any thread */
+@interface TCPConnectionBuffer : NSObject
+{
+@private
+	NSMutableData*		_data;
+	int32_t				_frameCount;
+}
+- (id) initWithLength:(NSUInteger)length;
+@property(nonatomic, readonly) NSMutableData* data;
+- (void) addFrame;
+- (void) removeFrame;
+- (BOOL) hasFrames;
+@end
+
+@interface TCPConnectionFrame : NSData
+{
+@private
+	TCPConnectionBuffer*	_buffer;
+	const void*				_bytes;
+	NSUInteger				_length;
+}
+- (id) initWithBuffer:(TCPConnectionBuffer*)buffer bytes:(const void*)bytes length:(NSUInteger)length;
+@end
+
 @interface TCPConnection (Internal)
 - (id) _initWithRunLoop:(CFRunLoopRef)runLoop readStream:(CFReadStreamRef)input writeStream:(CFWriteStreamRef)output;
 - (void) _handleStreamEvent:(CFStreamEventType)type forStream:(CFTypeRef)stream;
@@ -89,7 +120,82 @@ static void _WriteClientCallBack(CFWriteStreamRef stream, CFStreamEventType type
 	[localPool release];
 }
 
-//CLASS IMPLEMENTATION:
+//CLASS IMPLEMENTATIONS:
+
+@implementation TCPConnectionBuffer
+
+@synthesize data=_data;
+
+- (id) initWithLength:(NSUInteger)length
+{
+	if((self = [super init])) {
+		_data = [[NSMutableData alloc] initWithLength:length];
+		if(_data == nil) {
+			[self release];
+			return nil;
+		}
+	}
+	
+	return self;
+}
+
+- (void) dealloc
+{
+	[_data release];
+	
+	[super dealloc];
+}
+
+- (void) addFrame
+{
+	OSAtomicIncrement32Barrier(&_frameCount);
+}
+
+- (void) removeFrame
+{
+	OSAtomicDecrement32Barrier(&_frameCount);
+}
+
+- (BOOL) hasFrames
+{
+	return (OSAtomicAdd32Barrier(0, &_frameCount) > 0);
+}
+
+@end
+
+@implementation TCPConnectionFrame
+
+- (id) initWithBuffer:(TCPConnectionBuffer*)buffer bytes:(const void*)bytes length:(NSUInteger)length
+{
+	if((self = [super init])) {
+		_buffer = [buffer retain];
+		[_buffer addFrame];
+		_bytes = bytes;
+		_length = length;
+	}
+	
+	return self;
+}
+
+- (void) dealloc
+{
+	[_buffer removeFrame];
+	[_buffer release];
+	
+	[super dealloc];
+}
+
+- (const void*) bytes
+{
+	return _bytes;
+}
+
+- (NSUInteger) length
+{
+	return _length;
+}
+
+@end
 
 @implementation TCPConnection
 
@@ -259,6 +365,7 @@ static void _WriteClientCallBack(CFWriteStreamRef stream, CFStreamEventType type
 		_inputStream = (CFReadStreamRef)CFRetain(input);
 		_outputStream = (CFWriteStreamRef)CFRetain(output);
 		_runLoop = (CFRunLoopRef)CFRetain(runLoop);
+		_socket = -1;
 		
 		CFReadStreamSetClient(_inputStream, kCFStreamEventOpenCompleted | kCFStreamEventHasBytesAvailable | kCFStreamEventErrorOccurred | kCFStreamEventEndEncountered, _ReadClientCallBack, &context);
 		CFReadStreamScheduleWithRunLoop(_inputStream, _runLoop, kCFRunLoopCommonModes);
@@ -282,6 +389,8 @@ static void _WriteClientCallBack(CFWriteStreamRef stream, CFStreamEventType type
 	free(_localAddress);
 	if(_remoteAddress)
 	free(_remoteAddress);
+	[_batchBuffer release];
+	[_receiveBuffer release];
 	
 	[super dealloc];
 }
@@ -322,6 +431,9 @@ static void _WriteClientCallBack(CFWriteStreamRef stream, CFStreamEventType type
 		_runLoop = NULL;
 	}
 	
+	_socket = -1; //NOTE: The socket is owned and closed by the CF streams
+	[_batchBuffer setLength:0];
+	
 	if(_opened >= kOpenedMax) {
 		if(TEST_DELEGATE_METHOD_BIT(2))
 		[_delegate connectionDidClose:self];
@@ -340,62 +452,181 @@ static void _WriteClientCallBack(CFWriteStreamRef stream, CFStreamEventType type
 	}
 }
 
+/* Writes directly to the native socket so that the header and the data go out with a single system call */
+- (BOOL) _writeVectors:(struct iovec*)vectors count:(int)count
+{
+	struct pollfd			descriptor;
+	ssize_t					result;
+	
+	while(count > 0) {
+		result = writev(_socket, vectors, count);
+		if(result < 0) {
+			if(errno == EINTR)
+			continue;
+			if(errno == EAGAIN) { //NOTE: CF streams put the socket in non-blocking mode
+				descriptor.fd = _socket;
+				descriptor.events = POLLOUT;
+				descriptor.revents = 0;
+				if((poll(&descriptor, 1, -1) < 0) && (errno != EINTR)) {
+					REPORT_ERROR(@"Failed waiting for socket (%i)", errno);
+					return NO;
+				}
+				continue;
+			}
+			REPORT_ERROR(@"Failed writing to socket (%i)", errno);
+			return NO;
+		}
+		
+		while(count && ((size_t)result >= vectors->iov_len)) {
+			result -= vectors->iov_len;
+			vectors += 1;
+			count -= 1;
+		}
+		if(count) {
+			vectors->iov_base = (char*)vectors->iov_base + result;
+			vectors->iov_len -= result;
+		}
+	}
+	
+	return YES;
+}
+
+- (BOOL) _flushBatch
+{
+	struct iovec			vector;
+	BOOL					success;
+	
+	if(![_batchBuffer length])
+	return YES;
+	
+	vector.iov_base = [_batchBuffer mutableBytes];
+	vector.iov_len = [_batchBuffer length];
+	success = [self _writeVectors:&vector count:1];
+	[_batchBuffer setLength:0];
+	
+	return success;
+}
+
 - (BOOL) _writeData:(NSData*)data
 {
-	CFIndex					length = [data length],
-							result;
+	struct iovec			vectors[2];
 	Header					header;
 	
 	header.magic = NSSwapHostIntToBig(kMagic);
-	header.length = NSSwapHostIntToBig(length);
-	result = CFWriteStreamWrite(_outputStream, (const UInt8*)&header, sizeof(Header));
-	if(result != sizeof(Header)) {
-		REPORT_ERROR(@"Wrote only %i bytes out of %i bytes in header", (int)result, (int)sizeof(Header));
-		return NO;
+	header.length = NSSwapHostIntToBig([data length]);
+	
+	if(_batchLevel) {
+		if(_batchBuffer == nil)
+		_batchBuffer = [[NSMutableData alloc] initWithCapacity:kMaxBatchSize];
+		[_batchBuffer appendBytes:&header length:sizeof(Header)];
+		[_batchBuffer appendData:data];
+		return ([_batchBuffer length] >= kMaxBatchSize ? [self _flushBatch] : YES);
 	}
 	
-	while(length > 0) {
-		result = CFWriteStreamWrite(_outputStream, (UInt8*)[data bytes] + [data length] - length, length);
-		if(result <= 0) {
-			REPORT_ERROR(@"Wrote only %i bytes out of %i (%i) bytes in data", (int)result, (int)length, [data length]);
-			return NO;
+	vectors[0].iov_base = &header;
+	vectors[0].iov_len = sizeof(Header);
+	vectors[1].iov_base = (void*)[data bytes];
+	vectors[1].iov_len = [data length];
+	
+	return [self _writeVectors:vectors count:2];
+}
+
+/* Reads as many bytes as are available in a single call, making sure there is room for at least the rest of the current frame */
+- (CFIndex) _fillReceiveBuffer
+{
+	NSMutableData*			data = [_receiveBuffer data];
+	NSUInteger				pending = _receiveLength - _receiveOffset,
+							needed = sizeof(Header);
+	TCPConnectionBuffer*	buffer;
+	Header					header;
+	CFIndex					result;
+	
+	if(pending >= sizeof(Header)) {
+		bcopy((const UInt8*)[data bytes] + _receiveOffset, &header, sizeof(Header));
+		needed += NSSwapBigIntToHost(header.length);
+	}
+	
+	//NOTE: Consumed bytes can only be recycled once no frame handed out by -_extractFrame: references the buffer anymore
+	if(_receiveBuffer && ![_receiveBuffer hasFrames] && (needed <= [data length])) {
+		if((pending == 0) || (_receiveOffset + needed > [data length])) {
+			if(pending)
+			memmove([data mutableBytes], (const UInt8*)[data bytes] + _receiveOffset, pending);
+			_receiveOffset = 0;
+			_receiveLength = pending;
 		}
-		length -= result;
+	}
+	else if((_receiveBuffer == nil) || (_receiveOffset + needed > [data length])) {
+		buffer = [[TCPConnectionBuffer alloc] initWithLength:MAX(needed, kReceiveBufferSize)];
+		if(buffer == nil)
+		return -1;
+		if(pending)
+		bcopy((const UInt8*)[data bytes] + _receiveOffset, [[buffer data] mutableBytes], pending);
+		[_receiveBuffer release];
+		_receiveBuffer = buffer;
+		data = [buffer data];
+		_receiveOffset = 0;
+		_receiveLength = pending;
 	}
 	
-	return YES;
+	result = CFReadStreamRead(_inputStream, (UInt8*)[data mutableBytes] + _receiveLength, [data length] - _receiveLength);
+	if(result > 0)
+	_receiveLength += result;
+	
+	return result;
 }
 
-- (NSData*) _readData
+/* Returns nil if there is no complete frame in the receive buffer */
+- (NSData*) _extractFrame:(BOOL*)invalid
 {
-	NSMutableData*			data;
-	CFIndex					result,
+	NSUInteger				pending = _receiveLength - _receiveOffset,
 							length;
+	const UInt8*			bytes;
+	NSData*					data;
 	Header					header;
 	
-	result = CFReadStreamRead(_inputStream, (UInt8*)&header, sizeof(Header));
-	if(result == 0)
-	return (id)kCFNull;
-	if(result != sizeof(Header)) {
-		REPORT_ERROR(@"Read only %i bytes out of %i bytes in header", (int)result, (int)sizeof(Header));
-		return nil;
-	}
+	if(pending < sizeof(Header))
+	return nil;
+	
+	bytes = (const UInt8*)[[_receiveBuffer data] bytes] + _receiveOffset;
+	bcopy(bytes, &header, sizeof(Header)); //NOTE: The header is not necessarily aligned in the buffer
 	if(NSSwapBigIntToHost(header.magic) != kMagic) {
 		REPORT_ERROR(@"Invalid header", NULL);
+		*invalid = YES;
 		return nil;
 	}
 	
 	length = NSSwapBigIntToHost(header.length);
-	data = [NSMutableData dataWithCapacity:length];
-	[data setLength:length];
+	if(pending < sizeof(Header) + length)
+	return nil;
 	
-	while(length > 0) {
-		result = CFReadStreamRead(_inputStream, (UInt8*)[data mutableBytes] + [data length] - length, length);
-		if(result <= 0) {
-			REPORT_ERROR(@"Read only %i bytes out of %i (%i) bytes in data", (int)result, (int)length, [data length]);
-			return nil;
+	data = [[TCPConnectionFrame alloc] initWithBuffer:_receiveBuffer bytes:(bytes + sizeof(Header)) length:length];
+	_receiveOffset += sizeof(Header) + length;
+	
+	return [data autorelease];
+}
+
+- (NSData*) _readData
+{
+	NSData*					data;
+	CFIndex					result;
+	BOOL					invalid = NO;
+	
+	while(1) {
+		data = [self _extractFrame:&invalid];
+		if(data || invalid)
+		break;
+		
+		result = [self _fillReceiveBuffer];
+		if(result == 0) {
+			if(_receiveLength == _receiveOffset)
+			return (id)kCFNull;
+			REPORT_ERROR(@"Connection closed with %i bytes pending", (int)(_receiveLength - _receiveOffset));
+			break;
+		}
+		if(result < 0) {
+			REPORT_ERROR(@"Failed reading from stream", NULL);
+			break;
 		}
-		length -= result;
 	}
 	
 	return data;
@@ -412,10 +643,14 @@ static void _WriteClientCallBack(CFWriteStreamRef stream, CFStreamEventType type
 		CFDataGetBytes(data, CFRangeMake(0, sizeof(CFSocketNativeHandle)), (UInt8*)&socket);
 		value = 1;
 		setsockopt(socket, SOL_SOCKET, SO_KEEPALIVE, &value, sizeof(value));
+		value = 1;
+		setsockopt(socket, SOL_SOCKET, SO_NOSIGPIPE, &value, sizeof(value));
+		value = 1;
+		setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value)); //NOTE: Messages are written in one piece so there is no need to wait for more data
 		value = sizeof(Header);
 		setsockopt(socket, SOL_SOCKET, SO_SNDLOWAT, &value, sizeof(value));
-		setsockopt(socket, SOL_SOCKET, SO_SNDLOWAT, &value, sizeof(value));
 		CFRelease(data);
+		_socket = socket;
 		
 		length = SOCK_MAXADDRLEN;
 		_localAddress = malloc(length);
@@ -447,6 +682,8 @@ static void _WriteClientCallBack(CFWriteStreamRef stream, CFStreamEventType type
 {
 	NSData*				data;
 	CFErrorRef			error;
+	NSAutoreleasePool*	localPool;
+	BOOL				invalid = NO;
 	
 #if __DEBUG__
 	NSLog(@"[%p] %@ (%i) = %i", self, stream, (CFGetTypeID(stream) == CFReadStreamGetTypeID() ? CFReadStreamGetStatus((CFReadStreamRef)stream) : CFWriteStreamGetStatus((CFWriteStreamRef)stream)), type);
@@ -465,16 +702,24 @@ static void _WriteClientCallBack(CFWriteStreamRef stream, CFStreamEventType type
 		case kCFStreamEventHasBytesAvailable: //NOTE: kCFStreamEventHasBytesAvailable will be sent for 0 bytes available to read when stream reaches end
 		if(_opened >= kOpenedMax) {
 			do {
-				data = [self _readData];
-				if(data != (id)kCFNull) {
-					if(data == nil) {
-						[self invalidate]; //NOTE: "self" might have been already de-alloced after this call!
-						return;
-					}
-					else {
-						if((_invalidating == NO) && TEST_DELEGATE_METHOD_BIT(3))
-						[_delegate connection:(id)self didReceiveData:data]; //NOTE: Avoid type conflict with NSURLConnection delegate
-					}
+				if([self _fillReceiveBuffer] < 0) {
+					[self invalidate]; //NOTE: "self" might have been already de-alloced after this call!
+					return;
+				}
+				
+				//NOTE: Frames are delivered inside their own pool so that the receive buffer can be recycled as soon as possible
+				while(_invalidating == NO) {
+					localPool = [NSAutoreleasePool new];
+					data = [self _extractFrame:&invalid];
+					if(data && TEST_DELEGATE_METHOD_BIT(3))
+					[_delegate connection:(id)self didReceiveData:data]; //NOTE: Avoid type conflict with NSURLConnection delegate
+					[localPool release];
+					if(data == nil)
+					break;
+				}
+				if(invalid) {
+					[self invalidate]; //NOTE: "self" might have been already de-alloced after this call!
+					return;
 				}
 			} while(!_invalidating && CFReadStreamHasBytesAvailable(_inputStream));
 		}
@@ -500,12 +745,36 @@ static void _WriteClientCallBack(CFWriteStreamRef stream, CFStreamEventType type
 	}
 }
 
+/* Returns YES if the receive buffer starts with a complete frame or an invalid header */
+- (BOOL) _hasFrame
+{
+	NSUInteger				pending = _receiveLength - _receiveOffset;
+	Header					header;
+	
+	if(pending < sizeof(Header))
+	return NO;
+	
+	bcopy((const UInt8*)[[_receiveBuffer data] bytes] + _receiveOffset, &header, sizeof(Header));
+	if(NSSwapBigIntToHost(header.magic) != kMagic)
+	return YES;
+	
+	return (pending >= sizeof(Header) + NSSwapBigIntToHost(header.length));
+}
+
 - (BOOL) hasDataAvailable
 {
 	if(![self isValid])
 	return NO;
 	
-	return CFReadStreamHasBytesAvailable(_inputStream);
+	//NOTE: Pull in whatever the socket has so that a partially received frame doesn't make -receiveData block
+	while(![self _hasFrame]) {
+		if(!CFReadStreamHasBytesAvailable(_inputStream))
+		return NO;
+		if([self _fillReceiveBuffer] <= 0)
+		return YES; //NOTE: -receiveData will report the closed connection or the error without blocking
+	}
+	
+	return YES;
 }
 
 - (NSData*) receiveData
@@ -537,6 +806,31 @@ static void _WriteClientCallBack(CFWriteStreamRef stream, CFStreamEventType type
 	return YES;
 }
 
+- (void) beginBatchSending
+{
+	_batchLevel += 1;
+}
+
+- (BOOL) endBatchSending
+{
+	if(_batchLevel == 0)
+	return NO;
+	
+	_batchLevel -= 1;
+	if(_batchLevel)
+	return YES;
+	
+	if(![self isValid])
+	return NO;
+	
+	if(![self _flushBatch]) {
+		[self invalidate];
+		return NO;
+	}
+	
+	return YES;
+}
+
 - (UInt16) localPort
 {
 	if(_localAddress)
@@ -46,6 +46,7 @@ Copyright (C) 2008 Apple Inc. All Rights Reserved.
 //CLASSES:
 
 @class TCPServer, TCPServerConnection;
+struct _ConnectionShard;
 
 //PROTOCOLS:
 
@@ -55,8 +56,8 @@ Copyright (C) 2008 Apple Inc. All Rights Reserved.
 - (void) serverDidEnableBonjour:(TCPServer*)server;
 
 - (BOOL) server:(TCPServer*)server shouldAcceptConnectionFromAddress:(const struct sockaddr*)address;
-- (void) server:(TCPServer*)server didOpenConnection:(TCPServerConnection*)connection; //From this method, you typically set the delegate of the connection to be able to send & receive data through it
-- (void) server:(TCPServer*)server didCloseConnection:(TCPServerConnection*)connection;
+- (void) server:(TCPServer*)server didOpenConnection:(TCPServerConnection*)connection; //From this method, you typically set the delegate of the connection to be able to send & receive data through it - Called on the thread of the connection
+- (void) server:(TCPServer*)server didCloseConnection:(TCPServerConnection*)connection; //Called on the thread of the connection
 
 - (void) serverWillDisableBonjour:(TCPServer*)server;
 - (void) serverWillStop:(TCPServer*)server;
@@ -71,12 +72,14 @@ See TCPService.h for other methods.
 @interface TCPServer : TCPService
 {
 @private
-	pthread_mutex_t				_connectionsMutex;
-	NSMutableSet*				_connections;
+	struct _ConnectionShard*	_shards;
+	NSUInteger					_shardCount;
+	NSUInteger					_nextShard;
 	id<TCPServerDelegate>		_delegate;
 	NSUInteger					_delegateMethods;
 }
 + (BOOL) useConnectionThreads; //Use a separate thread for each connection - NO by default
++ (NSUInteger) connectionWorkerThreads; //Spread the connections across a fixed pool of threads each running its own run loop - 0 by default i.e. all connections use the server run loop - Ignored if +useConnectionThreads returns YES
 + (Class) connectionClass; //Must be a subclass of "TCPServerConnection"
 
 @property(nonatomic, readonly) NSArray* allConnections;
@@ -91,6 +94,7 @@ Subclass of TCPConnection used by TCPServer for its connections.
 {
 @private
 	TCPServer*			_server; //Not retained
+	NSUInteger			_shardIndex;
 }
 @property(nonatomic, readonly) TCPServer* server;
 @end
@@ -53,6 +53,33 @@ typedef struct {
 	NSAutoreleasePool*			pool;
 } ObserverData;
 
+typedef struct _ConnectionShard {
+	pthread_mutex_t				mutex;
+	pthread_cond_t				condition;
+	NSMutableSet*				connections;
+	TCPServer*					server; //Not retained
+	NSUInteger					index;
+	pthread_t					thread; //Only used with worker threads
+	CFRunLoopRef				runLoop; //Only used with worker threads
+	CFRunLoopSourceRef			source; //Only used with worker threads
+	NSMutableArray*				pendingSockets; //Only used with worker threads
+	BOOL						stopping;
+} ConnectionShard;
+
+//CLASS INTERFACES:
+
+@interface TCPServerConnection (Private)
+- (void) _setServer:(TCPServer*)server;
+- (void) _setShardIndex:(NSUInteger)index;
+- (NSUInteger) _shardIndex;
+@end
+
+@interface TCPServer (Internal)
+- (void) _addConnection:(TCPServerConnection*)connection toShard:(ConnectionShard*)shard;
+- (void) _removeConnection:(TCPServerConnection*)connection;
+- (void) _processShard:(ConnectionShard*)shard;
+@end
+
 //FUNCTIONS:
 
 static void _ObserverCallBack(CFRunLoopObserverRef observer, CFRunLoopActivity activity, void* info)
@@ -76,15 +103,51 @@ static void _ObserverCallBack(CFRunLoopObserverRef observer, CFRunLoopActivity a
 	data->depth -= 1;
 }
 
-//CLASS INTERFACES:
-
-@interface TCPServerConnection (Private)
-- (void) _setServer:(TCPServer*)server;
-@end
+static void _ShardPerformCallBack(void* info)
+{
+	NSAutoreleasePool*			localPool = [NSAutoreleasePool new];
+	ConnectionShard*			shard = (ConnectionShard*)info;
+	
+	[shard->server _processShard:shard];
+	
+	[localPool release];
+}
 
-@interface TCPServer (Internal)
-- (void) _removeConnection:(TCPServerConnection*)connection;
-@end
+/* Each worker thread runs its own run loop on which the CF streams of its connections are scheduled, so the kernel event multiplexing is done per thread */
+static void* _WorkerThread(void* info)
+{
+	NSAutoreleasePool*			pool = [NSAutoreleasePool new];
+	ConnectionShard*			shard = (ConnectionShard*)info;
+	ObserverData				data = {0, nil};
+	CFRunLoopObserverContext	observerContext = {0, &data, NULL, NULL, NULL};
+	CFRunLoopSourceContext		sourceContext = {0, shard, NULL, NULL, NULL, NULL, NULL, NULL, NULL, _ShardPerformCallBack};
+	CFRunLoopObserverRef		observerRef;
+	CFRunLoopSourceRef			source;
+	
+	observerRef = CFRunLoopObserverCreate(kCFAllocatorDefault, kCFRunLoopEntry | kCFRunLoopBeforeWaiting | kCFRunLoopAfterWaiting | kCFRunLoopExit, true, 0, _ObserverCallBack, &observerContext);
+	CFRunLoopAddObserver(CFRunLoopGetCurrent(), observerRef, kCFRunLoopCommonModes);
+	source = CFRunLoopSourceCreate(kCFAllocatorDefault, 0, &sourceContext);
+	CFRunLoopAddSource(CFRunLoopGetCurrent(), source, kCFRunLoopCommonModes);
+	
+	pthread_mutex_lock(&shard->mutex);
+	shard->runLoop = (CFRunLoopRef)CFRetain(CFRunLoopGetCurrent());
+	shard->source = (CFRunLoopSourceRef)CFRetain(source);
+	pthread_cond_signal(&shard->condition);
+	pthread_mutex_unlock(&shard->mutex);
+	
+	CFRunLoopRun(); //NOTE: The run loop source keeps the run loop alive until the shard is stopped
+	
+	//NOTE: The shard must not be accessed anymore as it may already have been freed if the server was stopped from this thread
+	CFRunLoopRemoveSource(CFRunLoopGetCurrent(), source, kCFRunLoopCommonModes);
+	CFRelease(source);
+	CFRunLoopObserverInvalidate(observerRef);
+	CFRelease(observerRef);
+	[data.pool drain];
+	
+	[pool drain];
+	
+	return NULL;
+}
 
 //CLASS IMPLEMENTATIONS:
 
@@ -97,6 +160,16 @@ static void _ObserverCallBack(CFRunLoopObserverRef observer, CFRunLoopActivity a
 	_server = server;
 }
 
+- (void) _setShardIndex:(NSUInteger)index
+{
+	_shardIndex = index;
+}
+
+- (NSUInteger) _shardIndex
+{
+	return _shardIndex;
+}
+
 - (void) _invalidate
 {
 	CFRunLoopRef		runLoop = [self CFRunLoop]; //NOTE: We don't need to retain it as we know it will still be valid
@@ -125,16 +198,35 @@ static void _ObserverCallBack(CFRunLoopObserverRef observer, CFRunLoopActivity a
 	return NO;
 }
 
++ (NSUInteger) connectionWorkerThreads
+{
+	return 0;
+}
+
 + (Class) connectionClass
 {
 	return [TCPServerConnection class];
 }
 
++ (void) _multiThreadingThread:(id)argument
+{
+	; //NOTE: Detaching a NSThread is required to put Cocoa in multithreaded mode before using POSIX threads
+}
+
 - (id) initWithPort:(UInt16)port
 {
+	NSUInteger			i;
+	
 	if((self = [super initWithPort:port])) {
-		_connections = [NSMutableSet new];
-		pthread_mutex_init(&_connectionsMutex, NULL);
+		_shardCount = ([[self class] useConnectionThreads] ? 1 : MAX([[self class] connectionWorkerThreads], 1));
+		_shards = calloc(_shardCount, sizeof(ConnectionShard));
+		for(i = 0; i < _shardCount; ++i) {
+			pthread_mutex_init(&_shards[i].mutex, NULL);
+			pthread_cond_init(&_shards[i].condition, NULL);
+			_shards[i].connections = [NSMutableSet new];
+			_shards[i].server = self;
+			_shards[i].index = i;
+		}
 	}
 	
 	return self;
@@ -142,11 +234,16 @@ static void _ObserverCallBack(CFRunLoopObserverRef observer, CFRunLoopActivity a
 
 - (void) dealloc
 {
-	[self stop]; //NOTE: Make sure our -stop is executed immediately
+	NSUInteger			i;
 	
-	pthread_mutex_destroy(&_connectionsMutex);
+	[self stop]; //NOTE: Make sure our -stop is executed immediately
 	
-	[_connections release];
+	for(i = 0; i < _shardCount; ++i) {
+		pthread_cond_destroy(&_shards[i].condition);
+		pthread_mutex_destroy(&_shards[i].mutex);
+		[_shards[i].connections release];
+	}
+	free(_shards);
 	
 	[super dealloc];
 }
@@ -164,11 +261,83 @@ static void _ObserverCallBack(CFRunLoopObserverRef observer, CFRunLoopActivity a
 	SET_DELEGATE_METHOD_BIT(6, serverWillStop:);
 }
 
+- (BOOL) _startWorkerThreads
+{
+	ConnectionShard*	shard;
+	NSUInteger			i;
+	
+	if(![NSThread isMultiThreaded])
+	[NSThread detachNewThreadSelector:@selector(_multiThreadingThread:) toTarget:[TCPServer class] withObject:nil];
+	
+	for(i = 0; i < _shardCount; ++i) {
+		shard = &_shards[i];
+		shard->stopping = NO;
+		shard->pendingSockets = [NSMutableArray new];
+		
+		pthread_mutex_lock(&shard->mutex);
+		if(pthread_create(&shard->thread, NULL, _WorkerThread, shard) != 0) {
+			pthread_mutex_unlock(&shard->mutex);
+			[shard->pendingSockets release];
+			shard->pendingSockets = nil;
+			REPORT_ERROR(@"Failed creating worker thread #%i", (int)i);
+			return NO;
+		}
+		while(shard->runLoop == NULL)
+		pthread_cond_wait(&shard->condition, &shard->mutex);
+		pthread_mutex_unlock(&shard->mutex);
+	}
+	
+	return YES;
+}
+
+- (void) _stopWorkerThreads
+{
+	ConnectionShard*	shard;
+	NSNumber*			socket;
+	NSUInteger			i;
+	
+	for(i = 0; i < _shardCount; ++i) {
+		shard = &_shards[i];
+		if(shard->runLoop == NULL)
+		continue;
+		
+		pthread_mutex_lock(&shard->mutex);
+		shard->stopping = YES;
+		pthread_mutex_unlock(&shard->mutex);
+		
+		//NOTE: If called from a worker thread, its shard is stopped right away and its source invalidated so that _ShardPerformCallBack() can never run again with the shard which may be freed before that thread exits
+		if(pthread_equal(pthread_self(), shard->thread)) {
+			CFRunLoopSourceInvalidate(shard->source);
+			[self _processShard:shard];
+			pthread_detach(shard->thread);
+		}
+		else {
+			CFRunLoopSourceSignal(shard->source);
+			CFRunLoopWakeUp(shard->runLoop);
+			pthread_join(shard->thread, NULL);
+		}
+		
+		for(socket in shard->pendingSockets)
+		close([socket intValue]);
+		[shard->pendingSockets release];
+		shard->pendingSockets = nil;
+		CFRelease(shard->source);
+		shard->source = NULL;
+		CFRelease(shard->runLoop);
+		shard->runLoop = NULL;
+	}
+}
+
 - (BOOL) startUsingRunLoop:(NSRunLoop*)runLoop
 {
 	if(![super startUsingRunLoop:runLoop])
 	return NO;
 	
+	if(![[self class] useConnectionThreads] && [[self class] connectionWorkerThreads] && ![self _startWorkerThreads]) {
+		[self stop];
+		return NO;
+	}
+	
 	if(TEST_DELEGATE_METHOD_BIT(0))
 	[_delegate serverDidStart:self];
 	
@@ -204,6 +373,9 @@ static void _ObserverCallBack(CFRunLoopObserverRef observer, CFRunLoopActivity a
 	
 	[super stop];
 	
+	//NOTE: Worker threads invalidate their own connections before exiting
+	[self _stopWorkerThreads];
+	
 	//NOTE: To avoid dead-locks in the connection threads, we need to work on a copy
 	connections = [self allConnections];
 	for(connection in connections)
@@ -212,21 +384,25 @@ static void _ObserverCallBack(CFRunLoopObserverRef observer, CFRunLoopActivity a
 
 - (NSArray*) allConnections
 {
-	NSArray*				connections;
+	NSMutableArray*			connections = [NSMutableArray array];
+	NSUInteger				i;
 	
-	pthread_mutex_lock(&_connectionsMutex);
-	connections = [_connections allObjects];
-	pthread_mutex_unlock(&_connectionsMutex);
+	for(i = 0; i < _shardCount; ++i) {
+		pthread_mutex_lock(&_shards[i].mutex);
+		[connections addObjectsFromArray:[_shards[i].connections allObjects]];
+		pthread_mutex_unlock(&_shards[i].mutex);
+	}
 	
 	return connections;
 }
 
-- (void) _addConnection:(TCPServerConnection*)connection
+- (void) _addConnection:(TCPServerConnection*)connection toShard:(ConnectionShard*)shard
 {
-	pthread_mutex_lock(&_connectionsMutex);
-	[_connections addObject:connection];
+	pthread_mutex_lock(&shard->mutex);
+	[shard->connections addObject:connection];
 	[connection _setServer:self];
-	pthread_mutex_unlock(&_connectionsMutex);
+	[connection _setShardIndex:shard->index];
+	pthread_mutex_unlock(&shard->mutex);
 	
 	if(TEST_DELEGATE_METHOD_BIT(3))
 	[_delegate server:self didOpenConnection:connection];
@@ -234,13 +410,55 @@ static void _ObserverCallBack(CFRunLoopObserverRef observer, CFRunLoopActivity a
 
 - (void) _removeConnection:(TCPServerConnection*)connection
 {
+	ConnectionShard*			shard = &_shards[[connection _shardIndex]];
+	
 	if(TEST_DELEGATE_METHOD_BIT(4))
 	[_delegate server:self didCloseConnection:connection];
 	
-	pthread_mutex_lock(&_connectionsMutex);
+	pthread_mutex_lock(&shard->mutex);
 	[connection _setServer:nil];
-	[_connections removeObject:connection];
-	pthread_mutex_unlock(&_connectionsMutex);
+	[shard->connections removeObject:connection];
+	pthread_mutex_unlock(&shard->mutex);
+}
+
+/* Called on the worker thread of the shard */
+- (void) _processShard:(ConnectionShard*)shard
+{
+	NSArray*					sockets;
+	NSArray*					connections;
+	NSNumber*					socket;
+	TCPServerConnection*		connection;
+	BOOL						stopping;
+	
+	pthread_mutex_lock(&shard->mutex);
+	sockets = [NSArray arrayWithArray:shard->pendingSockets];
+	[shard->pendingSockets removeAllObjects];
+	stopping = shard->stopping;
+	pthread_mutex_unlock(&shard->mutex);
+	
+	for(socket in sockets) {
+		if(stopping || shard->stopping) { //NOTE: The delegate may have stopped the server from this thread while a previous connection was being opened
+			close([socket intValue]);
+			continue;
+		}
+		connection = [[[[self class] connectionClass] alloc] initWithSocketHandle:[socket intValue]];
+		if(connection) {
+			[self _addConnection:connection toShard:shard];
+			[connection release];
+		}
+		else
+		REPORT_ERROR(@"Failed creating TCPServerConnection for socket #%i", [socket intValue]);
+	}
+	
+	if(stopping) {
+		pthread_mutex_lock(&shard->mutex);
+		connections = [shard->connections allObjects];
+		pthread_mutex_unlock(&shard->mutex);
+		for(connection in connections)
+		[connection invalidate];
+		
+		CFRunLoopStop(CFRunLoopGetCurrent());
+	}
 }
 
 - (void) _connectionThread:(NSNumber*)socketNumber
@@ -253,7 +471,7 @@ static void _ObserverCallBack(CFRunLoopObserverRef observer, CFRunLoopActivity a
 	
 	connection = [[[[self class] connectionClass] alloc] initWithSocketHandle:[socketNumber intValue]];
 	if(connection) {
-		[self _addConnection:connection];
+		[self _addConnection:connection toShard:&_shards[0]];
 		
 		observerRef = CFRunLoopObserverCreate(kCFAllocatorDefault, kCFRunLoopEntry | kCFRunLoopBeforeWaiting | kCFRunLoopAfterWaiting | kCFRunLoopExit, true, 0, _ObserverCallBack, &context);
 		CFRunLoopAddObserver(CFRunLoopGetCurrent(), observerRef, kCFRunLoopCommonModes);
@@ -274,14 +492,25 @@ static void _ObserverCallBack(CFRunLoopObserverRef observer, CFRunLoopActivity a
 - (void) handleNewConnectionWithSocket:(NSSocketNativeHandle)socket fromRemoteAddress:(const struct sockaddr*)address
 {
 	TCPServerConnection*		connection;
+	ConnectionShard*			shard;
 	
 	if(!TEST_DELEGATE_METHOD_BIT(2) || [_delegate server:self shouldAcceptConnectionFromAddress:address]) {
 		if([[self class] useConnectionThreads])
 		[NSThread detachNewThreadSelector:@selector(_connectionThread:) toTarget:self withObject:[NSNumber numberWithInt:socket]];
+		else if(_shards[0].runLoop) {
+			//NOTE: The accepting thread only hands the socket off to the next worker thread
+			shard = &_shards[_nextShard];
+			_nextShard = (_nextShard + 1) % _shardCount;
+			pthread_mutex_lock(&shard->mutex);
+			[shard->pendingSockets addObject:[NSNumber numberWithInt:socket]];
+			pthread_mutex_unlock(&shard->mutex);
+			CFRunLoopSourceSignal(shard->source);
+			CFRunLoopWakeUp(shard->runLoop);
+		}
 		else {
 			connection = [[[[self class] connectionClass] alloc] initWithSocketHandle:socket];
 			if(connection) {
-				[self _addConnection:connection];
+				[self _addConnection:connection toShard:&_shards[0]];
 				[connection release];
 			}
 			else
@@ -294,7 +523,7 @@ static void _ObserverCallBack(CFRunLoopObserverRef observer, CFRunLoopActivity a
 
 - (NSString*) description
 {
-	return [NSString stringWithFormat:@"<%@ = 0x%08X | running = %i | local address = %@ | %i connections>", [self class], (long)self, [self isRunning], [self localAddress], [_connections count]];
+	return [NSString stringWithFormat:@"<%@ = 0x%08X | running = %i | local address = %@ | %i connections>", [self class], (long)self, [self isRunning], [self localAddress], [[self allConnections] count]];
 }
 
 @end
@@ -61,6 +61,7 @@ Copyright (C) 2008 Apple Inc. All Rights Reserved.
 
 - (void) socketDidInvalidate:(UDPSocket*)socket;
 - (void) socket:(UDPSocket*)socket didReceiveData:(NSData*)data fromRemoteAddress:(const struct sockaddr*)address;
+- (void) socket:(UDPSocket*)socket didReceiveDatagrams:(NSArray*)datagrams fromRemoteAddresses:(NSArray*)addresses; //Called instead of the method above if implemented, with all the datagrams read during a single run loop wake up - "addresses" contains NSData wrapping "struct sockaddr"
 @end
 
 //CLASS INTERFACES:
@@ -81,6 +82,7 @@ You can also enable Bonjour advertising for the listening UDP port.
 	CFNetServiceRef				_netService;
 	struct sockaddr*			_localAddress;
 	BOOL						_invalidating;
+	void*						_receiveBuffer;
 }
 - (id) initWithPort:(UInt16)port; //Pass 0 to have a port automatically be chosen
 
@@ -98,6 +100,7 @@ You can also enable Bonjour advertising for the listening UDP port.
 - (void) disableBonjour;
 
 - (BOOL) sendData:(NSData*)data toRemoteAddress:(const struct sockaddr*)address; //Blocking - Must be called from same thread the connection was created on
+- (NSUInteger) sendData:(NSData*)data toRemoteAddresses:(const struct sockaddr**)addresses count:(NSUInteger)count; //Blocking - Must be called from same thread the connection was created on - Returns the number of addresses the data was successfully sent to
 - (BOOL) sendData:(NSData*)data toRemoteIPv4Address:(UInt32)address port:(UInt16)port; //Blocking - Must be called from same thread the connection was created on - The "address" is assumed to be in host-endian
 #if !TARGET_OS_IPHONE && !TARGET_IPHONE_SIMULATOR
 - (BOOL) sendData:(NSData*)data toRemoteIPv6Address:(const struct in6_addr*)address port:(UInt16)port; //Blocking - Must be called from same thread the connection was created on
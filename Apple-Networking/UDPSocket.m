@@ -41,6 +41,7 @@ Copyright (C) 2008 Apple Inc. All Rights Reserved.
 */
 
 #import <unistd.h>
+#import <errno.h>
 #import <netinet/in.h>
 #if !TARGET_OS_IPHONE && !TARGET_IPHONE_SIMULATOR
 #import <netinet6/in6.h>
@@ -50,10 +51,16 @@ Copyright (C) 2008 Apple Inc. All Rights Reserved.
 #import "NetUtilities.h"
 #import "Networking_Internal.h"
 
+//CONSTANTS:
+
+#define kMaxDatagramSize				65536
+#define kMaxDatagramsPerWakeUp			64
+
 //CLASS INTERFACES:
 
 @interface UDPSocket (Internal)
 - (CFSocketRef) _socket;
+- (void) _receiveDatagrams;
 @end
 
 //FUNCTIONS:
@@ -77,8 +84,8 @@ static void _SocketCallBack(CFSocketRef s, CFSocketCallBackType type, CFDataRef
 	NSAutoreleasePool*		pool = [NSAutoreleasePool new];
 	UDPSocket*				self = (UDPSocket*)info;
 	
-	if(TEST_DELEGATE_METHOD_BIT(3))
-	[self->_delegate socket:self didReceiveData:(NSData*)data fromRemoteAddress:(struct sockaddr*)CFDataGetBytePtr(address)];
+	if(type == kCFSocketReadCallBack)
+	[self _receiveDatagrams];
 	
 	[pool release];
 }
@@ -100,7 +107,7 @@ static void _SocketCallBack(CFSocketRef s, CFSocketCallBackType type, CFDataRef
 	}
 	
 	if((self = [super init])) {
-		_socket = CFSocketCreate(kCFAllocatorDefault, address->sa_family, SOCK_DGRAM, IPPROTO_IP, kCFSocketDataCallBack, _SocketCallBack, &context);
+		_socket = CFSocketCreate(kCFAllocatorDefault, address->sa_family, SOCK_DGRAM, IPPROTO_IP, kCFSocketReadCallBack, _SocketCallBack, &context); //NOTE: We read the datagrams ourselves to drain the socket in a single callback
 		if(_socket == NULL) {
 			[self release];
 			return nil;
@@ -168,6 +175,8 @@ static void _SocketCallBack(CFSocketRef s, CFSocketCallBackType type, CFDataRef
 	
 	if(_localAddress)
 	free(_localAddress);
+	if(_receiveBuffer)
+	free(_receiveBuffer);
 	
 	[super dealloc];
 }
@@ -180,6 +189,7 @@ static void _SocketCallBack(CFSocketRef s, CFSocketCallBackType type, CFDataRef
 	SET_DELEGATE_METHOD_BIT(1, socketWillDisableBonjour:);
 	SET_DELEGATE_METHOD_BIT(2, socketDidInvalidate:);
 	SET_DELEGATE_METHOD_BIT(3, socket:didReceiveData:fromRemoteAddress:);
+	SET_DELEGATE_METHOD_BIT(4, socket:didReceiveDatagrams:fromRemoteAddresses:);
 }
 
 - (BOOL) enableBonjourWithDomain:(NSString*)domain applicationProtocol:(NSString*)protocol name:(NSString*)name
@@ -300,9 +310,82 @@ static void _SocketCallBack(CFSocketRef s, CFSocketCallBackType type, CFDataRef
 	return (_localAddress ? IPAddressToString(_localAddress, NO, NO) : nil);
 }
 
+/* Reads every pending datagram (up to a limit so that other run loop sources are not starved) into a buffer reused across callbacks - Each datagram is then copied into its own NSData (as well as its address in batch mode) for the delegate */
+- (void) _receiveDatagrams
+{
+	NSMutableArray*			datagrams = nil;
+	NSMutableArray*			addresses = nil;
+	struct sockaddr_storage	address;
+	socklen_t				length;
+	ssize_t					result;
+	NSUInteger				count;
+	NSData*					data;
+	
+	[self retain]; //NOTE: The delegate may release the socket while datagrams are being received
+	
+	if(_receiveBuffer == NULL)
+	_receiveBuffer = malloc(kMaxDatagramSize);
+	if(TEST_DELEGATE_METHOD_BIT(4)) {
+		datagrams = [NSMutableArray arrayWithCapacity:kMaxDatagramsPerWakeUp];
+		addresses = [NSMutableArray arrayWithCapacity:kMaxDatagramsPerWakeUp];
+	}
+	
+	for(count = 0; (count < kMaxDatagramsPerWakeUp) && _socket; ++count) {
+		length = sizeof(address);
+		result = recvfrom(CFSocketGetNative(_socket), _receiveBuffer, kMaxDatagramSize, MSG_DONTWAIT, (struct sockaddr*)&address, &length);
+		if(result < 0) {
+			if(errno == EINTR)
+			continue;
+			if(errno != EAGAIN)
+			REPORT_ERROR(@"Failed receiving datagram (%i)", errno);
+			break;
+		}
+		
+		data = [NSData dataWithBytes:_receiveBuffer length:result];
+		if(datagrams) {
+			[datagrams addObject:data];
+			[addresses addObject:[NSData dataWithBytes:&address length:length]];
+		}
+		else if(TEST_DELEGATE_METHOD_BIT(3))
+		[_delegate socket:self didReceiveData:data fromRemoteAddress:(struct sockaddr*)&address]; //NOTE: The socket may have been invalidated after this call
+	}
+	
+	if([datagrams count])
+	[_delegate socket:self didReceiveDatagrams:datagrams fromRemoteAddresses:addresses];
+	
+	[self release];
+}
+
 - (BOOL) sendData:(NSData*)data toRemoteAddress:(const struct sockaddr*)address
 {
-	return (address && data && _socket && (CFSocketSendData(_socket, (CFDataRef)[NSData dataWithBytes:(void*)address length:address->sa_len], (CFDataRef)data, 0.0) == kCFSocketSuccess) ? YES : NO);
+	return (address ? ([self sendData:data toRemoteAddresses:&address count:1] == 1) : NO);
+}
+
+/* Sends directly on the native socket which avoids wrapping each destination address in a CFData */
+- (NSUInteger) sendData:(NSData*)data toRemoteAddresses:(const struct sockaddr**)addresses count:(NSUInteger)count
+{
+	const void*				bytes = [data bytes];
+	size_t					length = [data length];
+	NSUInteger				sent = 0,
+							i;
+	CFSocketNativeHandle	socket;
+	ssize_t					result;
+	
+	if(!data || !addresses || !_socket)
+	return 0;
+	socket = CFSocketGetNative(_socket);
+	
+	for(i = 0; i < count; ++i) {
+		if(addresses[i] == NULL)
+		continue;
+		do {
+			result = sendto(socket, bytes, length, 0, addresses[i], addresses[i]->sa_len);
+		} while((result < 0) && (errno == EINTR));
+		if(result == (ssize_t)length)
+		sent += 1;
+	}
+	
+	return sent;
 }
 
 - (BOOL) sendData:(NSData*)data toRemoteIPv4Address:(UInt32)address port:(UInt16)port
@@ -18,6 +18,44 @@
 
 #import <Foundation/Foundation.h>
 
+//CONSTANTS:
+
+#define kOSCTimeTagImmediately				1ULL
+#define kOSCEncoderMaxBundleDepth			8
+
+//TYPES:
+
+typedef UInt64 OSCTimeTag; //NTP format: seconds since 1900 in the upper 32 bits and fractions of a second in the lower 32 bits
+
+/* Encodes OSC messages and bundles into a caller-provided buffer without any heap allocation */
+typedef struct {
+	char*				bytes;
+	NSUInteger			capacity;
+	NSUInteger			length;
+	NSUInteger			sizeOffsets[kOSCEncoderMaxBundleDepth]; //Offsets of the size prefixes of the open bundles or NSNotFound if they have none
+	NSUInteger			depth;
+	NSUInteger			messageSizeOffset;
+	const char*			typeTags; //Type tags of the open message still expecting an argument or NULL if there is no open message
+	BOOL				failed;
+} OSCEncoder;
+
+/* Message parsed in place from a received packet - The pointers are only valid while the message is being dispatched */
+typedef struct {
+	const char*			address; //Can be a pattern
+	const char*			typeTags; //Without the leading comma
+	const char*			arguments;
+	NSUInteger			argumentsLength;
+	OSCTimeTag			timeTag; //Time tag of the enclosing bundle or kOSCTimeTagImmediately
+} OSCParsedMessage;
+
+typedef struct {
+	const char*			typeTags;
+	const char*			bytes;
+	const char*			end;
+} OSCArgumentReader;
+
+//CLASSES:
+
 @class MiniUDPSocket;
 
 /*
@@ -40,6 +78,8 @@ http://opensoundcontrol.org/spec-1_0
 - (void) appendUTF8String:(const char*)string;
 - (void) appendBlobData:(NSData*)data;
 - (void) appendBlobBytes:(const void*)bytes length:(unsigned)length;
+
+- (BOOL) appendToEncoder:(OSCEncoder*)encoder; //Returns NO if the encoder ran out of space
 @end
 
 @interface OSCController : NSObject
@@ -49,6 +89,7 @@ http://opensoundcontrol.org/spec-1_0
 	struct sockaddr*			_cachedAddress;
 	NSString*					_address;
 	unsigned short				_port;
+	char*						_buffer;
 }
 - (void) setDestinationAddress:(NSString*)address;
 - (NSString*) destinationAddress;
@@ -57,4 +98,71 @@ http://opensoundcontrol.org/spec-1_0
 - (unsigned short) destinationPort;
 
 - (void) sendMessage:(OSCMessage*)message;
+- (void) sendMessages:(NSArray*)messages timeTag:(OSCTimeTag)timeTag; //Messages are packed into bundles that fit in a single Ethernet frame whenever possible
+- (void) sendPacketWithEncoder:(const OSCEncoder*)encoder; //Sends the message or bundle encoded so far
+@end
+
+/*
+This class receives OSC packets over UDP using the current runloop at its time of creation.
+Packets are parsed in place and their messages dispatched to the handlers whose addresses match the message address patterns ('*', '?', '[]' and '{}' are supported).
+Messages in bundles with a time tag in the future are copied and dispatched when due - Bundles scheduled too far ahead or beyond the queue limits are dropped.
+Handler actions must have the signature "- (void) receiver:(OSCReceiver*)receiver didReceiveMessage:(const OSCParsedMessage*)message".
+*/
+@interface OSCReceiver : NSObject
+{
+@private
+	CFSocketRef					_socket;
+	CFRunLoopTimerRef			_timer;
+	char*						_buffer;
+	void*						_handlers;
+	NSUInteger					_handlerCount;
+	void*						_trie;
+	void*						_scheduledMessages;
+	NSUInteger					_scheduledCount;
+	NSUInteger					_scheduledCapacity;
+	NSUInteger					_scheduledBytes;
+	NSUInteger					_dispatchLevel;
+	BOOL						_invalidating;
+}
+- (id) initWithPort:(UInt16)port; //Pass 0 to have a port automatically be chosen
+- (UInt16) port;
+- (BOOL) isValid;
+- (void) invalidate;
+
+- (BOOL) addHandler:(id)target action:(SEL)action forAddress:(NSString*)address; //Replaces any handler previously added for the same address - The target is not retained
+- (void) removeHandlerForAddress:(NSString*)address;
+- (void) removeHandlersForTarget:(id)target;
+
+- (NSUInteger) processPacketBytes:(const void*)bytes length:(NSUInteger)length; //For packets received by other means - Returns the number of messages dispatched or scheduled
 @end
+
+//FUNCTIONS:
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+OSCTimeTag OSCTimeTagFromAbsoluteTime(CFAbsoluteTime time);
+CFAbsoluteTime OSCAbsoluteTimeFromTimeTag(OSCTimeTag timeTag);
+
+/* All the encoding functions return NO if the buffer is too small or if they are called out of order, after which the encoder stays failed until it is reset */
+void OSCEncoderInit(OSCEncoder* encoder, void* buffer, NSUInteger capacity);
+void OSCEncoderReset(OSCEncoder* encoder);
+BOOL OSCEncoderBeginBundle(OSCEncoder* encoder, OSCTimeTag timeTag);
+BOOL OSCEncoderEndBundle(OSCEncoder* encoder);
+BOOL OSCEncoderBeginMessage(OSCEncoder* encoder, const char* address, const char* typeTags); //"typeTags" does not start with a comma and must remain valid until the message is ended
+BOOL OSCEncoderAppendInt(OSCEncoder* encoder, int32_t value);
+BOOL OSCEncoderAppendFloat(OSCEncoder* encoder, float value);
+BOOL OSCEncoderAppendString(OSCEncoder* encoder, const char* string);
+BOOL OSCEncoderAppendBlob(OSCEncoder* encoder, const void* bytes, NSUInteger length);
+BOOL OSCEncoderEndMessage(OSCEncoder* encoder); //Fails if some of the arguments declared in the type tags are missing
+
+/* All the reading functions return NO if the next argument is of a different type or is truncated */
+void OSCArgumentReaderInit(OSCArgumentReader* reader, const OSCParsedMessage* message);
+BOOL OSCArgumentReaderReadInt(OSCArgumentReader* reader, int32_t* value);
+BOOL OSCArgumentReaderReadFloat(OSCArgumentReader* reader, float* value);
+BOOL OSCArgumentReaderReadString(OSCArgumentReader* reader, const char** string);
+BOOL OSCArgumentReaderReadBlob(OSCArgumentReader* reader, const void** bytes, NSUInteger* length);
+#ifdef __cplusplus
+}
+#endif
@@ -16,14 +16,570 @@
 	along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#import <sys/socket.h>
 #import <netinet/in.h>
 
 #import "OSCController.h"
 #import "MiniUDPSocket.h"
 
-@interface OSCMessage ()
-- (NSData*) serializedData;
-@end
+//CONSTANTS:
+
+#define kMaxPacketSize				65507 //Maximum UDP payload
+#define kMaxBundleSize				1472 //Ethernet MTU minus IPv4 and UDP headers
+#define kTimeTagEpochOffset			3187296000.0 //Seconds between 1900-01-01 (NTP) and 2001-01-01 (CFAbsoluteTime)
+#define kReceiveBufferSize			65536
+#define kMaxPacketsPerCallBack		64
+#define kMaxBundleDepth				8
+#define kMaxScheduledMessages		1024
+#define kMaxScheduledBytes			(1024 * 1024)
+#define kMaxScheduleHorizon			60.0 //Seconds
+#define kDistantFuture				1.0e10
+#define kMaxPatternMatchSteps		2048 //Per address component and trie node - Bounds the backtracking (and recursion depth) of patterns like "*a*a*a*b"
+
+//TYPES:
+
+typedef struct {
+	char*						address;
+	id							target;
+	SEL							action;
+	IMP							method;
+} Handler;
+
+typedef struct _TrieNode {
+	const char*					name; //Points into the handler address
+	NSUInteger					length;
+	struct _TrieNode*			children; //Sorted by name
+	NSUInteger					childCount;
+	NSUInteger					handler; //NSNotFound if no handler was added for this address
+} TrieNode;
+
+typedef struct {
+	CFAbsoluteTime				time;
+	OSCTimeTag					timeTag;
+	char*						bytes;
+	NSUInteger					length;
+} ScheduledMessage;
+
+typedef void (*HandlerMethod)(id target, SEL action, OSCReceiver* receiver, const OSCParsedMessage* message);
+
+//FUNCTIONS:
+
+OSCTimeTag OSCTimeTagFromAbsoluteTime(CFAbsoluteTime time)
+{
+	double						seconds = time + kTimeTagEpochOffset;
+	
+	return ((OSCTimeTag)seconds << 32) | (OSCTimeTag)((seconds - floor(seconds)) * 4294967296.0);
+}
+
+CFAbsoluteTime OSCAbsoluteTimeFromTimeTag(OSCTimeTag timeTag)
+{
+	return (double)(timeTag >> 32) + (double)(timeTag & 0xFFFFFFFF) / 4294967296.0 - kTimeTagEpochOffset;
+}
+
+static inline BOOL _EncoderReserve(OSCEncoder* encoder, NSUInteger length)
+{
+	if(encoder->failed || (length > encoder->capacity - encoder->length)) {
+		encoder->failed = YES;
+		return NO;
+	}
+	
+	return YES;
+}
+
+static inline void _EncoderWriteUInt32(OSCEncoder* encoder, NSUInteger offset, uint32_t value)
+{
+	value = CFSwapInt32HostToBig(value);
+	bcopy(&value, &encoder->bytes[offset], 4);
+}
+
+/* Writes the bytes followed by zeros up to the next 4 bytes boundary */
+static BOOL _EncoderAppendPaddedBytes(OSCEncoder* encoder, const void* bytes, NSUInteger length)
+{
+	NSUInteger					paddedLength = (length + 3) & ~3;
+	
+	if(!_EncoderReserve(encoder, paddedLength))
+	return NO;
+	
+	bcopy(bytes, &encoder->bytes[encoder->length], length);
+	bzero(&encoder->bytes[encoder->length + length], paddedLength - length);
+	encoder->length += paddedLength;
+	
+	return YES;
+}
+
+/* Elements of bundles are prefixed by their size which is only known once they are complete */
+static BOOL _EncoderBeginElement(OSCEncoder* encoder, NSUInteger* sizeOffset)
+{
+	if(encoder->depth == 0) {
+		*sizeOffset = NSNotFound;
+		return !encoder->failed;
+	}
+	if(!_EncoderReserve(encoder, 4))
+	return NO;
+	
+	*sizeOffset = encoder->length;
+	encoder->length += 4;
+	
+	return YES;
+}
+
+static void _EncoderEndElement(OSCEncoder* encoder, NSUInteger sizeOffset)
+{
+	if(sizeOffset != NSNotFound)
+	_EncoderWriteUInt32(encoder, sizeOffset, encoder->length - sizeOffset - 4);
+}
+
+static inline BOOL _EncoderExpectArgument(OSCEncoder* encoder, char tag)
+{
+	if(encoder->failed || !encoder->typeTags || (*encoder->typeTags != tag)) {
+		encoder->failed = YES;
+		return NO;
+	}
+	encoder->typeTags += 1;
+	
+	return YES;
+}
+
+void OSCEncoderInit(OSCEncoder* encoder, void* buffer, NSUInteger capacity)
+{
+	encoder->bytes = buffer;
+	encoder->capacity = capacity;
+	OSCEncoderReset(encoder);
+}
+
+void OSCEncoderReset(OSCEncoder* encoder)
+{
+	encoder->length = 0;
+	encoder->depth = 0;
+	encoder->typeTags = NULL;
+	encoder->failed = NO;
+}
+
+BOOL OSCEncoderBeginBundle(OSCEncoder* encoder, OSCTimeTag timeTag)
+{
+	static const char			header[8] = "#bundle";
+	NSUInteger					sizeOffset;
+	
+	if(encoder->typeTags || (encoder->depth == kOSCEncoderMaxBundleDepth) || ((encoder->depth == 0) && encoder->length))
+	encoder->failed = YES;
+	if(!_EncoderBeginElement(encoder, &sizeOffset) || !_EncoderReserve(encoder, 16))
+	return NO;
+	
+	bcopy(header, &encoder->bytes[encoder->length], 8);
+	_EncoderWriteUInt32(encoder, encoder->length + 8, timeTag >> 32);
+	_EncoderWriteUInt32(encoder, encoder->length + 12, timeTag);
+	encoder->length += 16;
+	encoder->sizeOffsets[encoder->depth++] = sizeOffset;
+	
+	return YES;
+}
+
+BOOL OSCEncoderEndBundle(OSCEncoder* encoder)
+{
+	if(encoder->typeTags || (encoder->depth == 0))
+	encoder->failed = YES;
+	if(encoder->failed)
+	return NO;
+	
+	_EncoderEndElement(encoder, encoder->sizeOffsets[--encoder->depth]);
+	
+	return YES;
+}
+
+BOOL OSCEncoderBeginMessage(OSCEncoder* encoder, const char* address, const char* typeTags)
+{
+	NSUInteger					count = strlen(typeTags),
+								paddedLength = (count + 2 + 3) & ~3;
+	
+	if(encoder->typeTags || (address[0] != '/') || ((encoder->depth == 0) && encoder->length)) //NOTE: Only bundles can contain multiple messages
+	encoder->failed = YES;
+	if(!_EncoderBeginElement(encoder, &encoder->messageSizeOffset) || !_EncoderAppendPaddedBytes(encoder, address, strlen(address) + 1) || !_EncoderReserve(encoder, paddedLength))
+	return NO;
+	
+	encoder->bytes[encoder->length] = ',';
+	bcopy(typeTags, &encoder->bytes[encoder->length + 1], count);
+	bzero(&encoder->bytes[encoder->length + 1 + count], paddedLength - count - 1);
+	encoder->length += paddedLength;
+	encoder->typeTags = typeTags;
+	
+	return YES;
+}
+
+BOOL OSCEncoderAppendInt(OSCEncoder* encoder, int32_t value)
+{
+	if(!_EncoderExpectArgument(encoder, 'i') || !_EncoderReserve(encoder, 4))
+	return NO;
+	
+	_EncoderWriteUInt32(encoder, encoder->length, value);
+	encoder->length += 4;
+	
+	return YES;
+}
+
+BOOL OSCEncoderAppendFloat(OSCEncoder* encoder, float value)
+{
+	uint32_t					intValue;
+	
+	if(!_EncoderExpectArgument(encoder, 'f') || !_EncoderReserve(encoder, 4))
+	return NO;
+	
+	bcopy(&value, &intValue, 4);
+	_EncoderWriteUInt32(encoder, encoder->length, intValue);
+	encoder->length += 4;
+	
+	return YES;
+}
+
+BOOL OSCEncoderAppendString(OSCEncoder* encoder, const char* string)
+{
+	if(!_EncoderExpectArgument(encoder, 's'))
+	return NO;
+	
+	return _EncoderAppendPaddedBytes(encoder, (string ? string : ""), (string ? strlen(string) : 0) + 1);
+}
+
+BOOL OSCEncoderAppendBlob(OSCEncoder* encoder, const void* bytes, NSUInteger length)
+{
+	if(!_EncoderExpectArgument(encoder, 'b') || !_EncoderReserve(encoder, 4))
+	return NO;
+	
+	_EncoderWriteUInt32(encoder, encoder->length, length);
+	encoder->length += 4;
+	
+	return _EncoderAppendPaddedBytes(encoder, bytes, length);
+}
+
+BOOL OSCEncoderEndMessage(OSCEncoder* encoder)
+{
+	if(!encoder->typeTags || *encoder->typeTags)
+	encoder->failed = YES;
+	if(encoder->failed)
+	return NO;
+	
+	_EncoderEndElement(encoder, encoder->messageSizeOffset);
+	encoder->typeTags = NULL;
+	
+	return YES;
+}
+
+static inline uint32_t _ReadUInt32(const char* bytes)
+{
+	return ((uint32_t)(unsigned char)bytes[0] << 24) | ((uint32_t)(unsigned char)bytes[1] << 16) | ((uint32_t)(unsigned char)bytes[2] << 8) | (unsigned char)bytes[3];
+}
+
+/* Returns the length of the string including its terminating character and padding or 0 if it is not terminated */
+static inline NSUInteger _PaddedStringLength(const char* bytes, NSUInteger length)
+{
+	const char*					end = memchr(bytes, 0, length);
+	NSUInteger					paddedLength;
+	
+	if(end == NULL)
+	return 0;
+	paddedLength = ((end - bytes) + 4) & ~3;
+	
+	return (paddedLength <= length ? paddedLength : 0);
+}
+
+static BOOL _ParseMessage(const char* bytes, NSUInteger length, OSCTimeTag timeTag, OSCParsedMessage* message)
+{
+	NSUInteger					addressLength = _PaddedStringLength(bytes, length),
+								typeTagsLength;
+	
+	if(!addressLength || (bytes[0] != '/'))
+	return NO;
+	
+	message->address = bytes;
+	message->timeTag = timeTag;
+	if(addressLength == length) { //NOTE: Type tags are optional in old implementations
+		message->typeTags = "";
+		message->arguments = &bytes[length];
+		message->argumentsLength = 0;
+		return YES;
+	}
+	typeTagsLength = _PaddedStringLength(&bytes[addressLength], length - addressLength);
+	if(!typeTagsLength || (bytes[addressLength] != ','))
+	return NO;
+	message->typeTags = &bytes[addressLength + 1];
+	message->arguments = &bytes[addressLength + typeTagsLength];
+	message->argumentsLength = length - addressLength - typeTagsLength;
+	
+	return YES;
+}
+
+static inline BOOL _ReaderExpectArgument(OSCArgumentReader* reader, char tag, NSUInteger length)
+{
+	if((*reader->typeTags != tag) || (length > (NSUInteger)(reader->end - reader->bytes)))
+	return NO;
+	reader->typeTags += 1;
+	
+	return YES;
+}
+
+void OSCArgumentReaderInit(OSCArgumentReader* reader, const OSCParsedMessage* message)
+{
+	reader->typeTags = message->typeTags;
+	reader->bytes = message->arguments;
+	reader->end = message->arguments + message->argumentsLength;
+}
+
+BOOL OSCArgumentReaderReadInt(OSCArgumentReader* reader, int32_t* value)
+{
+	if(!_ReaderExpectArgument(reader, 'i', 4))
+	return NO;
+	
+	*value = _ReadUInt32(reader->bytes);
+	reader->bytes += 4;
+	
+	return YES;
+}
+
+BOOL OSCArgumentReaderReadFloat(OSCArgumentReader* reader, float* value)
+{
+	uint32_t					intValue;
+	
+	if(!_ReaderExpectArgument(reader, 'f', 4))
+	return NO;
+	
+	intValue = _ReadUInt32(reader->bytes);
+	bcopy(&intValue, value, 4);
+	reader->bytes += 4;
+	
+	return YES;
+}
+
+BOOL OSCArgumentReaderReadString(OSCArgumentReader* reader, const char** string)
+{
+	NSUInteger					length = _PaddedStringLength(reader->bytes, reader->end - reader->bytes);
+	
+	if(!length || !_ReaderExpectArgument(reader, 's', length))
+	return NO;
+	
+	*string = reader->bytes;
+	reader->bytes += length;
+	
+	return YES;
+}
+
+BOOL OSCArgumentReaderReadBlob(OSCArgumentReader* reader, const void** bytes, NSUInteger* length)
+{
+	NSUInteger					blobLength;
+	
+	if((reader->end - reader->bytes < 4) || (*reader->typeTags != 'b'))
+	return NO;
+	blobLength = _ReadUInt32(reader->bytes);
+	if(blobLength > (NSUInteger)(reader->end - reader->bytes - 4)) //NOTE: Check before rounding up as it could overflow on 32 bits
+	return NO;
+	if(!_ReaderExpectArgument(reader, 'b', 4 + ((blobLength + 3) & ~3)))
+	return NO;
+	
+	*bytes = reader->bytes + 4;
+	*length = blobLength;
+	reader->bytes += 4 + ((blobLength + 3) & ~3);
+	
+	return YES;
+}
+
+/* Supports "[abc]", "[a-z]" and "[!abc]" - Returns the position after the closing bracket or NULL if there is none */
+static const char* _MatchBracket(const char* pattern, const char* patternEnd, char character, BOOL* matched)
+{
+	BOOL						negate = NO,
+								found = NO;
+	
+	if((pattern < patternEnd) && (*pattern == '!')) {
+		negate = YES;
+		++pattern;
+	}
+	while((pattern < patternEnd) && (*pattern != ']')) {
+		if((pattern + 2 < patternEnd) && (pattern[1] == '-') && (pattern[2] != ']')) {
+			if((character >= pattern[0]) && (character <= pattern[2]))
+			found = YES;
+			pattern += 3;
+		}
+		else {
+			if(character == *pattern)
+			found = YES;
+			pattern += 1;
+		}
+	}
+	if(pattern == patternEnd)
+	return NULL;
+	*matched = (found != negate);
+	
+	return pattern + 1;
+}
+
+/* "budget" is decremented for each step and matching fails once it reaches 0 */
+static BOOL _MatchPattern(const char* pattern, const char* patternEnd, const char* name, const char* nameEnd, NSUInteger* budget)
+{
+	const char*					closing;
+	const char*					alternative;
+	const char*					separator;
+	BOOL						matched;
+	
+	while(pattern < patternEnd) {
+		if(*budget == 0)
+		return NO;
+		*budget -= 1;
+		
+		switch(*pattern) {
+			
+			case '*':
+			while((pattern < patternEnd) && (*pattern == '*'))
+			++pattern;
+			if(pattern == patternEnd)
+			return YES;
+			for(; name <= nameEnd; ++name) {
+				if(_MatchPattern(pattern, patternEnd, name, nameEnd, budget))
+				return YES;
+				if(*budget == 0)
+				return NO;
+			}
+			return NO;
+			
+			case '?':
+			if(name == nameEnd)
+			return NO;
+			++pattern;
+			++name;
+			break;
+			
+			case '[':
+			if(name == nameEnd)
+			return NO;
+			pattern = _MatchBracket(pattern + 1, patternEnd, *name, &matched);
+			if(!pattern || !matched)
+			return NO;
+			++name;
+			break;
+			
+			case '{':
+			closing = memchr(pattern, '}', patternEnd - pattern);
+			if(closing == NULL)
+			return NO;
+			for(alternative = pattern + 1; alternative <= closing; alternative = separator + 1) {
+				for(separator = alternative; (separator < closing) && (*separator != ','); ++separator)
+				;
+				if(((NSUInteger)(separator - alternative) <= (NSUInteger)(nameEnd - name)) && !memcmp(alternative, name, separator - alternative) && _MatchPattern(closing + 1, patternEnd, name + (separator - alternative), nameEnd, budget))
+				return YES;
+			}
+			return NO;
+			
+			default:
+			if((name == nameEnd) || (*name != *pattern))
+			return NO;
+			++pattern;
+			++name;
+			break;
+			
+		}
+	}
+	
+	return (name == nameEnd);
+}
+
+static int _CompareNodes(const void* node1, const void* node2)
+{
+	const TrieNode*				first = node1;
+	const TrieNode*				second = node2;
+	int							result = memcmp(first->name, second->name, MIN(first->length, second->length));
+	
+	return (result ? result : (int)first->length - (int)second->length);
+}
+
+static TrieNode* _TrieNodeChild(TrieNode* node, const char* name, NSUInteger length)
+{
+	TrieNode*					child;
+	NSUInteger					i;
+	
+	for(i = 0; i < node->childCount; ++i) {
+		child = &node->children[i];
+		if((child->length == length) && !memcmp(child->name, name, length))
+		return child;
+	}
+	
+	node->children = realloc(node->children, (node->childCount + 1) * sizeof(TrieNode));
+	child = &node->children[node->childCount++];
+	bzero(child, sizeof(TrieNode));
+	child->name = name;
+	child->length = length;
+	child->handler = NSNotFound;
+	
+	return child;
+}
+
+static void _TrieNodeSort(TrieNode* node)
+{
+	NSUInteger					i;
+	
+	if(node->childCount > 1)
+	qsort(node->children, node->childCount, sizeof(TrieNode), _CompareNodes);
+	for(i = 0; i < node->childCount; ++i)
+	_TrieNodeSort(&node->children[i]);
+}
+
+static void _TrieNodeFree(TrieNode* node)
+{
+	NSUInteger					i;
+	
+	for(i = 0; i < node->childCount; ++i)
+	_TrieNodeFree(&node->children[i]);
+	if(node->children)
+	free(node->children);
+}
+
+static const TrieNode* _TrieNodeFindChild(const TrieNode* node, const char* name, NSUInteger length)
+{
+	TrieNode					key;
+	
+	key.name = name;
+	key.length = length;
+	
+	return bsearch(&key, node->children, node->childCount, sizeof(TrieNode), _CompareNodes);
+}
+
+/* Literal components of the pattern are looked up with a binary search while the others are matched against every child */
+static NSUInteger _TrieNodeDispatch(const TrieNode* node, const char* pattern, OSCReceiver* receiver, const Handler* handlers, const OSCParsedMessage* message)
+{
+	const char*					end = pattern;
+	BOOL						literal = YES;
+	NSUInteger					count = 0,
+								i;
+	const TrieNode*				child;
+	NSUInteger					budget;
+	
+	for(; *end && (*end != '/'); ++end) {
+		switch(*end) {
+			case '*': case '?': case '[': case ']': case '{': case '}':
+			literal = NO;
+			break;
+		}
+	}
+	
+	for(i = 0; i < node->childCount; ++i) {
+		if(literal) {
+			if(i > 0)
+			break;
+			child = _TrieNodeFindChild(node, pattern, end - pattern);
+			if(child == NULL)
+			break;
+		}
+		else {
+			child = &node->children[i];
+			budget = kMaxPatternMatchSteps;
+			if(!_MatchPattern(pattern, end, child->name, child->name + child->length, &budget))
+			continue;
+		}
+		
+		if(*end)
+		count += _TrieNodeDispatch(child, end + 1, receiver, handlers, message);
+		else if(child->handler != NSNotFound) {
+			((HandlerMethod)handlers[child->handler].method)(handlers[child->handler].target, handlers[child->handler].action, receiver, message);
+			count += 1;
+		}
+	}
+	
+	return count;
+}
 
 @interface NSMutableData (OSCController)
 - (void) _appendPaddedBytes:(const void*)bytes length:(unsigned)length;
@@ -56,7 +612,7 @@
 			case 'i':
 			[message appendInt:va_arg(list, int)];
 			break;
-
+	
 			case 'f':
 			[message appendFloat:va_arg(list, double)];
 			break;
@@ -154,18 +710,17 @@
 	[_arguments _appendPaddedBytes:bytes length:length];
 }
 
-- (NSData*) serializedData
+- (BOOL) appendToEncoder:(OSCEncoder*)encoder
 {
-	NSMutableData*				data = [NSMutableData new];
-	const char*					string;
+	if(!OSCEncoderBeginMessage(encoder, [_address UTF8String], [_typeTags UTF8String] + 1) || !_EncoderReserve(encoder, [_arguments length]))
+	return NO;
 	
-	string = [_address UTF8String];
-	[data _appendPaddedBytes:string length:(strlen(string) + 1)];
-	string = [_typeTags UTF8String];
-	[data _appendPaddedBytes:string length:(strlen(string) + 1)];
-	[data appendData:_arguments];
+	//NOTE: Arguments are already encoded so just copy them
+	bcopy([_arguments bytes], &encoder->bytes[encoder->length], [_arguments length]);
+	encoder->length += [_arguments length];
+	encoder->typeTags += strlen(encoder->typeTags);
 	
-	return [data autorelease];
+	return OSCEncoderEndMessage(encoder);
 }
 
 @end
@@ -179,7 +734,8 @@
 		_port = 10000;
 		
 		_udpSocket = [MiniUDPSocket new];
-		if(_udpSocket == nil) {
+		_buffer = malloc(kMaxPacketSize);
+		if((_udpSocket == nil) || (_buffer == NULL)) {
 			[self release];
 			return nil;
 		}
@@ -194,6 +750,8 @@
 	
 	if(_cachedAddress)
 	free(_cachedAddress);
+	if(_buffer)
+	free(_buffer);
 }
 
 - (void) finalize
@@ -267,18 +825,493 @@
 	return _port;
 }
 
-- (void) sendMessage:(OSCMessage*)message
+- (BOOL) _sendBytes:(const void*)bytes length:(NSUInteger)length
 {
 	if(_address) {
 		if(_cachedAddress)
-		((struct sockaddr_in*)_cachedAddress)->sin_port = _port;
-		if(![_udpSocket sendData:[message serializedData] toRemoteAddress:_cachedAddress])
-		NSLog(@"%s: Failed sending UDP datagram to '%@'", __FUNCTION__, _address);
+		((struct sockaddr_in*)_cachedAddress)->sin_port = htons(_port);
+		if(![_udpSocket sendBytes:bytes length:length toRemoteAddress:_cachedAddress]) {
+			NSLog(@"%s: Failed sending UDP datagram to '%@'", __FUNCTION__, _address);
+			return NO;
+		}
 	}
 	else {
-		if(![_udpSocket broadcastData:[message serializedData] toPort:_port])
-		NSLog(@"%s: Failed broadcasting UDP datagram", __FUNCTION__);
+		if(![_udpSocket sendBytes:bytes length:length toRemoteIPv4Address:INADDR_BROADCAST port:_port]) {
+			NSLog(@"%s: Failed broadcasting UDP datagram", __FUNCTION__);
+			return NO;
+		}
+	}
+	
+	return YES;
+}
+
+- (void) sendPacketWithEncoder:(const OSCEncoder*)encoder
+{
+	if(encoder->failed || encoder->typeTags || encoder->depth)
+	NSLog(@"%s: Invalid or incomplete OSC packet", __FUNCTION__);
+	else if(encoder->length)
+	[self _sendBytes:encoder->bytes length:encoder->length];
+}
+
+- (void) sendMessage:(OSCMessage*)message
+{
+	OSCEncoder					encoder;
+	
+	OSCEncoderInit(&encoder, _buffer, kMaxPacketSize);
+	if([message appendToEncoder:&encoder])
+	[self sendPacketWithEncoder:&encoder];
+	else
+	NSLog(@"%s: OSC message is too large", __FUNCTION__);
+}
+
+- (void) sendMessages:(NSArray*)messages timeTag:(OSCTimeTag)timeTag
+{
+	OSCEncoder					encoder,
+								savedEncoder;
+	OSCMessage*					message;
+	
+	OSCEncoderInit(&encoder, _buffer, kMaxBundleSize);
+	OSCEncoderBeginBundle(&encoder, timeTag);
+	for(message in messages) {
+		savedEncoder = encoder;
+		if([message appendToEncoder:&encoder])
+		continue;
+		
+		//NOTE: Send the bundle so far and start a new one with the message
+		encoder = savedEncoder;
+		if(encoder.length > 16) {
+			OSCEncoderEndBundle(&encoder);
+			[self sendPacketWithEncoder:&encoder];
+			OSCEncoderInit(&encoder, _buffer, kMaxBundleSize);
+			OSCEncoderBeginBundle(&encoder, timeTag);
+			if([message appendToEncoder:&encoder])
+			continue;
+		}
+		
+		//NOTE: The message does not fit alone in a bundle of kMaxBundleSize so send it by itself using the whole buffer
+		OSCEncoderInit(&encoder, _buffer, kMaxPacketSize);
+		OSCEncoderBeginBundle(&encoder, timeTag);
+		if([message appendToEncoder:&encoder]) {
+			OSCEncoderEndBundle(&encoder);
+			[self sendPacketWithEncoder:&encoder];
+		}
+		else
+		NSLog(@"%s: OSC message is too large", __FUNCTION__);
+		OSCEncoderInit(&encoder, _buffer, kMaxBundleSize);
+		OSCEncoderBeginBundle(&encoder, timeTag);
+	}
+	if(encoder.length > 16) {
+		OSCEncoderEndBundle(&encoder);
+		[self sendPacketWithEncoder:&encoder];
+	}
+}
+
+@end
+
+@interface OSCReceiver (Internal)
+- (void) _readPackets;
+- (void) _dispatchScheduledMessages;
+@end
+
+@implementation OSCReceiver
+
+static void _SocketCallBack(CFSocketRef s, CFSocketCallBackType type, CFDataRef address, const void* data, void* info)
+{
+	NSAutoreleasePool*			pool = [NSAutoreleasePool new];
+	OSCReceiver*				self = (OSCReceiver*)info;
+	
+	if(type == kCFSocketReadCallBack)
+	[self _readPackets];
+	
+	[pool release];
+}
+
+static void _TimerCallBack(CFRunLoopTimerRef timer, void* info)
+{
+	NSAutoreleasePool*			pool = [NSAutoreleasePool new];
+	OSCReceiver*				self = (OSCReceiver*)info;
+	
+	[self _dispatchScheduledMessages];
+	
+	[pool release];
+}
+
+- (id) init
+{
+	return [self initWithPort:0];
+}
+
+- (id) initWithPort:(UInt16)port
+{
+	CFSocketContext				socketContext = {0, self, NULL, NULL, NULL};
+	CFRunLoopTimerContext		timerContext = {0, self, NULL, NULL, NULL};
+	int							value = 1;
+	struct sockaddr_in			address;
+	CFRunLoopSourceRef			source;
+	
+	if((self = [super init])) {
+		_buffer = malloc(kReceiveBufferSize);
+		_socket = CFSocketCreate(kCFAllocatorDefault, AF_INET, SOCK_DGRAM, IPPROTO_UDP, kCFSocketReadCallBack, _SocketCallBack, &socketContext); //NOTE: We read the datagrams ourselves to drain the socket in a single callback
+		if((_buffer == NULL) || (_socket == NULL)) {
+			[self release];
+			return nil;
+		}
+		
+		if(setsockopt(CFSocketGetNative(_socket), SOL_SOCKET, SO_REUSEADDR, &value, sizeof(value)) < 0) {
+			[self release];
+			return nil;
+		}
+		
+		bzero(&address, sizeof(struct sockaddr_in));
+		address.sin_len = sizeof(struct sockaddr_in);
+		address.sin_family = AF_INET;
+		address.sin_port = htons(port);
+		address.sin_addr.s_addr = htonl(INADDR_ANY);
+		if(CFSocketSetAddress(_socket, (CFDataRef)[NSData dataWithBytes:&address length:address.sin_len]) != kCFSocketSuccess) {
+			NSLog(@"%s: Failed binding to port %i", __FUNCTION__, port);
+			[self release];
+			return nil;
+		}
+		
+		source = CFSocketCreateRunLoopSource(kCFAllocatorDefault, _socket, 0);
+		if(source == NULL) {
+			[self release];
+			return nil;
+		}
+		CFRunLoopAddSource(CFRunLoopGetCurrent(), source, kCFRunLoopCommonModes);
+		CFRelease(source);
+		
+		_timer = CFRunLoopTimerCreate(kCFAllocatorDefault, kDistantFuture, kDistantFuture, 0, 0, _TimerCallBack, &timerContext);
+		if(_timer == NULL) {
+			[self release];
+			return nil;
+		}
+		CFRunLoopAddTimer(CFRunLoopGetCurrent(), _timer, kCFRunLoopCommonModes);
+	}
+	
+	return self;
+}
+
+- (void) _cleanUp_OSCReceiver
+{
+	NSUInteger					i;
+	
+	[self invalidate];
+	
+	for(i = 0; i < _handlerCount; ++i)
+	free(((Handler*)_handlers)[i].address);
+	if(_handlers)
+	free(_handlers);
+	if(_trie) {
+		_TrieNodeFree(_trie);
+		free(_trie);
+	}
+	if(_buffer)
+	free(_buffer);
+}
+
+- (void) finalize
+{
+	[self _cleanUp_OSCReceiver];
+	
+	[super finalize];
+}
+
+- (void) dealloc
+{
+	[self _cleanUp_OSCReceiver];
+	
+	[super dealloc];
+}
+
+- (UInt16) port
+{
+	struct sockaddr_in			address;
+	socklen_t					length = sizeof(struct sockaddr_in);
+	
+	if((_socket == NULL) || (getsockname(CFSocketGetNative(_socket), (struct sockaddr*)&address, &length) < 0))
+	return 0;
+	
+	return ntohs(address.sin_port);
+}
+
+- (BOOL) isValid
+{
+	return !_invalidating;
+}
+
+/* Handlers are only freed on deallocation as this can be called from within one of them */
+- (void) invalidate
+{
+	NSUInteger					i;
+	
+	if(_invalidating == NO) {
+		_invalidating = YES;
+		
+		if(_socket) {
+			CFSocketInvalidate(_socket); //NOTE: This also calls CFRunLoopSourceInvalidate()
+			CFRelease(_socket);
+			_socket = NULL;
+		}
+		if(_timer) {
+			CFRunLoopTimerInvalidate(_timer);
+			CFRelease(_timer);
+			_timer = NULL;
+		}
+		
+		for(i = 0; i < _scheduledCount; ++i)
+		free(((ScheduledMessage*)_scheduledMessages)[i].bytes);
+		if(_scheduledMessages)
+		free(_scheduledMessages);
+		_scheduledMessages = NULL;
+		_scheduledCount = 0;
+		_scheduledCapacity = 0;
+		_scheduledBytes = 0;
+	}
+}
+
+- (void) _invalidateTrie
+{
+	if(_dispatchLevel)
+	[NSException raise:NSInternalInconsistencyException format:@"Handlers cannot be changed while dispatching messages"];
+	
+	if(_trie) {
+		_TrieNodeFree(_trie);
+		free(_trie);
+		_trie = NULL;
+	}
+}
+
+- (void) _compileTrie
+{
+	Handler*					handlers = _handlers;
+	TrieNode*					node;
+	const char*					name;
+	const char*					end;
+	NSUInteger					i;
+	
+	_trie = calloc(1, sizeof(TrieNode));
+	((TrieNode*)_trie)->handler = NSNotFound;
+	for(i = 0; i < _handlerCount; ++i) {
+		node = _trie;
+		name = handlers[i].address + 1;
+		while(1) {
+			for(end = name; *end && (*end != '/'); ++end)
+			;
+			node = _TrieNodeChild(node, name, end - name);
+			if(*end == 0)
+			break;
+			name = end + 1;
+		}
+		node->handler = i;
+	}
+	_TrieNodeSort(_trie);
+}
+
+- (BOOL) addHandler:(id)target action:(SEL)action forAddress:(NSString*)address
+{
+	const char*					string = [address UTF8String];
+	Handler*					handler = NULL;
+	NSUInteger					i;
+	
+	if(!target || !action || !string || (string[0] != '/') || strpbrk(string, "*?[]{}#, ")) {
+		NSLog(@"%s: Invalid handler for address '%@'", __FUNCTION__, address);
+		return NO;
+	}
+	[self _invalidateTrie];
+	
+	for(i = 0; i < _handlerCount; ++i) {
+		if(!strcmp(((Handler*)_handlers)[i].address, string)) {
+			handler = &((Handler*)_handlers)[i];
+			break;
+		}
+	}
+	if(handler == NULL) {
+		_handlers = realloc(_handlers, (_handlerCount + 1) * sizeof(Handler));
+		handler = &((Handler*)_handlers)[_handlerCount++];
+		handler->address = strdup(string);
+	}
+	handler->target = target;
+	handler->action = action;
+	handler->method = [target methodForSelector:action];
+	
+	return YES;
+}
+
+- (void) _removeHandlerAtIndex:(NSUInteger)index
+{
+	Handler*					handlers = _handlers;
+	
+	free(handlers[index].address);
+	memmove(&handlers[index], &handlers[index + 1], (_handlerCount - index - 1) * sizeof(Handler));
+	_handlerCount -= 1;
+}
+
+- (void) removeHandlerForAddress:(NSString*)address
+{
+	const char*					string = [address UTF8String];
+	NSUInteger					i;
+	
+	if(string == NULL)
+	return;
+	[self _invalidateTrie];
+	
+	for(i = 0; i < _handlerCount; ++i) {
+		if(!strcmp(((Handler*)_handlers)[i].address, string)) {
+			[self _removeHandlerAtIndex:i];
+			break;
+		}
+	}
+}
+
+- (void) removeHandlersForTarget:(id)target
+{
+	NSUInteger					i;
+	
+	[self _invalidateTrie];
+	
+	for(i = 0; i < _handlerCount;) {
+		if(((Handler*)_handlers)[i].target == target)
+		[self _removeHandlerAtIndex:i];
+		else
+		++i;
+	}
+}
+
+- (BOOL) _scheduleBytes:(const char*)bytes length:(NSUInteger)length timeTag:(OSCTimeTag)timeTag time:(CFAbsoluteTime)time now:(CFAbsoluteTime)now
+{
+	ScheduledMessage*			messages;
+	NSUInteger					index;
+	
+	//NOTE: Bound the memory a sender can make us hold on to
+	if((_scheduledCount >= kMaxScheduledMessages) || (length > kMaxScheduledBytes - _scheduledBytes) || (time - now > kMaxScheduleHorizon)) {
+#ifdef __DEBUG__
+		NSLog(@"%s: Dropping OSC bundle scheduled in %.3f seconds", __FUNCTION__, time - now);
+#endif
+		return NO;
+	}
+	
+	if(_scheduledCount == _scheduledCapacity) {
+		_scheduledCapacity = (_scheduledCapacity ? 2 * _scheduledCapacity : 16);
+		_scheduledMessages = realloc(_scheduledMessages, _scheduledCapacity * sizeof(ScheduledMessage));
+	}
+	messages = _scheduledMessages;
+	
+	//NOTE: Messages due at the same time are kept in the order they were received
+	for(index = _scheduledCount; (index > 0) && (messages[index - 1].time > time); --index)
+	;
+	memmove(&messages[index + 1], &messages[index], (_scheduledCount - index) * sizeof(ScheduledMessage));
+	messages[index].time = time;
+	messages[index].timeTag = timeTag;
+	messages[index].bytes = malloc(length);
+	bcopy(bytes, messages[index].bytes, length);
+	messages[index].length = length;
+	_scheduledCount += 1;
+	_scheduledBytes += length;
+	
+	if(index == 0)
+	CFRunLoopTimerSetNextFireDate(_timer, time);
+	
+	return YES;
+}
+
+- (NSUInteger) _dispatchMessage:(const OSCParsedMessage*)message
+{
+	NSUInteger					count = 0;
+	
+	if(_trie == NULL)
+	[self _compileTrie];
+	
+	_dispatchLevel += 1;
+	@try {
+		count = _TrieNodeDispatch(_trie, message->address + 1, self, _handlers, message);
+	}
+	@finally {
+		_dispatchLevel -= 1;
+	}
+	
+	return count;
+}
+
+- (NSUInteger) _processBytes:(const char*)bytes length:(NSUInteger)length timeTag:(OSCTimeTag)timeTag depth:(NSUInteger)depth time:(CFAbsoluteTime)now
+{
+	OSCParsedMessage			message;
+	CFAbsoluteTime				time;
+	NSUInteger					count = 0,
+								offset,
+								size;
+	
+	if((length >= 16) && !memcmp(bytes, "#bundle", 8)) {
+		timeTag = ((OSCTimeTag)_ReadUInt32(&bytes[8]) << 32) | _ReadUInt32(&bytes[12]);
+		if(timeTag != kOSCTimeTagImmediately) {
+			time = OSCAbsoluteTimeFromTimeTag(timeTag);
+			if((time > now) && _timer)
+			return ([self _scheduleBytes:bytes length:length timeTag:timeTag time:time now:now] ? 1 : 0);
+		}
+		
+		for(offset = 16; offset + 4 <= length; offset += 4 + size) {
+			size = _ReadUInt32(&bytes[offset]);
+			if((size & 3) || (size > length - offset - 4))
+			break;
+			if(depth + 1 < kMaxBundleDepth)
+			count += [self _processBytes:&bytes[offset + 4] length:size timeTag:timeTag depth:(depth + 1) time:now];
+		}
+	}
+	else if(_ParseMessage(bytes, length, timeTag, &message))
+	count = [self _dispatchMessage:&message];
+	
+	return count;
+}
+
+- (NSUInteger) processPacketBytes:(const void*)bytes length:(NSUInteger)length
+{
+	NSUInteger					count;
+	
+	if((length == 0) || (length & 3))
+	return 0;
+	
+	[self retain];
+	count = [self _processBytes:bytes length:length timeTag:kOSCTimeTagImmediately depth:0 time:CFAbsoluteTimeGetCurrent()];
+	[self release];
+	
+	return count;
+}
+
+- (void) _readPackets
+{
+	NSUInteger					i;
+	ssize_t						length;
+	
+	[self retain];
+	for(i = 0; (i < kMaxPacketsPerCallBack) && _socket; ++i) {
+		length = recv(CFSocketGetNative(_socket), _buffer, kReceiveBufferSize, MSG_DONTWAIT);
+		if(length <= 0)
+		break;
+		[self processPacketBytes:_buffer length:length];
+	}
+	[self release];
+}
+
+- (void) _dispatchScheduledMessages
+{
+	ScheduledMessage*			messages;
+	ScheduledMessage			message;
+	CFAbsoluteTime				now = CFAbsoluteTimeGetCurrent();
+	
+	[self retain];
+	while(_scheduledCount && (((ScheduledMessage*)_scheduledMessages)->time <= now)) {
+		messages = _scheduledMessages;
+		message = messages[0];
+		_scheduledCount -= 1;
+		_scheduledBytes -= message.length;
+		memmove(&messages[0], &messages[1], _scheduledCount * sizeof(ScheduledMessage));
+		
+		[self _processBytes:message.bytes length:message.length timeTag:message.timeTag depth:0 time:now];
+		free(message.bytes);
 	}
+	if(_timer)
+	CFRunLoopTimerSetNextFireDate(_timer, _scheduledCount ? ((ScheduledMessage*)_scheduledMessages)->time : kDistantFuture);
+	[self release];
 }
 
 @end
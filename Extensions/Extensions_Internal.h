@@ -0,0 +1,53 @@
+/*
+	This file is part of the PolKit library.
+	Copyright (C) 2008-2009 Pierre-Olivier Latour <info@pol-online.net>
+	
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#import <Foundation/Foundation.h>
+
+/* Writes all the bytes to the stream - Returns NO on error or if the stream cannot accept more bytes */
+static inline BOOL _WriteToStream(NSOutputStream* stream, const void* bytes, NSUInteger length)
+{
+	NSInteger					result;
+	
+	while(length) {
+		result = [stream write:bytes maxLength:length]; //NOTE: Writing 0 bytes will close the stream
+		if(result <= 0)
+		return NO;
+		bytes = (const unsigned char*)bytes + result;
+		length -= result;
+	}
+	
+	return YES;
+}
+
+/* Returns less than "length" only at the end of the stream or -1 on error */
+static inline NSInteger _ReadFromStream(NSInputStream* stream, void* bytes, NSUInteger length)
+{
+	NSUInteger					offset = 0;
+	NSInteger					result;
+	
+	while(offset < length) {
+		result = [stream read:((unsigned char*)bytes + offset) maxLength:(length - offset)];
+		if(result < 0)
+		return -1;
+		if(result == 0)
+		break;
+		offset += result;
+	}
+	
+	return offset;
+}
@@ -47,7 +47,30 @@
 - (NSString*) encodeBase64;
 @end
 
+/* Same digests and ciphers as above (including the OpenSSL "Salted__" header) but computed on streams with constant memory usage - Streams must not be opened yet as they are opened and closed by these methods */
+@interface NSData (EncryptionStreaming)
++ (NSData*) md5DigestFromStream:(NSInputStream*)stream;
++ (NSData*) sha1DigestFromStream:(NSInputStream*)stream;
++ (NSData*) md5DigestOfFile:(NSString*)path;
++ (NSData*) sha1DigestOfFile:(NSString*)path;
+
++ (BOOL) encryptBlowfishFromStream:(NSInputStream*)inputStream toStream:(NSOutputStream*)outputStream password:(NSString*)password useSalt:(BOOL)flag;
++ (BOOL) decryptBlowfishFromStream:(NSInputStream*)inputStream toStream:(NSOutputStream*)outputStream password:(NSString*)password useSalt:(BOOL)flag;
++ (BOOL) encryptAES128FromStream:(NSInputStream*)inputStream toStream:(NSOutputStream*)outputStream password:(NSString*)password useSalt:(BOOL)flag;
++ (BOOL) decryptAES128FromStream:(NSInputStream*)inputStream toStream:(NSOutputStream*)outputStream password:(NSString*)password useSalt:(BOOL)flag;
++ (BOOL) encryptAES256FromStream:(NSInputStream*)inputStream toStream:(NSOutputStream*)outputStream password:(NSString*)password useSalt:(BOOL)flag;
++ (BOOL) decryptAES256FromStream:(NSInputStream*)inputStream toStream:(NSOutputStream*)outputStream password:(NSString*)password useSalt:(BOOL)flag;
+
+/* These overwrite any pre-existing file and delete it on failure */
++ (BOOL) encryptBlowfishFile:(NSString*)inPath toFile:(NSString*)outPath password:(NSString*)password useSalt:(BOOL)flag;
++ (BOOL) decryptBlowfishFile:(NSString*)inPath toFile:(NSString*)outPath password:(NSString*)password useSalt:(BOOL)flag;
++ (BOOL) encryptAES128File:(NSString*)inPath toFile:(NSString*)outPath password:(NSString*)password useSalt:(BOOL)flag;
++ (BOOL) decryptAES128File:(NSString*)inPath toFile:(NSString*)outPath password:(NSString*)password useSalt:(BOOL)flag;
++ (BOOL) encryptAES256File:(NSString*)inPath toFile:(NSString*)outPath password:(NSString*)password useSalt:(BOOL)flag;
++ (BOOL) decryptAES256File:(NSString*)inPath toFile:(NSString*)outPath password:(NSString*)password useSalt:(BOOL)flag;
+@end
+
 @interface NSString (Encryption)
-/* Equivalent to 'openssl base64 -d -in IN_FILE -out OUT_FILE' */
+/* Equivalent to 'openssl base64 -d -in IN_FILE -out OUT_FILE' - Whitespace is ignored and nil is returned if the string is not valid base64 */
 - (NSData*) decodeBase64;
 @end
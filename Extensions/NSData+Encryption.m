@@ -21,7 +21,11 @@
 #import <openssl/rand.h>
 #import <pthread.h>
 
+#import "Base64.h"
+#import "Extensions_Internal.h"
+
 #define kBufferSize				1024
+#define kStreamBufferSize		(256 * 1024)
 
 static pthread_mutex_t*			_opensslLocks = NULL;
 static const char				_magic[]="Salted__";
@@ -131,23 +135,7 @@ static NSData* _ComputeDigest(const EVP_MD* type, const void* bytes, NSUInteger
 	
 - (NSString*) encodeBase64
 {
-	NSString*					string;
-	char*						base64Pointer;
-	long						base64Length;
-	BIO*						mem;
-	BIO*						b64;
-	
-	mem = BIO_new(BIO_s_mem());
-	b64 = BIO_new(BIO_f_base64());
-	BIO_set_flags(b64, BIO_FLAGS_BASE64_NO_NL);
-	mem = BIO_push(b64, mem);
-	BIO_write(mem, [self bytes], [self length]);
-	(void)BIO_flush(mem);
-	base64Length = BIO_get_mem_data(mem, &base64Pointer);
-	string = [[NSString alloc] initWithBytes:base64Pointer length:base64Length encoding:NSASCIIStringEncoding];
-	BIO_free_all(mem);
-	
-	return [string autorelease];
+	return Base64EncodeData(self);
 }
 
 /* See apps/enc.c from OpenSSL source */
@@ -288,32 +276,209 @@ static NSData* _ComputeDigest(const EVP_MD* type, const void* bytes, NSUInteger
 
 - (NSData*) decodeBase64
 {
-	NSMutableData*				outData = [NSMutableData data];
-	NSData*						inData;
-	BIO*						mem;
-	BIO*						b64;
-	char						buffer[kBufferSize];
-	int							length;
+	return Base64DecodeString(self);
+}
+
+@end
+
+@implementation NSData (EncryptionStreaming)
+
+static NSData* _ComputeStreamDigest(const EVP_MD* type, NSInputStream* stream)
+{
+	NSData*						data = nil;
+	EVP_MD_CTX					context;
+	unsigned char				value[EVP_MAX_MD_SIZE];
+	unsigned int				size;
+	unsigned char*				buffer;
+	NSInteger					numBytes = -1;
 	
-	inData = [self dataUsingEncoding:NSASCIIStringEncoding];
-	if(inData == nil) {
-		[self release];
-		return nil;
+	if(stream == nil)
+	return nil;
+	if(EVP_DigestInit(&context, type) != 1)
+	return nil;
+	
+	[stream open];
+	if([stream streamStatus] == NSStreamStatusOpen) {
+		buffer = malloc(kStreamBufferSize);
+		while(1) {
+			numBytes = [stream read:buffer maxLength:kStreamBufferSize];
+			if(numBytes <= 0)
+			break;
+			if(EVP_DigestUpdate(&context, buffer, numBytes) != 1) {
+				numBytes = -1;
+				break;
+			}
+		}
+		free(buffer);
 	}
+	[stream close];
+	
+	if((numBytes == 0) && (EVP_DigestFinal(&context, value, &size) == 1))
+	data = [NSData dataWithBytes:value length:size];
+	else
+	EVP_MD_CTX_cleanup(&context);
+	
+	return data;
+}
+
+/* See apps/enc.c from OpenSSL source - The EVP interface automatically uses the hardware accelerated implementation of the cipher when available */
+static BOOL _CipherStream(const EVP_CIPHER* cipher, BOOL encrypt, NSString* password, BOOL salted, NSInputStream* inputStream, NSOutputStream* outputStream)
+{
+	NSData*						passwordData = [password dataUsingEncoding:NSUTF8StringEncoding];
+	BOOL						success = NO;
+	unsigned char				header[sizeof(_magic) - 1 + PKCS5_SALT_LEN];
+	unsigned char*				salt = header + sizeof(_magic) - 1;
+	unsigned char				keyBuffer[EVP_MAX_KEY_LENGTH];
+	unsigned char				ivBuffer[EVP_MAX_IV_LENGTH];
+	EVP_CIPHER_CTX				context;
+	unsigned char*				inBuffer;
+	unsigned char*				outBuffer;
+	NSInteger					numBytes;
+	int							outLength;
+	
+	if(!passwordData || !inputStream || !outputStream)
+	return NO;
 	
-	mem = BIO_new_mem_buf((void*)[inData bytes], [inData length]);
-	b64 = BIO_new(BIO_f_base64());
-	BIO_set_flags(b64, BIO_FLAGS_BASE64_NO_NL);
-	mem = BIO_push(b64, mem);
-	while(1) {
-		length = BIO_read(mem, buffer, kBufferSize);
-		if(length <= 0)
-		break;
-		[outData appendBytes:buffer length:length];
+	[inputStream open];
+	[outputStream open];
+	if(([inputStream streamStatus] == NSStreamStatusOpen) && ([outputStream streamStatus] == NSStreamStatusOpen)) {
+		if(salted) {
+			if(encrypt) {
+				bcopy(_magic, header, sizeof(_magic) - 1);
+				success = (RAND_pseudo_bytes(salt, PKCS5_SALT_LEN) == 1) && _WriteToStream(outputStream, header, sizeof(header));
+			}
+			else
+			success = (_ReadFromStream(inputStream, header, sizeof(header)) == sizeof(header)) && !memcmp(header, _magic, sizeof(_magic) - 1);
+		}
+		else
+		success = YES;
+		
+		if(success)
+		success = (EVP_BytesToKey(cipher, EVP_md5(), salted ? salt : NULL, [passwordData bytes], [passwordData length], 1, keyBuffer, ivBuffer) != 0);
+		
+		if(success) {
+			EVP_CIPHER_CTX_init(&context);
+			if(EVP_CipherInit(&context, cipher, keyBuffer, ivBuffer, encrypt) == 1) {
+				inBuffer = malloc(kStreamBufferSize);
+				outBuffer = malloc(kStreamBufferSize + EVP_MAX_BLOCK_LENGTH);
+				while(1) {
+					numBytes = [inputStream read:inBuffer maxLength:kStreamBufferSize];
+					if(numBytes < 0) {
+						success = NO;
+						break;
+					}
+					if(numBytes == 0) {
+						success = (EVP_CipherFinal(&context, outBuffer, &outLength) == 1) && _WriteToStream(outputStream, outBuffer, outLength);
+						break;
+					}
+					if((EVP_CipherUpdate(&context, outBuffer, &outLength, inBuffer, numBytes) != 1) || !_WriteToStream(outputStream, outBuffer, outLength)) {
+						success = NO;
+						break;
+					}
+				}
+				free(outBuffer);
+				free(inBuffer);
+			}
+			else
+			success = NO;
+			EVP_CIPHER_CTX_cleanup(&context);
+		}
 	}
-	BIO_free_all(mem);
+	[outputStream close];
+	[inputStream close];
 	
-	return outData; 
+	return success;
+}
+
+static BOOL _CipherFile(const EVP_CIPHER* cipher, BOOL encrypt, NSString* password, BOOL salted, NSString* inPath, NSString* outPath)
+{
+	BOOL						success;
+	
+	success = _CipherStream(cipher, encrypt, password, salted, [NSInputStream inputStreamWithFileAtPath:inPath], [NSOutputStream outputStreamToFileAtPath:outPath append:NO]);
+	if(success == NO)
+	unlink([outPath fileSystemRepresentation]);
+	
+	return success;
+}
+
++ (NSData*) md5DigestFromStream:(NSInputStream*)stream
+{
+	return _ComputeStreamDigest(EVP_md5(), stream);
+}
+
++ (NSData*) sha1DigestFromStream:(NSInputStream*)stream
+{
+	return _ComputeStreamDigest(EVP_sha1(), stream);
+}
+
++ (NSData*) md5DigestOfFile:(NSString*)path
+{
+	return _ComputeStreamDigest(EVP_md5(), [NSInputStream inputStreamWithFileAtPath:path]);
+}
+
++ (NSData*) sha1DigestOfFile:(NSString*)path
+{
+	return _ComputeStreamDigest(EVP_sha1(), [NSInputStream inputStreamWithFileAtPath:path]);
+}
+
++ (BOOL) encryptBlowfishFromStream:(NSInputStream*)inputStream toStream:(NSOutputStream*)outputStream password:(NSString*)password useSalt:(BOOL)flag
+{
+	return _CipherStream(EVP_bf_cbc(), YES, password, flag, inputStream, outputStream);
+}
+
++ (BOOL) decryptBlowfishFromStream:(NSInputStream*)inputStream toStream:(NSOutputStream*)outputStream password:(NSString*)password useSalt:(BOOL)flag
+{
+	return _CipherStream(EVP_bf_cbc(), NO, password, flag, inputStream, outputStream);
+}
+
++ (BOOL) encryptAES128FromStream:(NSInputStream*)inputStream toStream:(NSOutputStream*)outputStream password:(NSString*)password useSalt:(BOOL)flag
+{
+	return _CipherStream(EVP_aes_128_cbc(), YES, password, flag, inputStream, outputStream);
+}
+
++ (BOOL) decryptAES128FromStream:(NSInputStream*)inputStream toStream:(NSOutputStream*)outputStream password:(NSString*)password useSalt:(BOOL)flag
+{
+	return _CipherStream(EVP_aes_128_cbc(), NO, password, flag, inputStream, outputStream);
+}
+
++ (BOOL) encryptAES256FromStream:(NSInputStream*)inputStream toStream:(NSOutputStream*)outputStream password:(NSString*)password useSalt:(BOOL)flag
+{
+	return _CipherStream(EVP_aes_256_cbc(), YES, password, flag, inputStream, outputStream);
+}
+
++ (BOOL) decryptAES256FromStream:(NSInputStream*)inputStream toStream:(NSOutputStream*)outputStream password:(NSString*)password useSalt:(BOOL)flag
+{
+	return _CipherStream(EVP_aes_256_cbc(), NO, password, flag, inputStream, outputStream);
+}
+
++ (BOOL) encryptBlowfishFile:(NSString*)inPath toFile:(NSString*)outPath password:(NSString*)password useSalt:(BOOL)flag
+{
+	return _CipherFile(EVP_bf_cbc(), YES, password, flag, inPath, outPath);
+}
+
++ (BOOL) decryptBlowfishFile:(NSString*)inPath toFile:(NSString*)outPath password:(NSString*)password useSalt:(BOOL)flag
+{
+	return _CipherFile(EVP_bf_cbc(), NO, password, flag, inPath, outPath);
+}
+
++ (BOOL) encryptAES128File:(NSString*)inPath toFile:(NSString*)outPath password:(NSString*)password useSalt:(BOOL)flag
+{
+	return _CipherFile(EVP_aes_128_cbc(), YES, password, flag, inPath, outPath);
+}
+
++ (BOOL) decryptAES128File:(NSString*)inPath toFile:(NSString*)outPath password:(NSString*)password useSalt:(BOOL)flag
+{
+	return _CipherFile(EVP_aes_128_cbc(), NO, password, flag, inPath, outPath);
+}
+
++ (BOOL) encryptAES256File:(NSString*)inPath toFile:(NSString*)outPath password:(NSString*)password useSalt:(BOOL)flag
+{
+	return _CipherFile(EVP_aes_256_cbc(), YES, password, flag, inPath, outPath);
+}
+
++ (BOOL) decryptAES256File:(NSString*)inPath toFile:(NSString*)outPath password:(NSString*)password useSalt:(BOOL)flag
+{
+	return _CipherFile(EVP_aes_256_cbc(), NO, password, flag, inPath, outPath);
 }
 
 @end
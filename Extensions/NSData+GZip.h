@@ -19,9 +19,20 @@
 #import <Foundation/Foundation.h>
 
 @interface NSData (GZip)
-- (NSData*) compressGZip;
+- (NSData*) compressGZip; //Uses Z_BEST_COMPRESSION
+- (NSData*) compressGZipWithLevel:(int)level; //Pass Z_DEFAULT_COMPRESSION or a level in [Z_NO_COMPRESSION, Z_BEST_COMPRESSION] range
 - (NSData*) decompressGZip;
 
 - (id) initWithGZipFile:(NSString*)path;
 - (BOOL) writeToGZipFile:(NSString*)path;
 @end
+
+/* Streams must not be opened yet: they are opened and closed by these methods - Concatenated gzip members are decompressed as a single stream */
+/* In parallel mode, the input is split into blocks which are compressed independently on all available CPUs but still form a single standard gzip stream (like pigz) */
+@interface NSData (GZipStreaming)
++ (BOOL) compressGZipFromStream:(NSInputStream*)inputStream toStream:(NSOutputStream*)outputStream level:(int)level parallel:(BOOL)parallel;
++ (BOOL) decompressGZipFromStream:(NSInputStream*)inputStream toStream:(NSOutputStream*)outputStream;
+
++ (BOOL) compressGZipFile:(NSString*)inPath toFile:(NSString*)outPath level:(int)level parallel:(BOOL)parallel; //Overwrites any pre-existing file
++ (BOOL) decompressGZipFile:(NSString*)inPath toFile:(NSString*)outPath; //Overwrites any pre-existing file
+@end
@@ -17,55 +17,93 @@
 */
 
 #import <zlib.h>
+#import <pthread.h>
+#import <sys/sysctl.h>
 
 #import "NSData+GZip.h"
+#import "Extensions_Internal.h"
 
 #define kMemoryChunkSize		1024
 #define kFileChunkSize			(128 * 1024) //128Kb
+#define kMaxChunkSize			(1024 * 1024 * 1024) //NOTE: zlib lengths are 32 bits
+#define kParallelBlockSize		(512 * 1024)
+#define kParallelDictionarySize	32768 //Size of the deflate window
+#define kParallelBlocksPerCPU	4
+
+typedef struct {
+	int						level;
+	const unsigned char*	dictionary;
+	size_t					dictionaryLength;
+	const unsigned char*	input;
+	size_t					inputLength;
+	unsigned char*			output;
+	size_t					outputLength;
+	size_t					outputCapacity;
+	uLong					crc;
+	BOOL					last;
+	BOOL					failed;
+} GZipBlock;
+
+typedef struct {
+	pthread_mutex_t			mutex;
+	GZipBlock*				blocks;
+	NSUInteger				count;
+	NSUInteger				next;
+} GZipBlockQueue;
 
 @implementation NSData (GZip)
 
 - (NSData*) compressGZip
+{
+	return [self compressGZipWithLevel:Z_BEST_COMPRESSION];
+}
+
+- (NSData*) compressGZipWithLevel:(int)level
 {
 	NSUInteger		length = [self length];
 	int				windowBits = 15 + 16, //Default + gzip header instead of zlib header
 					memLevel = 8, //Default
 					retCode;
+	NSUInteger		inOffset = 0,
+					outOffset = 0;
 	NSMutableData*	result;
 	z_stream		stream;
-	unsigned char	output[kMemoryChunkSize];
-	uInt			gotBack;
+	uInt			available;
 	
-	if((length == 0) || (length > UINT_MAX)) //FIXME: Support 64 bit inputs
+	if(length == 0)
 	return nil;
-
-	bzero(&stream, sizeof(z_stream));
-	stream.avail_in = (uInt)length;
-	stream.next_in = (unsigned char*)[self bytes];
 	
-	retCode = deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, windowBits, memLevel, Z_DEFAULT_STRATEGY);
+	bzero(&stream, sizeof(z_stream));
+	retCode = deflateInit2(&stream, level, Z_DEFLATED, windowBits, memLevel, Z_DEFAULT_STRATEGY);
 	if(retCode != Z_OK) {
 		NSLog(@"%s: deflateInit2() failed with error %i", __FUNCTION__, retCode);
 		return nil;
 	}
 	
-	result = [NSMutableData dataWithCapacity:(length / 4)];
+	//NOTE: Compress directly into the result and feed zlib in chunks as its lengths are limited to 32 bits
+	result = [NSMutableData dataWithLength:MAX(length / 4, kMemoryChunkSize)];
 	do {
-		stream.avail_out = kMemoryChunkSize;
-		stream.next_out = output;
-		retCode = deflate(&stream, Z_FINISH);
-		if((retCode != Z_OK) && (retCode != Z_STREAM_END)) {
+		if((stream.avail_in == 0) && (inOffset < length)) {
+			stream.next_in = (unsigned char*)[self bytes] + inOffset;
+			stream.avail_in = (uInt)MIN(length - inOffset, kMaxChunkSize);
+			inOffset += stream.avail_in;
+		}
+		if(outOffset == [result length])
+		[result setLength:(2 * outOffset)];
+		stream.next_out = (unsigned char*)[result mutableBytes] + outOffset;
+		stream.avail_out = available = (uInt)MIN([result length] - outOffset, kMaxChunkSize);
+		retCode = deflate(&stream, (inOffset == length ? Z_FINISH : Z_NO_FLUSH));
+		if((retCode != Z_OK) && (retCode != Z_STREAM_END) && (retCode != Z_BUF_ERROR)) {
 			NSLog(@"%s: deflate() failed with error %i", __FUNCTION__, retCode);
 			deflateEnd(&stream);
 			return nil;
 		}
-		gotBack = kMemoryChunkSize - stream.avail_out;
-		if(gotBack > 0)
-		[result appendBytes:output length:gotBack];
-	} while(retCode == Z_OK);
+		outOffset += available - stream.avail_out;
+	} while(retCode != Z_STREAM_END);
 	deflateEnd(&stream);
+	[result setLength:outOffset];
 	
-	return (retCode == Z_STREAM_END ? result : nil);
+	return result;
 }
 
 - (NSData*) decompressGZip
@@ -73,13 +111,14 @@
 	NSUInteger		length = [self length];
 	int				windowBits = 15 + 16, //Default + gzip header instead of zlib header
 					retCode;
-	unsigned char	output[kMemoryChunkSize];
-	uInt			gotBack;
+	NSUInteger		inOffset = 0,
+					outOffset = 0;
 	NSMutableData*	result;
 	z_stream		stream;
+	uInt			available;
 	uLong			size;
 	
-	if((length == 0) || (length > UINT_MAX)) //FIXME: Support 64 bit inputs
+	if(length == 0)
 	return nil;
 	
 	//FIXME: Remove support for original implementation of -compressGZip which wasn't generating real gzip data 
@@ -92,32 +131,35 @@
 	}
 	
 	bzero(&stream, sizeof(z_stream));
-	stream.avail_in = (uInt)length;
-	stream.next_in = (unsigned char*)[self bytes];
-	
 	retCode = inflateInit2(&stream, windowBits);
 	if(retCode != Z_OK) {
 		NSLog(@"%s: inflateInit2() failed with error %i", __FUNCTION__, retCode);
 		return nil;
 	}
 	
-	result = [NSMutableData dataWithCapacity:(length * 4)];
+	result = [NSMutableData dataWithLength:MAX(length * 4, kMemoryChunkSize)];
 	do {
-		stream.avail_out = kMemoryChunkSize;
-		stream.next_out = output;
+		if((stream.avail_in == 0) && (inOffset < length)) {
+			stream.next_in = (unsigned char*)[self bytes] + inOffset;
+			stream.avail_in = (uInt)MIN(length - inOffset, kMaxChunkSize);
+			inOffset += stream.avail_in;
+		}
+		if(outOffset == [result length])
+		[result setLength:(2 * outOffset)];
+		stream.next_out = (unsigned char*)[result mutableBytes] + outOffset;
+		stream.avail_out = available = (uInt)MIN([result length] - outOffset, kMaxChunkSize);
 		retCode = inflate(&stream, Z_NO_FLUSH);
-		if ((retCode != Z_OK) && (retCode != Z_STREAM_END)) {
+		if(((retCode != Z_OK) && (retCode != Z_STREAM_END) && (retCode != Z_BUF_ERROR)) || ((retCode == Z_BUF_ERROR) && (stream.avail_in == 0) && (inOffset == length))) {
 			NSLog(@"%s: inflate() failed with error %i", __FUNCTION__, retCode);
 			inflateEnd(&stream);
 			return nil;
 		}
-		gotBack = kMemoryChunkSize - stream.avail_out;
-		if(gotBack > 0)
-		[result appendBytes:output length:gotBack];
-	} while(retCode == Z_OK);
+		outOffset += available - stream.avail_out;
+	} while(retCode != Z_STREAM_END);
 	inflateEnd(&stream);
+	[result setLength:outOffset];
 	
-	return (retCode == Z_STREAM_END ? result : nil);
+	return result;
 }
 
 - (id) initWithGZipFile:(NSString*)path
@@ -171,12 +213,19 @@
 	const char*		string = [path UTF8String];
 	BOOL			success = NO;
 	gzFile			file;
+	NSUInteger		offset,
+					length;
 	
 	file = gzopen(string, "w9f"); //Stategy is f, h or R - 9 is Z_BEST_COMPRESSION
 	if(file == NULL)
 	return NO;
 	
-	if(gzwrite(file, [self bytes], [self length]) == [self length])
+	for(offset = 0; offset < [self length]; offset += length) { //NOTE: gzwrite() lengths are 32 bits
+		length = MIN([self length] - offset, kMaxChunkSize);
+		if(gzwrite(file, (const char*)[self bytes] + offset, length) != length)
+		break;
+	}
+	if(offset >= [self length])
 	success = YES;
 	
 	gzclose(file);
@@ -188,3 +237,308 @@
 }
 
 @end
+
+@implementation NSData (GZipStreaming)
+
+static void _CompressBlock(GZipBlock* block)
+{
+	z_stream				stream;
+	int						retCode;
+	
+	bzero(&stream, sizeof(z_stream));
+	if(deflateInit2(&stream, block->level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) { //NOTE: Raw deflate data without header
+		block->failed = YES;
+		return;
+	}
+	
+	//NOTE: Priming with the end of the previous block keeps the compression ratio close to the one of a single stream
+	if(block->dictionaryLength)
+	deflateSetDictionary(&stream, block->dictionary, block->dictionaryLength);
+	stream.next_in = (unsigned char*)block->input;
+	stream.avail_in = block->inputLength;
+	stream.next_out = block->output;
+	stream.avail_out = block->outputCapacity;
+	
+	//NOTE: Non-final blocks end with a sync flush so they are byte aligned and can simply be concatenated
+	retCode = deflate(&stream, (block->last ? Z_FINISH : Z_SYNC_FLUSH));
+	block->failed = (block->last ? (retCode != Z_STREAM_END) : ((retCode != Z_OK) || stream.avail_in));
+	block->outputLength = block->outputCapacity - stream.avail_out;
+	deflateEnd(&stream);
+	
+	block->crc = crc32(crc32(0L, Z_NULL, 0), block->input, block->inputLength);
+}
+
+static void* _CompressionThread(void* arg)
+{
+	GZipBlockQueue*			queue = (GZipBlockQueue*)arg;
+	NSUInteger				index;
+	
+	while(1) {
+		pthread_mutex_lock(&queue->mutex);
+		index = queue->next++;
+		pthread_mutex_unlock(&queue->mutex);
+		if(index >= queue->count)
+		break;
+		
+		_CompressBlock(&queue->blocks[index]);
+	}
+	
+	return NULL;
+}
+
+static void _WriteLittleEndian32(unsigned char* bytes, uLong value)
+{
+	bytes[0] = value & 0xFF;
+	bytes[1] = (value >> 8) & 0xFF;
+	bytes[2] = (value >> 16) & 0xFF;
+	bytes[3] = (value >> 24) & 0xFF;
+}
+
++ (BOOL) _compressGZipFromStream:(NSInputStream*)inputStream toStream:(NSOutputStream*)outputStream level:(int)level
+{
+	BOOL					success = YES;
+	z_stream				stream;
+	unsigned char*			inBuffer;
+	unsigned char*			outBuffer;
+	NSInteger				numBytes;
+	int						flush,
+							retCode;
+	
+	bzero(&stream, sizeof(z_stream));
+	retCode = deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+	if(retCode != Z_OK) {
+		NSLog(@"%s: deflateInit2() failed with error %i", __FUNCTION__, retCode);
+		return NO;
+	}
+	
+	inBuffer = malloc(kFileChunkSize);
+	outBuffer = malloc(kFileChunkSize);
+	do {
+		numBytes = [inputStream read:inBuffer maxLength:kFileChunkSize];
+		if(numBytes < 0) {
+			success = NO;
+			break;
+		}
+		stream.next_in = inBuffer;
+		stream.avail_in = numBytes;
+		flush = (numBytes ? Z_NO_FLUSH : Z_FINISH);
+		do {
+			stream.next_out = outBuffer;
+			stream.avail_out = kFileChunkSize;
+			retCode = deflate(&stream, flush);
+			if((retCode == Z_STREAM_ERROR) || !_WriteToStream(outputStream, outBuffer, kFileChunkSize - stream.avail_out)) {
+				success = NO;
+				break;
+			}
+		} while(stream.avail_out == 0);
+	} while(success && (flush != Z_FINISH));
+	if(success && (retCode != Z_STREAM_END))
+	success = NO;
+	free(outBuffer);
+	free(inBuffer);
+	deflateEnd(&stream);
+	
+	return success;
+}
+
++ (BOOL) _compressGZipParallelFromStream:(NSInputStream*)inputStream toStream:(NSOutputStream*)outputStream level:(int)level
+{
+	static const unsigned char	header[10] = {0x1F, 0x8B, Z_DEFLATED, 0, 0, 0, 0, 0, 0, 3}; //No flags, no timestamp, Unix
+	BOOL					success = YES;
+	uLong					crc = crc32(0L, Z_NULL, 0);
+	unsigned long long		totalLength = 0;
+	size_t					dictionaryLength = 0;
+	int						cpuCount = 1;
+	size_t					size = sizeof(cpuCount);
+	NSUInteger				maxBlocks,
+							i;
+	unsigned char*			inBuffer;
+	GZipBlockQueue			queue;
+	GZipBlock*				block;
+	NSInteger				numBytes;
+	pthread_t*				threads;
+	unsigned char			trailer[8];
+	
+	if((sysctlbyname("hw.activecpu", &cpuCount, &size, NULL, 0) != 0) || (cpuCount < 1))
+	cpuCount = 1;
+	maxBlocks = cpuCount * kParallelBlocksPerCPU;
+	
+	if(!_WriteToStream(outputStream, header, sizeof(header)))
+	return NO;
+	
+	//NOTE: The input buffer starts with the window from the previous round followed by the blocks of the current round
+	inBuffer = malloc(kParallelDictionarySize + maxBlocks * kParallelBlockSize);
+	threads = malloc((cpuCount - 1) * sizeof(pthread_t) + 1);
+	bzero(&queue, sizeof(GZipBlockQueue));
+	pthread_mutex_init(&queue.mutex, NULL);
+	queue.blocks = calloc(maxBlocks, sizeof(GZipBlock));
+	for(i = 0; i < maxBlocks; ++i) {
+		queue.blocks[i].level = level;
+		queue.blocks[i].outputCapacity = compressBound(kParallelBlockSize) + 64;
+		queue.blocks[i].output = malloc(queue.blocks[i].outputCapacity);
+	}
+	
+	do {
+		for(queue.count = 0; queue.count < maxBlocks; ++queue.count) {
+			block = &queue.blocks[queue.count];
+			block->input = inBuffer + kParallelDictionarySize + queue.count * kParallelBlockSize;
+			numBytes = _ReadFromStream(inputStream, (unsigned char*)block->input, kParallelBlockSize);
+			if(numBytes < 0) {
+				success = NO;
+				break;
+			}
+			block->inputLength = numBytes;
+			block->dictionaryLength = (queue.count ? kParallelDictionarySize : dictionaryLength);
+			block->dictionary = block->input - block->dictionaryLength;
+			block->last = (numBytes < kParallelBlockSize);
+			block->failed = NO;
+			if(block->last) {
+				queue.count += 1;
+				break;
+			}
+		}
+		if(!success)
+		break;
+		
+		queue.next = 0;
+		for(i = 0; i < cpuCount - 1; ++i) {
+			if(pthread_create(&threads[i], NULL, _CompressionThread, &queue) != 0)
+			break;
+		}
+		_CompressionThread(&queue);
+		while(i > 0)
+		pthread_join(threads[--i], NULL);
+		
+		for(i = 0; i < queue.count; ++i) {
+			block = &queue.blocks[i];
+			if(block->failed || !_WriteToStream(outputStream, block->output, block->outputLength)) {
+				success = NO;
+				break;
+			}
+			crc = crc32_combine(crc, block->crc, block->inputLength);
+			totalLength += block->inputLength;
+		}
+		
+		block = &queue.blocks[queue.count - 1];
+		if(block->inputLength >= kParallelDictionarySize) {
+			bcopy(block->input + block->inputLength - kParallelDictionarySize, inBuffer, kParallelDictionarySize);
+			dictionaryLength = kParallelDictionarySize;
+		}
+		else
+		dictionaryLength = 0; //NOTE: Only happens on the last round
+	} while(success && !block->last);
+	
+	for(i = 0; i < maxBlocks; ++i)
+	free(queue.blocks[i].output);
+	free(queue.blocks);
+	pthread_mutex_destroy(&queue.mutex);
+	free(threads);
+	free(inBuffer);
+	
+	if(success) {
+		_WriteLittleEndian32(trailer, crc);
+		_WriteLittleEndian32(trailer + 4, totalLength & 0xFFFFFFFF); //NOTE: The gzip format stores the length modulo 2^32
+		success = _WriteToStream(outputStream, trailer, sizeof(trailer));
+	}
+	
+	return success;
+}
+
++ (BOOL) compressGZipFromStream:(NSInputStream*)inputStream toStream:(NSOutputStream*)outputStream level:(int)level parallel:(BOOL)parallel
+{
+	BOOL					success = NO;
+	
+	if(!inputStream || !outputStream)
+	return NO;
+	
+	[inputStream open];
+	[outputStream open];
+	if(([inputStream streamStatus] == NSStreamStatusOpen) && ([outputStream streamStatus] == NSStreamStatusOpen)) {
+		if(parallel)
+		success = [self _compressGZipParallelFromStream:inputStream toStream:outputStream level:level];
+		else
+		success = [self _compressGZipFromStream:inputStream toStream:outputStream level:level];
+	}
+	[outputStream close];
+	[inputStream close];
+	
+	return success;
+}
+
++ (BOOL) decompressGZipFromStream:(NSInputStream*)inputStream toStream:(NSOutputStream*)outputStream
+{
+	BOOL					success = YES;
+	z_stream				stream;
+	unsigned char*			inBuffer;
+	unsigned char*			outBuffer;
+	NSInteger				numBytes;
+	int						retCode = Z_OK;
+	
+	if(!inputStream || !outputStream)
+	return NO;
+	
+	bzero(&stream, sizeof(z_stream));
+	retCode = inflateInit2(&stream, 15 + 16);
+	if(retCode != Z_OK) {
+		NSLog(@"%s: inflateInit2() failed with error %i", __FUNCTION__, retCode);
+		return NO;
+	}
+	
+	[inputStream open];
+	[outputStream open];
+	if(([inputStream streamStatus] == NSStreamStatusOpen) && ([outputStream streamStatus] == NSStreamStatusOpen)) {
+		inBuffer = malloc(kFileChunkSize);
+		outBuffer = malloc(kFileChunkSize);
+		while(success) {
+			numBytes = [inputStream read:inBuffer maxLength:kFileChunkSize];
+			if(numBytes <= 0) {
+				success = ((numBytes == 0) && (retCode == Z_STREAM_END));
+				break;
+			}
+			stream.next_in = inBuffer;
+			stream.avail_in = numBytes;
+			do {
+				if(retCode == Z_STREAM_END) //NOTE: Another gzip member follows
+				inflateReset(&stream);
+				stream.next_out = outBuffer;
+				stream.avail_out = kFileChunkSize;
+				retCode = inflate(&stream, Z_NO_FLUSH);
+				if(((retCode != Z_OK) && (retCode != Z_STREAM_END) && (retCode != Z_BUF_ERROR)) || !_WriteToStream(outputStream, outBuffer, kFileChunkSize - stream.avail_out))
+				success = NO;
+			} while(success && (stream.avail_in || ((stream.avail_out == 0) && (retCode != Z_STREAM_END))));
+		}
+		free(outBuffer);
+		free(inBuffer);
+	}
+	else
+	success = NO;
+	[outputStream close];
+	[inputStream close];
+	inflateEnd(&stream);
+	
+	return success;
+}
+
++ (BOOL) compressGZipFile:(NSString*)inPath toFile:(NSString*)outPath level:(int)level parallel:(BOOL)parallel
+{
+	BOOL					success;
+	
+	success = [self compressGZipFromStream:[NSInputStream inputStreamWithFileAtPath:inPath] toStream:[NSOutputStream outputStreamToFileAtPath:outPath append:NO] level:level parallel:parallel];
+	if(success == NO)
+	unlink([outPath fileSystemRepresentation]);
+	
+	return success;
+}
+
++ (BOOL) decompressGZipFile:(NSString*)inPath toFile:(NSString*)outPath
+{
+	BOOL					success;
+	
+	success = [self decompressGZipFromStream:[NSInputStream inputStreamWithFileAtPath:inPath] toStream:[NSOutputStream outputStreamToFileAtPath:outPath append:NO]];
+	if(success == NO)
+	unlink([outPath fileSystemRepresentation]);
+	
+	return success;
+}
+
+@end
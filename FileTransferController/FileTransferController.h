@@ -81,6 +81,19 @@
 										_maxDownloadSpeed;
 	BOOL								_fileTransfer;
 	double								_maxSpeed;
+	BOOL								_compressionEnabled;
+	void*								_compressionContext;
+	void*								_compressionBufferBytes;
+	BOOL								_compressionInflating,
+										_compressionInputEnded,
+										_compressionFinished;
+	NSUInteger							_compressionSourceLength;
+	NSInvocation*						_asyncInvocation;
+	NSThread*							_asyncThread;
+	NSStream*							_asyncStream;
+	NSString*							_asyncPath;
+	NSTimeInterval						_listingCacheTimeOut;
+	NSMutableDictionary*				_listingCache;
 }
 + (FileTransferController*) fileTransferControllerWithURL:(NSURL*)url;
 + (BOOL) hasAtomicUploads; //Means that a file that failed mid-upload won't appear on the server (e.g. WebDAV)
@@ -108,16 +121,19 @@
 @property(nonatomic) BOOL digestComputation; //Enables on-the-fly MD5 digest computation for file uploads / downloads
 @property(nonatomic, copy) NSString* encryptionPassword; //Enables on-the-fly AES-256 encryption / decryption for file uploads / downloads if not nil (use 'openssl aes-256-cbc -d -k PASSWORD -nosalt -in IN_FILE -out OUT_FILE' to decrypt an uploaded file)
 #endif
+@property(nonatomic) BOOL compressionEnabled; //Enables on-the-fly gzip compression / decompression for file uploads / downloads (compression happens before encryption and the digest is computed on the uncompressed data) - Compressed uploads have an unknown length so the server must accept that (use 'gunzip' to decompress an uploaded file)
 
 @property(nonatomic) NSTimeInterval timeOut; //In seconds - 0 means default
 @property(nonatomic) NSUInteger maximumDownloadSpeed; //In bytes per second - 0 means unlimited
 @property(nonatomic) NSUInteger maximumUploadSpeed; //In bytes per second - 0 means unlimited
+@property(nonatomic) NSTimeInterval listingCacheTimeOut; //In seconds - 0 (the default) disables caching of the results of -contentsOfDirectoryAtPath: - Cached listings are invalidated by the controller's own modifications but not by changes made by other clients (expired WebDAV listings are revalidated once using the directory ETag if available before being fetched again)
 
 - (NSString*) absolutePathForRemotePath:(NSString*)path;
 - (NSURL*) absoluteURLForRemotePath:(NSString*)path; //Returned URL does not contain user or password
 - (NSURL*) fullAbsoluteURLForRemotePath:(NSString*)path;
 
 - (BOOL) checkReachability;
+- (void) invalidateListingCache;
 @end
 
 @interface FileTransferController (Extensions)
@@ -134,6 +150,22 @@
 - (BOOL) uploadFileFromBytes:(const void*)buffer length:(NSUInteger)length toPath:(NSString*)remotePath; //Overwrites any pre-existing file
 @end
 
+/* Asynchronous transfers return immediately and call the target on the calling thread once done, so that thread must run its run loop in the default mode */
+/* Stream based controllers multiplex their transfers on a single shared I/O thread (unless a speed limit applies) while the others run each transfer on a thread of its own - Delegate methods are called on that thread */
+/* Only one asynchronous transfer can be in progress per controller and no other method must be called on it until the transfer has completed */
+@interface FileTransferController (Asynchronous)
+- (BOOL) downloadFileFromPath:(NSString*)remotePath toStream:(NSOutputStream*)stream target:(id)target selector:(SEL)selector context:(void*)context; //Selector must be of the form "- (void) fileTransferController:(FileTransferController*)controller didCompleteTransfer:(BOOL)success context:(void*)context" - Returns NO if the transfer could not be started
+- (BOOL) uploadFileToPath:(NSString*)remotePath fromStream:(NSInputStream*)stream length:(NSUInteger)length target:(id)target selector:(SEL)selector context:(void*)context; //Pass 0 if length is unknown
+- (BOOL) downloadFileFromPath:(NSString*)remotePath toPath:(NSString*)localPath target:(id)target selector:(SEL)selector context:(void*)context; //Overwrites any pre-existing file
+- (BOOL) uploadFileFromPath:(NSString*)localPath toPath:(NSString*)remotePath target:(id)target selector:(SEL)selector context:(void*)context; //Overwrites any pre-existing file
+@property(nonatomic, readonly, getter=isTransferringAsynchronously) BOOL transferringAsynchronously;
+@end
+
+/* Delta transfers are only supported by LocalTransferController and SFTPTransferController: other classes always perform a regular upload */
+@interface FileTransferController (DeltaTransfer)
+- (BOOL) uploadFileFromPath:(NSString*)localPath toPath:(NSString*)remotePath signatureCachePath:(NSString*)cachePath; //Only sends the blocks that differ from the remote file if a signature for it is available (from the cache directory or by reading it directly) - Pass nil for no cache
+@end
+
 /* Abstract class: do not instantiate directly */
 @interface StreamTransferController : FileTransferController
 {
@@ -145,6 +177,10 @@
 	id									_dataStream;
 	id									_userInfo;
 	id									_result;
+	BOOL								_asyncStreaming,
+										_silent;
+	CFRunLoopTimerRef					_asyncTimer;
+	CFAbsoluteTime						_lastActivityTime;
 }
 @end
 
@@ -184,9 +220,17 @@
 	BOOL								_disableSSLCertificates,
 										_keepAlive,
 										_hasShouldAbort;
+	NSString*							_slotKey;
+	NSString*							_asyncSlotKey;
+	CFRunLoopTimerRef					_slotWaitTimer;
+	CFAbsoluteTime						_slotWaitTime;
 }
++ (NSUInteger) maximumPersistentConnectionsPerHost; //4 by default - 0 means unlimited
++ (void) setMaximumPersistentConnectionsPerHost:(NSUInteger)max;
++ (NSTimeInterval) persistentConnectionIdleTimeOut; //In seconds - 30 by default
++ (void) setPersistentConnectionIdleTimeOut:(NSTimeInterval)timeOut;
 @property(nonatomic, getter=isSSLCertificateValidationDisabled) BOOL SSLCertificateValidationDisabled;
-@property(nonatomic) BOOL keepConnectionAlive; //NO by default
+@property(nonatomic) BOOL keepConnectionAlive; //NO by default - The number of persistent connections in use is limited per scheme, host and port across all HTTP controllers in the process which also share the same proxy and SSL settings so that CFNetwork can reuse idle connections
 - (NSURL*) finalURLForPath:(NSString*)remotePath;
 @end
 
@@ -216,6 +260,8 @@
 	NSString*							_productToken;
 	NSString*							_userToken;
 	NSString*							_newBucketLocation;
+	NSUInteger							_multipartPartSize;
+	NSUInteger							_multipartConcurrency;
 }
 + (NSDictionary*) activateDesktopProduct:(NSString*)productToken activationKey:(NSString*)activationKey expirationInterval:(NSTimeInterval)expirationInterval error:(NSError**)error; //Returns kAmazonS3ActivationInfo_XXX keys
 + (BOOL) isBucketNameValid:(NSString*)name;
@@ -223,8 +269,11 @@
 @property(nonatomic, copy) NSString* productToken; //Must start with "{ProductToken}"
 @property(nonatomic, copy) NSString* userToken; //Must start with "{UserToken}"
 @property(nonatomic, copy) NSString* newBucketLocation; //One of kAmazonS3BucketLocation_XXX or nil for default
+@property(nonatomic) NSUInteger multipartUploadPartSize; //0 by default (multipart uploads disabled except for compressed uploads which use 5 MB parts) - Must be at least 5 MB otherwise
+@property(nonatomic) NSUInteger multipartUploadConcurrency; //Number of parts uploaded in parallel - 4 by default
 - (NSString*) locationForPath:(NSString*)remotePath; //Return nil on error or empty string for default location
 - (NSDictionary*) bucketKeysForPath:(NSString*)remotePath withPrefix:(NSString*)prefix marker:(NSString*)marker delimiter:(NSString*)delimiter maxKeys:(NSUInteger)max isTruncated:(BOOL*)truncated;
+- (BOOL) enumerateBucketKeysForPath:(NSString*)remotePath withPrefix:(NSString*)prefix delimiter:(NSString*)delimiter target:(id)target selector:(SEL)selector context:(void*)context; //Selector must be of the form "- (BOOL) bucketKeys:(NSDictionary*)keys context:(void*)context" and is called for each page of keys as it is received - Return NO to stop the enumeration
 @end
 
 /* Same as AmazonS3TransferController */
@@ -242,9 +291,26 @@
 	NSStringEncoding					_stringEncoding;
 	BOOL								_keepAlive;
 	id									_transcript;
+	void*								_multi;
+	void**								_multiHandles;
+	NSUInteger							_multiHandleCount;
+	NSUInteger							_maxConnections;
+	BOOL								_noMachineListing;
 }
 @property(nonatomic) NSStringEncoding stringEncoding; //ISO Latin 1 by default
 @property(nonatomic) BOOL keepConnectionAlive; //NO by default
+@property(nonatomic) NSUInteger maximumConcurrentConnections; //4 by default - Only used by batch operations
+- (BOOL) enumerateContentsOfDirectoryAtPath:(NSString*)remotePath target:(id)target selector:(SEL)selector context:(void*)context; //Selector must be of the form "- (BOOL) directoryEntry:(NSString*)name attributes:(NSDictionary*)attributes context:(void*)context" and is called for each entry as the listing is received without collecting the whole listing - Return NO to stop the listing - Bypasses the listing cache
+@end
+
+/* Batch operations run concurrently over a pool of control connections and stop issuing new commands after the first failure - The delegate receives a single start and succeed / fail notification for the whole batch */
+/* Digest computation and encryption are not supported by concurrent transfers: if either is enabled, files are transferred one at a time - Speed limits are ignored */
+@interface FTPTransferController (Batch)
+- (BOOL) uploadFilesFromPaths:(NSArray*)localPaths toPaths:(NSArray*)remotePaths; //Creates missing intermediary remote directories
+- (BOOL) downloadFilesFromPaths:(NSArray*)remotePaths toPaths:(NSArray*)localPaths; //Overwrites any pre-existing files
+- (BOOL) deleteFilesAtPaths:(NSArray*)remotePaths;
+- (BOOL) createDirectoriesAtPaths:(NSArray*)remotePaths; //Parent directories must already exist as commands run concurrently
+- (BOOL) movePaths:(NSArray*)fromRemotePaths toPaths:(NSArray*)toRemotePaths;
 @end
 
 /* Supports everything except copy - Always use passive mode */
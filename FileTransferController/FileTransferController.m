@@ -23,19 +23,37 @@
 #import <openssl/evp.h>
 #endif
 #import <libkern/OSAtomic.h>
+#import <pthread.h>
+#import <poll.h>
 #import <SystemConfiguration/SystemConfiguration.h>
 #import <arpa/inet.h>
+#import <CommonCrypto/CommonDigest.h>
+#import <zlib.h>
 
 #import "FileTransferController_Internal.h"
 #import "NSURL+Parameters.h"
 #import "DataStream.h"
+#import "Extensions_Internal.h"
 
 #define kFileTransferRunLoopActiveMode	CFSTR("FileTransferActiveMode")
+#define kFileTransferRunLoopSharedMode	kCFRunLoopDefaultMode
 #define kStreamBufferSize				(256 * 1024)
 #define kRunLoopInterval				1.0
+#define kStreamOpenPollInterval			10000 //In microseconds
+#define kDeltaMinBlockSize				(2 * 1024)
+#define kDeltaMaxBlockSize				(128 * 1024)
+#define kDeltaHashSize					65536
+#define kDeltaSignatureMagic			0x44454C54
+#define kDeltaCacheKey_Size				@"size"
+#define kDeltaCacheKey_Date				@"date"
+#define kDeltaCacheKey_Signature		@"signature"
+#define kListingCacheKey_Contents		@"contents"
+#define kListingCacheKey_Time			@"time"
+#define kListingCacheKey_Validator		@"validator"
+#define kCompressionLevel				Z_DEFAULT_COMPRESSION
+#define kCompressionWindowBits			(15 + 16) //NOTE: Adding 16 selects the gzip format instead of zlib
 #if !TARGET_OS_IPHONE
 #define kEncryptionCipher				EVP_aes_256_cbc()
-#define kEncryptionCipherBlockSize		16
 #define kDigestType						EVP_md5()
 #endif
 
@@ -44,20 +62,94 @@ typedef struct {
 	NSUInteger							size;
 } DataInfo;
 
+typedef struct {
+	UInt32								magic;
+	UInt32								blockSize;
+	UInt32								blockCount;
+} DeltaSignatureHeader;
+
+typedef struct {
+	UInt32								weak;
+	unsigned char						strong[16];
+} DeltaSignatureBlock;
+
 static NSUInteger						_maximumDownloadSpeed = 0,
 										_maximumUploadSpeed = 0;
 static OSSpinLock						_downloadLock = 0,
 										_uploadLock = 0;
 static CFTimeInterval					_downloadTime = 0.0,
 										_uploadTime = 0.0;
+static NSThread*						_ioThread = nil;
+static pthread_mutex_t					_ioThreadMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t					_ioThreadCondition = PTHREAD_COND_INITIALIZER;
 
 #define MAKE_IPV4(A, B, C, D) ((((UInt32)A) << 24) | (((UInt32)B) << 16) | (((UInt32)C) << 8) | ((UInt32)D))
 
 #define IS_REACHABLE(__FLAGS__) (((__FLAGS__) & kSCNetworkFlagsReachable) && !((__FLAGS__) & kSCNetworkFlagsConnectionRequired))
 
+#define DELTA_HASH(__WEAK__) (((__WEAK__) ^ ((__WEAK__) >> 16)) & (kDeltaHashSize - 1))
+
+/* Same weak checksum as rsync: the low 16 bits are the sum of the bytes and the high 16 bits the sum of the partial sums */
+static inline UInt32 _DeltaWeakChecksum(const unsigned char* bytes, NSUInteger length, UInt32* a, UInt32* b)
+{
+	NSUInteger				i;
+	
+	*a = 0;
+	*b = 0;
+	for(i = 0; i < length; ++i) {
+		*a += bytes[i];
+		*b += (length - i) * bytes[i];
+	}
+	
+	return (*a & 0xFFFF) | (*b << 16);
+}
+
+/* Uses a block size around the square root of the file length like rsync does */
+static NSUInteger _DeltaBlockSizeForLength(NSUInteger length)
+{
+	NSUInteger				blockSize = (NSUInteger)sqrt((double)length);
+	
+	blockSize = (blockSize + 1023) & ~1023;
+	
+	return MIN(MAX(blockSize, kDeltaMinBlockSize), kDeltaMaxBlockSize);
+}
+
+static void _DeltaComputeDigest(const unsigned char* bytes, NSUInteger length, unsigned char digest[16])
+{
+	CC_MD5_CTX				context;
+	NSUInteger				size;
+	
+	CC_MD5_Init(&context);
+	while(length) {
+		size = MIN(length, kStreamBufferSize);
+		CC_MD5_Update(&context, bytes, size);
+		bytes += size;
+		length -= size;
+	}
+	CC_MD5_Final(digest, &context);
+}
+
+static void _DeltaAppendOperation(NSMutableData* data, BOOL copy, NSUInteger offset, NSUInteger length)
+{
+	DeltaOperation*			last = ([data length] ? (DeltaOperation*)((char*)[data mutableBytes] + [data length] - sizeof(DeltaOperation)) : NULL);
+	DeltaOperation			operation;
+	
+	if(length == 0)
+	return;
+	
+	if(last && (last->copy == copy) && (last->offset + last->length == offset))
+	last->length += length;
+	else {
+		operation.copy = copy;
+		operation.offset = offset;
+		operation.length = length;
+		[data appendBytes:&operation length:sizeof(DeltaOperation)];
+	}
+}
+
 @implementation FileTransferController
 
-@synthesize baseURL=_baseURL, delegate=_delegate, localHost=_localHost, maxLength=_maxLength, currentLength=_currentLength, timeOut=_timeOut, maximumDownloadSpeed=_maxDownloadSpeed, maximumUploadSpeed=_maxUploadSpeed;
+@synthesize baseURL=_baseURL, delegate=_delegate, localHost=_localHost, maxLength=_maxLength, currentLength=_currentLength, timeOut=_timeOut, maximumDownloadSpeed=_maxDownloadSpeed, maximumUploadSpeed=_maxUploadSpeed, compressionEnabled=_compressionEnabled, listingCacheTimeOut=_listingCacheTimeOut;
 #if !TARGET_OS_IPHONE
 @synthesize digestComputation=_digestComputation, encryptionPassword=_encryptionPassword;
 #endif
@@ -220,6 +312,7 @@ static CFTimeInterval					_downloadTime = 0.0,
 #if !TARGET_OS_IPHONE
 	[_encryptionPassword release];
 #endif
+	[_listingCache release];
 	[_baseURL release];
 	
 	[super dealloc];
@@ -233,6 +326,10 @@ static CFTimeInterval					_downloadTime = 0.0,
 
 - (void) setCurrentLength:(NSUInteger)length
 {
+	//NOTE: The transfer size of a compressed upload is the source length so progress must be measured in source bytes instead of transferred ones
+	if(_compressionContext && !_compressionInflating)
+	length = _compressionSourceLength;
+	
 	if((_maxLength > 0) && (length != _currentLength)) {
 		_currentLength = length;
 		if([_delegate respondsToSelector:@selector(fileTransferControllerDidUpdateProgress:)])
@@ -250,11 +347,28 @@ static CFTimeInterval					_downloadTime = 0.0,
 	return (_maxLength > 0 ? MIN((float)_currentLength / (float)_maxLength, 1.0) : NAN);
 }
 
+- (NSUInteger) _maxLengthForSourceLength:(NSUInteger)length
+{
+	if(_compressionEnabled)
+	return length;
+#if !TARGET_OS_IPHONE
+	if(_encryptionPassword)
+	length = (length / kEncryptionCipherBlockSize + 1) * kEncryptionCipherBlockSize;
+#endif
+	
+	return length;
+}
+
 - (NSUInteger) lastTransferSize
 {
 	return _totalSize;
 }
 
+- (void) setLastTransferSize:(NSUInteger)size
+{
+	_totalSize = size;
+}
+
 #if !TARGET_OS_IPHONE
 
 - (NSData*) lastTransferDigestData
@@ -341,13 +455,177 @@ static CFTimeInterval					_downloadTime = 0.0,
 
 - (BOOL) uploadFileToPath:(NSString*)remotePath fromStream:(NSInputStream*)stream
 {
-	BOOL						result = [self _uploadFileToPath:remotePath fromStream:stream];
+	BOOL						result;
+	
+	[self invalidateCachedContentsForPath:remotePath];
+	result = [self _uploadFileToPath:remotePath fromStream:stream];
 	
 	[self setMaxLength:0];
 	
 	return result;
 }
 
+- (NSDictionary*) _attributesForDeltaTransferAtPath:(NSString*)remotePath
+{
+	return nil;
+}
+
+- (NSData*) _copyDeltaSignatureForPath:(NSString*)remotePath blockSize:(NSUInteger)blockSize
+{
+	return nil;
+}
+
+- (BOOL) _applyDeltaOperations:(const DeltaOperation*)operations count:(NSUInteger)count fromBytes:(const void*)bytes length:(NSUInteger)length digest:(const unsigned char*)digest toPath:(NSString*)remotePath
+{
+	[self doesNotRecognizeSelector:_cmd];
+	return NO;
+}
+
+- (NSData*) _deltaSignatureForBytes:(const void*)bytes length:(NSUInteger)length blockSize:(NSUInteger)blockSize
+{
+	NSMutableData*				data;
+	DeltaSignatureHeader*		header;
+	DeltaSignatureBlock*		block;
+	NSUInteger					i;
+	UInt32						a,
+								b;
+	
+	if(blockSize == 0)
+	return nil;
+	
+	data = [NSMutableData dataWithLength:(sizeof(DeltaSignatureHeader) + length / blockSize * sizeof(DeltaSignatureBlock))];
+	header = (DeltaSignatureHeader*)[data mutableBytes];
+	header->magic = kDeltaSignatureMagic;
+	header->blockSize = blockSize;
+	header->blockCount = length / blockSize;
+	
+	block = (DeltaSignatureBlock*)(header + 1);
+	for(i = 0; i < header->blockCount; ++i, ++block) {
+		block->weak = _DeltaWeakChecksum((const unsigned char*)bytes + i * blockSize, blockSize, &a, &b);
+		CC_MD5((const unsigned char*)bytes + i * blockSize, blockSize, block->strong);
+	}
+	
+	return data;
+}
+
+/* Applies the same per-instance and global upload speed limits as -readFromInputStream:bytes:maxLength: */
+- (void) _limitUploadSpeedForLength:(NSUInteger)length startTime:(CFAbsoluteTime)time
+{
+	CFTimeInterval				dTime = 0.0;
+	
+	if((length == 0) || [self isLocalHost])
+	return;
+	
+	if(_maxUploadSpeed)
+	dTime = (double)length / (double)_maxUploadSpeed - (CFAbsoluteTimeGetCurrent() - time);
+	else if(_maximumUploadSpeed) {
+		OSSpinLockLock(&_uploadLock);
+		_uploadTime = MAX(_uploadTime, time) + (double)length / (double)_maximumUploadSpeed;
+		dTime = _uploadTime - CFAbsoluteTimeGetCurrent();
+		OSSpinLockUnlock(&_uploadLock);
+	}
+	if(dTime > 0.0)
+	usleep(dTime * 1000000.0);
+}
+
+/* Returns nil if the signature is invalid */
+- (NSData*) _deltaOperationsForBytes:(const unsigned char*)bytes length:(NSUInteger)length signature:(NSData*)signature
+{
+	const DeltaSignatureHeader*	header = (const DeltaSignatureHeader*)[signature bytes];
+	NSMutableData*				data;
+	const DeltaSignatureBlock*	blocks;
+	NSUInteger					blockSize,
+								offset,
+								literalOffset,
+								expected,
+								i;
+	NSInteger*					heads;
+	NSInteger*					next;
+	NSInteger					index,
+								match;
+	unsigned char				strong[16];
+	BOOL						hasStrong;
+	UInt32						weak = 0,
+								a = 0,
+								b = 0;
+	
+	if(([signature length] < sizeof(DeltaSignatureHeader)) || (header->magic != kDeltaSignatureMagic) || (header->blockSize == 0)
+		|| ([signature length] != sizeof(DeltaSignatureHeader) + header->blockCount * sizeof(DeltaSignatureBlock)))
+	return nil;
+	blockSize = header->blockSize;
+	blocks = (const DeltaSignatureBlock*)(header + 1);
+	
+	data = [NSMutableData data];
+	if(header->blockCount == 0) {
+		_DeltaAppendOperation(data, NO, 0, length);
+		return data;
+	}
+	
+	heads = malloc(kDeltaHashSize * sizeof(NSInteger));
+	next = malloc(header->blockCount * sizeof(NSInteger));
+	for(i = 0; i < kDeltaHashSize; ++i)
+	heads[i] = -1;
+	for(i = header->blockCount; i > 0; --i) {
+		next[i - 1] = heads[DELTA_HASH(blocks[i - 1].weak)];
+		heads[DELTA_HASH(blocks[i - 1].weak)] = i - 1;
+	}
+	
+	offset = 0;
+	literalOffset = 0;
+	expected = 0;
+	weak = (length >= blockSize ? _DeltaWeakChecksum(bytes, blockSize, &a, &b) : 0);
+	while(offset + blockSize <= length) {
+		match = -1;
+		hasStrong = NO;
+		
+		//NOTE: Try the block following the previous match first so that unchanged runs stay contiguous
+		if((expected < header->blockCount) && (blocks[expected].weak == weak)) {
+			CC_MD5(bytes + offset, blockSize, strong);
+			hasStrong = YES;
+			if(!memcmp(strong, blocks[expected].strong, 16))
+			match = expected;
+		}
+		if(match < 0) {
+			for(index = heads[DELTA_HASH(weak)]; index >= 0; index = next[index]) {
+				if(blocks[index].weak != weak)
+				continue;
+				if(!hasStrong) {
+					CC_MD5(bytes + offset, blockSize, strong);
+					hasStrong = YES;
+				}
+				if(!memcmp(strong, blocks[index].strong, 16)) {
+					match = index;
+					break;
+				}
+			}
+		}
+		
+		if(match >= 0) {
+			_DeltaAppendOperation(data, NO, literalOffset, offset - literalOffset);
+			_DeltaAppendOperation(data, YES, match * blockSize, blockSize);
+			offset += blockSize;
+			literalOffset = offset;
+			expected = match + 1;
+			if(offset + blockSize <= length)
+			weak = _DeltaWeakChecksum(bytes + offset, blockSize, &a, &b);
+		}
+		else {
+			if(offset + blockSize < length) {
+				a = a - bytes[offset] + bytes[offset + blockSize];
+				b = b - blockSize * bytes[offset] + a;
+				weak = (a & 0xFFFF) | (b << 16);
+			}
+			offset += 1;
+		}
+	}
+	_DeltaAppendOperation(data, NO, literalOffset, length - literalOffset);
+	
+	free(next);
+	free(heads);
+	
+	return data;
+}
+
 #if !TARGET_OS_IPHONE
 
 - (BOOL) _createDigestContext
@@ -412,14 +690,126 @@ static CFTimeInterval					_downloadTime = 0.0,
 
 #endif
 
+- (BOOL) _createCompressionContext:(BOOL)decompress
+{
+	z_stream*					zStream;
+	
+	if(_compressionEnabled) {
+		zStream = calloc(1, sizeof(z_stream));
+		if((decompress ? inflateInit2(zStream, kCompressionWindowBits) : deflateInit2(zStream, kCompressionLevel, Z_DEFLATED, kCompressionWindowBits, 8, Z_DEFAULT_STRATEGY)) != Z_OK) {
+			free(zStream);
+			return NO;
+		}
+		
+		_compressionContext = zStream;
+		_compressionBufferBytes = malloc(kStreamBufferSize);
+		_compressionInflating = decompress;
+		_compressionInputEnded = NO;
+		_compressionFinished = NO;
+		_compressionSourceLength = 0;
+	}
+	
+	return YES;
+}
+
+- (void) _destroyCompressionContext
+{
+	if(_compressionContext) {
+		if(_compressionInflating)
+		inflateEnd(_compressionContext);
+		else
+		deflateEnd(_compressionContext);
+		free(_compressionContext);
+		_compressionContext = NULL;
+		free(_compressionBufferBytes);
+	}
+}
+
+/* Inflates the data and writes the result to the stream, updating the digest along the way */
+- (BOOL) _inflateBytes:(const void*)bytes length:(NSUInteger)length toOutputStream:(NSOutputStream*)stream
+{
+	z_stream*					zStream = _compressionContext;
+	NSUInteger					outLength;
+	int							error;
+	
+	zStream->next_in = (Bytef*)bytes;
+	zStream->avail_in = length;
+	do {
+		if(_compressionFinished) //NOTE: Any data past the end of the gzip stream is invalid
+		return (zStream->avail_in == 0);
+		
+		zStream->next_out = _compressionBufferBytes;
+		zStream->avail_out = kStreamBufferSize;
+		error = inflate(zStream, Z_NO_FLUSH);
+		if(error == Z_STREAM_END)
+		_compressionFinished = YES;
+		else if((error != Z_OK) && (error != Z_BUF_ERROR))
+		return NO;
+		
+		outLength = kStreamBufferSize - zStream->avail_out;
+		if(outLength) {
+#if !TARGET_OS_IPHONE
+			if(_digestContext && (EVP_DigestUpdate(_digestContext, _compressionBufferBytes, outLength) != 1))
+			return NO;
+#endif
+			if(!_WriteToStream(stream, _compressionBufferBytes, outLength))
+			return NO;
+		}
+	} while(zStream->avail_in || (zStream->avail_out == 0));
+	
+	return YES;
+}
+
+/* Returns deflated data if compression is enabled, updating the digest with the source data along the way - Never returns 0 before reaching the end of the compressed stream */
+- (NSInteger) _readFromInputStream:(NSInputStream*)stream bytes:(void*)bytes maxLength:(NSUInteger)length
+{
+	z_stream*					zStream = _compressionContext;
+	NSInteger					result;
+	int							error;
+	
+	if(zStream == NULL)
+	return [stream read:bytes maxLength:length];
+	
+	zStream->next_out = bytes;
+	zStream->avail_out = length;
+	while((zStream->avail_out == length) && !_compressionFinished) {
+		if((zStream->avail_in == 0) && !_compressionInputEnded) {
+			result = [stream read:_compressionBufferBytes maxLength:kStreamBufferSize];
+			if(result < 0)
+			return -1;
+			if(result == 0)
+			_compressionInputEnded = YES;
+#if !TARGET_OS_IPHONE
+			else if(_digestContext && (EVP_DigestUpdate(_digestContext, _compressionBufferBytes, result) != 1))
+			return -1;
+#endif
+			_compressionSourceLength += result;
+			zStream->next_in = _compressionBufferBytes;
+			zStream->avail_in = result;
+		}
+		
+		error = deflate(zStream, (_compressionInputEnded ? Z_FINISH : Z_NO_FLUSH));
+		if(error == Z_STREAM_END)
+		_compressionFinished = YES;
+		else if((error != Z_OK) && (error != Z_BUF_ERROR))
+		return -1;
+	}
+	
+	return length - zStream->avail_out;
+}
+
 - (BOOL) openOutputStream:(NSOutputStream*)stream isFileTransfer:(BOOL)isFileTransfer
 {
 	_totalSize = 0;
 	_fileTransfer = isFileTransfer;
 	if(_fileTransfer) {
-#if !TARGET_OS_IPHONE
-		if(![self _createDigestContext] || ![self _createCypherContext:YES])
+		if(![self _createCompressionContext:YES])
 		return NO;
+#if !TARGET_OS_IPHONE
+		if(![self _createDigestContext] || ![self _createCypherContext:YES]) {
+			[self _destroyCompressionContext];
+			return NO;
+		}
 #endif
 		_maxSpeed = ([self isLocalHost] ? 0.0 : _maxDownloadSpeed);
 	}
@@ -432,6 +822,7 @@ static CFTimeInterval					_downloadTime = 0.0,
 		[self _destroyCypherContext];
 		[self _destroyDigestContext];
 #endif
+		[self _destroyCompressionContext];
 		return NO;
 	}
 	
@@ -443,9 +834,7 @@ static CFTimeInterval					_downloadTime = 0.0,
 	double						maxSpeed = (_fileTransfer && ![self isLocalHost] ? _maximumDownloadSpeed : 0.0);
 	CFAbsoluteTime				time = 0.0;
 	BOOL						success = YES;
-	int							offset = 0,
-								realLength,
-								numBytes;
+	int							realLength;
 	void*						realBytes;
 	CFTimeInterval				dTime;
 	
@@ -469,7 +858,7 @@ static CFTimeInterval					_downloadTime = 0.0,
 	}
 	
 #if !TARGET_OS_IPHONE
-	if(success && _digestContext) {
+	if(success && _digestContext && !_compressionContext) {
 		if(EVP_DigestUpdate(_digestContext, realBytes, realLength) != 1)
 		success = NO;
 	}
@@ -490,22 +879,8 @@ static CFTimeInterval					_downloadTime = 0.0,
 			}
 		}
 		
-		if(success) {
-			success = NO;
-			while(1) {
-				numBytes = [stream write:((const uint8_t*)realBytes + offset) maxLength:(realLength - offset)]; //NOTE: Writing 0 bytes will close the stream
-				if(numBytes < 0)
-				break;
-				offset += numBytes;
-				if(offset == realLength) {
-					success = YES;
-					break;
-				}
-#ifdef __DEBUG__
-				NSLog(@"%s wrote only %i bytes out of %i", __FUNCTION__, numBytes, realLength - offset);
-#endif
-			}
-		}
+		if(success)
+		success = (_compressionContext ? [self _inflateBytes:realBytes length:realLength toOutputStream:stream] : _WriteToStream(stream, realBytes, realLength));
 		
 		if(success) {
 			if(_maxSpeed) {
@@ -532,9 +907,7 @@ static CFTimeInterval					_downloadTime = 0.0,
 {
 	BOOL						success = YES;
 #if !TARGET_OS_IPHONE
-	int							offset = 0,
-								outLength,
-								numBytes;
+	int							outLength;
 	unsigned char				buffer[EVP_MAX_BLOCK_LENGTH];
 #endif
 	
@@ -545,29 +918,28 @@ static CFTimeInterval					_downloadTime = 0.0,
 		
 		[self _destroyCypherContext];
 		
-		if(success) {
-			success = NO;
-			while(1) {
-				numBytes = [stream write:((const uint8_t*)buffer + offset) maxLength:(outLength - offset)];
-				if(numBytes < 0)
-				break;
-				offset += numBytes;
-				if(offset == outLength) {
-					success = YES;
-					break;
-				}
-#ifdef __DEBUG__
-				NSLog(@"%s wrote only %i bytes out of %i", __FUNCTION__, numBytes, outLength - offset);
-#endif
+		if(success && _compressionContext)
+		success = [self _inflateBytes:buffer length:outLength toOutputStream:stream];
+		else {
+			if(success)
+			success = _WriteToStream(stream, buffer, outLength);
+			
+			if(success && _digestContext) {
+				if(EVP_DigestUpdate(_digestContext, buffer, outLength) != 1)
+				success = NO;
 			}
 		}
+	}
+#endif
+	
+	if(_compressionContext) {
+		if(!_compressionFinished) //NOTE: The gzip stream is truncated
+		success = NO;
 		
-		if(success && _digestContext) {
-			if(EVP_DigestUpdate(_digestContext, buffer, outLength) != 1)
-			success = NO;
-		}
+		[self _destroyCompressionContext];
 	}
 	
+#if !TARGET_OS_IPHONE
 	if(_digestContext) {
 		if(success) {
 			if(EVP_DigestFinal(_digestContext, _digestBuffer, (unsigned int*)&outLength) != 1)
@@ -587,6 +959,7 @@ static CFTimeInterval					_downloadTime = 0.0,
 	[self _destroyCypherContext];
 	[self _destroyDigestContext];
 #endif
+	[self _destroyCompressionContext];
 	
 	[stream close];
 }
@@ -596,9 +969,13 @@ static CFTimeInterval					_downloadTime = 0.0,
 	_totalSize = 0;
 	_fileTransfer = isFileTransfer;
 	if(_fileTransfer) {
-#if !TARGET_OS_IPHONE
-		if(![self _createDigestContext] || ![self _createCypherContext:NO])
+		if(![self _createCompressionContext:NO])
 		return NO;
+#if !TARGET_OS_IPHONE
+		if(![self _createDigestContext] || ![self _createCypherContext:NO]) {
+			[self _destroyCompressionContext];
+			return NO;
+		}
 #endif
 		_maxSpeed = ([self isLocalHost] ? 0.0 : _maxUploadSpeed);
 	}
@@ -611,6 +988,7 @@ static CFTimeInterval					_downloadTime = 0.0,
 		[self _destroyCypherContext];
 		[self _destroyDigestContext];
 #endif
+		[self _destroyCompressionContext];
 		return NO;
 	}
 	
@@ -654,7 +1032,7 @@ static CFTimeInterval					_downloadTime = 0.0,
 		}
 		
 		newBytes = _encryptionBufferBytes;
-		result = [stream read:newBytes maxLength:(length - EVP_MAX_BLOCK_LENGTH)];
+		result = [self _readFromInputStream:stream bytes:newBytes maxLength:(length - EVP_MAX_BLOCK_LENGTH)];
 		
 		if(result > 0) {
 			if(_maxSpeed) {
@@ -671,7 +1049,7 @@ static CFTimeInterval					_downloadTime = 0.0,
 		}
 		
 		if(result > 0) {
-			if(_digestContext) {
+			if(_digestContext && !_compressionContext) {
 				if(EVP_DigestUpdate(_digestContext, newBytes, result) != 1)
 				result = -1;
 			}
@@ -717,7 +1095,7 @@ static CFTimeInterval					_downloadTime = 0.0,
 			}
 		}
 		
-		result = [stream read:bytes maxLength:length];
+		result = [self _readFromInputStream:stream bytes:bytes maxLength:length];
 		
 		if(result > 0) {
 			if(_maxSpeed) {
@@ -735,11 +1113,11 @@ static CFTimeInterval					_downloadTime = 0.0,
 		
 #if !TARGET_OS_IPHONE
 		if(_digestContext) {
-			if(result > 0) {
+			if((result > 0) && !_compressionContext) {
 				if(EVP_DigestUpdate(_digestContext, bytes, result) != 1)
 				result = -1;
 			}
-			if((result == 0) || (_currentLength + result == _maxLength)) { //HACK: CFReadStreamCreateForStreamedHTTPRequest() will stop reading when reaching Content-Length, so NSInputStream may never have an opportunity to return 0
+			if((result == 0) || (!_compressionContext && (_currentLength + result == _maxLength))) { //HACK: CFReadStreamCreateForStreamedHTTPRequest() will stop reading when reaching Content-Length, so NSInputStream may never have an opportunity to return 0
 				if(EVP_DigestFinal(_digestContext, _digestBuffer, (unsigned int*)&newLength) != 1)
 				result = -1;
 				
@@ -761,6 +1139,7 @@ static CFTimeInterval					_downloadTime = 0.0,
 	[self _destroyCypherContext];
 	[self _destroyDigestContext];
 #endif
+	[self _destroyCompressionContext];
 	
 	[stream close];
 }
@@ -773,11 +1152,7 @@ static CFTimeInterval					_downloadTime = 0.0,
 {
 	BOOL					success;
 	
-#if !TARGET_OS_IPHONE
-	if([self encryptionPassword])
-	length = (length / kEncryptionCipherBlockSize + 1) * kEncryptionCipherBlockSize;
-#endif
-	[self setMaxLength:length];
+	[self setMaxLength:[self _maxLengthForSourceLength:length]];
 	
 	success = [self uploadFileToPath:remotePath fromStream:stream];
 	
@@ -804,7 +1179,7 @@ static CFTimeInterval					_downloadTime = 0.0,
 	
 	if(!success && ([stream streamStatus] > NSStreamStatusNotOpen)) {
 		if(![[NSFileManager defaultManager] removeItemAtPath:localPath error:&error])
-		NSLog(@"%@: %@", __FUNCTION__, error);
+		NSLog(@"%s: %@", __FUNCTION__, error);
 	}
 	
 	return success;
@@ -827,11 +1202,7 @@ static CFTimeInterval					_downloadTime = 0.0,
 		break;
 	}
 	
-	maxLength = [[info objectForKey:NSFileSize] unsignedIntegerValue];
-#if !TARGET_OS_IPHONE
-	if([self encryptionPassword])
-	maxLength = (maxLength / kEncryptionCipherBlockSize + 1) * kEncryptionCipherBlockSize;
-#endif
+	maxLength = [self _maxLengthForSourceLength:[[info objectForKey:NSFileSize] unsignedIntegerValue]];
 	[self setMaxLength:maxLength];
 	
 	success = [self uploadFileToPath:remotePath fromStream:[NSInputStream inputStreamWithFileAtPath:localPath]];
@@ -858,11 +1229,7 @@ static CFTimeInterval					_downloadTime = 0.0,
 	if(data == nil)
 	return NO;
 	
-	maxLength = [data length];
-#if !TARGET_OS_IPHONE
-	if([self encryptionPassword])
-	maxLength = (maxLength / kEncryptionCipherBlockSize + 1) * kEncryptionCipherBlockSize;
-#endif
+	maxLength = [self _maxLengthForSourceLength:[data length]];
 	[self setMaxLength:maxLength];
 	
 	success = [self uploadFileToPath:remotePath fromStream:[NSInputStream inputStreamWithData:data]];
@@ -932,11 +1299,7 @@ static CFTimeInterval					_downloadTime = 0.0,
 	if(bytes == NULL)
 	return NO;
 	
-	maxLength = length;
-#if !TARGET_OS_IPHONE
-	if([self encryptionPassword])
-	maxLength = (maxLength / kEncryptionCipherBlockSize + 1) * kEncryptionCipherBlockSize;
-#endif
+	maxLength = [self _maxLengthForSourceLength:length];
 	[self setMaxLength:maxLength];
 	
 	info.buffer = (void*)bytes;
@@ -950,9 +1313,394 @@ static CFTimeInterval					_downloadTime = 0.0,
 
 @end
 
+@implementation FileTransferController (DeltaTransfer)
+
+- (NSString*) _deltaCacheFileForPath:(NSString*)remotePath inDirectory:(NSString*)cachePath
+{
+	const char*				string = [[[self absoluteURLForRemotePath:remotePath] absoluteString] UTF8String];
+	unsigned char			md5[16];
+	
+	if(string == NULL)
+	return nil;
+	CC_MD5(string, strlen(string), md5);
+	
+	return [cachePath stringByAppendingPathComponent:[NSString stringWithFormat:@"%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x.signature",
+		md5[0], md5[1], md5[2], md5[3], md5[4], md5[5], md5[6], md5[7], md5[8], md5[9], md5[10], md5[11], md5[12], md5[13], md5[14], md5[15]]];
+}
+
+- (BOOL) uploadFileFromPath:(NSString*)localPath toPath:(NSString*)remotePath signatureCachePath:(NSString*)cachePath
+{
+	NSString*				cacheFile = nil;
+	NSData*					signature = nil;
+	NSData*					operations = nil;
+	NSUInteger				copyLength = 0,
+							i;
+	const DeltaOperation*	operation;
+	NSDictionary*			attributes;
+	NSDictionary*			entry;
+	NSData*					data;
+	unsigned char			digest[16];
+	BOOL					success;
+	
+	localPath = [[localPath stringByStandardizingPath] stringByResolvingSymlinksInPath];
+	data = [[NSData alloc] initWithContentsOfFile:localPath options:NSMappedRead error:NULL];
+	if(data == nil)
+	return NO;
+	
+	if([self compressionEnabled]) { //NOTE: Compressed uploads cannot be patched
+		[data release];
+		return [self uploadFileFromPath:localPath toPath:remotePath];
+	}
+#if !TARGET_OS_IPHONE
+	if([self encryptionPassword]) { //NOTE: Encrypted uploads cannot be patched
+		[data release];
+		return [self uploadFileFromPath:localPath toPath:remotePath];
+	}
+#endif
+	
+	attributes = [self _attributesForDeltaTransferAtPath:remotePath];
+	if(attributes && cachePath) {
+		cacheFile = [self _deltaCacheFileForPath:remotePath inDirectory:cachePath];
+		entry = (cacheFile ? [NSDictionary dictionaryWithContentsOfFile:cacheFile] : nil);
+		if([[entry objectForKey:kDeltaCacheKey_Size] isEqual:[attributes objectForKey:NSFileSize]] && [[entry objectForKey:kDeltaCacheKey_Date] isEqual:[attributes objectForKey:NSFileModificationDate]])
+		signature = [entry objectForKey:kDeltaCacheKey_Signature];
+	}
+	if(attributes && (signature == nil))
+	signature = [[self _copyDeltaSignatureForPath:remotePath blockSize:_DeltaBlockSizeForLength([[attributes objectForKey:NSFileSize] unsignedIntegerValue])] autorelease];
+	if(signature) {
+		operations = [self _deltaOperationsForBytes:[data bytes] length:[data length] signature:signature];
+		for(i = 0, operation = [operations bytes]; i < [operations length] / sizeof(DeltaOperation); ++i, ++operation) {
+			if(operation->copy)
+			copyLength += operation->length;
+		}
+	}
+	
+	if(copyLength > 0) {
+		_DeltaComputeDigest([data bytes], [data length], digest);
+		[self setMaxLength:[data length]];
+		[self invalidateCachedContentsForPath:remotePath];
+		success = [self _applyDeltaOperations:[operations bytes] count:([operations length] / sizeof(DeltaOperation)) fromBytes:[data bytes] length:[data length] digest:digest toPath:remotePath];
+		[self setMaxLength:0];
+#if !TARGET_OS_IPHONE
+		if(success && _digestComputation) //NOTE: The reconstructed file was verified against this digest
+		bcopy(digest, _digestBuffer, 16);
+		else
+		bzero(_digestBuffer, 16);
+#endif
+	}
+	else
+	success = [self uploadFileFromPath:localPath toPath:remotePath];
+	
+	if(cacheFile == nil)
+	cacheFile = (cachePath ? [self _deltaCacheFileForPath:remotePath inDirectory:cachePath] : nil);
+	if(cacheFile) {
+		attributes = (success ? [self _attributesForDeltaTransferAtPath:remotePath] : nil);
+		if(attributes) {
+			entry = [NSDictionary dictionaryWithObjectsAndKeys:[attributes objectForKey:NSFileSize], kDeltaCacheKey_Size, [attributes objectForKey:NSFileModificationDate], kDeltaCacheKey_Date,
+				[self _deltaSignatureForBytes:[data bytes] length:[data length] blockSize:_DeltaBlockSizeForLength([data length])], kDeltaCacheKey_Signature, nil];
+			if(![[NSPropertyListSerialization dataFromPropertyList:entry format:NSPropertyListBinaryFormat_v1_0 errorDescription:NULL] writeToFile:cacheFile atomically:YES])
+			NSLog(@"%s: Failed writing signature cache file \"%@\"", __FUNCTION__, cacheFile);
+		}
+		else
+		[[NSFileManager defaultManager] removeItemAtPath:cacheFile error:NULL];
+	}
+	
+	[data release];
+	
+	return success;
+}
+
+@end
+
+@implementation FileTransferController (ListingCache)
+
+- (void) setListingCacheTimeOut:(NSTimeInterval)timeOut
+{
+	_listingCacheTimeOut = timeOut;
+	if(timeOut <= 0.0)
+	[self invalidateListingCache];
+}
+
+- (void) invalidateListingCache
+{
+	[_listingCache release];
+	_listingCache = nil;
+}
+
+- (NSString*) _listingCacheKeyForPath:(NSString*)remotePath
+{
+	NSString*				path = [self absolutePathForRemotePath:remotePath];
+	
+	while(([path length] > 1) && [path hasSuffix:@"/"])
+	path = [path substringToIndex:([path length] - 1)];
+	
+	return path;
+}
+
+- (id) validatorForDirectoryAtPath:(NSString*)remotePath
+{
+	return nil;
+}
+
+- (NSDictionary*) cachedContentsOfDirectoryAtPath:(NSString*)remotePath
+{
+	NSString*				key;
+	NSDictionary*			entry;
+	NSDictionary*			contents;
+	id						validator;
+	
+	if(_listingCacheTimeOut <= 0.0)
+	return nil;
+	
+	key = [self _listingCacheKeyForPath:remotePath];
+	entry = [_listingCache objectForKey:key];
+	if(entry == nil)
+	return nil;
+	contents = [[[entry objectForKey:kListingCacheKey_Contents] retain] autorelease];
+	if(CFAbsoluteTimeGetCurrent() - [[entry objectForKey:kListingCacheKey_Time] doubleValue] < _listingCacheTimeOut)
+	return contents;
+	
+	//NOTE: Expired listings are kept for another period if the server reports the directory has not changed - This only happens once as validators like WebDAV collection ETags do not reliably change when members are modified
+	validator = [entry objectForKey:kListingCacheKey_Validator];
+	if(validator && [[self validatorForDirectoryAtPath:remotePath] isEqual:validator]) {
+		[self cacheContents:contents ofDirectoryAtPath:remotePath validator:nil];
+		return contents;
+	}
+	
+	[_listingCache removeObjectForKey:key];
+	return nil;
+}
+
+- (void) cacheContents:(NSDictionary*)contents ofDirectoryAtPath:(NSString*)remotePath validator:(id)validator
+{
+	if((_listingCacheTimeOut <= 0.0) || (contents == nil))
+	return;
+	
+	if(_listingCache == nil)
+	_listingCache = [NSMutableDictionary new];
+	[_listingCache setObject:[NSDictionary dictionaryWithObjectsAndKeys:[[contents copy] autorelease], kListingCacheKey_Contents, [NSNumber numberWithDouble:CFAbsoluteTimeGetCurrent()], kListingCacheKey_Time,
+		validator, kListingCacheKey_Validator, nil] forKey:[self _listingCacheKeyForPath:remotePath]]; //NOTE: The validator is last as it can be nil
+}
+
+- (void) invalidateCachedContentsForPath:(NSString*)remotePath
+{
+	NSString*				key;
+	NSString*				prefix;
+	NSString*				path;
+	
+	if(![_listingCache count])
+	return;
+	
+	key = [self _listingCacheKeyForPath:remotePath];
+	for(path = [key stringByDeletingLastPathComponent]; [path length] && ![path isEqualToString:key]; path = [path stringByDeletingLastPathComponent]) {
+		[_listingCache removeObjectForKey:path]; //NOTE: Ancestors are dropped too as some backends list directories recursively
+		if([path isEqualToString:@"/"])
+		break;
+	}
+	prefix = ([key isEqualToString:@"/"] ? key : [key stringByAppendingString:@"/"]);
+	for(path in [_listingCache allKeys]) {
+		if([path isEqualToString:key] || [path hasPrefix:prefix])
+		[_listingCache removeObjectForKey:path];
+	}
+}
+
+@end
+
+@implementation FileTransferController (Asynchronous)
+
++ (void) _ioThread:(id)argument
+{
+	NSAutoreleasePool*		pool = [NSAutoreleasePool new];
+	NSAutoreleasePool*		localPool;
+	
+	[[NSRunLoop currentRunLoop] addPort:[NSPort port] forMode:NSDefaultRunLoopMode]; //NOTE: Prevents the run loop from exiting when no transfer is in progress
+	
+	pthread_mutex_lock(&_ioThreadMutex);
+	_ioThread = [[NSThread currentThread] retain];
+	pthread_cond_broadcast(&_ioThreadCondition);
+	pthread_mutex_unlock(&_ioThreadMutex);
+	
+	while(1) {
+		localPool = [NSAutoreleasePool new];
+		[[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate distantFuture]];
+		[localPool drain];
+	}
+	
+	[pool drain];
+}
+
++ (NSThread*) _sharedIOThread
+{
+	pthread_mutex_lock(&_ioThreadMutex);
+	if(_ioThread == nil) {
+		[NSThread detachNewThreadSelector:@selector(_ioThread:) toTarget:[FileTransferController class] withObject:nil];
+		while(_ioThread == nil)
+		pthread_cond_wait(&_ioThreadCondition, &_ioThreadMutex);
+	}
+	pthread_mutex_unlock(&_ioThreadMutex);
+	
+	return _ioThread;
+}
+
++ (BOOL) isSharedIOThread
+{
+	return (_ioThread && ([NSThread currentThread] == _ioThread));
+}
+
+- (BOOL) isTransferringAsynchronously
+{
+	return (_asyncInvocation ? YES : NO);
+}
+
+- (BOOL) canMultiplexTransferForUpload:(BOOL)upload
+{
+	return NO;
+}
+
+- (BOOL) isStreamingAsynchronously
+{
+	return NO;
+}
+
+- (void) _runAsynchronousOperation:(NSInvocation*)operation
+{
+	NSAutoreleasePool*		pool = [NSAutoreleasePool new];
+	BOOL					success;
+	
+	[operation invokeWithTarget:self];
+	[operation getReturnValue:&success];
+	if(![self isStreamingAsynchronously])
+	[self finishAsynchronousTransfer:success];
+	
+	[pool drain];
+}
+
+/* The operation is run on the shared I/O thread if possible or on a new thread otherwise */
+- (BOOL) _startAsynchronousOperation:(SEL)operation path:(NSString*)remotePath stream:(NSStream*)stream upload:(BOOL)upload target:(id)target selector:(SEL)selector context:(void*)context
+{
+	NSMethodSignature*		signature = [target methodSignatureForSelector:selector];
+	NSInvocation*			invocation;
+	
+	if(_asyncInvocation || !stream || ([stream streamStatus] != NSStreamStatusNotOpen) || ([signature numberOfArguments] != 5))
+	return NO;
+	
+	_asyncInvocation = [[NSInvocation invocationWithMethodSignature:signature] retain];
+	[_asyncInvocation setTarget:target];
+	[_asyncInvocation setSelector:selector];
+	[_asyncInvocation setArgument:&self atIndex:2];
+	[_asyncInvocation setArgument:&context atIndex:4];
+	_asyncThread = [[NSThread currentThread] retain];
+	_asyncStream = [stream retain];
+	[self retain]; //NOTE: Balanced in -finishAsynchronousTransfer:
+	if(upload)
+	[self invalidateCachedContentsForPath:remotePath];
+	
+	invocation = [NSInvocation invocationWithMethodSignature:[self methodSignatureForSelector:operation]];
+	[invocation setSelector:operation];
+	[invocation setArgument:&remotePath atIndex:2];
+	[invocation setArgument:&stream atIndex:3];
+	[invocation retainArguments];
+	if([self canMultiplexTransferForUpload:upload])
+	[self performSelector:@selector(_runAsynchronousOperation:) onThread:[FileTransferController _sharedIOThread] withObject:invocation waitUntilDone:NO];
+	else
+	[NSThread detachNewThreadSelector:@selector(_runAsynchronousOperation:) toTarget:self withObject:invocation];
+	
+	return YES;
+}
+
+/* Must be called from the thread running the transfer */
+- (void) finishAsynchronousTransfer:(BOOL)success
+{
+	NSInvocation*			invocation = _asyncInvocation;
+	NSError*				error;
+	
+	[self setMaxLength:0];
+	
+	if(!success && _asyncPath && ([_asyncStream streamStatus] > NSStreamStatusNotOpen)) {
+		if(![[NSFileManager defaultManager] removeItemAtPath:_asyncPath error:&error])
+		NSLog(@"%s: %@", __FUNCTION__, error);
+	}
+	[_asyncPath release];
+	_asyncPath = nil;
+	[_asyncStream release];
+	_asyncStream = nil;
+	
+	[invocation setArgument:&success atIndex:3];
+	[invocation retainArguments];
+	_asyncInvocation = nil;
+	[invocation performSelector:@selector(invoke) onThread:_asyncThread withObject:nil waitUntilDone:NO];
+	[invocation release];
+	[_asyncThread release];
+	_asyncThread = nil;
+	
+	[self autorelease]; //NOTE: The transfer may complete from inside a stream callback still using the controller
+}
+
+- (BOOL) downloadFileFromPath:(NSString*)remotePath toStream:(NSOutputStream*)stream target:(id)target selector:(SEL)selector context:(void*)context
+{
+	return [self _startAsynchronousOperation:@selector(_downloadFileFromPath:toStream:) path:remotePath stream:stream upload:NO target:target selector:selector context:context];
+}
+
+- (BOOL) uploadFileToPath:(NSString*)remotePath fromStream:(NSInputStream*)stream length:(NSUInteger)length target:(id)target selector:(SEL)selector context:(void*)context
+{
+	if(_asyncInvocation)
+	return NO;
+	
+	[self setMaxLength:[self _maxLengthForSourceLength:length]];
+	
+	if(![self _startAsynchronousOperation:@selector(_uploadFileToPath:fromStream:) path:remotePath stream:stream upload:YES target:target selector:selector context:context]) {
+		[self setMaxLength:0];
+		return NO;
+	}
+	
+	return YES;
+}
+
+- (BOOL) downloadFileFromPath:(NSString*)remotePath toPath:(NSString*)localPath target:(id)target selector:(SEL)selector context:(void*)context
+{
+	NSOutputStream*			stream;
+	
+	if(_asyncInvocation)
+	return NO;
+	
+	localPath = [localPath stringByStandardizingPath];
+	stream = [NSOutputStream outputStreamToFileAtPath:localPath append:NO];
+	if(stream == nil)
+	return NO;
+	
+	_asyncPath = [localPath copy];
+	if(![self downloadFileFromPath:remotePath toStream:stream target:target selector:selector context:context]) {
+		[_asyncPath release];
+		_asyncPath = nil;
+		return NO;
+	}
+	
+	return YES;
+}
+
+- (BOOL) uploadFileFromPath:(NSString*)localPath toPath:(NSString*)remotePath target:(id)target selector:(SEL)selector context:(void*)context
+{
+	NSDictionary*			info;
+	
+	localPath = [localPath stringByStandardizingPath];
+	while(1) {
+		info = [[NSFileManager defaultManager] attributesOfItemAtPath:localPath error:NULL];
+		if(info == nil)
+		return NO;
+		if([[info objectForKey:NSFileType] isEqualToString:NSFileTypeSymbolicLink])
+		localPath = [[NSFileManager defaultManager] destinationOfSymbolicLinkAtPath:localPath error:NULL];
+		else
+		break;
+	}
+	
+	return [self uploadFileToPath:remotePath fromStream:[NSInputStream inputStreamWithFileAtPath:localPath] length:[[info objectForKey:NSFileSize] unsignedIntegerValue] target:target selector:selector context:context];
+}
+
+@end
+
 @implementation StreamTransferController
 
-@synthesize activeStream=_activeStream;
+@synthesize activeStream=_activeStream, silent=_silent;
 
 + (id) allocWithZone:(NSZone*)zone
 {
@@ -992,8 +1740,30 @@ static CFTimeInterval					_downloadTime = 0.0,
 	[super dealloc];
 }
 
+- (BOOL) canMultiplexTransferForUpload:(BOOL)upload
+{
+	//NOTE: Speed limits are enforced by sleeping which would stall all other multiplexed transfers
+	if(upload ? (_maximumUploadSpeed || [self maximumUploadSpeed]) : (_maximumDownloadSpeed || [self maximumDownloadSpeed]))
+	return NO;
+	
+	return [[self class] useAsyncStreams];
+}
+
+- (BOOL) isStreamingAsynchronously
+{
+	return _asyncStreaming;
+}
+
 - (void) invalidate
 {
+	CFStringRef				mode = (_asyncStreaming ? kFileTransferRunLoopSharedMode : kFileTransferRunLoopActiveMode);
+	
+	if(_asyncTimer) {
+		CFRunLoopTimerInvalidate(_asyncTimer);
+		CFRelease(_asyncTimer);
+		_asyncTimer = NULL;
+	}
+	
 	[_userInfo release];
 	_userInfo = nil;
 	
@@ -1007,14 +1777,14 @@ static CFTimeInterval					_downloadTime = 0.0,
 	if(_activeStream) {
 		if(CFGetTypeID(_activeStream) == CFReadStreamGetTypeID()) {
 			if([[self class] useAsyncStreams]) {
-				CFReadStreamUnscheduleFromRunLoop((CFReadStreamRef)_activeStream, CFRunLoopGetCurrent(), kFileTransferRunLoopActiveMode);
+				CFReadStreamUnscheduleFromRunLoop((CFReadStreamRef)_activeStream, CFRunLoopGetCurrent(), mode);
 				CFReadStreamSetClient((CFReadStreamRef)_activeStream, kCFStreamEventNone, NULL, NULL);
 			}
 			CFReadStreamClose((CFReadStreamRef)_activeStream);
 		}
 		else if(CFGetTypeID(_activeStream) == CFWriteStreamGetTypeID()) {
 			if([[self class] useAsyncStreams]) {
-				CFWriteStreamUnscheduleFromRunLoop((CFWriteStreamRef)_activeStream, CFRunLoopGetCurrent(), kFileTransferRunLoopActiveMode);
+				CFWriteStreamUnscheduleFromRunLoop((CFWriteStreamRef)_activeStream, CFRunLoopGetCurrent(), mode);
 				CFWriteStreamSetClient((CFWriteStreamRef)_activeStream, kCFStreamEventNone, NULL, NULL);
 			}
 			CFWriteStreamClose((CFWriteStreamRef)_activeStream);
@@ -1024,6 +1794,34 @@ static CFTimeInterval					_downloadTime = 0.0,
 	}
 }
 
+/* Waits up to "interval" for the socket backing the stream to become ready instead of spinning on the stream status - Returns YES if the stream is ready or is not backed by a socket (in which case reading or writing simply blocks in the kernel) */
+static BOOL _WaitForStream(CFTypeRef stream, BOOL write, BOOL opening, CFTimeInterval interval)
+{
+	BOOL					ready = YES;
+	struct pollfd			descriptor;
+	CFDataRef				handle;
+	
+	if(!opening && (write ? CFWriteStreamCanAcceptBytes((CFWriteStreamRef)stream) : CFReadStreamHasBytesAvailable((CFReadStreamRef)stream)))
+	return YES;
+	
+	handle = (write ? CFWriteStreamCopyProperty((CFWriteStreamRef)stream, kCFStreamPropertySocketNativeHandle) : CFReadStreamCopyProperty((CFReadStreamRef)stream, kCFStreamPropertySocketNativeHandle));
+	if(handle) {
+		if(CFDataGetLength(handle) == sizeof(CFSocketNativeHandle)) {
+			CFDataGetBytes(handle, CFRangeMake(0, sizeof(CFSocketNativeHandle)), (UInt8*)&descriptor.fd);
+			descriptor.events = (write || opening ? POLLOUT : POLLIN); //NOTE: A connecting socket becomes writable once connected
+			descriptor.revents = 0;
+			ready = (poll(&descriptor, 1, interval * 1000.0) > 0);
+		}
+		CFRelease(handle);
+	}
+	else if(opening) {
+		usleep(kStreamOpenPollInterval);
+		ready = NO;
+	}
+	
+	return ready;
+}
+
 static void _ReadStreamClientCallBack(CFReadStreamRef stream, CFStreamEventType type, void* clientCallBackInfo)
 {
 	NSAutoreleasePool*		pool = [NSAutoreleasePool new];
@@ -1038,12 +1836,50 @@ static void _ReadStreamClientCallBack(CFReadStreamRef stream, CFStreamEventType
 	[self invalidate];
 	
 	if(result) {
-		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidSucceed:)])
+		if(!_silent && [[self delegate] respondsToSelector:@selector(fileTransferControllerDidSucceed:)])
 		[[self delegate] fileTransferControllerDidSucceed:self];
 	}
 	
-	_result = [result retain];
-	CFRunLoopStop(CFRunLoopGetCurrent());
+	if(_asyncStreaming) {
+		_asyncStreaming = NO;
+		[self finishAsynchronousTransfer:(result ? YES : NO)];
+	}
+	else {
+		_result = [result retain];
+		CFRunLoopStop(CFRunLoopGetCurrent());
+	}
+}
+
+/* Replaces the checks performed by the run loop in -runReadStream:... and -runWriteStream:... for transfers multiplexed on the shared I/O thread */
+- (void) _checkAsynchronousTransfer
+{
+	CFAbsoluteTime			timeout = [self timeOut];
+	
+	if((timeout > 0.0) && (CFAbsoluteTimeGetCurrent() - _lastActivityTime >= timeout)) {
+		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+		[[self delegate] fileTransferControllerDidFail:self withError:MAKE_FILETRANSFERCONTROLLER_ERROR(@"Timeout while %@ stream", (CFGetTypeID(_activeStream) == CFReadStreamGetTypeID() ? @"reading from" : @"writing to"))];
+		[self _doneWithResult:nil];
+	}
+	else if([[self delegate] respondsToSelector:@selector(fileTransferControllerShouldAbort:)] && [[self delegate] fileTransferControllerShouldAbort:self])
+	[self _doneWithResult:nil];
+}
+
+static void _AsyncTimerCallBack(CFRunLoopTimerRef timer, void* info)
+{
+	NSAutoreleasePool*		pool = [NSAutoreleasePool new];
+	
+	[(StreamTransferController*)info _checkAsynchronousTransfer];
+	
+	[pool drain];
+}
+
+- (void) _scheduleAsynchronousTimer
+{
+	CFRunLoopTimerContext	context = {0, self, NULL, NULL, NULL};
+	
+	_lastActivityTime = CFAbsoluteTimeGetCurrent();
+	_asyncTimer = CFRunLoopTimerCreate(kCFAllocatorDefault, _lastActivityTime + kRunLoopInterval, kRunLoopInterval, 0, 0, _AsyncTimerCallBack, &context);
+	CFRunLoopAddTimer(CFRunLoopGetCurrent(), _asyncTimer, kFileTransferRunLoopSharedMode);
 }
 
 - (void) readStreamClientCallBack:(CFReadStreamRef)stream type:(CFStreamEventType)type
@@ -1052,6 +1888,9 @@ static void _ReadStreamClientCallBack(CFReadStreamRef stream, CFStreamEventType
 	NSError*					error;
 	BOOL						success;
 	
+	if(_asyncStreaming)
+	_lastActivityTime = CFAbsoluteTimeGetCurrent();
+	
 	switch(type) {
 		
 		case kCFStreamEventOpenCompleted:
@@ -1108,7 +1947,7 @@ static void _ReadStreamClientCallBack(CFReadStreamRef stream, CFStreamEventType
 	CFStreamClientContext	context = {0, self, NULL, NULL, NULL};
 	BOOL					opened = NO;
 	CFAbsoluteTime			timeout = [self timeOut],
-							lastTime = 0.0,
+							lastTime = CFAbsoluteTimeGetCurrent(),
 							time;
 	id						result;
 	SInt32					value;
@@ -1118,9 +1957,12 @@ static void _ReadStreamClientCallBack(CFReadStreamRef stream, CFStreamEventType
 		return nil;
 	}
 	
+	//NOTE: File transfers started asynchronously go on from the shared I/O thread run loop once this method has returned
+	_asyncStreaming = (allowEncryption && [self isTransferringAsynchronously] && [FileTransferController isSharedIOThread] && [[self class] useAsyncStreams]);
+	
 	if([[self class] useAsyncStreams]) {
 		CFReadStreamSetClient(readStream, kCFStreamEventOpenCompleted | kCFStreamEventHasBytesAvailable | kCFStreamEventErrorOccurred | kCFStreamEventEndEncountered, _ReadStreamClientCallBack, &context);
-		CFReadStreamScheduleWithRunLoop(readStream, CFRunLoopGetCurrent(), kFileTransferRunLoopActiveMode);
+		CFReadStreamScheduleWithRunLoop(readStream, CFRunLoopGetCurrent(), (_asyncStreaming ? kFileTransferRunLoopSharedMode : kFileTransferRunLoopActiveMode));
 	}
 	CFReadStreamOpen(readStream);
 	
@@ -1128,9 +1970,14 @@ static void _ReadStreamClientCallBack(CFReadStreamRef stream, CFStreamEventType
 	_dataStream = [dataStream retain];
 	_userInfo = [info retain];
 	
-	if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidStart:)])
+	if(!_silent && [[self delegate] respondsToSelector:@selector(fileTransferControllerDidStart:)])
 	[[self delegate] fileTransferControllerDidStart:self];
 	
+	if(_asyncStreaming) {
+		[self _scheduleAsynchronousTimer];
+		return [NSNumber numberWithBool:YES];
+	}
+	
 	_result = nil;
 	if([[self class] useAsyncStreams]) {
 		do {
@@ -1152,12 +1999,14 @@ static void _ReadStreamClientCallBack(CFReadStreamRef stream, CFStreamEventType
 			switch(CFReadStreamGetStatus(readStream)) {
 				
 				case kCFStreamStatusOpen:
-				if(opened)
-				[self readStreamClientCallBack:readStream type:kCFStreamEventHasBytesAvailable];
-				else {
+				if(!opened) {
 					[self readStreamClientCallBack:readStream type:kCFStreamEventOpenCompleted];
 					opened = YES;
 				}
+				else if(_WaitForStream(readStream, NO, NO, kRunLoopInterval)) {
+					[self readStreamClientCallBack:readStream type:kCFStreamEventHasBytesAvailable];
+					lastTime = CFAbsoluteTimeGetCurrent();
+				}
 				break;
 				
 				case kCFStreamStatusAtEnd:
@@ -1174,6 +2023,15 @@ static void _ReadStreamClientCallBack(CFReadStreamRef stream, CFStreamEventType
 				readStream = NULL;
 				break;
 				
+				default:
+				_WaitForStream(readStream, NO, YES, kRunLoopInterval);
+				break;
+				
+			}
+			if(readStream && (timeout > 0.0) && (CFAbsoluteTimeGetCurrent() - lastTime >= timeout)) {
+				if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+				[[self delegate] fileTransferControllerDidFail:self withError:MAKE_FILETRANSFERCONTROLLER_ERROR(@"Timeout while reading from stream")];
+				break;
 			}
 		} while(readStream && (!delegateHasShouldAbort || ![[self delegate] fileTransferControllerShouldAbort:self]));
 	}
@@ -1203,6 +2061,9 @@ static void _WriteStreamClientCallBack(CFWriteStreamRef stream, CFStreamEventTyp
 {
 	CFIndex						count;
 	
+	if(_asyncStreaming)
+	_lastActivityTime = CFAbsoluteTimeGetCurrent();
+	
 	switch(type) {
 		
 		case kCFStreamEventOpenCompleted:
@@ -1250,7 +2111,7 @@ static void _WriteStreamClientCallBack(CFWriteStreamRef stream, CFStreamEventTyp
 	CFStreamClientContext	context = {0, self, NULL, NULL, NULL};
 	BOOL					opened = NO;
 	CFAbsoluteTime			timeout = [self timeOut],
-							lastTime = 0.0,
+							lastTime = CFAbsoluteTimeGetCurrent(),
 							time;
 	id						result;
 	SInt32					value;
@@ -1260,9 +2121,12 @@ static void _WriteStreamClientCallBack(CFWriteStreamRef stream, CFStreamEventTyp
 		return nil;
 	}
 	
+	//NOTE: File transfers started asynchronously go on from the shared I/O thread run loop once this method has returned
+	_asyncStreaming = (allowEncryption && [self isTransferringAsynchronously] && [FileTransferController isSharedIOThread] && [[self class] useAsyncStreams]);
+	
 	if([[self class] useAsyncStreams]) {
 		CFWriteStreamSetClient(writeStream, kCFStreamEventOpenCompleted | kCFStreamEventCanAcceptBytes | kCFStreamEventErrorOccurred | kCFStreamEventEndEncountered, _WriteStreamClientCallBack, &context);
-		CFWriteStreamScheduleWithRunLoop(writeStream, CFRunLoopGetCurrent(), kFileTransferRunLoopActiveMode);
+		CFWriteStreamScheduleWithRunLoop(writeStream, CFRunLoopGetCurrent(), (_asyncStreaming ? kFileTransferRunLoopSharedMode : kFileTransferRunLoopActiveMode));
 	}
 	CFWriteStreamOpen(writeStream);
 	
@@ -1271,9 +2135,14 @@ static void _WriteStreamClientCallBack(CFWriteStreamRef stream, CFStreamEventTyp
 	_userInfo = [info retain];
 	_transferOffset = 0;
 	
-	if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidStart:)])
+	if(!_silent && [[self delegate] respondsToSelector:@selector(fileTransferControllerDidStart:)])
 	[[self delegate] fileTransferControllerDidStart:self];
 	
+	if(_asyncStreaming) {
+		[self _scheduleAsynchronousTimer];
+		return [NSNumber numberWithBool:YES];
+	}
+	
 	_result = nil;
 	if([[self class] useAsyncStreams]) {
 		do {
@@ -1295,12 +2164,14 @@ static void _WriteStreamClientCallBack(CFWriteStreamRef stream, CFStreamEventTyp
 			switch(CFWriteStreamGetStatus(writeStream)) {
 				
 				case kCFStreamStatusOpen:
-				if(opened)
-				[self writeStreamClientCallBack:writeStream type:kCFStreamEventCanAcceptBytes];
-				else {
+				if(!opened) {
 					[self writeStreamClientCallBack:writeStream type:kCFStreamEventOpenCompleted];
 					opened = YES;
 				}
+				else if(_WaitForStream(writeStream, YES, NO, kRunLoopInterval)) {
+					[self writeStreamClientCallBack:writeStream type:kCFStreamEventCanAcceptBytes];
+					lastTime = CFAbsoluteTimeGetCurrent();
+				}
 				break;
 				
 				case kCFStreamStatusAtEnd:
@@ -1317,6 +2188,15 @@ static void _WriteStreamClientCallBack(CFWriteStreamRef stream, CFStreamEventTyp
 				writeStream = NULL;
 				break;
 				
+				default:
+				_WaitForStream(writeStream, YES, YES, kRunLoopInterval);
+				break;
+				
+			}
+			if(writeStream && (timeout > 0.0) && (CFAbsoluteTimeGetCurrent() - lastTime >= timeout)) {
+				if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+				[[self delegate] fileTransferControllerDidFail:self withError:MAKE_FILETRANSFERCONTROLLER_ERROR(@"Timeout while writing to stream")];
+				break;
 			}
 		} while(writeStream && (!delegateHasShouldAbort || ![[self delegate] fileTransferControllerShouldAbort:self]));
 	}	
@@ -17,6 +17,8 @@
 */
 
 #import <SystemConfiguration/SystemConfiguration.h>
+#import <sys/select.h>
+#import <pthread.h>
 #import <curl/curl.h>
 
 #import "FileTransferController_Internal.h"
@@ -25,11 +27,63 @@
 #define __USE_COMMAND_PROGRESS__ 0
 #define __USE_LISTING_PROGRESS__ 0
 
+#define kDefaultMaxConcurrentConnections 4
+#define kProxySettingsCacheDuration 30.0 //In seconds
+#define kMultiMaxWaitTime 100 //In milliseconds
+
+typedef enum {
+	kFTPBatchOperation_Upload = 0,
+	kFTPBatchOperation_Download,
+	kFTPBatchOperation_Delete,
+	kFTPBatchOperation_CreateDirectory,
+	kFTPBatchOperation_Move
+} FTPBatchOperation;
+
+typedef struct FTPBatch FTPBatch;
+
+typedef struct {
+	FTPBatch*				batch;
+	CURL*					handle;
+	BOOL					active;
+	NSUInteger				index;
+	FILE*					file;
+	struct curl_slist*		quote;
+	double					length;
+	char					error[CURL_ERROR_SIZE];
+} FTPBatchSlot;
+
+typedef BOOL (*FTPListingCallback)(id target, SEL selector, NSString* name, NSDictionary* attributes, void* context);
+
+typedef struct {
+	FTPListingCallback		callback; //Called for each entry as soon as its line is parsed
+	id						target;
+	SEL						selector;
+	void*					context;
+	NSMutableData*			pending;
+	NSStringEncoding		encoding;
+	BOOL					machineListing;
+	BOOL					invalid;
+	BOOL					stopped;
+} FTPListing;
+
+struct FTPBatch {
+	FTPTransferController*	controller;
+	BOOL					checkAbort;
+	double					completedLength;
+	NSUInteger				slotCount;
+	FTPBatchSlot*			slots;
+};
+
 @interface FTPTransferController ()
-@property(nonatomic, readonly) void* handle;
 - (void) _reset;
+- (void) _resetHandle:(void*)handle;
+- (BOOL) _listDirectoryAtPath:(NSString*)remotePath listing:(FTPListing*)listing;
 @end
 
+static pthread_mutex_t					_proxyMutex = PTHREAD_MUTEX_INITIALIZER;
+static NSDictionary*					_proxySettings = nil;
+static CFAbsoluteTime					_proxySettingsTime = 0.0;
+
 static inline NSError* _MakeCURLError(CURLcode code, const char* message, id transcript)
 {
 	return [NSError errorWithDomain:@"curl" code:code userInfo:[NSDictionary dictionaryWithObjectsAndKeys:[NSString stringWithUTF8String:message], NSLocalizedDescriptionKey, transcript, @"Last Server Message", nil]];
@@ -37,7 +91,7 @@ static inline NSError* _MakeCURLError(CURLcode code, const char* message, id tra
 
 @implementation FTPTransferController
 
-@synthesize handle=_handle, stringEncoding=_stringEncoding, keepConnectionAlive=_keepAlive;
+@synthesize stringEncoding=_stringEncoding, keepConnectionAlive=_keepAlive, maximumConcurrentConnections=_maxConnections;
 
 + (void) initialize
 {
@@ -60,13 +114,30 @@ static inline NSError* _MakeCURLError(CURLcode code, const char* message, id tra
 			return nil;
 		}
 		_stringEncoding = NSISOLatin1StringEncoding;
+		_maxConnections = kDefaultMaxConcurrentConnections;
 	}
 	
 	return self;
 }
 
+- (void) _cleanUpMultiHandles
+{
+	NSUInteger				i;
+	
+	for(i = 0; i < _multiHandleCount; ++i)
+	curl_easy_cleanup(_multiHandles[i]);
+	if(_multiHandles)
+	free(_multiHandles);
+	_multiHandles = NULL;
+	_multiHandleCount = 0;
+	if(_multi)
+	curl_multi_cleanup(_multi);
+	_multi = NULL;
+}
+
 - (void) _cleanUp_FTPTransferController
 {
+	[self _cleanUpMultiHandles];
 	if(_handle)
 	curl_easy_cleanup(_handle);
 }
@@ -117,40 +188,72 @@ static int _DebugCallback(CURL* handle, curl_infotype type, char* data, size_t s
 	return 0;
 }
 
-- (void) _reset
+/* Querying the dynamic store is expensive so the FTP proxy settings are cached for a little while and shared by all controllers */
+static NSDictionary* _CopyProxySettings()
 {
-	NSTimeInterval			timeOut = [self timeOut];
+	CFAbsoluteTime			time = CFAbsoluteTimeGetCurrent();
 	CFDictionaryRef			proxySettings;
+	NSMutableDictionary*	dictionary;
+	NSDictionary*			settings;
+	
+	pthread_mutex_lock(&_proxyMutex);
+	if((_proxySettings == nil) || (time >= _proxySettingsTime + kProxySettingsCacheDuration)) {
+		dictionary = [NSMutableDictionary new];
+		if((proxySettings = SCDynamicStoreCopyProxies(NULL))) {
+			if([[(NSDictionary*)proxySettings objectForKey:(id)kSCPropNetProxiesFTPEnable] boolValue]) {
+				if([(NSDictionary*)proxySettings objectForKey:(id)kSCPropNetProxiesFTPProxy])
+				[dictionary setObject:[(NSDictionary*)proxySettings objectForKey:(id)kSCPropNetProxiesFTPProxy] forKey:(id)kSCPropNetProxiesFTPProxy];
+				if([(NSDictionary*)proxySettings objectForKey:(id)kSCPropNetProxiesFTPPort])
+				[dictionary setObject:[(NSDictionary*)proxySettings objectForKey:(id)kSCPropNetProxiesFTPPort] forKey:(id)kSCPropNetProxiesFTPPort];
+			}
+			CFRelease(proxySettings);
+		}
+		[_proxySettings release];
+		_proxySettings = dictionary;
+		_proxySettingsTime = time;
+	}
+	settings = [_proxySettings retain];
+	pthread_mutex_unlock(&_proxyMutex);
+	
+	return settings;
+}
+
+- (void) _resetHandle:(void*)handle
+{
+	NSTimeInterval			timeOut = [self timeOut];
+	NSDictionary*			proxySettings;
 	const char*				host;
 	long					port;
 	//NSArray*				array;
 	
-	[_transcript release];
-	_transcript = nil;
-	curl_easy_reset(_handle);
+	curl_easy_reset(handle);
 	
-	curl_easy_setopt(_handle, CURLOPT_FORBID_REUSE, (long)(_keepAlive ? 0 : 1));
-	curl_easy_setopt(_handle, CURLOPT_IPRESOLVE, (long)CURL_IPRESOLVE_V4); //HACK: Work around an issue with Bonjour hostnames that resolve to IPv6 and passive connections can't be established
+	curl_easy_setopt(handle, CURLOPT_FORBID_REUSE, (long)(_keepAlive ? 0 : 1));
+	curl_easy_setopt(handle, CURLOPT_IPRESOLVE, (long)CURL_IPRESOLVE_V4); //HACK: Work around an issue with Bonjour hostnames that resolve to IPv6 and passive connections can't be established
 	if(timeOut > 0.0)
-	curl_easy_setopt(_handle, CURLOPT_FTP_RESPONSE_TIMEOUT, (long)ceil(timeOut));
-	
-	curl_easy_setopt(_handle, CURLOPT_VERBOSE, (long)1);
-	curl_easy_setopt(_handle, CURLOPT_DEBUGFUNCTION, _DebugCallback);
-	curl_easy_setopt(_handle, CURLOPT_DEBUGDATA, self);
-	
-	if((proxySettings = SCDynamicStoreCopyProxies(NULL))) {
-		if([[(NSDictionary*)proxySettings objectForKey:(id)kSCPropNetProxiesFTPEnable] boolValue]) {
-			if((host = [[(NSDictionary*)proxySettings objectForKey:(id)kSCPropNetProxiesFTPProxy] UTF8String]))
-			curl_easy_setopt(_handle, CURLOPT_PROXY, host);
-			if((port = [[(NSDictionary*)proxySettings objectForKey:(id)kSCPropNetProxiesFTPPort] longValue]))
-			curl_easy_setopt(_handle, CURLOPT_PROXYPORT, port);
-			/*
-			if((array = [(NSDictionary*)proxySettings objectForKey:(id)kSCPropNetProxiesExceptionsList])) 
-			curl_easy_setopt(_handle, CURLOPT_NOPROXY, [[array componentsJoinedByString:@","] UTF8String]);
-			*/
-		}
-		CFRelease(proxySettings);
-	}
+	curl_easy_setopt(handle, CURLOPT_FTP_RESPONSE_TIMEOUT, (long)ceil(timeOut));
+	
+	curl_easy_setopt(handle, CURLOPT_VERBOSE, (long)1);
+	curl_easy_setopt(handle, CURLOPT_DEBUGFUNCTION, _DebugCallback);
+	curl_easy_setopt(handle, CURLOPT_DEBUGDATA, self);
+	
+	proxySettings = _CopyProxySettings();
+	if((host = [[proxySettings objectForKey:(id)kSCPropNetProxiesFTPProxy] UTF8String]))
+	curl_easy_setopt(handle, CURLOPT_PROXY, host);
+	if((port = [[proxySettings objectForKey:(id)kSCPropNetProxiesFTPPort] longValue]))
+	curl_easy_setopt(handle, CURLOPT_PROXYPORT, port);
+	/*
+	if((array = [proxySettings objectForKey:(id)kSCPropNetProxiesExceptionsList])) 
+	curl_easy_setopt(handle, CURLOPT_NOPROXY, [[array componentsJoinedByString:@","] UTF8String]);
+	*/
+	[proxySettings release];
+}
+
+- (void) _reset
+{
+	[_transcript release];
+	_transcript = nil;
+	[self _resetHandle:_handle];
 }
 
 - (const char*) _convertURL:(NSURL*)url
@@ -275,7 +378,7 @@ static size_t _ReadCallback(char* bufptr, size_t size, size_t nitems, void* user
 	curl_easy_setopt(_handle, CURLOPT_PROGRESSFUNCTION, _ReadProgressCallback);
 	curl_easy_setopt(_handle, CURLOPT_PROGRESSDATA, params);
 	curl_easy_setopt(_handle, CURLOPT_UPLOAD, (long)1);
-	curl_easy_setopt(_handle, CURLOPT_INFILESIZE, (long)[self maxLength]);
+	curl_easy_setopt(_handle, CURLOPT_INFILESIZE, ([self compressionEnabled] ? (long)-1 : (long)[self maxLength])); //NOTE: The length of compressed uploads is unknown
 	
 	if([self openInputStream:stream isFileTransfer:YES]) {
 		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidStart:)])
@@ -298,50 +401,272 @@ static size_t _ReadCallback(char* bufptr, size_t size, size_t nitems, void* user
 	return success;
 }
 
-- (NSDictionary*) _ParseFTPDirectoryListing:(NSData*)data
+static const char* _monthNames[12] = {"jan", "feb", "mar", "apr", "may", "jun", "jul", "aug", "sep", "oct", "nov", "dec"};
+
+static NSInteger _MonthFromToken(const char* token, size_t length)
 {
-	NSMutableDictionary*	result = [NSMutableDictionary dictionary];
-	NSUInteger				offset = 0;
-	NSMutableDictionary*	dictionary;
-	CFDictionaryRef			entry;
-	CFIndex					length;
-	NSInteger				type;
-	NSString*				string;
+	NSInteger				i;
 	
-	//HACK: CFFTPCreateParsedResourceListing() creates strings with the kCFStringEncodingMacRoman encoding
-	if(_stringEncoding != NSMacOSRomanStringEncoding) {
-		string = [[NSString alloc] initWithData:data encoding:_stringEncoding];
-		data = [string dataUsingEncoding:NSMacOSRomanStringEncoding];
-		[string release];
-		if(data == nil)
-		return nil;
+	if(length == 3) {
+		for(i = 0; i < 12; ++i) {
+			if(!strncasecmp(token, _monthNames[i], 3))
+			return i;
+		}
 	}
 	
-	while(1) {
-		length = CFFTPCreateParsedResourceListing(kCFAllocatorDefault, (unsigned char*)[data bytes] + offset, [data length] - offset, &entry);
-		if((length <= 0) || (entry == NULL))
+	return -1;
+}
+
+static NSInteger _IntegerFromToken(const char* token, size_t length)
+{
+	NSInteger				value = 0;
+	
+	if(length == 0)
+	return -1;
+	while(length--) {
+		if((*token < '0') || (*token > '9'))
+		return -1;
+		value = value * 10 + (*token++ - '0');
+	}
+	
+	return value;
+}
+
+/* Returns the number of whitespace separated tokens found */
+static NSUInteger _TokenizeLine(const char* line, size_t length, NSUInteger maxTokens, const char** tokens, size_t* lengths)
+{
+	const char*				end = line + length;
+	NSUInteger				count = 0;
+	
+	while((count < maxTokens) && (line < end)) {
+		while((line < end) && ((*line == ' ') || (*line == '\t')))
+		++line;
+		if(line == end)
 		break;
-		
-		if(![(NSString*)CFDictionaryGetValue(entry, kCFFTPResourceName) isEqualToString:@"."] && ![(NSString*)CFDictionaryGetValue(entry, kCFFTPResourceName) isEqualToString:@".."]) {
-			type = [(NSNumber*)CFDictionaryGetValue(entry, kCFFTPResourceType) integerValue];
-			
-			dictionary = [NSMutableDictionary new];
-			if(type == 8) {
-				[dictionary setObject:NSFileTypeRegular forKey:NSFileType];
-				[dictionary setObject:(id)CFDictionaryGetValue(entry, kCFFTPResourceSize) forKey:NSFileSize];
-			}
-			else if(type == 4)
-			[dictionary setObject:NSFileTypeDirectory forKey:NSFileType];
-			[dictionary setObject:(id)CFDictionaryGetValue(entry, kCFFTPResourceModDate) forKey:NSFileModificationDate];
-			[result setObject:dictionary forKey:(id)CFDictionaryGetValue(entry, kCFFTPResourceName)];
-			[dictionary release];
+		tokens[count] = line;
+		while((line < end) && (*line != ' ') && (*line != '\t'))
+		++line;
+		lengths[count] = line - tokens[count];
+		++count;
+	}
+	
+	return count;
+}
+
+/* Parses a "facts; name" line as returned by MLSD (see RFC 3659) */
+static BOOL _ParseMLSDLine(const char* line, size_t length, NSInteger* type, unsigned long long* size, struct tm* date, const char** name, size_t* nameLength)
+{
+	const char*				end = line + length;
+	const char*				fact;
+	const char*				value;
+	const char*				separator;
+	
+	separator = memchr(line, ' ', length);
+	if(separator == NULL)
+	return NO;
+	*name = separator + 1;
+	*nameLength = end - *name;
+	
+	for(fact = line; fact < separator; fact = value + 1) {
+		value = memchr(fact, ';', separator - fact);
+		if(value == NULL)
+		value = separator;
+		if(((value - fact) > 5) && !strncasecmp(fact, "type=", 5)) {
+			if(((value - fact) == 9) && !strncasecmp(fact + 5, "file", 4))
+			*type = 8;
+			else if(((value - fact) == 8) && !strncasecmp(fact + 5, "dir", 3))
+			*type = 4;
+			else if(((value - fact) == 9) && (!strncasecmp(fact + 5, "cdir", 4) || !strncasecmp(fact + 5, "pdir", 4)))
+			return NO;
 		}
+		else if(((value - fact) > 5) && !strncasecmp(fact, "size=", 5))
+		*size = strtoull(fact + 5, NULL, 10);
+		else if(((value - fact) >= 21) && !strncasecmp(fact, "modify=", 7)) {
+			date->tm_year = _IntegerFromToken(fact + 7, 4) - 1900;
+			date->tm_mon = _IntegerFromToken(fact + 11, 2) - 1;
+			date->tm_mday = _IntegerFromToken(fact + 13, 2);
+			date->tm_hour = _IntegerFromToken(fact + 15, 2);
+			date->tm_min = _IntegerFromToken(fact + 17, 2);
+			date->tm_sec = _IntegerFromToken(fact + 19, 2);
+		}
+	}
+	
+	return YES;
+}
+
+/* Parses a Unix "ls -l" style line - The owner and group columns are optional */
+static BOOL _ParseUnixLine(const char* line, size_t length, NSInteger* type, unsigned long long* size, struct tm* date, const char** name, size_t* nameLength)
+{
+	const char*				tokens[9];
+	size_t					lengths[9];
+	NSUInteger				count,
+							i;
+	NSInteger				month = -1,
+							day = 0,
+							value;
+	const char*				separator;
+	time_t					now;
+	struct tm				today;
+	
+	//NOTE: Look for a "MMM DD HH:MM|YYYY" sequence followed by the name as owner or group names could look like months
+	count = _TokenizeLine(line, length, 9, tokens, lengths);
+	for(i = 2; i + 2 < count; ++i) {
+		month = _MonthFromToken(tokens[i], lengths[i]);
+		day = _IntegerFromToken(tokens[i + 1], lengths[i + 1]);
+		if((month >= 0) && (day >= 1) && (day <= 31) && (tokens[i + 2] + lengths[i + 2] < line + length))
+		break;
+		month = -1;
+	}
+	if(month < 0)
+	return NO;
+	
+	if(line[0] == '-')
+	*type = 8;
+	else if(line[0] == 'd')
+	*type = 4;
+	else if(line[0] == 'l')
+	*type = 10;
+	*size = strtoull(tokens[i - 1], NULL, 10);
+	
+	date->tm_mon = month;
+	date->tm_mday = day;
+	if((lengths[i + 2] == 5) && (tokens[i + 2][2] == ':')) {
+		date->tm_hour = _IntegerFromToken(tokens[i + 2], 2);
+		date->tm_min = _IntegerFromToken(tokens[i + 2] + 3, 2);
 		
-		CFRelease(entry);
-		offset += length;
+		//NOTE: Entries without a year are less than 6 months old
+		now = time(NULL);
+		localtime_r(&now, &today);
+		date->tm_year = today.tm_year;
+		if((date->tm_mon > today.tm_mon) || ((date->tm_mon == today.tm_mon) && (date->tm_mday > today.tm_mday + 1)))
+		date->tm_year -= 1;
+	}
+	else if((value = _IntegerFromToken(tokens[i + 2], lengths[i + 2])) > 1900)
+	date->tm_year = value - 1900;
+	else
+	return NO;
+	
+	*name = tokens[i + 2] + lengths[i + 2] + 1;
+	*nameLength = line + length - *name;
+	if((*type == 10) && (separator = strnstr(*name, " -> ", *nameLength)))
+	*nameLength = separator - *name;
+	
+	return YES;
+}
+
+/* Parses a "MM-DD-YY  HH:MMAM  <DIR> | SIZE  NAME" line as returned by IIS */
+static BOOL _ParseDOSLine(const char* line, size_t length, NSInteger* type, unsigned long long* size, struct tm* date, const char** name, size_t* nameLength)
+{
+	const char*				tokens[3];
+	size_t					lengths[3];
+	
+	if((_TokenizeLine(line, length, 3, tokens, lengths) != 3) || (lengths[0] < 8) || (tokens[0][2] != '-') || (lengths[1] < 5) || (tokens[1][2] != ':'))
+	return NO;
+	
+	date->tm_mon = _IntegerFromToken(tokens[0], 2) - 1;
+	date->tm_mday = _IntegerFromToken(tokens[0] + 3, 2);
+	date->tm_year = _IntegerFromToken(tokens[0] + 6, lengths[0] - 6);
+	date->tm_year += (date->tm_year < 70 ? 100 : (date->tm_year >= 1900 ? -1900 : 0));
+	date->tm_hour = _IntegerFromToken(tokens[1], 2) % 12;
+	date->tm_min = _IntegerFromToken(tokens[1] + 3, 2);
+	if((lengths[1] == 7) && ((tokens[1][5] == 'P') || (tokens[1][5] == 'p')))
+	date->tm_hour += 12;
+	else if(lengths[1] == 5)
+	date->tm_hour = _IntegerFromToken(tokens[1], 2);
+	
+	if((lengths[2] == 5) && !strncasecmp(tokens[2], "<DIR>", 5))
+	*type = 4;
+	else {
+		*type = 8;
+		*size = strtoull(tokens[2], NULL, 10);
+	}
+	
+	*name = tokens[2] + lengths[2];
+	while((*name < line + length) && (**name == ' '))
+	++*name;
+	*nameLength = line + length - *name;
+	
+	return YES;
+}
+
+static void _ParseFTPListingLine(FTPListing* listing, const char* line, size_t length)
+{
+	NSInteger				type = 0;
+	unsigned long long		size = 0;
+	struct tm				date;
+	const char*				name = NULL;
+	size_t					nameLength = 0;
+	BOOL					success;
+	NSMutableDictionary*	dictionary;
+	NSString*				string;
+	time_t					timestamp;
+	
+	if(length && (line[length - 1] == '\r'))
+	--length;
+	if((length == 0) || listing->invalid || listing->stopped)
+	return;
+	
+	bzero(&date, sizeof(struct tm));
+	date.tm_isdst = -1;
+	if(listing->machineListing)
+	success = _ParseMLSDLine(line, length, &type, &size, &date, &name, &nameLength);
+	else if((line[0] >= '0') && (line[0] <= '9'))
+	success = _ParseDOSLine(line, length, &type, &size, &date, &name, &nameLength);
+	else if((length > 10) && strchr("-dlcbps", line[0]))
+	success = _ParseUnixLine(line, length, &type, &size, &date, &name, &nameLength);
+	else
+	success = NO; //NOTE: This also skips the "total" line
+	if(!success || (nameLength == 0) || ((nameLength == 1) && (name[0] == '.')) || ((nameLength == 2) && (name[0] == '.') && (name[1] == '.')))
+	return;
+	
+	string = [[NSString alloc] initWithBytes:name length:nameLength encoding:listing->encoding];
+	if(string == nil) {
+		listing->invalid = YES;
+		return;
+	}
+	
+	dictionary = [NSMutableDictionary new];
+	if(type == 8) {
+		[dictionary setObject:NSFileTypeRegular forKey:NSFileType];
+		[dictionary setObject:[NSNumber numberWithUnsignedLongLong:size] forKey:NSFileSize];
+	}
+	else if(type == 4)
+	[dictionary setObject:NSFileTypeDirectory forKey:NSFileType];
+	if(date.tm_mday) {
+		timestamp = (listing->machineListing ? timegm(&date) : mktime(&date)); //NOTE: MLSD times are always in UTC
+		if(timestamp != -1)
+		[dictionary setObject:[NSDate dateWithTimeIntervalSince1970:timestamp] forKey:NSFileModificationDate];
+	}
+	if(!(*listing->callback)(listing->target, listing->selector, string, dictionary, listing->context))
+	listing->stopped = YES;
+	[dictionary release];
+	[string release];
+}
+
+/* Lines are parsed as soon as they are received and only an incomplete trailing line is ever buffered */
+static void _ParseFTPListingBytes(FTPListing* listing, const char* bytes, size_t length)
+{
+	const char*				end = bytes + length;
+	const char*				newline;
+	
+	if([listing->pending length]) {
+		newline = memchr(bytes, '\n', length);
+		if(newline == NULL) {
+			[listing->pending appendBytes:bytes length:length];
+			return;
+		}
+		[listing->pending appendBytes:bytes length:(newline - bytes)];
+		_ParseFTPListingLine(listing, [listing->pending bytes], [listing->pending length]);
+		[listing->pending setLength:0];
+		bytes = newline + 1;
 	}
 	
-	return result;
+	while((bytes < end) && (newline = memchr(bytes, '\n', end - bytes))) {
+		_ParseFTPListingLine(listing, bytes, newline - bytes);
+		bytes = newline + 1;
+	}
+	if(bytes < end)
+	[listing->pending appendBytes:bytes length:(end - bytes)];
 }
 
 #if __USE_LISTING_PROGRESS__
@@ -354,22 +679,88 @@ static int _ListingProgressCallback(void* clientp, double dltotal, double dlnow,
 }
 #endif
 
+/* Returning less than the received length makes curl abort the transfer */
 static size_t _ListingCallback(void* buffer, size_t size, size_t nmemb, void* userp)
 {
 	void**					params = (void*)userp;
-	NSMutableData*			data = (NSMutableData*)params[0];
+	FTPListing*				listing = (FTPListing*)params[0];
+	
+	_ParseFTPListingBytes(listing, buffer, size * nmemb);
+	
+	return (listing->invalid || listing->stopped ? 0 : size * nmemb);
+}
+
+static BOOL _AddListingEntry(id target, SEL selector, NSString* name, NSDictionary* attributes, void* context)
+{
+	[(NSMutableDictionary*)context setObject:attributes forKey:name];
+	
+	return YES;
+}
+
++ (NSDictionary*) _contentsOfDirectoryFromListingData:(NSData*)data machineListing:(BOOL)flag encoding:(NSStringEncoding)encoding chunkSize:(NSUInteger)size
+{
+	const char*				bytes = [data bytes];
+	NSUInteger				length = [data length];
+	NSMutableDictionary*	entries = [NSMutableDictionary dictionary];
+	FTPListing				listing;
+	NSUInteger				offset;
+	
+	bzero(&listing, sizeof(FTPListing));
+	listing.callback = _AddListingEntry;
+	listing.context = entries;
+	listing.pending = [NSMutableData data];
+	listing.encoding = encoding;
+	listing.machineListing = flag;
 	
-	[data appendBytes:buffer length:(size * nmemb)];
+	for(offset = 0; offset < length; offset += size)
+	_ParseFTPListingBytes(&listing, bytes + offset, MIN(size, length - offset));
+	_ParseFTPListingLine(&listing, [listing.pending bytes], [listing.pending length]);
 	
-	return (size * nmemb);
+	return (listing.invalid ? nil : entries);
 }
 
 - (NSDictionary*) contentsOfDirectoryAtPath:(NSString*)remotePath
 {
-	NSMutableData*			data = [NSMutableData data];
-	NSDictionary*			dictionary = nil;
+	NSDictionary*			contents;
+	NSMutableDictionary*	entries;
+	FTPListing				listing;
+	
+	if((contents = [self cachedContentsOfDirectoryAtPath:remotePath]))
+	return contents;
+	
+	entries = [NSMutableDictionary dictionary];
+	bzero(&listing, sizeof(FTPListing));
+	listing.callback = _AddListingEntry;
+	listing.context = entries;
+	if(![self _listDirectoryAtPath:remotePath listing:&listing])
+	return nil;
+	[self cacheContents:entries ofDirectoryAtPath:remotePath validator:nil];
+	
+	return entries;
+}
+
+- (BOOL) enumerateContentsOfDirectoryAtPath:(NSString*)remotePath target:(id)target selector:(SEL)selector context:(void*)context
+{
+	FTPListing				listing;
+	
+	bzero(&listing, sizeof(FTPListing));
+	listing.callback = (FTPListingCallback)[target methodForSelector:selector];
+	if(listing.callback == NULL)
+	return NO;
+	listing.target = target;
+	listing.selector = selector;
+	listing.context = context;
+	
+	return [self _listDirectoryAtPath:remotePath listing:&listing];
+}
+
+/* Entries are passed to the listing callback as they are received - Returns NO on error or if the callback stopped the listing */
+- (BOOL) _listDirectoryAtPath:(NSString*)remotePath listing:(FTPListing*)listing
+{
+	BOOL					success = NO;
 	NSURL*					url;
 	CURLcode				result;
+	long					code;
 	char					buffer[CURL_ERROR_SIZE];
 #if __USE_LISTING_PROGRESS__
 	void*					params[3];
@@ -385,46 +776,61 @@ static size_t _ListingCallback(void* buffer, size_t size, size_t nmemb, void* us
 	remotePath = @"/";
 	url = [self fullAbsoluteURLForRemotePath:remotePath];
 	
-	params[0] = data;
+	listing->encoding = _stringEncoding;
+	params[0] = listing;
 #if __USE_LISTING_PROGRESS__
 	params[1] = self;
 	params[2] = ([[self delegate] respondsToSelector:@selector(fileTransferControllerShouldAbort:)] ? self : NULL);
 #endif
 	
-	[self _reset];
-	curl_easy_setopt(_handle, CURLOPT_URL, [self _convertURL:url]);
-	curl_easy_setopt(_handle, CURLOPT_ERRORBUFFER, buffer);
-	curl_easy_setopt(_handle, CURLOPT_WRITEFUNCTION, _ListingCallback);
-	curl_easy_setopt(_handle, CURLOPT_WRITEDATA, params);
-#if __USE_LISTING_PROGRESS__
-	curl_easy_setopt(_handle, CURLOPT_NOPROGRESS, (long)0);
-	curl_easy_setopt(_handle, CURLOPT_PROGRESSFUNCTION, _ListingProgressCallback);
-	curl_easy_setopt(_handle, CURLOPT_PROGRESSDATA, params);
-#else
-	curl_easy_setopt(_handle, CURLOPT_NOPROGRESS, (long)1);
-#endif
-	
 	if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidStart:)])
 	[[self delegate] fileTransferControllerDidStart:self];
 	
-	result = curl_easy_perform(_handle);
-	if(result == CURLE_OK) {
-		dictionary = [self _ParseFTPDirectoryListing:data];
-		if(dictionary) {
-			if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidSucceed:)])
-			[[self delegate] fileTransferControllerDidSucceed:self];
-		}
-		else {
-			if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
-			[[self delegate] fileTransferControllerDidFail:self withError:MAKE_FILETRANSFERCONTROLLER_ERROR(@"Failed parsing FTP listing (invalid character encoding)")];
+	do {
+		listing->pending = [NSMutableData data];
+		listing->machineListing = !_noMachineListing;
+		listing->invalid = NO;
+		
+		[self _reset];
+		curl_easy_setopt(_handle, CURLOPT_URL, [self _convertURL:url]);
+		curl_easy_setopt(_handle, CURLOPT_ERRORBUFFER, buffer);
+		curl_easy_setopt(_handle, CURLOPT_WRITEFUNCTION, _ListingCallback);
+		curl_easy_setopt(_handle, CURLOPT_WRITEDATA, params);
+		if(listing->machineListing)
+		curl_easy_setopt(_handle, CURLOPT_CUSTOMREQUEST, "MLSD");
+#if __USE_LISTING_PROGRESS__
+		curl_easy_setopt(_handle, CURLOPT_NOPROGRESS, (long)0);
+		curl_easy_setopt(_handle, CURLOPT_PROGRESSFUNCTION, _ListingProgressCallback);
+		curl_easy_setopt(_handle, CURLOPT_PROGRESSDATA, params);
+#else
+		curl_easy_setopt(_handle, CURLOPT_NOPROGRESS, (long)1);
+#endif
+		
+		result = curl_easy_perform(_handle);
+		if(listing->machineListing && (result != CURLE_OK) && (curl_easy_getinfo(_handle, CURLINFO_RESPONSE_CODE, &code) == CURLE_OK) && ((code == 500) || (code == 502) || (code == 504))) {
+			_noMachineListing = YES; //NOTE: The server does not implement MLSD so fall back to LIST
+			continue;
 		}
+		break;
+	} while(1);
+	
+	if(result == CURLE_OK)
+	_ParseFTPListingLine(listing, [listing->pending bytes], [listing->pending length]);
+	if(listing->invalid) {
+		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+		[[self delegate] fileTransferControllerDidFail:self withError:MAKE_FILETRANSFERCONTROLLER_ERROR(@"Failed parsing FTP listing (invalid character encoding)")];
+	}
+	else if((result == CURLE_OK) || listing->stopped) {
+		success = !listing->stopped; //NOTE: Stopping the listing is not a failure of the transfer itself
+		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidSucceed:)])
+		[[self delegate] fileTransferControllerDidSucceed:self];
 	}
 	else {
 		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
 		[[self delegate] fileTransferControllerDidFail:self withError:_MakeCURLError(result, buffer, _transcript)];
 	}
 	
-	return dictionary;
+	return success;
 }
 
 #if __USE_COMMAND_PROGRESS__
@@ -495,6 +901,9 @@ static int _CommandProgressCallback(void* clientp, double dltotal, double dlnow,
 {
 	struct curl_slist*		headerList = NULL;
 	
+	[self invalidateCachedContentsForPath:fromRemotePath];
+	[self invalidateCachedContentsForPath:toRemotePath];
+	
 	if([fromRemotePath hasPrefix:@"/"])
 	fromRemotePath = [fromRemotePath substringFromIndex:1];
 	headerList = curl_slist_append(headerList, [[NSString stringWithFormat:@"RNFR %@", fromRemotePath] cStringUsingEncoding:_stringEncoding]);
@@ -508,6 +917,8 @@ static int _CommandProgressCallback(void* clientp, double dltotal, double dlnow,
 
 - (BOOL) createDirectoryAtPath:(NSString*)remotePath
 {
+	[self invalidateCachedContentsForPath:remotePath];
+	
 #if 1 //FIXME: Work around CURL bug that closes the connection when doing CURLOPT_POSTQUOTE inside an empty directory 
 	if(![remotePath hasSuffix:@"/"])
 	remotePath = [remotePath stringByAppendingString:@"/"];
@@ -528,6 +939,8 @@ static int _CommandProgressCallback(void* clientp, double dltotal, double dlnow,
 {
 	struct curl_slist*		headerList = NULL;
 	
+	[self invalidateCachedContentsForPath:remotePath];
+	
 	if([remotePath hasPrefix:@"/"])
 	remotePath = [remotePath substringFromIndex:1];
 	headerList = curl_slist_append(headerList, [[NSString stringWithFormat:@"DELE %@", remotePath] cStringUsingEncoding:_stringEncoding]);
@@ -539,6 +952,8 @@ static int _CommandProgressCallback(void* clientp, double dltotal, double dlnow,
 {
 	struct curl_slist*		headerList = NULL;
 	
+	[self invalidateCachedContentsForPath:remotePath];
+	
 	if([remotePath hasPrefix:@"/"])
 	remotePath = [remotePath substringFromIndex:1];
 	headerList = curl_slist_append(headerList, [[NSString stringWithFormat:@"RMD %@", remotePath] cStringUsingEncoding:_stringEncoding]);
@@ -548,6 +963,353 @@ static int _CommandProgressCallback(void* clientp, double dltotal, double dlnow,
 
 @end
 
+@implementation FTPTransferController (Batch)
+
+static int _BatchProgressCallback(void* clientp, double dltotal, double dlnow, double ultotal, double ulnow)
+{
+	FTPBatchSlot*			slot = (FTPBatchSlot*)clientp;
+	FTPBatch*				batch = slot->batch;
+	double					length = batch->completedLength;
+	NSUInteger				i;
+	
+	slot->length = dlnow + ulnow;
+	for(i = 0; i < batch->slotCount; ++i)
+	length += batch->slots[i].length;
+	[batch->controller setCurrentLength:length];
+	
+	return (batch->checkAbort ? [[batch->controller delegate] fileTransferControllerShouldAbort:batch->controller] : 0);
+}
+
+/* Easy handles are kept around with the multi handle so that their control connections can be reused by later batches if "keepConnectionAlive" is set */
+- (BOOL) _prepareMultiHandles
+{
+	NSUInteger				count = MAX(_maxConnections, 1);
+	
+	if(_multiHandleCount != count)
+	[self _cleanUpMultiHandles];
+	
+	if(_multi == NULL) {
+		_multi = curl_multi_init();
+		if(_multi == NULL) {
+			NSLog(@"%s: curl_multi_init() failed", __FUNCTION__);
+			return NO;
+		}
+		_multiHandles = calloc(count, sizeof(void*));
+		for(_multiHandleCount = 0; _multiHandleCount < count; ++_multiHandleCount) {
+			_multiHandles[_multiHandleCount] = curl_easy_init();
+			if(_multiHandles[_multiHandleCount] == NULL) {
+				NSLog(@"%s: curl_easy_init() failed", __FUNCTION__);
+				[self _cleanUpMultiHandles];
+				return NO;
+			}
+		}
+	}
+	
+	return YES;
+}
+
+/* For move operations, "otherPath" is the destination remote path - Otherwise it's the local path */
+- (BOOL) _startBatchSlot:(FTPBatchSlot*)slot operation:(FTPBatchOperation)operation remotePath:(NSString*)remotePath otherPath:(NSString*)otherPath
+{
+	CURL*					handle = slot->handle;
+	const char*				command;
+	const char*				otherCommand;
+	
+	[self _resetHandle:handle];
+	curl_easy_setopt(handle, CURLOPT_FORBID_REUSE, (long)0); //NOTE: Connections are closed after the batch if needed
+	curl_easy_setopt(handle, CURLOPT_ERRORBUFFER, slot->error);
+	curl_easy_setopt(handle, CURLOPT_NOPROGRESS, (long)0);
+	curl_easy_setopt(handle, CURLOPT_PROGRESSFUNCTION, _BatchProgressCallback);
+	curl_easy_setopt(handle, CURLOPT_PROGRESSDATA, slot);
+	slot->error[0] = 0;
+	slot->length = 0.0;
+	
+	switch(operation) {
+		
+		case kFTPBatchOperation_Upload:
+		slot->file = fopen([otherPath fileSystemRepresentation], "r");
+		if(slot->file == NULL)
+		return NO;
+		curl_easy_setopt(handle, CURLOPT_URL, [self _convertURL:[self fullAbsoluteURLForRemotePath:remotePath]]);
+		curl_easy_setopt(handle, CURLOPT_READDATA, slot->file);
+		curl_easy_setopt(handle, CURLOPT_UPLOAD, (long)1);
+		curl_easy_setopt(handle, CURLOPT_FTP_CREATE_MISSING_DIRS, (long)1);
+		break;
+		
+		case kFTPBatchOperation_Download:
+		slot->file = fopen([otherPath fileSystemRepresentation], "w");
+		if(slot->file == NULL)
+		return NO;
+		curl_easy_setopt(handle, CURLOPT_URL, [self _convertURL:[self fullAbsoluteURLForRemotePath:remotePath]]);
+		curl_easy_setopt(handle, CURLOPT_WRITEDATA, slot->file);
+		break;
+		
+		case kFTPBatchOperation_Delete:
+		if([remotePath hasPrefix:@"/"])
+		remotePath = [remotePath substringFromIndex:1];
+		command = [[NSString stringWithFormat:@"DELE %@", remotePath] cStringUsingEncoding:_stringEncoding];
+		if(command == NULL) {
+			NSLog(@"%s: Path \"%@\" cannot be converted to the server string encoding", __FUNCTION__, remotePath);
+			return NO;
+		}
+		slot->quote = curl_slist_append(NULL, command);
+		if(slot->quote == NULL)
+		return NO;
+		curl_easy_setopt(handle, CURLOPT_URL, [self _convertURL:[self fullAbsoluteURLForRemotePath:@"/"]]);
+		curl_easy_setopt(handle, CURLOPT_PREQUOTE, slot->quote); //NOTE: Unlike CURLOPT_POSTQUOTE this doesn't require listing the base directory
+		curl_easy_setopt(handle, CURLOPT_NOBODY, (long)1);
+		break;
+		
+		case kFTPBatchOperation_CreateDirectory:
+		if([remotePath hasPrefix:@"/"])
+		remotePath = [remotePath substringFromIndex:1];
+		command = [[NSString stringWithFormat:@"MKD %@", remotePath] cStringUsingEncoding:_stringEncoding];
+		if(command == NULL) {
+			NSLog(@"%s: Path \"%@\" cannot be converted to the server string encoding", __FUNCTION__, remotePath);
+			return NO;
+		}
+		slot->quote = curl_slist_append(NULL, command);
+		if(slot->quote == NULL)
+		return NO;
+		curl_easy_setopt(handle, CURLOPT_URL, [self _convertURL:[self fullAbsoluteURLForRemotePath:@"/"]]);
+		curl_easy_setopt(handle, CURLOPT_PREQUOTE, slot->quote);
+		curl_easy_setopt(handle, CURLOPT_NOBODY, (long)1);
+		break;
+		
+		case kFTPBatchOperation_Move:
+		if([remotePath hasPrefix:@"/"])
+		remotePath = [remotePath substringFromIndex:1];
+		if([otherPath hasPrefix:@"/"])
+		otherPath = [otherPath substringFromIndex:1];
+		command = [[NSString stringWithFormat:@"RNFR %@", remotePath] cStringUsingEncoding:_stringEncoding];
+		otherCommand = [[NSString stringWithFormat:@"RNTO %@", otherPath] cStringUsingEncoding:_stringEncoding];
+		if((command == NULL) || (otherCommand == NULL)) {
+			NSLog(@"%s: Path \"%@\" cannot be converted to the server string encoding", __FUNCTION__, (command ? otherPath : remotePath));
+			return NO;
+		}
+		slot->quote = curl_slist_append(NULL, command);
+		if((slot->quote == NULL) || (curl_slist_append(slot->quote, otherCommand) == NULL)) //NOTE: The list is left untouched on failure and released by -_finishBatchSlot:
+		return NO;
+		curl_easy_setopt(handle, CURLOPT_URL, [self _convertURL:[self fullAbsoluteURLForRemotePath:@"/"]]);
+		curl_easy_setopt(handle, CURLOPT_PREQUOTE, slot->quote);
+		curl_easy_setopt(handle, CURLOPT_NOBODY, (long)1);
+		break;
+		
+	}
+	
+	return (curl_multi_add_handle(_multi, handle) == CURLM_OK);
+}
+
+- (void) _finishBatchSlot:(FTPBatchSlot*)slot
+{
+	if(slot->active)
+	curl_multi_remove_handle(_multi, slot->handle);
+	if(slot->file) {
+		fclose(slot->file);
+		slot->file = NULL;
+	}
+	if(slot->quote) {
+		curl_slist_free_all(slot->quote);
+		slot->quote = NULL;
+	}
+	slot->batch->completedLength += slot->length;
+	slot->length = 0.0;
+	slot->active = NO;
+}
+
+- (BOOL) _performBatchOperation:(FTPBatchOperation)operation remotePaths:(NSArray*)remotePaths otherPaths:(NSArray*)otherPaths
+{
+	NSUInteger				count = [remotePaths count];
+	NSUInteger				next = 0,
+							active = 0,
+							maxLength = 0,
+							i;
+	NSError*				error = nil;
+	FTPBatch				batch;
+	FTPBatchSlot*			slot;
+	CURLMsg*				message;
+	CURLcode				result;
+	int						running,
+							remaining,
+							maxFD;
+	fd_set					readSet,
+							writeSet,
+							exceptSet;
+	long					timeOut;
+	struct timeval			timeVal;
+	NSString*				otherPath;
+	
+	if(otherPaths && ([otherPaths count] != count))
+	return NO;
+	if(![self _prepareMultiHandles])
+	return NO;
+	
+	if(operation != kFTPBatchOperation_Download) {
+		for(i = 0; i < count; ++i)
+		[self invalidateCachedContentsForPath:[remotePaths objectAtIndex:i]];
+	}
+	if(operation == kFTPBatchOperation_Move) {
+		for(i = 0; i < count; ++i)
+		[self invalidateCachedContentsForPath:[otherPaths objectAtIndex:i]];
+	}
+	
+	if(operation == kFTPBatchOperation_Upload) {
+		for(i = 0; i < count; ++i)
+		maxLength += [[[[NSFileManager defaultManager] attributesOfItemAtPath:[[otherPaths objectAtIndex:i] stringByResolvingSymlinksInPath] error:NULL] objectForKey:NSFileSize] unsignedIntegerValue];
+	}
+	[self setMaxLength:maxLength];
+	[self setCurrentLength:0];
+	
+	bzero(&batch, sizeof(FTPBatch));
+	batch.controller = self;
+	batch.checkAbort = [[self delegate] respondsToSelector:@selector(fileTransferControllerShouldAbort:)];
+	batch.slotCount = MIN(_multiHandleCount, count);
+	batch.slots = calloc(MAX(batch.slotCount, 1), sizeof(FTPBatchSlot));
+	for(i = 0; i < batch.slotCount; ++i) {
+		batch.slots[i].batch = &batch;
+		batch.slots[i].handle = _multiHandles[i];
+	}
+	
+	[_transcript release];
+	_transcript = nil;
+	
+	if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidStart:)])
+	[[self delegate] fileTransferControllerDidStart:self];
+	
+	while(1) {
+		for(i = 0; (i < batch.slotCount) && (next < count) && (error == nil); ++i) {
+			slot = &batch.slots[i];
+			if(slot->active)
+			continue;
+			
+			otherPath = [otherPaths objectAtIndex:next];
+			if((operation == kFTPBatchOperation_Upload) || (operation == kFTPBatchOperation_Download))
+			otherPath = [otherPath stringByStandardizingPath];
+			slot->index = next;
+			if([self _startBatchSlot:slot operation:operation remotePath:[remotePaths objectAtIndex:next] otherPath:otherPath]) {
+				slot->active = YES;
+				active += 1;
+			}
+			else {
+				[self _finishBatchSlot:slot];
+				error = MAKE_FILETRANSFERCONTROLLER_ERROR(@"Failed starting transfer for \"%@\"", [remotePaths objectAtIndex:next]);
+			}
+			next += 1;
+		}
+		if(active == 0)
+		break;
+		
+		while(curl_multi_perform(_multi, &running) == CURLM_CALL_MULTI_PERFORM)
+		;
+		
+		while((message = curl_multi_info_read(_multi, &remaining))) {
+			if(message->msg != CURLMSG_DONE)
+			continue;
+			for(i = 0; i < batch.slotCount; ++i) {
+				if(batch.slots[i].active && (batch.slots[i].handle == message->easy_handle))
+				break;
+			}
+			if(i == batch.slotCount)
+			continue;
+			slot = &batch.slots[i];
+			
+			result = message->data.result; //NOTE: The message is not valid anymore once the handle has been removed
+			if((result != CURLE_OK) && (error == nil))
+			error = _MakeCURLError(result, slot->error, _transcript);
+			[self _finishBatchSlot:slot];
+			if((result != CURLE_OK) && (operation == kFTPBatchOperation_Download))
+			unlink([[[otherPaths objectAtIndex:slot->index] stringByStandardizingPath] fileSystemRepresentation]);
+			active -= 1;
+		}
+		
+		if(running) {
+			FD_ZERO(&readSet);
+			FD_ZERO(&writeSet);
+			FD_ZERO(&exceptSet);
+			maxFD = -1;
+			curl_multi_fdset(_multi, &readSet, &writeSet, &exceptSet, &maxFD);
+			if((curl_multi_timeout(_multi, &timeOut) != CURLM_OK) || (timeOut < 0) || (timeOut > kMultiMaxWaitTime))
+			timeOut = kMultiMaxWaitTime;
+			if(timeOut > 0) {
+				timeVal.tv_sec = timeOut / 1000;
+				timeVal.tv_usec = (timeOut % 1000) * 1000;
+				select(maxFD + 1, &readSet, &writeSet, &exceptSet, &timeVal); //NOTE: With no sockets to watch, this simply sleeps
+			}
+		}
+	}
+	
+	free(batch.slots);
+	if(!_keepAlive)
+	[self _cleanUpMultiHandles];
+	
+	if(error == nil) {
+		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidSucceed:)])
+		[[self delegate] fileTransferControllerDidSucceed:self];
+	}
+	else {
+		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+		[[self delegate] fileTransferControllerDidFail:self withError:error];
+	}
+	
+	return (error == nil);
+}
+
+- (BOOL) uploadFilesFromPaths:(NSArray*)localPaths toPaths:(NSArray*)remotePaths
+{
+	NSUInteger				i;
+	
+	if([localPaths count] != [remotePaths count])
+	return NO;
+	
+	if([self digestComputation] || [self encryptionPassword] || [self compressionEnabled]) {
+		for(i = 0; i < [localPaths count]; ++i) {
+			if(![self uploadFileFromPath:[localPaths objectAtIndex:i] toPath:[remotePaths objectAtIndex:i]])
+			return NO;
+		}
+		return YES;
+	}
+	
+	return [self _performBatchOperation:kFTPBatchOperation_Upload remotePaths:remotePaths otherPaths:localPaths];
+}
+
+- (BOOL) downloadFilesFromPaths:(NSArray*)remotePaths toPaths:(NSArray*)localPaths
+{
+	NSUInteger				i;
+	
+	if([localPaths count] != [remotePaths count])
+	return NO;
+	
+	if([self digestComputation] || [self encryptionPassword] || [self compressionEnabled]) {
+		for(i = 0; i < [remotePaths count]; ++i) {
+			if(![self downloadFileFromPath:[remotePaths objectAtIndex:i] toPath:[localPaths objectAtIndex:i]])
+			return NO;
+		}
+		return YES;
+	}
+	
+	return [self _performBatchOperation:kFTPBatchOperation_Download remotePaths:remotePaths otherPaths:localPaths];
+}
+
+- (BOOL) deleteFilesAtPaths:(NSArray*)remotePaths
+{
+	return [self _performBatchOperation:kFTPBatchOperation_Delete remotePaths:remotePaths otherPaths:nil];
+}
+
+- (BOOL) createDirectoriesAtPaths:(NSArray*)remotePaths
+{
+	return [self _performBatchOperation:kFTPBatchOperation_CreateDirectory remotePaths:remotePaths otherPaths:nil];
+}
+
+- (BOOL) movePaths:(NSArray*)fromRemotePaths toPaths:(NSArray*)toRemotePaths
+{
+	if([fromRemotePaths count] != [toRemotePaths count])
+	return NO;
+	
+	return [self _performBatchOperation:kFTPBatchOperation_Move remotePaths:fromRemotePaths otherPaths:toRemotePaths];
+}
+
+@end
+
 @implementation FTPSTransferController
 
 + (NSString*) urlScheme;
@@ -556,13 +1318,13 @@ static int _CommandProgressCallback(void* clientp, double dltotal, double dlnow,
 }
 
 /* Override */
-- (void) _reset
+- (void) _resetHandle:(void*)handle
 {
-	[super _reset];
+	[super _resetHandle:handle];
 	
-	curl_easy_setopt([self handle], CURLOPT_FTP_SSL, CURLFTPSSL_ALL);
-	curl_easy_setopt([self handle], CURLOPT_SSL_VERIFYPEER, (long)0);
-	curl_easy_setopt([self handle], CURLOPT_SSL_VERIFYHOST, (long)0);
+	curl_easy_setopt(handle, CURLOPT_FTP_SSL, CURLFTPSSL_ALL);
+	curl_easy_setopt(handle, CURLOPT_SSL_VERIFYPEER, (long)0);
+	curl_easy_setopt(handle, CURLOPT_SSL_VERIFYHOST, (long)0);
 }
 
 /* Override completely */
@@ -23,7 +23,10 @@ HTTP Status Codes: http://www.w3.org/Protocols/rfc2616/rfc2616-sec10.html
 */
 
 #import <CommonCrypto/CommonHMAC.h>
+#import <CommonCrypto/CommonDigest.h>
 #import <SystemConfiguration/SystemConfiguration.h>
+#import <pthread.h>
+#import <sys/time.h>
 #if TARGET_OS_IPHONE
 #import <MobileCoreServices/MobileCoreServices.h>
 #endif
@@ -32,6 +35,7 @@ HTTP Status Codes: http://www.w3.org/Protocols/rfc2616/rfc2616-sec10.html
 #import "NSURL+Parameters.h"
 #import "DataStream.h"
 #import "MiniXMLParser.h"
+#import "Base64.h"
 #if !TARGET_OS_IPHONE
 #import "Keychain.h"
 #endif
@@ -42,6 +46,12 @@ HTTP Status Codes: http://www.w3.org/Protocols/rfc2616/rfc2616-sec10.html
 #define kFileBufferSize					(256 * 1024)
 #define kDefaultHTTPError				@"Unsupported HTTP response"
 #define	kAmazonAWSSuffix				@".amazonaws.com"
+#define kDefaultMaxConnectionsPerHost	4
+#define kDefaultConnectionIdleTimeOut	30.0
+#define kDefaultConnectionWaitTimeOut	60.0
+#define kConnectionWaitCheckInterval	1.0
+#define kMultipartMinimumPartSize		(5 * 1024 * 1024)
+#define kMultipartDefaultConcurrency	4
 
 #define MAKE_HTTP_ERROR(__STATUS__, ...) MAKE_ERROR(@"http", __STATUS__, __VA_ARGS__)
 
@@ -50,6 +60,66 @@ HTTP Status Codes: http://www.w3.org/Protocols/rfc2616/rfc2616-sec10.html
 @property(nonatomic, readonly) CFHTTPMessageRef responseHeaders;
 @end
 
+@interface AmazonS3TransferController ()
+- (NSString*) _uploadPart:(NSUInteger)partNumber data:(NSData*)data uploadID:(NSString*)uploadID toPath:(NSString*)remotePath;
+@end
+
+@interface AmazonS3MultipartUpload : NSObject <FileTransferControllerDelegate>
+{
+@private
+	pthread_mutex_t						_mutex;
+	pthread_cond_t						_condition;
+	NSString*							_path;
+	NSString*							_uploadID;
+	NSMutableArray*						_pendingParts;
+	NSMutableDictionary*				_etags;
+	NSUInteger							_partCount;
+	NSUInteger							_activeCount;
+	NSUInteger							_threadCount;
+	BOOL								_finished;
+	BOOL								_aborted;
+	NSError*							_error;
+}
+- (id) initWithPath:(NSString*)remotePath uploadID:(NSString*)uploadID;
+- (void) startThreadWithController:(AmazonS3TransferController*)controller;
+- (BOOL) addPart:(NSData*)data maximumActiveParts:(NSUInteger)max; //Blocks until there are less than "max" parts queued or uploading
+- (void) abort;
+- (NSArray*) waitUntilDone; //Returns the ETags ordered by part number or nil on error
+@property(readonly) NSUInteger partCount;
+@property(readonly) NSError* error;
+@end
+
+/* Collects the keys of a PROPFIND response while it is being downloaded */
+@interface WebDAVDirectoryListing : NSObject <DataStreamDestination>
+{
+@private
+	MiniXMLStreamParser*				_parser;
+	NSMutableDictionary*				_result;
+	NSString*							_directoryETag;
+	NSUInteger							_dataLength;
+	BOOL								_skipped;
+}
+- (NSMutableDictionary*) finishParsing; //Returns nil on error
+- (NSString*) directoryETag; //ETag of the directory itself if the server reported one
+@property(nonatomic, readonly) NSUInteger dataLength; //Number of bytes received so far
+@end
+
+/* Collects the keys or buckets of a GET response while it is being downloaded */
+@interface AmazonS3BucketListing : NSObject <DataStreamDestination>
+{
+@private
+	MiniXMLStreamParser*				_parser;
+	NSMutableDictionary*				_result;
+	NSMutableDictionary*				_info;
+	NSString*							_lastKey;
+	NSString*							_errorMessage;
+	NSUInteger							_dataLength;
+}
+- (NSMutableDictionary*) finishParsing; //Returns nil on error - For bucket contents, the info dictionary is stored under the NSNull key
+@property(nonatomic, readonly) NSString* errorMessage;
+@property(nonatomic, readonly) NSUInteger dataLength; //Number of bytes received so far
+@end
+
 /* Required for the compiler not to complain */
 @interface StreamTransferController (DataStreamSource)
 - (BOOL) openDataStream:(id)userInfo;
@@ -57,7 +127,180 @@ HTTP Status Codes: http://www.w3.org/Protocols/rfc2616/rfc2616-sec10.html
 - (void) closeDataStream:(id)userInfo;
 @end
 
-static char* NewBase64Encode(const void *buffer, size_t length, bool separateLines, size_t *outputLength);
+/* There is no pool of connections here as CFNetwork does the actual reuse of idle persistent connections: this is only a per-host counting semaphore bounding how many connections are in use, plus the proxy and SSL settings all streams to that host share */
+typedef struct {
+	NSUInteger							activeCount;
+	CFAbsoluteTime						lastUseTime;
+	CFDictionaryRef						proxySettings;
+	CFDictionaryRef						sslSettings;
+} HostConnectionSlots;
+
+static pthread_mutex_t					_slotsMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t					_slotsCondition = PTHREAD_COND_INITIALIZER;
+static CFMutableDictionaryRef			_hostSlots = NULL;
+static NSMutableArray*					_slotWaitingOperations = nil;
+static NSUInteger						_maxConnectionsPerHost = kDefaultMaxConnectionsPerHost;
+static NSTimeInterval					_connectionIdleTimeOut = kDefaultConnectionIdleTimeOut;
+
+static NSString* _HostSlotsKey(NSURL* url, BOOL validatesCertificates)
+{
+	NSString*					scheme = [[url scheme] lowercaseString];
+	NSUInteger					port = [[url port] unsignedIntegerValue];
+	
+	if(port == 0)
+	port = ([scheme isEqualToString:@"https"] ? 443 : 80);
+	
+	return [NSString stringWithFormat:@"%@://%@:%lu%@", scheme, [[url host] lowercaseString], (unsigned long)port, (validatesCertificates ? @"" : @"#insecure")];
+}
+
+/* Must be called with the slots mutex locked */
+static void _HostSlotsExpire(CFAbsoluteTime time)
+{
+	CFIndex						count = CFDictionaryGetCount(_hostSlots),
+								i;
+	const void**				keys;
+	const void**				values;
+	HostConnectionSlots*		entry;
+	
+	if(count == 0)
+	return;
+	
+	keys = malloc(count * sizeof(void*));
+	values = malloc(count * sizeof(void*));
+	CFDictionaryGetKeysAndValues(_hostSlots, keys, values);
+	for(i = 0; i < count; ++i) {
+		entry = (HostConnectionSlots*)values[i];
+		if((entry->activeCount == 0) && (time - entry->lastUseTime >= _connectionIdleTimeOut)) {
+			CFDictionaryRemoveValue(_hostSlots, keys[i]);
+			if(entry->proxySettings)
+			CFRelease(entry->proxySettings);
+			if(entry->sslSettings)
+			CFRelease(entry->sslSettings);
+			free(entry);
+		}
+	}
+	free(values);
+	free(keys);
+}
+
+/* Must be called with the slots mutex locked */
+static HostConnectionSlots* _HostSlotsForKey(NSString* key, NSURL* url, BOOL validatesCertificates)
+{
+	HostConnectionSlots*		entry;
+	CFMutableDictionaryRef		sslSettings;
+	
+	if(_hostSlots == NULL)
+	_hostSlots = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks, NULL);
+	_HostSlotsExpire(CFAbsoluteTimeGetCurrent());
+	
+	entry = (HostConnectionSlots*)CFDictionaryGetValue(_hostSlots, key);
+	if(entry == NULL) {
+		entry = calloc(1, sizeof(HostConnectionSlots));
+#if TARGET_OS_IPHONE
+		entry->proxySettings = CFNetworkCopySystemProxySettings();
+#else
+		entry->proxySettings = SCDynamicStoreCopyProxies(NULL);
+#endif
+		//NOTE: Secure Transport can only resume a TLS session if the peer name and settings are identical - Whether sessions actually get resumed is up to CFNetwork
+		sslSettings = CFDictionaryCreateMutable(kCFAllocatorDefault, 2, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+		CFDictionarySetValue(sslSettings, kCFStreamSSLPeerName, (CFStringRef)[url host]);
+		if(!validatesCertificates)
+		CFDictionarySetValue(sslSettings, kCFStreamSSLValidatesCertificateChain, kCFBooleanFalse);
+		entry->sslSettings = sslSettings;
+		CFDictionarySetValue(_hostSlots, key, entry);
+	}
+	
+	return entry;
+}
+
+/* Blocks until a connection slot is available for this host - Returns NULL if none became available before the timeout or immediately if "wait" is NO */
+/* Waiting for a connection to become available is not possible on the shared I/O thread as the connections in use may belong to transfers multiplexed on that same thread */
+static HostConnectionSlots* _HostSlotAcquire(NSString* key, NSURL* url, BOOL validatesCertificates, BOOL wait, NSTimeInterval timeOut)
+{
+	HostConnectionSlots*		entry;
+	struct timeval				now;
+	struct timespec				deadline;
+	
+	gettimeofday(&now, NULL);
+	timeOut = (timeOut > 0.0 ? timeOut : kDefaultConnectionWaitTimeOut);
+	deadline.tv_sec = now.tv_sec + (time_t)timeOut;
+	deadline.tv_nsec = now.tv_usec * 1000 + (long)((timeOut - floor(timeOut)) * 1000000000.0);
+	if(deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec += 1;
+		deadline.tv_nsec -= 1000000000;
+	}
+	
+	pthread_mutex_lock(&_slotsMutex);
+	
+	while(1) {
+		entry = _HostSlotsForKey(key, url, validatesCertificates); //NOTE: The entry may have expired while waiting
+		if(!_maxConnectionsPerHost || (entry->activeCount < _maxConnectionsPerHost))
+		break;
+		if(!wait || (pthread_cond_timedwait(&_slotsCondition, &_slotsMutex, &deadline) == ETIMEDOUT)) {
+			entry = NULL;
+			break;
+		}
+	}
+	if(entry)
+	entry->activeCount += 1;
+	
+	pthread_mutex_unlock(&_slotsMutex);
+	
+	return entry;
+}
+
+/* Returns the entry for a slot already acquired by the caller */
+static HostConnectionSlots* _HostSlotsLookup(NSString* key, NSURL* url, BOOL validatesCertificates)
+{
+	HostConnectionSlots*		entry;
+	
+	pthread_mutex_lock(&_slotsMutex);
+	entry = _HostSlotsForKey(key, url, validatesCertificates); //NOTE: Entries in use never expire
+	pthread_mutex_unlock(&_slotsMutex);
+	
+	return entry;
+}
+
+/* Restarts on their threads the asynchronous operations waiting for a connection slot to the host of "key" or for all hosts if "key" is nil - They will simply queue themselves again if the slot was taken in the meantime */
+static void _HostSlotResumeWaitingOperations(NSString* key)
+{
+	NSMutableArray*				operations = [NSMutableArray array];
+	NSArray*					operation;
+	NSUInteger					i;
+	
+	pthread_mutex_lock(&_slotsMutex);
+	for(i = 0; i < [_slotWaitingOperations count]; ++i) {
+		operation = [_slotWaitingOperations objectAtIndex:i];
+		if(key && ![[operation objectAtIndex:3] isEqualToString:key])
+		continue;
+		[operations addObject:operation];
+		[_slotWaitingOperations removeObjectAtIndex:i--];
+		if(key)
+		break;
+	}
+	pthread_mutex_unlock(&_slotsMutex);
+	
+	for(operation in operations)
+	[[operation objectAtIndex:0] performSelector:@selector(_runAsynchronousOperation:) onThread:[operation objectAtIndex:2] withObject:[operation objectAtIndex:1] waitUntilDone:NO];
+}
+
+static void _HostSlotRelease(NSString* key)
+{
+	HostConnectionSlots*		entry;
+	
+	pthread_mutex_lock(&_slotsMutex);
+	
+	entry = (_hostSlots ? (HostConnectionSlots*)CFDictionaryGetValue(_hostSlots, key) : NULL);
+	if(entry && entry->activeCount) {
+		entry->activeCount -= 1;
+		entry->lastUseTime = CFAbsoluteTimeGetCurrent();
+	}
+	pthread_cond_broadcast(&_slotsCondition);
+	
+	pthread_mutex_unlock(&_slotsMutex);
+	
+	_HostSlotResumeWaitingOperations(key);
+}
 
 @implementation HTTPTransferController
 
@@ -78,6 +321,184 @@ static char* NewBase64Encode(const void *buffer, size_t length, bool separateLin
 	return NO;
 }
 
++ (NSUInteger) maximumPersistentConnectionsPerHost
+{
+	return _maxConnectionsPerHost;
+}
+
++ (void) setMaximumPersistentConnectionsPerHost:(NSUInteger)max
+{
+	pthread_mutex_lock(&_slotsMutex);
+	_maxConnectionsPerHost = max;
+	pthread_cond_broadcast(&_slotsCondition);
+	pthread_mutex_unlock(&_slotsMutex);
+	
+	_HostSlotResumeWaitingOperations(nil);
+}
+
++ (NSTimeInterval) persistentConnectionIdleTimeOut
+{
+	return _connectionIdleTimeOut;
+}
+
++ (void) setPersistentConnectionIdleTimeOut:(NSTimeInterval)timeOut
+{
+	pthread_mutex_lock(&_slotsMutex);
+	_connectionIdleTimeOut = timeOut;
+	pthread_mutex_unlock(&_slotsMutex);
+}
+
++ (NSUInteger) _activePersistentConnectionCountForURL:(NSURL*)url
+{
+	HostConnectionSlots*		entry;
+	NSUInteger					count;
+	
+	pthread_mutex_lock(&_slotsMutex);
+	entry = (_hostSlots ? (HostConnectionSlots*)CFDictionaryGetValue(_hostSlots, _HostSlotsKey(url, YES)) : NULL);
+	count = (entry ? entry->activeCount : 0);
+	pthread_mutex_unlock(&_slotsMutex);
+	
+	return count;
+}
+
+- (void) _releaseConnectionSlot
+{
+	if(_slotKey) {
+		_HostSlotRelease(_slotKey);
+		[_slotKey release];
+		_slotKey = nil;
+	}
+}
+
+- (void) _releaseAsynchronousConnectionSlot
+{
+	if(_asyncSlotKey) {
+		_HostSlotRelease(_asyncSlotKey);
+		[_asyncSlotKey release];
+		_asyncSlotKey = nil;
+	}
+}
+
+- (void) finalize
+{
+	[self _releaseConnectionSlot];
+	[self _releaseAsynchronousConnectionSlot];
+	
+	[super finalize];
+}
+
+- (void) dealloc
+{
+	[self _releaseConnectionSlot];
+	[self _releaseAsynchronousConnectionSlot];
+	
+	[super dealloc];
+}
+
+- (BOOL) canMultiplexTransferForUpload:(BOOL)upload
+{
+	//NOTE: Uploads start with a synchronous HEAD request to resolve redirects which would stall all other multiplexed transfers
+	if(upload)
+	return NO;
+	
+	return [super canMultiplexTransferForUpload:upload];
+}
+
+- (void) _invalidateSlotWaitTimer
+{
+	if(_slotWaitTimer) {
+		CFRunLoopTimerInvalidate(_slotWaitTimer);
+		CFRelease(_slotWaitTimer);
+		_slotWaitTimer = NULL;
+	}
+}
+
+/* Queued operations give up waiting for a slot if the transfer is aborted, or fall back to a non-persistent connection once the timeout is reached like synchronous transfers do */
+- (void) _checkSlotWait
+{
+	CFAbsoluteTime			timeout = [self timeOut];
+	NSArray*				operation = nil;
+	BOOL					abort = ([[self delegate] respondsToSelector:@selector(fileTransferControllerShouldAbort:)] && [[self delegate] fileTransferControllerShouldAbort:self]);
+	NSUInteger				i;
+	
+	if(!abort && (CFAbsoluteTimeGetCurrent() - _slotWaitTime < (timeout > 0.0 ? timeout : kDefaultConnectionWaitTimeOut)))
+	return;
+	
+	pthread_mutex_lock(&_slotsMutex);
+	for(i = 0; i < [_slotWaitingOperations count]; ++i) {
+		if([[_slotWaitingOperations objectAtIndex:i] objectAtIndex:0] == self) {
+			operation = [[[_slotWaitingOperations objectAtIndex:i] retain] autorelease];
+			[_slotWaitingOperations removeObjectAtIndex:i];
+			break;
+		}
+	}
+	pthread_mutex_unlock(&_slotsMutex);
+	if(operation == nil) //NOTE: A slot was released in the meantime and the operation is already being resumed
+	return;
+	
+	[self _invalidateSlotWaitTimer];
+	if(abort)
+	[self finishAsynchronousTransfer:NO];
+	else
+	[super _runAsynchronousOperation:[operation objectAtIndex:1]];
+}
+
+static void _SlotWaitTimerCallBack(CFRunLoopTimerRef timer, void* info)
+{
+	NSAutoreleasePool*		pool = [NSAutoreleasePool new];
+	
+	[(HTTPTransferController*)info _checkSlotWait];
+	
+	[pool drain];
+}
+
+/* Transfers multiplexed on the shared I/O thread cannot block waiting for a persistent connection so they acquire one upfront and are queued until a slot is released if the host is at its limit */
+- (void) _runAsynchronousOperation:(NSInvocation*)operation
+{
+	NSURL*					url = [self baseURL];
+	HostConnectionSlots*	entry;
+	NSString*				key;
+	CFRunLoopTimerContext	context = {0, self, NULL, NULL, NULL};
+	BOOL					queued = NO;
+	
+	if(_keepAlive && !_asyncSlotKey && [FileTransferController isSharedIOThread]) {
+		key = _HostSlotsKey(url, !_disableSSLCertificates);
+		
+		//NOTE: Checking the slots and queuing must be atomic so that a slot released in-between is not missed
+		pthread_mutex_lock(&_slotsMutex);
+		entry = _HostSlotsForKey(key, url, !_disableSSLCertificates);
+		if(!_maxConnectionsPerHost || (entry->activeCount < _maxConnectionsPerHost)) {
+			entry->activeCount += 1;
+			_asyncSlotKey = [key retain];
+		}
+		else {
+			if(_slotWaitingOperations == nil)
+			_slotWaitingOperations = [NSMutableArray new];
+			[_slotWaitingOperations addObject:[NSArray arrayWithObjects:self, operation, [NSThread currentThread], key, nil]];
+			queued = YES;
+		}
+		pthread_mutex_unlock(&_slotsMutex);
+		if(queued) {
+			if(_slotWaitTimer == NULL) { //NOTE: Keep the original wait time if the operation had to queue itself again
+				_slotWaitTime = CFAbsoluteTimeGetCurrent();
+				_slotWaitTimer = CFRunLoopTimerCreate(kCFAllocatorDefault, _slotWaitTime + kConnectionWaitCheckInterval, kConnectionWaitCheckInterval, 0, 0, _SlotWaitTimerCallBack, &context);
+				CFRunLoopAddTimer(CFRunLoopGetCurrent(), _slotWaitTimer, kCFRunLoopDefaultMode);
+			}
+			return;
+		}
+	}
+	[self _invalidateSlotWaitTimer];
+	
+	[super _runAsynchronousOperation:operation];
+}
+
+- (void) finishAsynchronousTransfer:(BOOL)success
+{
+	[self _releaseAsynchronousConnectionSlot];
+	
+	[super finishAsynchronousTransfer:success];
+}
+
 - (void) invalidate
 {
 	if(_responseHeaders) {
@@ -86,6 +507,8 @@ static char* NewBase64Encode(const void *buffer, size_t length, bool separateLin
 	}
 	
 	[super invalidate];
+	
+	[self _releaseConnectionSlot];
 }
 
 - (CFHTTPMessageRef) _newHTTPRequestWithMethod:(NSString*)method url:(NSURL*)url
@@ -120,6 +543,9 @@ static char* NewBase64Encode(const void *buffer, size_t length, bool separateLin
 	CFReadStreamRef			readStream = NULL;
 	CFDictionaryRef			proxySettings;
 	CFMutableDictionaryRef	sslSettings;
+	NSURL*					url;
+	NSString*				key;
+	HostConnectionSlots*	entry;
 	
 #if __LOG_HTTP_MESSAGES__
 	NSLog(@"%@ [HTTP Request]\n%@", self, [[[NSString alloc] initWithData:[(id)CFHTTPMessageCopySerializedMessage(request) autorelease] encoding:NSUTF8StringEncoding] autorelease]);
@@ -132,7 +558,32 @@ static char* NewBase64Encode(const void *buffer, size_t length, bool separateLin
 		CFReadStreamSetProperty(readStream, kCFStreamPropertyHTTPShouldAutoredirect, kCFBooleanTrue);
 	}
 	
-	CFReadStreamSetProperty(readStream, kCFStreamPropertyHTTPAttemptPersistentConnection, (_keepAlive ? kCFBooleanTrue : kCFBooleanFalse));
+	/* Persistent connections take one of the per-host slots: CFNetwork only reuses an idle connection if the stream properties match, so all streams to the same host share the same proxy and SSL settings */
+	[self _releaseConnectionSlot];
+	if(_keepAlive) {
+		url = [NSMakeCollectable(CFHTTPMessageCopyRequestURL(request)) autorelease];
+		key = _HostSlotsKey(url, !_disableSSLCertificates);
+		if([key isEqualToString:_asyncSlotKey])
+		entry = _HostSlotsLookup(key, url, !_disableSSLCertificates); //NOTE: The slot was acquired when the asynchronous operation started
+		else {
+			_slotKey = [key retain];
+			entry = _HostSlotAcquire(_slotKey, url, !_disableSSLCertificates, ![FileTransferController isSharedIOThread], [self timeOut]);
+		}
+		if(entry) {
+			CFReadStreamSetProperty(readStream, kCFStreamPropertyHTTPAttemptPersistentConnection, kCFBooleanTrue);
+			if([[[url scheme] lowercaseString] isEqualToString:@"https"])
+			CFReadStreamSetProperty(readStream, kCFStreamPropertySSLSettings, entry->sslSettings);
+			if(entry->proxySettings)
+			CFReadStreamSetProperty(readStream, kCFStreamPropertyHTTPProxy, entry->proxySettings);
+			return readStream;
+		}
+		
+		//NOTE: Fall back to a non-persistent connection rather than waiting forever on a slot that may never be released
+		NSLog(@"%s: No persistent connection to \"%@\" became available", __FUNCTION__, _slotKey);
+		[_slotKey release];
+		_slotKey = nil;
+	}
+	CFReadStreamSetProperty(readStream, kCFStreamPropertyHTTPAttemptPersistentConnection, kCFBooleanFalse);
 	
 	if([[[self class] urlScheme] isEqualToString:@"https"] && _disableSSLCertificates) {
 		sslSettings = CFDictionaryCreateMutable(kCFAllocatorDefault, 1, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
@@ -154,6 +605,16 @@ static char* NewBase64Encode(const void *buffer, size_t length, bool separateLin
 	return readStream;
 }
 
+- (id) runReadStream:(CFReadStreamRef)readStream dataStream:(NSOutputStream*)dataStream userInfo:(id)info isFileTransfer:(BOOL)allowEncryption
+{
+	id						result = [super runReadStream:readStream dataStream:dataStream userInfo:info isFileTransfer:allowEncryption];
+	
+	if(!result || ![self isStreamingAsynchronously]) //NOTE: Otherwise the connection is released by -invalidate once the transfer has completed
+	[self _releaseConnectionSlot];
+	
+	return result;
+}
+
 - (void) readStreamClientCallBack:(CFReadStreamRef)stream type:(CFStreamEventType)type
 {
 	CFStringRef					value;
@@ -267,10 +728,22 @@ static char* NewBase64Encode(const void *buffer, size_t length, bool separateLin
 	[super closeDataStream:userInfo];
 }
 
-- (BOOL) _uploadFileToPath:(NSString*)remotePath fromStream:(NSInputStream*)stream
+static NSString* _MIMETypeForPath(NSString* path)
 {
 	NSString*				type = nil;
 	NSString*				UTI;
+	
+	if([[path pathExtension] length]) {
+		UTI = (NSString*)[NSMakeCollectable(UTTypeCreatePreferredIdentifierForTag(kUTTagClassFilenameExtension, (CFStringRef)[path pathExtension], NULL)) autorelease];
+		if([UTI length])
+		type = (NSString*)[NSMakeCollectable(UTTypeCopyPreferredTagWithClass((CFStringRef)UTI, kUTTagClassMIMEType)) autorelease];
+	}
+	
+	return ([type length] ? type : @"application/octet-stream");
+}
+
+- (BOOL) _uploadFileToPath:(NSString*)remotePath fromStream:(NSInputStream*)stream
+{
 	CFHTTPMessageRef		request;
 	CFReadStreamRef			readStream;
 	NSURL*					finalURL;
@@ -293,16 +766,9 @@ static char* NewBase64Encode(const void *buffer, size_t length, bool separateLin
 	if(request == NULL)
 	return NO;
 	
-	if([[remotePath pathExtension] length]) {
-		UTI = (NSString*)[NSMakeCollectable(UTTypeCreatePreferredIdentifierForTag(kUTTagClassFilenameExtension, (CFStringRef)[remotePath pathExtension], NULL)) autorelease];
-		if([UTI length])
-		type = (NSString*)[NSMakeCollectable(UTTypeCopyPreferredTagWithClass((CFStringRef)UTI, kUTTagClassMIMEType)) autorelease];
-	}
-	if(![type length])
-	type = @"application/octet-stream";
-	CFHTTPMessageSetHeaderFieldValue(request, CFSTR("Content-Type"), (CFStringRef)type);
+	CFHTTPMessageSetHeaderFieldValue(request, CFSTR("Content-Type"), (CFStringRef)_MIMETypeForPath(remotePath));
 	
-	if([self maxLength] > 0)
+	if(([self maxLength] > 0) && ![self compressionEnabled]) //NOTE: The length of compressed uploads is unknown
 	CFHTTPMessageSetHeaderFieldValue(request, CFSTR("Content-Length"), (CFStringRef)[NSString stringWithFormat:@"%i", [self maxLength]]);
 	
 	readStream = [self _newReadStreamWithHTTPRequest:request bodyStream:stream];
@@ -339,7 +805,7 @@ static char* NewBase64Encode(const void *buffer, size_t length, bool separateLin
 
 @implementation WebDAVTransferController
 
-static NSDictionary* _DictionaryFromDAVProperties(MiniXMLNode* node)
+static NSDictionary* _DictionaryFromDAVProperties(NSDictionary* values)
 {
 	static NSDateFormatter*	formatter1 = nil; //FIXME: Is this class really thread-safe?
 	static NSDateFormatter*	formatter2 = nil; //FIXME: Is this class really thread-safe?
@@ -358,20 +824,20 @@ static NSDictionary* _DictionaryFromDAVProperties(MiniXMLNode* node)
 		[formatter2 setDateFormat:@"EEE, d MMM yyyy HH:mm:ss zzz"];
 	}
 	
-	if([node firstNodeAtSubpath:@"resourcetype:collection"])
+	if([values objectForKey:@"propstat:prop:resourcetype:collection"])
 	[dictionary setObject:NSFileTypeDirectory forKey:NSFileType];
 	else
 	[dictionary setObject:NSFileTypeRegular forKey:NSFileType];
 	
-	if((string = [node firstValueAtSubpath:@"creationdate"]))
+	if((string = [values objectForKey:@"propstat:prop:creationdate"]))
 	[dictionary setValue:[formatter1 dateFromString:string] forKey:NSFileCreationDate];
 	
-	if((string = [node firstValueAtSubpath:@"modificationdate"]))
+	if((string = [values objectForKey:@"propstat:prop:modificationdate"]))
 	[dictionary setValue:[formatter1 dateFromString:string] forKey:NSFileModificationDate];
-	else if((string = [node firstValueAtSubpath:@"getlastmodified"]))
+	else if((string = [values objectForKey:@"propstat:prop:getlastmodified"]))
 	[dictionary setValue:[formatter2 dateFromString:string] forKey:NSFileModificationDate];	
 	
-	if((string = [node firstValueAtSubpath:@"getcontentlength"]))
+	if((string = [values objectForKey:@"propstat:prop:getcontentlength"]))
 	[dictionary setValue:[NSNumber numberWithInteger:[string integerValue]] forKey:NSFileSize];
 	
 	return dictionary;
@@ -380,6 +846,7 @@ static NSDictionary* _DictionaryFromDAVProperties(MiniXMLNode* node)
 - (id) processReadResultStream:(NSOutputStream*)stream userInfo:(id)info error:(NSError**)error
 {
 	NSData*					data = [stream propertyForKey:NSStreamDataWrittenToMemoryStreamKey];
+	NSUInteger				length = [data length];
 	CFHTTPMessageRef		responseHeaders = [self responseHeaders];
 	NSInteger				status = (responseHeaders ? CFHTTPMessageGetResponseStatusCode(responseHeaders) : -1);
 	NSString*				method = info;
@@ -389,8 +856,7 @@ static NSDictionary* _DictionaryFromDAVProperties(MiniXMLNode* node)
 	NSString*				mime = nil;
 	NSString*				type;
 	NSRange					range;
-	MiniXMLNode*			node;
-	NSString*				path;
+	NSDictionary*			dictionary;
 	
 	if(error)
 	*error = nil;
@@ -399,7 +865,11 @@ static NSDictionary* _DictionaryFromDAVProperties(MiniXMLNode* node)
 	NSLog(@"%@ [HTTP Response]\n%@\n%@", self, [(id)(responseHeaders ? CFHTTPMessageCopyResponseStatusLine(responseHeaders) : NULL) autorelease], [(id)(responseHeaders ? CFHTTPMessageCopyAllHeaderFields(responseHeaders) : NULL) autorelease]);
 #endif
 	
-	if(responseHeaders && [data length]) {
+	//NOTE: Listings are parsed as they are received by the destination of their DataWriteStream so the body is not available in memory
+	if([method isEqualToString:@"PROPFIND"])
+	length = [(WebDAVDirectoryListing*)[(DataWriteStream*)stream dataDestination] dataLength];
+	
+	if(responseHeaders && length) {
 		type = [(NSString*)[NSMakeCollectable(CFHTTPMessageCopyHeaderFieldValue(responseHeaders, CFSTR("Content-Type"))) autorelease] lowercaseString];
 		if([type length]) {
 			range = [type rangeOfString:@";" options:0 range:NSMakeRange(0, [type length])];
@@ -426,12 +896,16 @@ static NSDictionary* _DictionaryFromDAVProperties(MiniXMLNode* node)
 			}
 		}
 		
-		if([mime isEqualToString:@"text/plain"])
-		body = [[NSString alloc] initWithData:data encoding:encoding];
+		if([mime isEqualToString:@"text/plain"]) {
+			if(data)
+			body = [[NSString alloc] initWithData:data encoding:encoding];
+		}
 		else if([mime isEqualToString:@"text/xml"] || [mime isEqualToString:@"application/xml"]) {
-			body = [[MiniXMLParser alloc] initWithXMLData:data nodeNamespace:@"DAV:"];
-			if((body == nil) && error)
-			*error = MAKE_FILETRANSFERCONTROLLER_ERROR(@"Invalid XML response");
+			if(data) {
+				body = [[MiniXMLParser alloc] initWithXMLData:data nodeNamespace:@"DAV:"];
+				if((body == nil) && error)
+				*error = MAKE_FILETRANSFERCONTROLLER_ERROR(@"Invalid XML response");
+			}
 		}
 		else if([mime length]) {
 			if(error)
@@ -440,18 +914,11 @@ static NSDictionary* _DictionaryFromDAVProperties(MiniXMLNode* node)
 	}
 	
 	if([method isEqualToString:@"PROPFIND"]) {
-		if((status == 207) && [body isKindOfClass:[MiniXMLParser class]]) {
-			result = [NSMutableDictionary dictionary];
-			path = (id)kCFNull;
-			for(node in [[(MiniXMLParser*)body firstNodeAtPath:@"multistatus"] children]) {
-				if(path == (id)kCFNull) {
-					path = nil;
-					continue;
-				}
-				path = [[[node firstValueAtSubpath:@"href"] lastPathComponent] stringByReplacingPercentEscapesUsingEncoding:NSUTF8StringEncoding];
-				if(path)
-				[result setObject:_DictionaryFromDAVProperties([node firstNodeAtSubpath:@"propstat:prop"]) forKey:path];
-			}
+		dictionary = [(WebDAVDirectoryListing*)[(DataWriteStream*)stream dataDestination] finishParsing];
+		if(status == 207) {
+			result = dictionary;
+			if((result == nil) && error)
+			*error = MAKE_FILETRANSFERCONTROLLER_ERROR(@"Invalid XML response");
 		}
 	}
 	else if([method isEqualToString:@"MOVE"] || [method isEqualToString:@"COPY"]) {
@@ -481,6 +948,12 @@ static NSDictionary* _DictionaryFromDAVProperties(MiniXMLNode* node)
 {
 	CFHTTPMessageRef		request;
 	CFReadStreamRef			stream;
+	WebDAVDirectoryListing*	listing;
+	DataWriteStream*		dataStream;
+	NSDictionary*			result;
+	
+	if((result = [self cachedContentsOfDirectoryAtPath:remotePath]))
+	return result;
 	
 	if(![remotePath length])
 	remotePath = @"/";
@@ -496,7 +969,48 @@ static NSDictionary* _DictionaryFromDAVProperties(MiniXMLNode* node)
 	stream = [self _newReadStreamWithHTTPRequest:request bodyStream:nil];
 	CFRelease(request);
 	
-	return [self runReadStream:stream dataStream:[NSOutputStream outputStreamToMemory] userInfo:@"PROPFIND" isFileTransfer:NO];
+	//NOTE: The response is parsed while it is being downloaded
+	listing = [WebDAVDirectoryListing new];
+	dataStream = [[DataWriteStream alloc] initWithDataDestination:listing userInfo:nil];
+	result = [self runReadStream:stream dataStream:dataStream userInfo:@"PROPFIND" isFileTransfer:NO];
+	[self cacheContents:result ofDirectoryAtPath:remotePath validator:[listing directoryETag]];
+	[dataStream release];
+	[listing release];
+	
+	return result;
+}
+
+/* Override */
+- (id) validatorForDirectoryAtPath:(NSString*)remotePath
+{
+	CFHTTPMessageRef		request;
+	CFReadStreamRef			stream;
+	WebDAVDirectoryListing*	listing;
+	DataWriteStream*		dataStream;
+	NSString*				etag = nil;
+	
+	if(![remotePath length])
+	remotePath = @"/";
+	else if(![remotePath hasSuffix:@"/"])
+	remotePath = [remotePath stringByAppendingString:@"/"];
+	
+	request = [self _newHTTPRequestWithMethod:@"PROPFIND" path:remotePath];
+	if(request == NULL)
+	return nil;
+	CFHTTPMessageSetHeaderFieldValue(request, CFSTR("Depth"), CFSTR("0"));
+	CFHTTPMessageSetHeaderFieldValue(request, CFSTR("Brief"), CFSTR("T"));
+	
+	stream = [self _newReadStreamWithHTTPRequest:request bodyStream:nil];
+	CFRelease(request);
+	
+	listing = [WebDAVDirectoryListing new];
+	dataStream = [[DataWriteStream alloc] initWithDataDestination:listing userInfo:nil];
+	if([self runReadStream:stream dataStream:dataStream userInfo:@"PROPFIND" isFileTransfer:NO])
+	etag = [[[listing directoryETag] retain] autorelease];
+	[dataStream release];
+	[listing release];
+	
+	return etag;
 }
 
 - (BOOL) createDirectoryAtPath:(NSString*)remotePath
@@ -504,6 +1018,8 @@ static NSDictionary* _DictionaryFromDAVProperties(MiniXMLNode* node)
 	CFHTTPMessageRef		request;
 	CFReadStreamRef			stream;
 	
+	[self invalidateCachedContentsForPath:remotePath];
+	
 	request = [self _newHTTPRequestWithMethod:@"MKCOL" path:remotePath];
 	if(request == NULL)
 	return NO;
@@ -519,6 +1035,10 @@ static NSDictionary* _DictionaryFromDAVProperties(MiniXMLNode* node)
 	CFHTTPMessageRef		request;
 	CFReadStreamRef			stream;
 	
+	if(!copy)
+	[self invalidateCachedContentsForPath:fromRemotePath];
+	[self invalidateCachedContentsForPath:toRemotePath];
+	
 	request = [self _newHTTPRequestWithMethod:(copy ? @"COPY" : @"MOVE") path:fromRemotePath];
 	if(request == NULL)
 	return NO;
@@ -550,6 +1070,8 @@ static NSDictionary* _DictionaryFromDAVProperties(MiniXMLNode* node)
 	CFHTTPMessageRef		request;
 	CFReadStreamRef			stream;
 	
+	[self invalidateCachedContentsForPath:remotePath];
+	
 	request = [self _newHTTPRequestWithMethod:@"DELETE" path:remotePath];
 	if(request == NULL)
 	return NO;
@@ -576,6 +1098,73 @@ static NSDictionary* _DictionaryFromDAVProperties(MiniXMLNode* node)
 
 @end
 
+@implementation WebDAVDirectoryListing
+
+@synthesize dataLength=_dataLength;
+
+- (id) init
+{
+	if((self = [super init])) {
+		_parser = [[MiniXMLStreamParser alloc] initWithNodeNamespace:@"DAV:" target:self selector:@selector(parser:didEndElementAtPath:values:)];
+		[_parser watchPath:@"multistatus:response"];
+		_result = [NSMutableDictionary new];
+	}
+	
+	return self;
+}
+
+- (void) dealloc
+{
+	[_directoryETag release];
+	[_result release];
+	[_parser release];
+	
+	[super dealloc];
+}
+
+- (NSString*) directoryETag
+{
+	return _directoryETag;
+}
+
+- (void) parser:(MiniXMLStreamParser*)parser didEndElementAtPath:(NSString*)path values:(NSDictionary*)values
+{
+	//NOTE: The first response is always the directory itself
+	if(_skipped == NO) {
+		_directoryETag = [[values objectForKey:@"propstat:prop:getetag"] copy];
+		_skipped = YES;
+		return;
+	}
+	
+	path = [[[values objectForKey:@"href"] lastPathComponent] stringByReplacingPercentEscapesUsingEncoding:NSUTF8StringEncoding];
+	if(path)
+	[_result setObject:_DictionaryFromDAVProperties(values) forKey:path];
+}
+
+- (NSMutableDictionary*) finishParsing
+{
+	return ([_parser finishParsing] && [[_parser rootName] isEqualToString:@"multistatus"] ? _result : nil);
+}
+
+- (BOOL) openDataStream:(id)userInfo
+{
+	return YES;
+}
+
+- (NSInteger) writeDataToStream:(id)userInfo buffer:(const void*)buffer maxLength:(NSUInteger)length
+{
+	_dataLength += length;
+	
+	return ([_parser parseBytes:buffer length:length] ? length : -1);
+}
+
+- (void) closeDataStream:(id)userInfo
+{
+	;
+}
+
+@end
+
 @implementation WebDAVTransferController (iDisk)
 
 - (id) initWithIDiskForLocalUser:(NSString*)basePath
@@ -621,9 +1210,186 @@ static NSDictionary* _DictionaryFromDAVProperties(MiniXMLNode* node)
 
 @end
 
+@implementation AmazonS3MultipartUpload
+
+@synthesize partCount=_partCount;
+
+- (id) initWithPath:(NSString*)remotePath uploadID:(NSString*)uploadID
+{
+	if((self = [super init])) {
+		pthread_mutex_init(&_mutex, NULL);
+		pthread_cond_init(&_condition, NULL);
+		_path = [remotePath copy];
+		_uploadID = [uploadID copy];
+		_pendingParts = [NSMutableArray new];
+		_etags = [NSMutableDictionary new];
+	}
+	
+	return self;
+}
+
+- (void) _cleanUp_AmazonS3MultipartUpload
+{
+	pthread_cond_destroy(&_condition);
+	pthread_mutex_destroy(&_mutex);
+}
+
+- (void) finalize
+{
+	[self _cleanUp_AmazonS3MultipartUpload];
+	
+	[super finalize];
+}
+
+- (void) dealloc
+{
+	[self _cleanUp_AmazonS3MultipartUpload];
+	
+	[_error release];
+	[_etags release];
+	[_pendingParts release];
+	[_uploadID release];
+	[_path release];
+	
+	[super dealloc];
+}
+
+- (NSError*) error
+{
+	NSError*				error;
+	
+	pthread_mutex_lock(&_mutex);
+	error = [[_error retain] autorelease];
+	pthread_mutex_unlock(&_mutex);
+	
+	return error;
+}
+
+- (void) _uploadThread:(AmazonS3TransferController*)controller
+{
+	NSAutoreleasePool*		pool = [NSAutoreleasePool new];
+	NSAutoreleasePool*		localPool;
+	NSArray*				part;
+	NSString*				etag;
+	
+	[controller setDelegate:self];
+	while(1) {
+		pthread_mutex_lock(&_mutex);
+		while(![_pendingParts count] && !_finished && !_aborted && !_error)
+		pthread_cond_wait(&_condition, &_mutex);
+		if(![_pendingParts count] || _aborted || _error) {
+			pthread_mutex_unlock(&_mutex);
+			break;
+		}
+		part = [[_pendingParts objectAtIndex:0] retain];
+		[_pendingParts removeObjectAtIndex:0];
+		pthread_mutex_unlock(&_mutex);
+		
+		localPool = [NSAutoreleasePool new];
+		etag = [controller _uploadPart:[[part objectAtIndex:0] unsignedIntegerValue] data:[part objectAtIndex:1] uploadID:_uploadID toPath:_path];
+		pthread_mutex_lock(&_mutex);
+		if(etag)
+		[_etags setObject:etag forKey:[part objectAtIndex:0]];
+		else if((_error == nil) && !_aborted)
+		_error = [MAKE_FILETRANSFERCONTROLLER_ERROR(@"Failed uploading part #%@", [part objectAtIndex:0]) retain];
+		_activeCount -= 1;
+		pthread_cond_broadcast(&_condition);
+		pthread_mutex_unlock(&_mutex);
+		[localPool drain];
+		[part release];
+	}
+	[controller setDelegate:nil];
+	
+	pthread_mutex_lock(&_mutex);
+	_threadCount -= 1;
+	pthread_cond_broadcast(&_condition);
+	pthread_mutex_unlock(&_mutex);
+	
+	[pool drain];
+}
+
+- (void) startThreadWithController:(AmazonS3TransferController*)controller
+{
+	pthread_mutex_lock(&_mutex);
+	_threadCount += 1;
+	pthread_mutex_unlock(&_mutex);
+	
+	[NSThread detachNewThreadSelector:@selector(_uploadThread:) toTarget:self withObject:controller];
+}
+
+- (BOOL) addPart:(NSData*)data maximumActiveParts:(NSUInteger)max
+{
+	BOOL					success;
+	
+	pthread_mutex_lock(&_mutex);
+	while((_activeCount >= max) && !_aborted && !_error)
+	pthread_cond_wait(&_condition, &_mutex);
+	success = (!_aborted && !_error);
+	if(success) {
+		_partCount += 1;
+		[_pendingParts addObject:[NSArray arrayWithObjects:[NSNumber numberWithUnsignedInteger:_partCount], data, nil]];
+		_activeCount += 1;
+		pthread_cond_broadcast(&_condition);
+	}
+	pthread_mutex_unlock(&_mutex);
+	
+	return success;
+}
+
+- (void) abort
+{
+	pthread_mutex_lock(&_mutex);
+	_aborted = YES;
+	pthread_cond_broadcast(&_condition);
+	pthread_mutex_unlock(&_mutex);
+}
+
+- (NSArray*) waitUntilDone
+{
+	NSMutableArray*			etags = nil;
+	NSUInteger				i;
+	
+	pthread_mutex_lock(&_mutex);
+	_finished = YES;
+	pthread_cond_broadcast(&_condition);
+	while(_threadCount)
+	pthread_cond_wait(&_condition, &_mutex);
+	if(!_aborted && !_error && ([_etags count] == _partCount)) {
+		etags = [NSMutableArray arrayWithCapacity:_partCount];
+		for(i = 1; i <= _partCount; ++i)
+		[etags addObject:[_etags objectForKey:[NSNumber numberWithUnsignedInteger:i]]];
+	}
+	pthread_mutex_unlock(&_mutex);
+	
+	return etags;
+}
+
+- (void) fileTransferControllerDidFail:(FileTransferController*)controller withError:(NSError*)error
+{
+	pthread_mutex_lock(&_mutex);
+	if(_error == nil)
+	_error = [error retain];
+	pthread_cond_broadcast(&_condition);
+	pthread_mutex_unlock(&_mutex);
+}
+
+/* Stop the other parts as soon as one fails */
+- (BOOL) fileTransferControllerShouldAbort:(FileTransferController*)controller
+{
+	BOOL					abort;
+	
+	pthread_mutex_lock(&_mutex);
+	abort = (_aborted || _error);
+	pthread_mutex_unlock(&_mutex);
+	
+	return abort;
+}
+
+@end
+
 @implementation AmazonS3TransferController
 
-@synthesize productToken=_productToken, userToken=_userToken, newBucketLocation=_newBucketLocation;
+@synthesize productToken=_productToken, userToken=_userToken, newBucketLocation=_newBucketLocation, multipartUploadPartSize=_multipartPartSize, multipartUploadConcurrency=_multipartConcurrency;
 
 + (NSDictionary*) activateDesktopProduct:(NSString*)productToken activationKey:(NSString*)activationKey expirationInterval:(NSTimeInterval)expirationInterval error:(NSError**)error
 {
@@ -679,7 +1445,7 @@ static NSDictionary* _DictionaryFromDAVProperties(MiniXMLNode* node)
 	}
 	else if(error)
 	*error = MAKE_ERROR(@"s3", -1, @"Failed retrieving activation data");
-
+	
 	return dictionary;
 }
 
@@ -719,7 +1485,10 @@ static NSDictionary* _DictionaryFromDAVProperties(MiniXMLNode* node)
 		return nil;
 	}
 	
-	return [super initWithBaseURL:url];
+	if((self = [super initWithBaseURL:url]))
+	_multipartConcurrency = kMultipartDefaultConcurrency;
+	
+	return self;
 }
 
 - (id) initWithAccessKeyID:(NSString*)accessKeyID secretAccessKey:(NSString*)secretAccessKey bucket:(NSString*)bucket
@@ -786,19 +1555,25 @@ static NSData* _ComputeSHA1HMAC(NSData* data, NSString* key)
 	return hash;
 }
 
-static NSString* _EncodeBase64(NSData* data)
+/* Sub-resources must be part of the signed resource and sorted by name */
+static NSString* _SubResourcesFromQuery(NSString* query)
 {
-	NSString*				string = nil;
-	char*					buffer;
-	size_t					length;
+	static NSSet*			subResources = nil;
+	NSMutableArray*			array = [NSMutableArray array];
+	NSString*				parameter;
+	NSRange					range;
 	
-	buffer = NewBase64Encode([data bytes], [data length], false, &length);
-	if(buffer) {
-		string = [[[NSString alloc] initWithBytes:buffer length:length encoding:NSUTF8StringEncoding] autorelease];
-		free(buffer);
+	if(subResources == nil)
+	subResources = [[NSSet alloc] initWithObjects:@"location", @"logging", @"torrent", @"partNumber", @"uploadId", @"uploads", nil];
+	
+	for(parameter in [query componentsSeparatedByString:@"&"]) {
+		range = [parameter rangeOfString:@"="];
+		if([subResources containsObject:(range.location != NSNotFound ? [parameter substringToIndex:range.location] : parameter)])
+		[array addObject:parameter];
 	}
+	[array sortUsingSelector:@selector(compare:)];
 	
-	return string;
+	return ([array count] ? [array componentsJoinedByString:@"&"] : nil);
 }
 
 /* See http://docs.amazonwebservices.com/AmazonS3/2006-03-01/index.html?RESTAuthentication.html */
@@ -823,7 +1598,9 @@ static NSString* _EncodeBase64(NSData* data)
 		[formatter setDateFormat:@"EEE, d MMM yyyy HH:mm:ss Z"];
 	}
 	
-	dateString = [formatter stringFromDate:[NSDate date]];
+	@synchronized(formatter) { //NOTE: Multipart uploads sign requests from multiple threads
+		dateString = [formatter stringFromDate:[NSDate date]];
+	}
 	CFHTTPMessageSetHeaderFieldValue(request, CFSTR("Date"), (CFStringRef)dateString);
 	
 	if(_productToken && _userToken)
@@ -851,9 +1628,9 @@ static NSString* _EncodeBase64(NSData* data)
 		else
 		[buffer appendFormat:@"/%@/", [host substringToIndex:range.location]];
 	}
-	if([query isEqualToString:@"location"] || [query isEqualToString:@"logging"] || [query isEqualToString:@"torrent"])
+	if([query length] && (query = _SubResourcesFromQuery(query)))
 	[buffer appendFormat:@"?%@", query];
-	authorization = _EncodeBase64(_ComputeSHA1HMAC([buffer dataUsingEncoding:NSUTF8StringEncoding], [[self baseURL] passwordByReplacingPercentEscapes]));
+	authorization = Base64EncodeData(_ComputeSHA1HMAC([buffer dataUsingEncoding:NSUTF8StringEncoding], [[self baseURL] passwordByReplacingPercentEscapes]));
 	[buffer release];
 	
 	CFHTTPMessageSetHeaderFieldValue(request, CFSTR("Authorization"), (CFStringRef)[NSString stringWithFormat:@"AWS %@:%@", [[self baseURL] user], authorization]);
@@ -861,7 +1638,7 @@ static NSString* _EncodeBase64(NSData* data)
 	return [super _newReadStreamWithHTTPRequest:request bodyStream:stream];
 }
 
-static NSDictionary* _DictionaryFromS3Buckets(MiniXMLNode* node)
+static NSDictionary* _DictionaryFromS3Buckets(NSDictionary* values)
 {
 	static NSDateFormatter*	formatter = nil; //FIXME: Is this class really thread-safe?
 	NSMutableDictionary*	dictionary = [NSMutableDictionary dictionary];
@@ -876,19 +1653,17 @@ static NSDictionary* _DictionaryFromS3Buckets(MiniXMLNode* node)
 	
 	[dictionary setObject:NSFileTypeDirectory forKey:NSFileType];
 	
-	if((string = [node firstValueAtSubpath:@"CreationDate"]))
+	if((string = [values objectForKey:@"CreationDate"]))
 	[dictionary setValue:[formatter dateFromString:string] forKey:NSFileCreationDate]; //FIXME: We ignore Z and assume UTC (%z)
 	
 	return dictionary;
 }	
 
-static NSDictionary* _DictionaryFromS3Objects(MiniXMLNode* node, NSString* basePath, NSString** path)
+static NSDictionary* _DictionaryFromS3Objects(NSDictionary* values)
 {
 	static NSDateFormatter*	formatter = nil; //FIXME: Is this class really thread-safe?
 	NSMutableDictionary*	dictionary = [NSMutableDictionary dictionary];
-	BOOL					isDirectory = NO;
 	NSString*				string;
-	NSRange					range;
 	
 	if(formatter == nil) {
 		formatter = [NSDateFormatter new];
@@ -897,31 +1672,11 @@ static NSDictionary* _DictionaryFromS3Objects(MiniXMLNode* node, NSString* baseP
 		[formatter setDateFormat:@"yyyy-MM-dd'T'HH:mm:ss.SSS'Z'"]; //FIXME: We ignore Z and assume UTC
 	}
 	
-	string = [node firstValueAtSubpath:@"Key"];
-	if(basePath) {
-		range = [string rangeOfString:@"/" options:0 range:NSMakeRange([basePath length] + 1, [string length] - [basePath length] - 1)];
-		if((range.location != NSNotFound) && (range.location != [string length] - 1))
-		return nil;
-		
-		if([string characterAtIndex:([string length] - 1)] == '/')
-		isDirectory = YES;
-		
-		*path = [string lastPathComponent];
-		if(isDirectory && [*path isEqualToString:basePath])
-		return nil;
-		
-		[dictionary setObject:(isDirectory ? NSFileTypeDirectory : NSFileTypeRegular) forKey:NSFileType];
-	}
-	else
-	*path = string;
-	
-	if((string = [node firstValueAtSubpath:@"LastModified"]))
+	if((string = [values objectForKey:@"LastModified"]))
 	[dictionary setValue:[formatter dateFromString:string] forKey:NSFileModificationDate];
 	
-	if(isDirectory == NO) {
-		if((string = [node firstValueAtSubpath:@"Size"]))
-		[dictionary setValue:[NSNumber numberWithInteger:[string integerValue]] forKey:NSFileSize];
-	}
+	if((string = [values objectForKey:@"Size"]))
+	[dictionary setValue:[NSNumber numberWithInteger:[string integerValue]] forKey:NSFileSize];
 	
 	return dictionary;
 }	
@@ -929,6 +1684,7 @@ static NSDictionary* _DictionaryFromS3Objects(MiniXMLNode* node, NSString* baseP
 - (id) processReadResultStream:(NSOutputStream*)stream userInfo:(id)info error:(NSError**)error
 {
 	NSData*					data = [stream propertyForKey:NSStreamDataWrittenToMemoryStreamKey];
+	NSUInteger				length = [data length];
 	CFHTTPMessageRef		responseHeaders = [self responseHeaders];
 	NSInteger				status = (responseHeaders ? CFHTTPMessageGetResponseStatusCode(responseHeaders) : -1);
 	NSString*				method = info;
@@ -937,11 +1693,10 @@ static NSDictionary* _DictionaryFromS3Objects(MiniXMLNode* node, NSString* baseP
 	NSString*				mime = nil;
 	NSString*				type;
 	NSRange					range;
+	AmazonS3BucketListing*	listing = nil;
+	NSDictionary*			dictionary;
 	MiniXMLNode*			node;
-	NSDictionary*			properties;
-	NSString*				path;
 	NSString*				string;
-	NSMutableDictionary*	dictionary;
 	
 	if(error)
 	*error = nil;
@@ -950,7 +1705,11 @@ static NSDictionary* _DictionaryFromS3Objects(MiniXMLNode* node, NSString* baseP
 	NSLog(@"%@ [HTTP Response]\n%@\n%@", self, [(id)(responseHeaders ? CFHTTPMessageCopyResponseStatusLine(responseHeaders) : NULL) autorelease], [(id)(responseHeaders ? CFHTTPMessageCopyAllHeaderFields(responseHeaders) : NULL) autorelease]);
 #endif
 	
-	if(responseHeaders && [data length]) {
+	//NOTE: Listings are parsed as they are received by the destination of their DataWriteStream so the body is not available in memory
+	if([method isEqualToString:@"GET/"])
+	length = [(AmazonS3BucketListing*)[(DataWriteStream*)stream dataDestination] dataLength];
+	
+	if(responseHeaders && length) {
 		type = [(NSString*)[NSMakeCollectable(CFHTTPMessageCopyHeaderFieldValue(responseHeaders, CFSTR("Content-Type"))) autorelease] lowercaseString];
 		if([type length]) {
 			range = [type rangeOfString:@";" options:0 range:NSMakeRange(0, [type length])];
@@ -961,9 +1720,11 @@ static NSDictionary* _DictionaryFromS3Objects(MiniXMLNode* node, NSString* baseP
 		}
 		
 		if([mime isEqualToString:@"application/xml"]) {
-			body = [[MiniXMLParser alloc] initWithXMLData:data nodeNamespace:nil];
-			if((body == nil) && error)
-			*error = MAKE_FILETRANSFERCONTROLLER_ERROR(@"Invalid XML response");
+			if(data) {
+				body = [[MiniXMLParser alloc] initWithXMLData:data nodeNamespace:nil];
+				if((body == nil) && error)
+				*error = MAKE_FILETRANSFERCONTROLLER_ERROR(@"Invalid XML response");
+			}
 		}
 		else if([mime length]) {
 			if(error)
@@ -972,32 +1733,12 @@ static NSDictionary* _DictionaryFromS3Objects(MiniXMLNode* node, NSString* baseP
 	}
 	
 	if([method isEqualToString:@"GET/"]) {
-		if((status == 200) && [body isKindOfClass:[MiniXMLParser class]]) {
-			string = [[(MiniXMLParser*)body rootNode] name];
-			if([string isEqualToString:@"ListBucketResult"]) {
-				dictionary = [NSMutableDictionary new];
-				result = [NSMutableDictionary dictionary];
-				for(node in [[(MiniXMLParser*)body rootNode] children]) {
-					string = [node name];
-					if([string isEqualToString:@"Contents"]) {
-						properties = _DictionaryFromS3Objects(node, nil, &path);
-						if(properties)
-						[result setObject:properties forKey:path];
-					}
-					else if(string)
-					[dictionary setValue:[node value] forKey:string];
-				}
-				[result setObject:dictionary forKey:[NSNull null]];
-				[dictionary release];
-			}
-			else if([string isEqualToString:@"ListAllMyBucketsResult"]) {
-				result = [NSMutableDictionary dictionary];
-				for(node in [[(MiniXMLParser*)body firstNodeAtPath:@"ListAllMyBucketsResult:Buckets"] children]) {
-					path = [node firstValueAtSubpath:@"Name"];
-					if(path)
-					[result setObject:_DictionaryFromS3Buckets(node) forKey:path];
-				}
-			}
+		listing = (AmazonS3BucketListing*)[(DataWriteStream*)stream dataDestination];
+		dictionary = [listing finishParsing];
+		if(status == 200) {
+			result = dictionary;
+			if((result == nil) && error)
+			*error = MAKE_FILETRANSFERCONTROLLER_ERROR(@"Invalid XML response");
 		}
 	}
 	else if([method isEqualToString:@"GET?"]) {
@@ -1018,6 +1759,18 @@ static NSDictionary* _DictionaryFromS3Objects(MiniXMLNode* node, NSString* baseP
 		if((status == 200) && [body isKindOfClass:[MiniXMLParser class]] && [[[(MiniXMLParser*)body rootNode] name] isEqualToString:@"CopyObjectResult"])
 		result = [NSNumber numberWithBool:YES];
 	}
+	else if([method isEqualToString:@"POST?uploads"]) {
+		if((status == 200) && [body isKindOfClass:[MiniXMLParser class]] && [[[(MiniXMLParser*)body rootNode] name] isEqualToString:@"InitiateMultipartUploadResult"])
+		result = [(MiniXMLParser*)body firstValueAtPath:@"InitiateMultipartUploadResult:UploadId"];
+	}
+	else if([method isEqualToString:@"PUT?partNumber"]) {
+		if(status == 200)
+		result = [NSMakeCollectable(CFHTTPMessageCopyHeaderFieldValue(responseHeaders, CFSTR("ETag"))) autorelease];
+	}
+	else if([method isEqualToString:@"POST?uploadId"]) {
+		if((status == 200) && [body isKindOfClass:[MiniXMLParser class]] && [[[(MiniXMLParser*)body rootNode] name] isEqualToString:@"CompleteMultipartUploadResult"]) //NOTE: Errors can be returned with a 200 status
+		result = [NSNumber numberWithBool:YES];
+	}
 	else
 	result = [super processReadResultStream:stream userInfo:info error:error];
 	
@@ -1028,7 +1781,7 @@ static NSDictionary* _DictionaryFromS3Objects(MiniXMLNode* node, NSString* baseP
 			string = [(MiniXMLParser*)body firstValueAtPath:@"Error:Code"];
 		}
 		else
-		string = nil;
+		string = [listing errorMessage];
 		if(string)
 		*error = MAKE_HTTP_ERROR(status, @"Amazon S3 Error: %@", string);
 		else
@@ -1040,11 +1793,13 @@ static NSDictionary* _DictionaryFromS3Objects(MiniXMLNode* node, NSString* baseP
 	return result;
 }
 
-- (NSDictionary*) bucketKeysForPath:(NSString*)remotePath withPrefix:(NSString*)prefix marker:(NSString*)marker delimiter:(NSString*)delimiter maxKeys:(NSUInteger)max isTruncated:(BOOL*)truncated
+- (NSDictionary*) _bucketKeysForPath:(NSString*)remotePath withPrefix:(NSString*)prefix marker:(NSString*)marker delimiter:(NSString*)delimiter maxKeys:(NSUInteger)max nextMarker:(NSString**)nextMarker
 {
 	CFHTTPMessageRef		request;
 	CFReadStreamRef			stream;
 	NSMutableString*		query;
+	AmazonS3BucketListing*	listing;
+	DataWriteStream*		dataStream;
 	NSDictionary*			result;
 	NSDictionary*			info;
 	
@@ -1065,7 +1820,7 @@ static NSDictionary* _DictionaryFromS3Objects(MiniXMLNode* node, NSString* baseP
 		if(max) {
 			if([query length])
 			[query appendString:@"&"];
-			[query appendFormat:@"max-keys=%lu", max];
+			[query appendFormat:@"max-keys=%lu", (unsigned long)max];
 		}
 		remotePath = (remotePath ? [remotePath stringByAppendingFormat:@"?%@", query] : [NSString stringWithFormat:@"?%@", query]);
 	}
@@ -1077,43 +1832,84 @@ static NSDictionary* _DictionaryFromS3Objects(MiniXMLNode* node, NSString* baseP
 	stream = [self _newReadStreamWithHTTPRequest:request bodyStream:nil];
 	CFRelease(request);
 	
-	result = [self runReadStream:stream dataStream:[NSOutputStream outputStreamToMemory] userInfo:@"GET/" isFileTransfer:NO];
+	//NOTE: The response is parsed while it is being downloaded
+	listing = [AmazonS3BucketListing new];
+	dataStream = [[DataWriteStream alloc] initWithDataDestination:listing userInfo:nil];
+	[listing release];
+	result = [self runReadStream:stream dataStream:dataStream userInfo:@"GET/" isFileTransfer:NO];
+	[dataStream release];
 	if(result == nil)
 	return nil;
 	
 	if((info = [result objectForKey:[NSNull null]])) {
-		if(truncated)
-		*truncated = ([info objectForKey:@"IsTruncated"] && ([[info objectForKey:@"IsTruncated"] caseInsensitiveCompare:@"true"] == NSOrderedSame));
-		result = [NSMutableDictionary dictionaryWithDictionary:result];
-		[(NSMutableDictionary*)result removeObjectForKey:[NSNull null]];
+		if(nextMarker) {
+			if([info objectForKey:@"IsTruncated"] && ([[info objectForKey:@"IsTruncated"] caseInsensitiveCompare:@"true"] == NSOrderedSame))
+			*nextMarker = [info objectForKey:@"NextMarker"];
+			else
+			*nextMarker = nil;
+		}
+		[(NSMutableDictionary*)result removeObjectForKey:[NSNull null]]; //NOTE: The listing is built by AmazonS3BucketListing so it is mutable
 	}
-	else if(truncated)
-	*truncated = NO;
+	else if(nextMarker)
+	*nextMarker = nil;
 	
 	return result;
 }
 
-- (NSDictionary*) contentsOfDirectoryAtPath:(NSString*)remotePath
+- (NSDictionary*) bucketKeysForPath:(NSString*)remotePath withPrefix:(NSString*)prefix marker:(NSString*)marker delimiter:(NSString*)delimiter maxKeys:(NSUInteger)max isTruncated:(BOOL*)truncated
+{
+	NSDictionary*			result;
+	NSString*				nextMarker;
+	
+	result = [self _bucketKeysForPath:remotePath withPrefix:prefix marker:marker delimiter:delimiter maxKeys:max nextMarker:&nextMarker];
+	if(result && truncated)
+	*truncated = (nextMarker != nil);
+	
+	return result;
+}
+
+- (BOOL) enumerateBucketKeysForPath:(NSString*)remotePath withPrefix:(NSString*)prefix delimiter:(NSString*)delimiter target:(id)target selector:(SEL)selector context:(void*)context
 {
-	NSMutableDictionary*	allResults = [NSMutableDictionary dictionary];
+	BOOL					(*callback)(id, SEL, NSDictionary*, void*) = (BOOL(*)(id, SEL, NSDictionary*, void*))[target methodForSelector:selector];
 	NSString*				marker = nil;
 	NSAutoreleasePool*		localPool;
-	BOOL					isTruncated;
 	NSDictionary*			result;
+	BOOL					success;
+	
+	if(callback == NULL)
+	return NO;
 	
 	do {
 		localPool = [NSAutoreleasePool new];
-		result = [self bucketKeysForPath:remotePath withPrefix:nil marker:marker delimiter:nil maxKeys:0 isTruncated:&isTruncated];
-		if(isTruncated)
-		marker = [[[[result allKeys] sortedArrayUsingSelector:@selector(compare:)] lastObject] retain];
-		else
-		marker = nil;
-		[allResults addEntriesFromDictionary:result];
+		result = [self _bucketKeysForPath:remotePath withPrefix:prefix marker:marker delimiter:delimiter maxKeys:0 nextMarker:&marker];
+		success = (result && (*callback)(target, selector, result, context));
+		[marker retain];
 		[localPool drain];
 		[marker autorelease];
-		if(result == nil)
-		return nil;
-	} while(marker);
+	} while(success && marker);
+	
+	return success;
+}
+
+- (BOOL) _addBucketKeys:(NSDictionary*)keys context:(void*)context
+{
+	[(NSMutableDictionary*)context addEntriesFromDictionary:keys];
+	
+	return YES;
+}
+
+- (NSDictionary*) contentsOfDirectoryAtPath:(NSString*)remotePath
+{
+	NSMutableDictionary*	allResults;
+	NSDictionary*			contents;
+	
+	if((contents = [self cachedContentsOfDirectoryAtPath:remotePath]))
+	return contents;
+	
+	allResults = [NSMutableDictionary dictionary];
+	if(![self enumerateBucketKeysForPath:remotePath withPrefix:nil delimiter:nil target:self selector:@selector(_addBucketKeys:context:) context:allResults])
+	return nil;
+	[self cacheContents:allResults ofDirectoryAtPath:remotePath validator:nil]; //NOTE: S3 has no cheap way to tell whether a bucket changed so listings only expire
 	
 	return allResults;
 }
@@ -1123,6 +1919,8 @@ static NSDictionary* _DictionaryFromS3Objects(MiniXMLNode* node, NSString* baseP
 	CFHTTPMessageRef		request;
 	CFReadStreamRef			stream;
 	
+	[self invalidateCachedContentsForPath:remotePath];
+	
 	request = [self _newHTTPRequestWithMethod:@"DELETE" path:remotePath];
 	if(request == NULL)
 	return NO;
@@ -1144,6 +1942,8 @@ static NSDictionary* _DictionaryFromS3Objects(MiniXMLNode* node, NSString* baseP
 	CFHTTPMessageRef		request;
 	CFReadStreamRef			stream;
 	
+	[self invalidateCachedContentsForPath:toRemotePath];
+	
 	if(![fromRemotePath length])
 	return NO;
 	if([fromRemotePath characterAtIndex:0] != '/') {
@@ -1172,6 +1972,8 @@ static NSDictionary* _DictionaryFromS3Objects(MiniXMLNode* node, NSString* baseP
 	NSString*				xmlString;
 	NSData*					xmlData;
 	
+	[self invalidateCachedContentsForPath:remotePath];
+	
 	request = [self _newHTTPRequestWithMethod:@"PUT" path:remotePath];
 	if(request == NULL)
 	return NO;
@@ -1194,6 +1996,178 @@ static NSDictionary* _DictionaryFromS3Objects(MiniXMLNode* node, NSString* baseP
 	return [self _deletePath:remotePath];
 }
 
+- (void) setMultipartUploadPartSize:(NSUInteger)size
+{
+	_multipartPartSize = (size ? MAX(size, kMultipartMinimumPartSize) : 0);
+}
+
+- (NSString*) _uploadPart:(NSUInteger)partNumber data:(NSData*)data uploadID:(NSString*)uploadID toPath:(NSString*)remotePath
+{
+	unsigned char			md5[CC_MD5_DIGEST_LENGTH];
+	CFHTTPMessageRef		request;
+	CFReadStreamRef			stream;
+	
+	request = [self _newHTTPRequestWithMethod:@"PUT" path:[NSString stringWithFormat:@"%@?partNumber=%lu&uploadId=%@", remotePath, (unsigned long)partNumber, uploadID]];
+	if(request == NULL)
+	return nil;
+	
+	CC_MD5([data bytes], [data length], md5);
+	CFHTTPMessageSetHeaderFieldValue(request, CFSTR("Content-MD5"), (CFStringRef)Base64EncodeData([NSData dataWithBytes:md5 length:CC_MD5_DIGEST_LENGTH]));
+	CFHTTPMessageSetHeaderFieldValue(request, CFSTR("Content-Length"), (CFStringRef)[NSString stringWithFormat:@"%lu", (unsigned long)[data length]]);
+	CFHTTPMessageSetBody(request, (CFDataRef)data);
+	
+	stream = [self _newReadStreamWithHTTPRequest:request bodyStream:nil];
+	CFRelease(request);
+	
+	return [self runReadStream:stream dataStream:[NSOutputStream outputStreamToMemory] userInfo:@"PUT?partNumber" isFileTransfer:NO];
+}
+
+/* See http://docs.amazonwebservices.com/AmazonS3/latest/dev/mpuoverview.html */
+- (BOOL) _uploadFileToPath:(NSString*)remotePath fromStream:(NSInputStream*)stream
+{
+	NSUInteger					length = [self maxLength];
+	NSUInteger					concurrency = MAX(_multipartConcurrency, 1);
+	NSUInteger					partSize = (_multipartPartSize ? _multipartPartSize : kMultipartMinimumPartSize);
+	id<FileTransferControllerDelegate>	delegate = [self delegate];
+	BOOL						delegateHasShouldAbort = [delegate respondsToSelector:@selector(fileTransferControllerShouldAbort:)];
+	NSError*					error = nil;
+	BOOL						success;
+	CFHTTPMessageRef			request;
+	CFReadStreamRef				readStream;
+	NSString*					uploadID;
+	AmazonS3MultipartUpload*	upload;
+	AmazonS3TransferController*	controller;
+	NSMutableData*				data;
+	NSUInteger					partLength;
+	NSInteger					numBytes;
+	void*						buffer;
+	NSArray*					etags;
+	NSMutableString*			xmlString;
+	NSData*						xmlData;
+	NSUInteger					i;
+	
+	//NOTE: Multipart uploads are only worth it if there's going to be more than one part (the length is unknown when uploading from a stream) - Compressed uploads always use them as S3 rejects PUT requests without a Content-Length
+	if(![self compressionEnabled] && (!_multipartPartSize || (length && (length <= _multipartPartSize))))
+	return [super _uploadFileToPath:remotePath fromStream:stream];
+	
+	if(![remotePath length] || !stream || ([stream streamStatus] != NSStreamStatusNotOpen))
+	return NO;
+	
+	request = [self _newHTTPRequestWithMethod:@"POST" path:[remotePath stringByAppendingString:@"?uploads"]];
+	if(request == NULL)
+	return NO;
+	
+	CFHTTPMessageSetHeaderFieldValue(request, CFSTR("Content-Type"), (CFStringRef)_MIMETypeForPath(remotePath));
+	CFHTTPMessageSetHeaderFieldValue(request, CFSTR("Content-Length"), CFSTR("0"));
+	CFHTTPMessageSetBody(request, (CFDataRef)[NSData data]);
+	
+	//NOTE: The internal requests must not report themselves as transfers to the delegate
+	if([delegate respondsToSelector:@selector(fileTransferControllerDidStart:)])
+	[delegate fileTransferControllerDidStart:self];
+	[self setSilent:YES];
+	readStream = [self _newReadStreamWithHTTPRequest:request bodyStream:nil];
+	CFRelease(request);
+	uploadID = [self runReadStream:readStream dataStream:[NSOutputStream outputStreamToMemory] userInfo:@"POST?uploads" isFileTransfer:NO];
+	[self setSilent:NO];
+	if(uploadID == nil)
+	return NO;
+	[self setMaxLength:length]; //NOTE: The response to the initiate request has overwritten the transfer length
+	
+	//NOTE: Each upload thread uses its own controller so that requests don't interfere with each other
+	upload = [[AmazonS3MultipartUpload alloc] initWithPath:remotePath uploadID:uploadID];
+	for(i = 0; i < concurrency; ++i) {
+		controller = [[[self class] alloc] initWithBaseURL:[self baseURL]];
+		[controller setTimeOut:[self timeOut]];
+		[controller setSSLCertificateValidationDisabled:[self isSSLCertificateValidationDisabled]];
+		[controller setKeepConnectionAlive:[self keepConnectionAlive]];
+		[controller setProductToken:_productToken];
+		[controller setUserToken:_userToken];
+		[upload startThreadWithController:controller];
+		[controller release];
+	}
+	
+	//NOTE: Parts are read sequentially through the regular stream methods so that digest and encryption are computed over the entire file
+	success = [self openInputStream:stream isFileTransfer:YES];
+	if(success) {
+		buffer = malloc(kFileBufferSize);
+		data = [NSMutableData new];
+		do {
+			if(delegateHasShouldAbort && [[self delegate] fileTransferControllerShouldAbort:self]) {
+				success = NO;
+				break;
+			}
+			
+			numBytes = [self readFromInputStream:stream bytes:buffer maxLength:kFileBufferSize];
+			if(numBytes < 0) {
+				error = MAKE_FILETRANSFERCONTROLLER_ERROR(@"Failed reading from data stream");
+				success = NO;
+				break;
+			}
+			if(numBytes > 0) {
+				[data appendBytes:buffer length:numBytes];
+				[self setCurrentLength:([self currentLength] + numBytes)];
+			}
+			
+			while(([data length] >= partSize) || ((numBytes == 0) && ([data length] || ![upload partCount]))) {
+				partLength = MIN([data length], partSize);
+				if(![upload addPart:[data subdataWithRange:NSMakeRange(0, partLength)] maximumActiveParts:concurrency]) {
+					success = NO;
+					break;
+				}
+				[data replaceBytesInRange:NSMakeRange(0, partLength) withBytes:NULL length:0];
+			}
+		} while(success && (numBytes > 0));
+		[data release];
+		free(buffer);
+		[self closeInputStream:stream];
+	}
+	
+	if(!success)
+	[upload abort];
+	etags = [upload waitUntilDone];
+	if((etags == nil) && (error == nil))
+	error = [upload error];
+	[upload release];
+	
+	if(etags) {
+		request = [self _newHTTPRequestWithMethod:@"POST" path:[NSString stringWithFormat:@"%@?uploadId=%@", remotePath, uploadID]];
+		if(request) {
+			xmlString = [NSMutableString stringWithString:@"<CompleteMultipartUpload>"];
+			for(i = 0; i < [etags count]; ++i)
+			[xmlString appendFormat:@"<Part><PartNumber>%lu</PartNumber><ETag>%@</ETag></Part>", (unsigned long)(i + 1), [etags objectAtIndex:i]];
+			[xmlString appendString:@"</CompleteMultipartUpload>"];
+			xmlData = [xmlString dataUsingEncoding:NSUTF8StringEncoding];
+			CFHTTPMessageSetHeaderFieldValue(request, CFSTR("Content-Length"), (CFStringRef)[NSString stringWithFormat:@"%lu", (unsigned long)[xmlData length]]);
+			CFHTTPMessageSetBody(request, (CFDataRef)xmlData);
+			
+			[self setSilent:YES];
+			readStream = [self _newReadStreamWithHTTPRequest:request bodyStream:nil];
+			CFRelease(request);
+			success = [[self runReadStream:readStream dataStream:[NSOutputStream outputStreamToMemory] userInfo:@"POST?uploadId" isFileTransfer:NO] boolValue];
+			[self setSilent:NO];
+			if(success) {
+				if([delegate respondsToSelector:@selector(fileTransferControllerDidSucceed:)])
+				[delegate fileTransferControllerDidSucceed:self];
+				return YES;
+			}
+		}
+	}
+	else if(error && [delegate respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+	[delegate fileTransferControllerDidFail:self withError:error];
+	
+	//NOTE: Parts of incomplete uploads are stored (and billed) until the upload is aborted - This does not delete "remotePath" itself so the listing cache is left alone, and the failure has already been reported so the delegate is detached
+	request = [self _newHTTPRequestWithMethod:@"DELETE" path:[NSString stringWithFormat:@"%@?uploadId=%@", remotePath, uploadID]];
+	if(request) {
+		[self setDelegate:nil];
+		readStream = [self _newReadStreamWithHTTPRequest:request bodyStream:nil];
+		CFRelease(request);
+		[self runReadStream:readStream dataStream:[NSOutputStream outputStreamToMemory] userInfo:@"DELETE" isFileTransfer:NO];
+		[self setDelegate:delegate];
+	}
+	
+	return NO;
+}
+
 - (NSString*) locationForPath:(NSString*)remotePath
 {
 	NSString*				host = [[self baseURL] host];
@@ -1224,163 +2198,104 @@ static NSDictionary* _DictionaryFromS3Objects(MiniXMLNode* node, NSString* baseP
 
 @end
 
-@implementation SecureAmazonS3TransferController
+@implementation AmazonS3BucketListing
 
-+ (NSString*) urlScheme;
-{
-	return @"https";
-}
-
-@end
+@synthesize errorMessage=_errorMessage, dataLength=_dataLength;
 
-/* Source below was copied from http://cocoawithlove.com/2009/06/base64-encoding-options-on-mac-and.html */
-
-//
-//  NSData+Base64.h
-//  base64
-//
-//  Created by Matt Gallagher on 2009/06/03.
-//  Copyright 2009 Matt Gallagher. All rights reserved.
-//
-//  Permission is given to use this source code file, free of charge, in any
-//  project, commercial or otherwise, entirely at your risk, with the condition
-//  that any redistribution (in part or whole) of source code must retain
-//  this copyright and permission notice. Attribution in compiled projects is
-//  appreciated but not required.
-//
-
-static unsigned char base64EncodeLookup[65] =
-	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-
-//
-// Fundamental sizes of the binary and base64 encode/decode units in bytes
-//
-#define BINARY_UNIT_SIZE 3
-#define BASE64_UNIT_SIZE 4
-
-//
-// NewBase64Decode
-//
-// Encodes the arbitrary data in the inputBuffer as base64 into a newly malloced
-// output buffer.
-//
-//  inputBuffer - the source data for the encode
-//	length - the length of the input in bytes
-//  separateLines - if zero, no CR/LF characters will be added. Otherwise
-//		a CR/LF pair will be added every 64 encoded chars.
-//	outputLength - if not-NULL, on output will contain the encoded length
-//		(not including terminating 0 char)
-//
-// returns the encoded buffer. Must be free'd by caller. Length is given by
-//	outputLength.
-//
-static char *NewBase64Encode(
-	const void *buffer,
-	size_t length,
-	bool separateLines,
-	size_t *outputLength)
-{
-	const unsigned char *inputBuffer = (const unsigned char *)buffer;
-	
-	#define MAX_NUM_PADDING_CHARS 2
-	#define OUTPUT_LINE_LENGTH 64
-	#define INPUT_LINE_LENGTH ((OUTPUT_LINE_LENGTH / BASE64_UNIT_SIZE) * BINARY_UNIT_SIZE)
-	#define CR_LF_SIZE 2
-	
-	//
-	// Byte accurate calculation of final buffer size
-	//
-	size_t outputBufferSize =
-			((length / BINARY_UNIT_SIZE)
-				+ ((length % BINARY_UNIT_SIZE) ? 1 : 0))
-					* BASE64_UNIT_SIZE;
-	if (separateLines)
-	{
-		outputBufferSize +=
-			(outputBufferSize / OUTPUT_LINE_LENGTH) * CR_LF_SIZE;
+- (id) init
+{
+	if((self = [super init])) {
+		_parser = [[MiniXMLStreamParser alloc] initWithNodeNamespace:nil target:self selector:@selector(parser:didEndElementAtPath:values:)];
+		[_parser watchPath:@"ListBucketResult:Contents"];
+		[_parser watchPath:@"ListBucketResult:IsTruncated"];
+		[_parser watchPath:@"ListBucketResult:NextMarker"];
+		[_parser watchPath:@"ListAllMyBucketsResult:Buckets:Bucket"];
+		[_parser watchPath:@"Error"];
+		_result = [NSMutableDictionary new];
+		_info = [NSMutableDictionary new];
 	}
 	
-	//
-	// Include space for a terminating zero
-	//
-	outputBufferSize += 1;
-
-	//
-	// Allocate the output buffer
-	//
-	char *outputBuffer = (char *)malloc(outputBufferSize);
-	if (!outputBuffer)
-	{
-		return NULL;
-	}
+	return self;
+}
 
-	size_t i = 0;
-	size_t j = 0;
-	const size_t lineLength = separateLines ? INPUT_LINE_LENGTH : length;
-	size_t lineEnd = lineLength;
+- (void) dealloc
+{
+	[_errorMessage release];
+	[_lastKey release];
+	[_info release];
+	[_result release];
+	[_parser release];
 	
-	while (true)
-	{
-		if (lineEnd > length)
-		{
-			lineEnd = length;
-		}
+	[super dealloc];
+}
 
-		for (; i + BINARY_UNIT_SIZE - 1 < lineEnd; i += BINARY_UNIT_SIZE)
-		{
-			//
-			// Inner loop: turn 48 bytes into 64 base64 characters
-			//
-			outputBuffer[j++] = base64EncodeLookup[(inputBuffer[i] & 0xFC) >> 2];
-			outputBuffer[j++] = base64EncodeLookup[((inputBuffer[i] & 0x03) << 4)
-				| ((inputBuffer[i + 1] & 0xF0) >> 4)];
-			outputBuffer[j++] = base64EncodeLookup[((inputBuffer[i + 1] & 0x0F) << 2)
-				| ((inputBuffer[i + 2] & 0xC0) >> 6)];
-			outputBuffer[j++] = base64EncodeLookup[inputBuffer[i + 2] & 0x3F];
-		}
-		
-		if (lineEnd == length)
-		{
-			break;
+- (void) parser:(MiniXMLStreamParser*)parser didEndElementAtPath:(NSString*)path values:(NSDictionary*)values
+{
+	NSString*				string;
+	
+	if([path isEqualToString:@"ListBucketResult:Contents"]) {
+		if((string = [values objectForKey:@"Key"])) {
+			[_result setObject:_DictionaryFromS3Objects(values) forKey:string];
+			[_lastKey release];
+			_lastKey = [string retain];
 		}
-		
-		//
-		// Add the newline
-		//
-		outputBuffer[j++] = '\r';
-		outputBuffer[j++] = '\n';
-		lineEnd += lineLength;
 	}
+	else if([path isEqualToString:@"ListAllMyBucketsResult:Buckets:Bucket"]) {
+		if((string = [values objectForKey:@"Name"]))
+		[_result setObject:_DictionaryFromS3Buckets(values) forKey:string];
+	}
+	else if([path isEqualToString:@"Error"]) {
+		string = [values objectForKey:@"Message"];
+		if(string == nil)
+		string = [values objectForKey:@"Code"];
+		[_errorMessage release];
+		_errorMessage = [string copy];
+	}
+	else
+	[_info setValue:[values objectForKey:@""] forKey:[[path componentsSeparatedByString:@":"] lastObject]];
+}
+
+- (NSMutableDictionary*) finishParsing
+{
+	if(![_parser finishParsing])
+	return nil;
 	
-	if (i + 1 < length)
-	{
-		//
-		// Handle the single '=' case
-		//
-		outputBuffer[j++] = base64EncodeLookup[(inputBuffer[i] & 0xFC) >> 2];
-		outputBuffer[j++] = base64EncodeLookup[((inputBuffer[i] & 0x03) << 4)
-			| ((inputBuffer[i + 1] & 0xF0) >> 4)];
-		outputBuffer[j++] = base64EncodeLookup[(inputBuffer[i + 1] & 0x0F) << 2];
-		outputBuffer[j++] =	'=';
-	}
-	else if (i < length)
-	{
-		//
-		// Handle the double '=' case
-		//
-		outputBuffer[j++] = base64EncodeLookup[(inputBuffer[i] & 0xFC) >> 2];
-		outputBuffer[j++] = base64EncodeLookup[(inputBuffer[i] & 0x03) << 4];
-		outputBuffer[j++] = '=';
-		outputBuffer[j++] = '=';
-	}
-	outputBuffer[j] = 0;
-	
-	//
-	// Set the output length and return the buffer
-	//
-	if (outputLength)
-	{
-		*outputLength = j;
+	if([[_parser rootName] isEqualToString:@"ListBucketResult"]) {
+		//NOTE: S3 only returns "NextMarker" if a delimiter was specified, otherwise the last key returned is the marker
+		if(_lastKey && ![_info objectForKey:@"NextMarker"])
+		[_info setObject:_lastKey forKey:@"NextMarker"];
+		[_result setObject:_info forKey:[NSNull null]];
 	}
-	return outputBuffer;
+	else if(![[_parser rootName] isEqualToString:@"ListAllMyBucketsResult"])
+	return nil;
+	
+	return _result;
 }
+
+- (BOOL) openDataStream:(id)userInfo
+{
+	return YES;
+}
+
+- (NSInteger) writeDataToStream:(id)userInfo buffer:(const void*)buffer maxLength:(NSUInteger)length
+{
+	_dataLength += length;
+	
+	return ([_parser parseBytes:buffer length:length] ? length : -1);
+}
+
+- (void) closeDataStream:(id)userInfo
+{
+	;
+}
+
+@end
+
+@implementation SecureAmazonS3TransferController
+
++ (NSString*) urlScheme;
+{
+	return @"https";
+}
+
+@end
@@ -21,6 +21,14 @@
 #define MAKE_ERROR(__DOMAIN__, __CODE__, ...) [NSError errorWithDomain:__DOMAIN__ code:__CODE__ userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:__VA_ARGS__] forKey:NSLocalizedDescriptionKey]]
 #define MAKE_FILETRANSFERCONTROLLER_ERROR(...) MAKE_ERROR(@"FileTransferController", -1, __VA_ARGS__)
 
+#define kEncryptionCipherBlockSize 16
+
+typedef struct {
+	BOOL					copy; //Range is in the existing remote file if YES or in the local file otherwise
+	NSUInteger				offset;
+	NSUInteger				length;
+} DeltaOperation;
+
 #if TARGET_OS_IPHONE
 #define NSMakeCollectable(__ARG__) (id)(__ARG__)
 #endif
@@ -28,13 +36,33 @@
 @interface FileTransferController ()
 @property(nonatomic) NSUInteger currentLength;
 @property(nonatomic) NSUInteger maxLength;
+@property(nonatomic) NSUInteger lastTransferSize;
+
+- (NSUInteger) _maxLengthForSourceLength:(NSUInteger)length; //Accounts for encryption padding - Returns the source length if compression is enabled as the transferred length cannot be known in advance
 
 - (BOOL) _downloadFileFromPath:(NSString*)remotePath toStream:(NSOutputStream*)stream; //To be implemented by subclasses
 - (BOOL) _uploadFileToPath:(NSString*)remotePath fromStream:(NSInputStream*)stream; //To be implemented by subclasses
 
+- (NSDictionary*) _attributesForDeltaTransferAtPath:(NSString*)remotePath; //To be implemented by subclasses supporting delta transfers - Must contain at least NSFileSize and NSFileModificationDate
+- (NSData*) _copyDeltaSignatureForPath:(NSString*)remotePath blockSize:(NSUInteger)blockSize; //May be implemented by subclasses able to read the remote file directly
+- (BOOL) _applyDeltaOperations:(const DeltaOperation*)operations count:(NSUInteger)count fromBytes:(const void*)bytes length:(NSUInteger)length digest:(const unsigned char*)digest toPath:(NSString*)remotePath; //To be implemented by subclasses supporting delta transfers - Must verify the MD5 digest of the reconstructed file
+- (NSData*) _deltaSignatureForBytes:(const void*)bytes length:(NSUInteger)length blockSize:(NSUInteger)blockSize;
+- (void) _limitUploadSpeedForLength:(NSUInteger)length startTime:(CFAbsoluteTime)time; //Must be called by subclasses after sending literal data of delta transfers
+
 + (BOOL) useAsyncStreams;
 + (NSString*) urlScheme;
 
+- (NSDictionary*) cachedContentsOfDirectoryAtPath:(NSString*)remotePath; //Returns nil if caching is disabled or the listing is not cached or has expired and could not be revalidated - A listing can only be revalidated once
+- (void) cacheContents:(NSDictionary*)contents ofDirectoryAtPath:(NSString*)remotePath validator:(id)validator; //Pass nil if the listing cannot be revalidated once expired
+- (void) invalidateCachedContentsForPath:(NSString*)remotePath; //Invalidates the listing of the parent directory as well as the ones of the path itself and its descendants - Must be called before modifying the remote path
+- (id) validatorForDirectoryAtPath:(NSString*)remotePath; //May be implemented by subclasses able to cheaply check if a directory has changed - Returns nil if unknown
+
++ (BOOL) isSharedIOThread; //Returns YES if called from the thread multiplexing asynchronous transfers
+- (BOOL) canMultiplexTransferForUpload:(BOOL)upload; //May be overriden by subclasses able to run an asynchronous transfer without blocking the shared I/O thread
+- (BOOL) isStreamingAsynchronously; //May be overriden by subclasses to indicate the transfer is still in progress on the shared I/O thread after the operation has returned
+- (void) _runAsynchronousOperation:(NSInvocation*)operation; //May be overriden by subclasses to defer the operation - Called on the thread that will run the transfer
+- (void) finishAsynchronousTransfer:(BOOL)success;
+
 - (BOOL) openInputStream:(NSInputStream*)stream isFileTransfer:(BOOL)isFileTransfer;
 - (NSInteger) readFromInputStream:(NSInputStream*)stream bytes:(void*)bytes maxLength:(NSUInteger)length;
 - (void) closeInputStream:(NSInputStream*)stream;
@@ -47,6 +75,7 @@
 
 @interface StreamTransferController ()
 @property(nonatomic, readonly) CFTypeRef activeStream;
+@property(nonatomic, getter=isSilent) BOOL silent; //Suppresses the "didStart" and "didSucceed" delegate callbacks for internal requests which are part of a larger transfer
 
 - (void) readStreamClientCallBack:(CFReadStreamRef)stream type:(CFStreamEventType)type;
 - (id) runReadStream:(CFReadStreamRef)readStream dataStream:(NSOutputStream*)dataStream userInfo:(id)info isFileTransfer:(BOOL)allowEncryption;
@@ -56,3 +85,11 @@
 - (id) processReadResultStream:(NSOutputStream*)stream userInfo:(id)info error:(NSError**)error;
 - (void) invalidate;
 @end
+
+@interface FTPTransferController ()
++ (NSDictionary*) _contentsOfDirectoryFromListingData:(NSData*)data machineListing:(BOOL)flag encoding:(NSStringEncoding)encoding chunkSize:(NSUInteger)size; //Parses a complete MLSD or LIST response passed in chunks of the given size - Returns nil on invalid encoding
+@end
+
+@interface HTTPTransferController ()
++ (NSUInteger) _activePersistentConnectionCountForURL:(NSURL*)url; //Number of connection slots currently in use for the scheme, host and port of the URL
+@end
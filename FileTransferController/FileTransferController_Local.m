@@ -18,15 +18,44 @@
 
 #import <sys/mount.h>
 #import <pthread.h>
+#import <fcntl.h>
+#import <copyfile.h>
+#import <CommonCrypto/CommonDigest.h>
 
 #import "FileTransferController_Internal.h"
 #import "NSURL+Parameters.h"
 
+#define kDeltaBufferSize			(256 * 1024)
+#define kCopyBufferSize				(4 * 1024 * 1024)
+#define kNoCacheMinimumSize			(16 * 1024 * 1024) //Smaller files are likely to be read again soon and are cheap to keep in the buffer cache
+
 #if !TARGET_OS_IPHONE
 static CFMutableBagRef		_mountedList = NULL;
 static pthread_mutex_t		_mountedMutex = PTHREAD_MUTEX_INITIALIZER;
 #endif
 
+/* Reserves the space for the file upfront so that it ends up as contiguous as possible on disk */
+static BOOL _PreallocateFile(int fd, off_t length)
+{
+	fstore_t				store;
+	
+	if(length <= 0)
+	return YES;
+	
+	store.fst_flags = F_ALLOCATECONTIG;
+	store.fst_posmode = F_PEOFPOSMODE;
+	store.fst_offset = 0;
+	store.fst_length = length;
+	store.fst_bytesalloc = 0;
+	if(fcntl(fd, F_PREALLOCATE, &store) == -1) {
+		store.fst_flags = F_ALLOCATEALL;
+		if(fcntl(fd, F_PREALLOCATE, &store) == -1)
+		return NO;
+	}
+	
+	return YES;
+}
+
 @implementation LocalTransferController
 
 + (BOOL) useAsyncStreams
@@ -56,6 +85,9 @@ static pthread_mutex_t		_mountedMutex = PTHREAD_MUTEX_INITIALIZER;
 	NSMutableDictionary*	entry;
 	NSDictionary*			info;
 	
+	if((info = [self cachedContentsOfDirectoryAtPath:remotePath]))
+	return info;
+	
 	if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidStart:)])
 	[[self delegate] fileTransferControllerDidStart:self];
 	
@@ -83,6 +115,7 @@ static pthread_mutex_t		_mountedMutex = PTHREAD_MUTEX_INITIALIZER;
 			[dictionary setObject:entry forKey:path];
 			[entry release];
 		}
+		[self cacheContents:dictionary ofDirectoryAtPath:remotePath validator:nil];
 	}
 	else {
 		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
@@ -101,6 +134,8 @@ static pthread_mutex_t		_mountedMutex = PTHREAD_MUTEX_INITIALIZER;
 	NSURL*					url = [self absoluteURLForRemotePath:remotePath];
 	NSError*				error;
 	
+	[self invalidateCachedContentsForPath:remotePath];
+	
 	if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidStart:)])
 	[[self delegate] fileTransferControllerDidStart:self];
 	
@@ -176,6 +211,204 @@ static pthread_mutex_t		_mountedMutex = PTHREAD_MUTEX_INITIALIZER;
 	return [[self runWriteStream:writeStream dataStream:stream userInfo:nil isFileTransfer:YES] boolValue];
 }
 
+/* Copies a regular file between file descriptors with large page-aligned buffers bypassing the CFStream machinery and the buffer cache - If an input stream is passed, data is read through it instead so that encryption, digest computation and speed limits apply */
+- (BOOL) _copyFileFromPath:(NSString*)fromPath toPath:(NSString*)toPath inputStream:(NSInputStream*)stream error:(NSError**)error
+{
+	BOOL					delegateHasShouldAbort = [[self delegate] respondsToSelector:@selector(fileTransferControllerShouldAbort:)];
+	BOOL					success = YES;
+	NSUInteger				totalLength = 0;
+	int						inFD = -1,
+							outFD = -1;
+	struct stat				info,
+							toInfo;
+	NSUInteger				length;
+	void*					buffer;
+	ssize_t					numBytes,
+							offset,
+							result;
+#ifdef COPYFILE_CLONE_FORCE
+	NSString*				tempPath;
+#endif
+	
+	*error = nil;
+	if(stat([fromPath fileSystemRepresentation], &info) || !S_ISREG(info.st_mode)) {
+		*error = MAKE_FILETRANSFERCONTROLLER_ERROR(@"\"%@\" is not a regular file", fromPath);
+		return NO;
+	}
+	if(!stat([toPath fileSystemRepresentation], &toInfo) && (toInfo.st_dev == info.st_dev) && (toInfo.st_ino == info.st_ino)) {
+		*error = MAKE_FILETRANSFERCONTROLLER_ERROR(@"\"%@\" and \"%@\" are the same file", fromPath, toPath);
+		return NO;
+	}
+	length = (stream ? [self _maxLengthForSourceLength:info.st_size] : info.st_size);
+	[self setMaxLength:length];
+	
+#ifdef COPYFILE_CLONE_FORCE
+	//NOTE: Cloning is instantaneous on copy-on-write volumes but it is only possible if the destination does not exist yet, so clone to a temporary file next to it and move it into place
+	if(stream == nil) {
+		tempPath = [[toPath stringByDeletingLastPathComponent] stringByAppendingPathComponent:[NSString stringWithFormat:@".%@.%@", [toPath lastPathComponent], [[NSProcessInfo processInfo] globallyUniqueString]]];
+		if(copyfile([fromPath fileSystemRepresentation], [tempPath fileSystemRepresentation], NULL, COPYFILE_CLONE_FORCE) == 0) {
+			if(rename([tempPath fileSystemRepresentation], [toPath fileSystemRepresentation]) == 0) {
+				[self setCurrentLength:length];
+				[self setLastTransferSize:length];
+				return YES;
+			}
+			unlink([tempPath fileSystemRepresentation]);
+		}
+	}
+#endif
+	
+	if(stream) {
+		if(![self openInputStream:stream isFileTransfer:YES]) {
+			*error = MAKE_FILETRANSFERCONTROLLER_ERROR(@"Failed opening \"%@\"", fromPath);
+			return NO;
+		}
+	}
+	else {
+		inFD = open([fromPath fileSystemRepresentation], O_RDONLY);
+		if(inFD < 0) {
+			*error = MAKE_FILETRANSFERCONTROLLER_ERROR(@"Failed opening \"%@\" (%s)", fromPath, strerror(errno));
+			return NO;
+		}
+		if(info.st_size >= kNoCacheMinimumSize)
+		fcntl(inFD, F_NOCACHE, 1);
+	}
+	
+	outFD = open([toPath fileSystemRepresentation], O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if(outFD < 0) {
+		*error = MAKE_FILETRANSFERCONTROLLER_ERROR(@"Failed creating \"%@\" (%s)", toPath, strerror(errno));
+		success = NO;
+	}
+	else {
+		if(info.st_size >= kNoCacheMinimumSize)
+		fcntl(outFD, F_NOCACHE, 1);
+		if(![self compressionEnabled] && !_PreallocateFile(outFD, length))
+		NSLog(@"%s: Failed preallocating %lu bytes for \"%@\" (%s)", __FUNCTION__, (unsigned long)length, toPath, strerror(errno));
+		
+		buffer = valloc(kCopyBufferSize); //NOTE: F_NOCACHE I/Os are most efficient with page-aligned buffers
+		while(1) {
+			if(delegateHasShouldAbort && [[self delegate] fileTransferControllerShouldAbort:self]) {
+				success = NO;
+				break;
+			}
+			
+			numBytes = (stream ? [self readFromInputStream:stream bytes:buffer maxLength:kCopyBufferSize] : read(inFD, buffer, kCopyBufferSize));
+			if(numBytes < 0) {
+				*error = MAKE_FILETRANSFERCONTROLLER_ERROR(@"Failed reading from \"%@\"", fromPath);
+				success = NO;
+				break;
+			}
+			if(numBytes == 0)
+			break;
+			
+			for(offset = 0; offset < numBytes; offset += result) {
+				result = write(outFD, (char*)buffer + offset, numBytes - offset);
+				if(result < 0) {
+					if(errno == EINTR) {
+						result = 0;
+						continue;
+					}
+					*error = MAKE_FILETRANSFERCONTROLLER_ERROR(@"Failed writing to \"%@\" (%s)", toPath, strerror(errno));
+					success = NO;
+					break;
+				}
+			}
+			if(!success)
+			break;
+			
+			totalLength += numBytes;
+			[self setCurrentLength:totalLength];
+		}
+		free(buffer);
+		
+		if(close(outFD) && success) {
+			*error = MAKE_FILETRANSFERCONTROLLER_ERROR(@"Failed writing to \"%@\" (%s)", toPath, strerror(errno));
+			success = NO;
+		}
+		if(!success)
+		unlink([toPath fileSystemRepresentation]);
+	}
+	
+	if(stream)
+	[self closeInputStream:stream];
+	else
+	close(inFD);
+	[self setLastTransferSize:totalLength];
+	
+	return success;
+}
+
+- (BOOL) _canCopyDirectly:(BOOL)upload
+{
+	if(![self isLocalHost] && (upload ? [self maximumUploadSpeed] || [FileTransferController globalMaximumUploadSpeed] : [self maximumDownloadSpeed] || [FileTransferController globalMaximumDownloadSpeed]))
+	return NO;
+#if !TARGET_OS_IPHONE
+	if([self digestComputation] || [self encryptionPassword])
+	return NO;
+#endif
+	if([self compressionEnabled])
+	return NO;
+	
+	return YES;
+}
+
+/* Override */
+- (BOOL) downloadFileFromPath:(NSString*)remotePath toPath:(NSString*)localPath
+{
+	NSURL*					url = [self absoluteURLForRemotePath:remotePath];
+	NSError*				error;
+	
+	if((url == nil) || ![self _canCopyDirectly:NO])
+	return [super downloadFileFromPath:remotePath toPath:localPath];
+	
+	if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidStart:)])
+	[[self delegate] fileTransferControllerDidStart:self];
+	
+	if(![self _copyFileFromPath:[url path] toPath:[localPath stringByStandardizingPath] inputStream:nil error:&error]) {
+		if(error && [[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+		[[self delegate] fileTransferControllerDidFail:self withError:error];
+		return NO;
+	}
+	
+	if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidSucceed:)])
+	[[self delegate] fileTransferControllerDidSucceed:self];
+	
+	return YES;
+}
+
+/* Override - Uploads with encryption or digest computation still go through the direct copy path but read the data through an input stream */
+- (BOOL) uploadFileFromPath:(NSString*)localPath toPath:(NSString*)remotePath
+{
+	NSURL*					url = [self absoluteURLForRemotePath:remotePath];
+	NSInputStream*			stream = nil;
+	NSError*				error;
+	
+	[self invalidateCachedContentsForPath:remotePath];
+	
+	if(url == nil)
+	return [super uploadFileFromPath:localPath toPath:remotePath];
+	
+	localPath = [[localPath stringByStandardizingPath] stringByResolvingSymlinksInPath];
+	if(![self _canCopyDirectly:YES]) {
+		stream = [NSInputStream inputStreamWithFileAtPath:localPath];
+		if(stream == nil)
+		return NO;
+	}
+	
+	if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidStart:)])
+	[[self delegate] fileTransferControllerDidStart:self];
+	
+	if(![self _copyFileFromPath:localPath toPath:[url path] inputStream:stream error:&error]) {
+		if(error && [[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+		[[self delegate] fileTransferControllerDidFail:self withError:error];
+		return NO;
+	}
+	
+	if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidSucceed:)])
+	[[self delegate] fileTransferControllerDidSucceed:self];
+	
+	return YES;
+}
+
 - (BOOL) movePath:(NSString*)fromRemotePath toPath:(NSString*)toRemotePath
 {
 	NSURL*					fromURL = [self absoluteURLForRemotePath:fromRemotePath];
@@ -183,6 +416,9 @@ static pthread_mutex_t		_mountedMutex = PTHREAD_MUTEX_INITIALIZER;
 	NSFileManager*			manager = [NSFileManager defaultManager];
 	NSError*				error;
 	
+	[self invalidateCachedContentsForPath:fromRemotePath];
+	[self invalidateCachedContentsForPath:toRemotePath];
+	
 	if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidStart:)])
 	[[self delegate] fileTransferControllerDidStart:self];
 	
@@ -218,6 +454,8 @@ static pthread_mutex_t		_mountedMutex = PTHREAD_MUTEX_INITIALIZER;
 	NSFileManager*			manager = [NSFileManager defaultManager];
 	NSError*				error;
 	
+	[self invalidateCachedContentsForPath:toRemotePath];
+	
 	if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidStart:)])
 	[[self delegate] fileTransferControllerDidStart:self];
 	
@@ -227,7 +465,8 @@ static pthread_mutex_t		_mountedMutex = PTHREAD_MUTEX_INITIALIZER;
 			[[self delegate] fileTransferControllerDidFail:self withError:error];
 			return NO;
 		}
-
+		
+		//NOTE: Unlike a plain data copy, NSFileManager preserves permissions, dates, extended attributes and resource forks
 		if(![manager copyItemAtPath:[fromURL path] toPath:[toURL path] error:&error]) {
 			if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
 			[[self delegate] fileTransferControllerDidFail:self withError:error];
@@ -252,6 +491,8 @@ static pthread_mutex_t		_mountedMutex = PTHREAD_MUTEX_INITIALIZER;
 	NSFileManager*			manager = [NSFileManager defaultManager];
 	NSError*				error;
 	
+	[self invalidateCachedContentsForPath:remotePath];
+	
 	if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidStart:)])
 	[[self delegate] fileTransferControllerDidStart:self];
 	
@@ -284,6 +525,137 @@ static pthread_mutex_t		_mountedMutex = PTHREAD_MUTEX_INITIALIZER;
 	return [self _deletePath:remotePath];
 }
 
+- (NSDictionary*) _attributesForDeltaTransferAtPath:(NSString*)remotePath
+{
+	NSURL*					url = [self absoluteURLForRemotePath:remotePath];
+	NSDictionary*			info = (url ? [[NSFileManager defaultManager] attributesOfItemAtPath:[url path] error:NULL] : nil);
+	
+	return ([[info objectForKey:NSFileType] isEqualToString:NSFileTypeRegular] ? info : nil);
+}
+
+- (NSData*) _copyDeltaSignatureForPath:(NSString*)remotePath blockSize:(NSUInteger)blockSize
+{
+	NSURL*					url = [self absoluteURLForRemotePath:remotePath];
+	NSData*					data;
+	NSData*					signature;
+	
+	data = (url ? [[NSData alloc] initWithContentsOfFile:[url path] options:NSMappedRead error:NULL] : nil);
+	if(data == nil)
+	return nil;
+	
+	signature = [[self _deltaSignatureForBytes:[data bytes] length:[data length] blockSize:blockSize] retain];
+	[data release];
+	
+	return signature;
+}
+
+/* Reconstructs the file next to the original from its own blocks and the literal data, then atomically replaces it */
+- (BOOL) _applyDeltaOperations:(const DeltaOperation*)operations count:(NSUInteger)count fromBytes:(const void*)bytes length:(NSUInteger)length digest:(const unsigned char*)digest toPath:(NSString*)remotePath
+{
+	BOOL					delegateHasShouldAbort = [[self delegate] respondsToSelector:@selector(fileTransferControllerShouldAbort:)];
+	NSURL*					url = [self absoluteURLForRemotePath:remotePath];
+	NSError*				error = nil;
+	BOOL					aborted = NO;
+	NSUInteger				position = 0,
+							offset,
+							size,
+							i;
+	unsigned char			md5[16];
+	CC_MD5_CTX				context;
+	const char*				path;
+	const char*				tempPath;
+	unsigned char*			buffer;
+	const unsigned char*	source;
+	struct stat				info;
+	int						oldFD,
+							newFD;
+	ssize_t					result;
+	CFAbsoluteTime			time;
+	
+	if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidStart:)])
+	[[self delegate] fileTransferControllerDidStart:self];
+	
+	if(url == nil) {
+		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+		[[self delegate] fileTransferControllerDidFail:self withError:MAKE_FILETRANSFERCONTROLLER_ERROR(@"\"%@\" is not reachable", remotePath)];
+		return NO;
+	}
+	path = [[url path] fileSystemRepresentation];
+	tempPath = [[[[url path] stringByDeletingLastPathComponent] stringByAppendingPathComponent:[NSString stringWithFormat:@".%@.%@", [[url path] lastPathComponent], [[NSProcessInfo processInfo] globallyUniqueString]]] fileSystemRepresentation];
+	
+	oldFD = open(path, O_RDONLY);
+	if(oldFD < 0) {
+		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+		[[self delegate] fileTransferControllerDidFail:self withError:MAKE_ERROR(NSPOSIXErrorDomain, errno, @"open(%s) failed with error \"%s\"", path, strerror(errno))];
+		return NO;
+	}
+	if(fstat(oldFD, &info) != 0)
+	info.st_mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+	newFD = open(tempPath, O_CREAT | O_EXCL | O_WRONLY, info.st_mode & ACCESSPERMS);
+	if(newFD < 0) {
+		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+		[[self delegate] fileTransferControllerDidFail:self withError:MAKE_ERROR(NSPOSIXErrorDomain, errno, @"open(%s) failed with error \"%s\"", tempPath, strerror(errno))];
+		close(oldFD);
+		return NO;
+	}
+	
+	buffer = malloc(kDeltaBufferSize);
+	CC_MD5_Init(&context);
+	for(i = 0; (i < count) && (error == nil) && !aborted; ++i) {
+		for(offset = 0; offset < operations[i].length; offset += size) {
+			size = MIN(operations[i].length - offset, kDeltaBufferSize);
+			if(operations[i].copy) {
+				result = pread(oldFD, buffer, size, operations[i].offset + offset);
+				if(result != size) {
+					error = (result < 0 ? MAKE_ERROR(NSPOSIXErrorDomain, errno, @"pread() failed with error \"%s\"", strerror(errno)) : MAKE_FILETRANSFERCONTROLLER_ERROR(@"Remote file is shorter than expected"));
+					break;
+				}
+				source = buffer;
+			}
+			else
+			source = (const unsigned char*)bytes + operations[i].offset + offset;
+			
+			time = CFAbsoluteTimeGetCurrent();
+			if(write(newFD, source, size) != size) {
+				error = MAKE_ERROR(NSPOSIXErrorDomain, errno, @"write() failed with error \"%s\"", strerror(errno));
+				break;
+			}
+			if(!operations[i].copy)
+			[self _limitUploadSpeedForLength:size startTime:time];
+			CC_MD5_Update(&context, source, size);
+			
+			position += size;
+			[self setCurrentLength:position];
+			if(delegateHasShouldAbort && [[self delegate] fileTransferControllerShouldAbort:self]) {
+				aborted = YES;
+				break;
+			}
+		}
+	}
+	CC_MD5_Final(md5, &context);
+	free(buffer);
+	
+	if((error == nil) && !aborted && ((position != length) || memcmp(md5, digest, 16)))
+	error = MAKE_FILETRANSFERCONTROLLER_ERROR(@"Reconstructed file does not match local file");
+	if((close(newFD) != 0) && (error == nil))
+	error = MAKE_ERROR(NSPOSIXErrorDomain, errno, @"close() failed with error \"%s\"", strerror(errno));
+	close(oldFD);
+	if((error == nil) && !aborted && (rename(tempPath, path) != 0))
+	error = MAKE_ERROR(NSPOSIXErrorDomain, errno, @"rename(%s) failed with error \"%s\"", path, strerror(errno));
+	
+	if(error || aborted) {
+		unlink(tempPath);
+		if(error && [[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+		[[self delegate] fileTransferControllerDidFail:self withError:error];
+		return NO;
+	}
+	
+	if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidSucceed:)])
+	[[self delegate] fileTransferControllerDidSucceed:self];
+	
+	return YES;
+}
+
 @end
 
 #if !TARGET_OS_IPHONE
@@ -17,6 +17,7 @@
 */
 
 #import <netinet/in.h>
+#import <CommonCrypto/CommonDigest.h>
 #import "libssh2.h"
 #import "libssh2_sftp.h"
 
@@ -377,6 +378,180 @@ static CFSocketRef _CreateSocketConnectedToHost(NSString* name, UInt16 port, CFO
 	return success;
 }
 
+- (ssize_t) _readFromHandle:(LIBSSH2_SFTP_HANDLE*)handle bytes:(void*)bytes maxLength:(size_t)length timeOut:(NSTimeInterval)timeOut
+{
+	CFTimeInterval			lastTime = CFAbsoluteTimeGetCurrent();
+	ssize_t					numBytes;
+	
+	do {
+		numBytes = libssh2_sftp_read(handle, bytes, length);
+		if((numBytes == LIBSSH2SFTP_EAGAIN) && (timeOut > 0.0) && (CFAbsoluteTimeGetCurrent() - lastTime >= timeOut))
+		numBytes = -1;
+	} while(numBytes == LIBSSH2SFTP_EAGAIN);
+	
+	return numBytes;
+}
+
+- (BOOL) _writeToHandle:(LIBSSH2_SFTP_HANDLE*)handle bytes:(const void*)bytes length:(size_t)length timeOut:(NSTimeInterval)timeOut
+{
+	CFTimeInterval			lastTime = CFAbsoluteTimeGetCurrent(),
+							time;
+	ssize_t					result;
+	
+	while(length) {
+		result = libssh2_sftp_write(handle, bytes, length);
+		time = CFAbsoluteTimeGetCurrent();
+		if(result == LIBSSH2SFTP_EAGAIN) {
+			if((timeOut > 0.0) && (time - lastTime >= timeOut))
+			return NO;
+			continue;
+		}
+		if(result < 0)
+		return NO;
+		lastTime = time;
+		bytes = (const char*)bytes + result;
+		length -= result;
+	}
+	
+	return YES;
+}
+
+- (NSDictionary*) _attributesForDeltaTransferAtPath:(NSString*)remotePath
+{
+	const char*				serverPath = [[self absolutePathForRemotePath:remotePath] UTF8String];
+	LIBSSH2_SFTP_ATTRIBUTES	attributes;
+	
+	if(![self _reconnect:[self timeOut]])
+	return nil;
+	
+	if(libssh2_sftp_stat(_sftp, serverPath, &attributes) || !(attributes.flags & LIBSSH2_SFTP_ATTR_SIZE) || !(attributes.flags & LIBSSH2_SFTP_ATTR_ACMODTIME))
+	return nil;
+	if((attributes.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) && !S_ISREG(attributes.permissions))
+	return nil;
+	
+	return [NSDictionary dictionaryWithObjectsAndKeys:NSFileTypeRegular, NSFileType, [NSNumber numberWithUnsignedLongLong:attributes.filesize], NSFileSize, [NSDate dateWithTimeIntervalSince1970:attributes.mtime], NSFileModificationDate, nil];
+}
+
+/* There is no standard way to compute the remote signature server-side, so we rely on the signature cache and don't implement -_copyDeltaSignatureForPath:blockSize: */
+- (BOOL) _applyDeltaOperations:(const DeltaOperation*)operations count:(NSUInteger)count fromBytes:(const void*)bytes length:(NSUInteger)length digest:(const unsigned char*)digest toPath:(NSString*)remotePath
+{
+	BOOL					delegateHasShouldAbort = [[self delegate] respondsToSelector:@selector(fileTransferControllerShouldAbort:)];
+	NSString*				absolutePath = [self absolutePathForRemotePath:remotePath];
+	const char*				serverPath = [absolutePath UTF8String];
+	NSString*				uniqueString = [[NSProcessInfo processInfo] globallyUniqueString];
+	const char*				tempPath = [[[absolutePath stringByDeletingLastPathComponent] stringByAppendingPathComponent:[NSString stringWithFormat:@".%@.%@", [absolutePath lastPathComponent], uniqueString]] UTF8String];
+	const char*				backupPath = [[[absolutePath stringByDeletingLastPathComponent] stringByAppendingPathComponent:[NSString stringWithFormat:@".%@.%@.old", [absolutePath lastPathComponent], uniqueString]] UTF8String];
+	NSTimeInterval			timeOut = [self timeOut];
+	NSError*				error = nil;
+	BOOL					aborted = NO;
+	NSUInteger				position = 0,
+							offset,
+							size,
+							i;
+	unsigned char			buffer[kTransferBufferSize];
+	unsigned char			md5[16];
+	CC_MD5_CTX				context;
+	const unsigned char*	source;
+	LIBSSH2_SFTP_HANDLE*	oldHandle;
+	LIBSSH2_SFTP_HANDLE*	newHandle;
+	LIBSSH2_SFTP_ATTRIBUTES	attributes;
+	ssize_t					numBytes;
+	CFAbsoluteTime			time;
+	
+	if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidStart:)])
+	[[self delegate] fileTransferControllerDidStart:self];
+	
+	if(![self _reconnect:timeOut]) {
+		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+		[[self delegate] fileTransferControllerDidFail:self withError:MAKE_FILETRANSFERCONTROLLER_ERROR(@"\"%@\" is not reachable", [[self baseURL] URLByDeletingUserAndPassword])];
+		return NO;
+	}
+	
+	oldHandle = libssh2_sftp_open(_sftp, serverPath, LIBSSH2_FXF_READ, 0);
+	newHandle = (oldHandle ? libssh2_sftp_open(_sftp, tempPath, LIBSSH2_FXF_CREAT | LIBSSH2_FXF_TRUNC | LIBSSH2_FXF_WRITE, kDefaultMode) : NULL);
+	if(newHandle == NULL) {
+		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+		[[self delegate] fileTransferControllerDidFail:self withError:_MakeLibSSH2Error(_session, _sftp)];
+		if(oldHandle)
+		libssh2_sftp_close(oldHandle);
+		return NO;
+	}
+	
+	[self _setTimeOut:1.0];
+	CC_MD5_Init(&context);
+	for(i = 0; (i < count) && (error == nil) && !aborted; ++i) {
+		if(operations[i].copy)
+		libssh2_sftp_seek64(oldHandle, operations[i].offset);
+		for(offset = 0; offset < operations[i].length; offset += size) {
+			size = MIN(operations[i].length - offset, kTransferBufferSize);
+			if(operations[i].copy) {
+				numBytes = [self _readFromHandle:oldHandle bytes:buffer maxLength:size timeOut:timeOut];
+				if(numBytes <= 0) {
+					error = (numBytes < 0 ? _MakeLibSSH2Error(_session, _sftp) : MAKE_FILETRANSFERCONTROLLER_ERROR(@"Remote file is shorter than expected"));
+					break;
+				}
+				size = numBytes;
+				source = buffer;
+			}
+			else
+			source = (const unsigned char*)bytes + operations[i].offset + offset;
+			
+			time = CFAbsoluteTimeGetCurrent();
+			if(![self _writeToHandle:newHandle bytes:source length:size timeOut:timeOut]) {
+				error = _MakeLibSSH2Error(_session, _sftp);
+				break;
+			}
+			if(!operations[i].copy)
+			[self _limitUploadSpeedForLength:size startTime:time];
+			CC_MD5_Update(&context, source, size);
+			
+			position += size;
+			[self setCurrentLength:position];
+			if(delegateHasShouldAbort && [[self delegate] fileTransferControllerShouldAbort:self]) {
+				aborted = YES;
+				break;
+			}
+		}
+	}
+	CC_MD5_Final(md5, &context);
+	[self _setTimeOut:timeOut];
+	
+	if((error == nil) && !aborted && ((position != length) || memcmp(md5, digest, 16)))
+	error = MAKE_FILETRANSFERCONTROLLER_ERROR(@"Reconstructed file does not match local file");
+	if((error == nil) && !aborted && (libssh2_sftp_fstat(oldHandle, &attributes) == 0) && (attributes.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS)) {
+		attributes.flags = LIBSSH2_SFTP_ATTR_PERMISSIONS;
+		if(libssh2_sftp_fsetstat(newHandle, &attributes))
+		NSLog(@"%s: libssh2_sftp_fsetstat() failed", __FUNCTION__);
+	}
+	libssh2_sftp_close(newHandle);
+	libssh2_sftp_close(oldHandle);
+	
+	//NOTE: SFTP v3 servers refuse to rename over an existing file so move the original one aside until the reconstructed one is in place
+	if((error == nil) && !aborted && libssh2_sftp_rename(_sftp, tempPath, serverPath)) {
+		if(libssh2_sftp_rename(_sftp, serverPath, backupPath))
+		error = _MakeLibSSH2Error(_session, _sftp);
+		else if(libssh2_sftp_rename(_sftp, tempPath, serverPath)) {
+			error = _MakeLibSSH2Error(_session, _sftp);
+			if(libssh2_sftp_rename(_sftp, backupPath, serverPath))
+			NSLog(@"%s: Failed restoring \"%s\" from \"%s\"", __FUNCTION__, serverPath, backupPath);
+		}
+		else if(libssh2_sftp_unlink(_sftp, backupPath))
+		NSLog(@"%s: Failed deleting \"%s\"", __FUNCTION__, backupPath);
+	}
+	
+	if(error || aborted) {
+		libssh2_sftp_unlink(_sftp, tempPath);
+		if(error && [[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+		[[self delegate] fileTransferControllerDidFail:self withError:error];
+		return NO;
+	}
+	
+	if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidSucceed:)])
+	[[self delegate] fileTransferControllerDidSucceed:self];
+	
+	return YES;
+}
+
 - (NSDictionary*) contentsOfDirectoryAtPath:(NSString*)remotePath
 {
 	const char*				serverPath = [[self absolutePathForRemotePath:remotePath] UTF8String];
@@ -385,8 +560,12 @@ static CFSocketRef _CreateSocketConnectedToHost(NSString* name, UInt16 port, CFO
 	LIBSSH2_SFTP_HANDLE*	handle;
 	LIBSSH2_SFTP_ATTRIBUTES	attributes;
 	NSMutableDictionary*	dictionary;
+	NSDictionary*			contents;
 	int						result;
 	
+	if((contents = [self cachedContentsOfDirectoryAtPath:remotePath]))
+	return contents;
+	
 	if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidStart:)])
 	[[self delegate] fileTransferControllerDidStart:self];
 	
@@ -426,6 +605,7 @@ static CFSocketRef _CreateSocketConnectedToHost(NSString* name, UInt16 port, CFO
 		[[self delegate] fileTransferControllerDidFail:self withError:_MakeLibSSH2Error(_session, _sftp)];
 	}
 	else {
+		[self cacheContents:listing ofDirectoryAtPath:remotePath validator:nil];
 		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidSucceed:)])
 		[[self delegate] fileTransferControllerDidSucceed:self];
 	}
@@ -439,6 +619,8 @@ static CFSocketRef _CreateSocketConnectedToHost(NSString* name, UInt16 port, CFO
 {
 	const char*				serverPath = [[self absolutePathForRemotePath:remotePath] UTF8String];
 	
+	[self invalidateCachedContentsForPath:remotePath];
+	
 	if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidStart:)])
 	[[self delegate] fileTransferControllerDidStart:self];
 	
@@ -465,6 +647,9 @@ static CFSocketRef _CreateSocketConnectedToHost(NSString* name, UInt16 port, CFO
 	const char*				fromPath = [[self absolutePathForRemotePath:fromRemotePath] UTF8String];
 	const char*				toPath = [[self absolutePathForRemotePath:toRemotePath] UTF8String];
 	
+	[self invalidateCachedContentsForPath:fromRemotePath];
+	[self invalidateCachedContentsForPath:toRemotePath];
+	
 	if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidStart:)])
 	[[self delegate] fileTransferControllerDidStart:self];
 	
@@ -491,6 +676,8 @@ static CFSocketRef _CreateSocketConnectedToHost(NSString* name, UInt16 port, CFO
 	const char*				serverPath = [[self absolutePathForRemotePath:remotePath] UTF8String];
 	LIBSSH2_SFTP_ATTRIBUTES	attributes;
 	
+	[self invalidateCachedContentsForPath:remotePath];
+	
 	if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidStart:)])
 	[[self delegate] fileTransferControllerDidStart:self];
 	
@@ -517,6 +704,8 @@ static CFSocketRef _CreateSocketConnectedToHost(NSString* name, UInt16 port, CFO
 	const char*				serverPath = [[self absolutePathForRemotePath:remotePath] UTF8String];
 	LIBSSH2_SFTP_ATTRIBUTES	attributes;
 	
+	[self invalidateCachedContentsForPath:remotePath];
+	
 	if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidStart:)])
 	[[self delegate] fileTransferControllerDidStart:self];
 	
@@ -36,4 +36,6 @@
 - (BOOL) broadcastData:(NSData*)data toPort:(UInt16)port; //Blocking
 - (BOOL) sendData:(NSData*)data toRemoteAddress:(const struct sockaddr*)address; //Blocking
 - (BOOL) sendData:(NSData*)data toRemoteIPv4Address:(UInt32)address port:(UInt16)port; //Blocking - The "address" is assumed to be in host-endian
+- (BOOL) sendBytes:(const void*)bytes length:(NSUInteger)length toRemoteAddress:(const struct sockaddr*)address; //Blocking - Does not allocate anything
+- (BOOL) sendBytes:(const void*)bytes length:(NSUInteger)length toRemoteIPv4Address:(UInt32)address port:(UInt16)port; //Blocking - The "address" is assumed to be in host-endian
 @end
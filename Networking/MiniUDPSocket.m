@@ -97,6 +97,24 @@
 	return [self sendData:data toRemoteAddress:(struct sockaddr*)&ipAddress];
 }
 
+- (BOOL) sendBytes:(const void*)bytes length:(NSUInteger)length toRemoteAddress:(const struct sockaddr*)address
+{
+	return (address && _socket && (sendto(CFSocketGetNative(_socket), bytes, length, 0, address, address->sa_len) == (ssize_t)length) ? YES : NO);
+}
+
+- (BOOL) sendBytes:(const void*)bytes length:(NSUInteger)length toRemoteIPv4Address:(UInt32)address port:(UInt16)port
+{
+	struct sockaddr_in		ipAddress;
+	
+	bzero(&ipAddress, sizeof(ipAddress));
+	ipAddress.sin_len = sizeof(ipAddress);
+	ipAddress.sin_family = AF_INET;
+	ipAddress.sin_port = htons(port);
+	ipAddress.sin_addr.s_addr = htonl(address);
+	
+	return [self sendBytes:bytes length:length toRemoteAddress:(struct sockaddr*)&ipAddress];
+}
+
 - (NSString*) description
 {
 	return [NSString stringWithFormat:@"<%@ = 0x%08X | valid = %i>", [self class], (long)self, [self isValid]];
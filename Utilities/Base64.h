@@ -0,0 +1,65 @@
+/*
+	This file is part of the PolKit library.
+	Copyright (C) 2008-2009 Pierre-Olivier Latour <info@pol-online.net>
+	
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#import <Foundation/Foundation.h>
+
+/* Standard base64 alphabet with '=' padding and no line breaks (like 'openssl base64 -A') - Whitespace is ignored when decoding */
+/* Large inputs are processed 16 or 64 characters at a time using SSSE3 or NEON when the compiler targets them */
+
+typedef struct {
+	unsigned char		bytes[3];
+	NSUInteger			count;
+} Base64Encoder;
+
+typedef struct {
+	UInt32				bits;
+	NSUInteger			count;
+	NSUInteger			padding; //Number of '=' characters seen
+	BOOL				failed;
+} Base64Decoder;
+
+static inline NSUInteger Base64EncodedLength(NSUInteger length)
+{
+	return (length + 2) / 3 * 4;
+}
+
+static inline NSUInteger Base64DecodedMaximumLength(NSUInteger length)
+{
+	return (length + 3) / 4 * 3;
+}
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+void Base64EncoderInit(Base64Encoder* encoder);
+NSUInteger Base64EncoderUpdate(Base64Encoder* encoder, const void* bytes, NSUInteger length, char* output); //"output" must have room for Base64EncodedLength(length + 2) characters - Returns the number of characters written
+NSUInteger Base64EncoderFinal(Base64Encoder* encoder, char* output); //"output" must have room for 4 characters
+
+void Base64DecoderInit(Base64Decoder* decoder);
+NSInteger Base64DecoderUpdate(Base64Decoder* decoder, const char* string, NSUInteger length, void* output); //"output" must have room for Base64DecodedMaximumLength(length + 3) bytes - Returns the number of bytes written or -1 if the input is invalid
+NSInteger Base64DecoderFinal(Base64Decoder* decoder, void* output); //"output" must have room for 2 bytes - Returns -1 if the input is invalid or truncated
+
+NSUInteger Base64EncodeBytes(const void* bytes, NSUInteger length, char* output); //"output" must have room for Base64EncodedLength(length) characters
+NSInteger Base64DecodeBytes(const char* string, NSUInteger length, void* output); //"output" must have room for Base64DecodedMaximumLength(length) bytes - Returns -1 if the input is invalid
+
+NSString* Base64EncodeData(NSData* data);
+NSData* Base64DecodeString(NSString* string); //Returns nil if the string is not valid base64
+#ifdef __cplusplus
+}
+#endif
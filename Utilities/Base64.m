@@ -0,0 +1,437 @@
+/*
+	This file is part of the PolKit library.
+	Copyright (C) 2008-2009 Pierre-Olivier Latour <info@pol-online.net>
+	
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if defined(__SSSE3__)
+#import <tmmintrin.h>
+#elif defined(__ARM_NEON__)
+#import <arm_neon.h>
+#endif
+
+#import "Base64.h"
+
+#define IV						0xFF
+#define WS						0xFE
+#define PD						0xFD
+
+static const char				_encodeTable[64] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static const unsigned char		_decodeTable[256] = {
+	IV, IV, IV, IV, IV, IV, IV, IV, IV, WS, WS, IV, IV, WS, IV, IV,
+	IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV,
+	WS, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, 62, IV, IV, IV, 63,
+	52, 53, 54, 55, 56, 57, 58, 59, 60, 61, IV, IV, IV, PD, IV, IV,
+	IV,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+	15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, IV, IV, IV, IV, IV,
+	IV, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+	41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, IV, IV, IV, IV, IV,
+	IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV,
+	IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV,
+	IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV,
+	IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV,
+	IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV,
+	IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV,
+	IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV,
+	IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV, IV
+};
+
+static inline void _EncodeQuantum(const unsigned char* input, char* output)
+{
+	output[0] = _encodeTable[input[0] >> 2];
+	output[1] = _encodeTable[((input[0] & 0x03) << 4) | (input[1] >> 4)];
+	output[2] = _encodeTable[((input[1] & 0x0F) << 2) | (input[2] >> 6)];
+	output[3] = _encodeTable[input[2] & 0x3F];
+}
+
+#if defined(__SSSE3__)
+
+/* Maps 6-bit values to their characters by adding the offset of the range they fall in */
+static inline __m128i _EncodeValues(__m128i values)
+{
+	__m128i					result = _mm_add_epi8(values, _mm_set1_epi8('A'));
+	
+	result = _mm_add_epi8(result, _mm_and_si128(_mm_cmpgt_epi8(values, _mm_set1_epi8(25)), _mm_set1_epi8('a' - 26 - 'A')));
+	result = _mm_add_epi8(result, _mm_and_si128(_mm_cmpgt_epi8(values, _mm_set1_epi8(51)), _mm_set1_epi8('0' - 52 - 'a' + 26)));
+	result = _mm_add_epi8(result, _mm_and_si128(_mm_cmpeq_epi8(values, _mm_set1_epi8(62)), _mm_set1_epi8('+' - 62 - '0' + 52)));
+	result = _mm_add_epi8(result, _mm_and_si128(_mm_cmpeq_epi8(values, _mm_set1_epi8(63)), _mm_set1_epi8('/' - 63 - '0' + 52)));
+	
+	return result;
+}
+
+/* See http://0x80.pl/notesen/2016-01-12-sse-base64-encoding.html - Reads 16 bytes but only encodes the first 12 */
+static NSUInteger _EncodeBlocks(const unsigned char* input, NSUInteger length, char* output)
+{
+	const char*				start = output;
+	__m128i					block;
+	
+	while(length >= 16) {
+		block = _mm_loadu_si128((const __m128i*)input);
+		block = _mm_shuffle_epi8(block, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+		block = _mm_or_si128(_mm_mulhi_epu16(_mm_and_si128(block, _mm_set1_epi32(0x0FC0FC00)), _mm_set1_epi32(0x04000040)), _mm_mullo_epi16(_mm_and_si128(block, _mm_set1_epi32(0x003F03F0)), _mm_set1_epi32(0x01000010)));
+		_mm_storeu_si128((__m128i*)output, _EncodeValues(block));
+		input += 12;
+		length -= 12;
+		output += 16;
+	}
+	for(; length; length -= 3, input += 3, output += 4)
+	_EncodeQuantum(input, output);
+	
+	return output - start;
+}
+
+/* Returns the number of characters decoded which stops at the first block containing anything else than base64 digits (whitespace, padding or invalid characters) */
+static NSUInteger _DecodeBlocks(const unsigned char* input, NSUInteger length, unsigned char* output)
+{
+	const unsigned char*	start = input;
+	__m128i					block,
+							upper,
+							lower,
+							digit,
+							plus,
+							slash,
+							shift;
+	
+	while(length >= 24) { //NOTE: 16 bytes are stored but only 12 are valid so make sure the output buffer has room for them
+		block = _mm_loadu_si128((const __m128i*)input);
+		upper = _mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(block, _mm_set1_epi8('Z' + 1)));
+		lower = _mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(block, _mm_set1_epi8('z' + 1)));
+		digit = _mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(block, _mm_set1_epi8('9' + 1)));
+		plus = _mm_cmpeq_epi8(block, _mm_set1_epi8('+'));
+		slash = _mm_cmpeq_epi8(block, _mm_set1_epi8('/'));
+		if(_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, plus)), slash)) != 0xFFFF)
+		break;
+		
+		shift = _mm_and_si128(upper, _mm_set1_epi8(-'A'));
+		shift = _mm_or_si128(shift, _mm_and_si128(lower, _mm_set1_epi8(26 - 'a')));
+		shift = _mm_or_si128(shift, _mm_and_si128(digit, _mm_set1_epi8(52 - '0')));
+		shift = _mm_or_si128(shift, _mm_and_si128(plus, _mm_set1_epi8(62 - '+')));
+		shift = _mm_or_si128(shift, _mm_and_si128(slash, _mm_set1_epi8(63 - '/')));
+		block = _mm_add_epi8(block, shift);
+		
+		//NOTE: Merge the 6-bit values into 24-bit groups and store them in big-endian order
+		block = _mm_madd_epi16(_mm_maddubs_epi16(block, _mm_set1_epi32(0x01400140)), _mm_set1_epi32(0x00011000));
+		block = _mm_shuffle_epi8(block, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+		_mm_storeu_si128((__m128i*)output, block);
+		input += 16;
+		length -= 16;
+		output += 12;
+	}
+	
+	return input - start;
+}
+
+#elif defined(__ARM_NEON__)
+
+static inline uint8x16_t _EncodeValues(uint8x16_t values)
+{
+	uint8x16_t				result = vaddq_u8(values, vdupq_n_u8('A'));
+	
+	result = vaddq_u8(result, vandq_u8(vcgtq_u8(values, vdupq_n_u8(25)), vdupq_n_u8('a' - 26 - 'A')));
+	result = vsubq_u8(result, vandq_u8(vcgtq_u8(values, vdupq_n_u8(51)), vdupq_n_u8('a' - 26 - '0' + 52)));
+	result = vsubq_u8(result, vandq_u8(vceqq_u8(values, vdupq_n_u8(62)), vdupq_n_u8('0' - 52 - '+' + 62)));
+	result = vsubq_u8(result, vandq_u8(vceqq_u8(values, vdupq_n_u8(63)), vdupq_n_u8('0' - 52 - '/' + 63)));
+	
+	return result;
+}
+
+/* De-interleaving loads and interleaving stores do all the shuffling so 48 bytes are encoded at once */
+static NSUInteger _EncodeBlocks(const unsigned char* input, NSUInteger length, char* output)
+{
+	const char*				start = output;
+	uint8x16x3_t			in;
+	uint8x16x4_t			out;
+	
+	while(length >= 48) {
+		in = vld3q_u8(input);
+		out.val[0] = _EncodeValues(vshrq_n_u8(in.val[0], 2));
+		out.val[1] = _EncodeValues(vorrq_u8(vshlq_n_u8(vandq_u8(in.val[0], vdupq_n_u8(0x03)), 4), vshrq_n_u8(in.val[1], 4)));
+		out.val[2] = _EncodeValues(vorrq_u8(vshlq_n_u8(vandq_u8(in.val[1], vdupq_n_u8(0x0F)), 2), vshrq_n_u8(in.val[2], 6)));
+		out.val[3] = _EncodeValues(vandq_u8(in.val[2], vdupq_n_u8(0x3F)));
+		vst4q_u8((uint8_t*)output, out);
+		input += 48;
+		length -= 48;
+		output += 64;
+	}
+	for(; length; length -= 3, input += 3, output += 4)
+	_EncodeQuantum(input, output);
+	
+	return output - start;
+}
+
+static inline uint8x16_t _DecodeCharacters(uint8x16_t characters, uint8x16_t* valid)
+{
+	uint8x16_t				upper = vcltq_u8(vsubq_u8(characters, vdupq_n_u8('A')), vdupq_n_u8(26)),
+							lower = vcltq_u8(vsubq_u8(characters, vdupq_n_u8('a')), vdupq_n_u8(26)),
+							digit = vcltq_u8(vsubq_u8(characters, vdupq_n_u8('0')), vdupq_n_u8(10)),
+							plus = vceqq_u8(characters, vdupq_n_u8('+')),
+							slash = vceqq_u8(characters, vdupq_n_u8('/')),
+							shift;
+	
+	shift = vandq_u8(upper, vdupq_n_u8((uint8_t)-'A'));
+	shift = vorrq_u8(shift, vandq_u8(lower, vdupq_n_u8((uint8_t)(26 - 'a'))));
+	shift = vorrq_u8(shift, vandq_u8(digit, vdupq_n_u8((uint8_t)(52 - '0'))));
+	shift = vorrq_u8(shift, vandq_u8(plus, vdupq_n_u8((uint8_t)(62 - '+'))));
+	shift = vorrq_u8(shift, vandq_u8(slash, vdupq_n_u8((uint8_t)(63 - '/'))));
+	*valid = vandq_u8(*valid, vorrq_u8(vorrq_u8(vorrq_u8(upper, lower), vorrq_u8(digit, plus)), slash));
+	
+	return vaddq_u8(characters, shift);
+}
+
+/* Returns the number of characters decoded which stops at the first block containing anything else than base64 digits (whitespace, padding or invalid characters) */
+static NSUInteger _DecodeBlocks(const unsigned char* input, NSUInteger length, unsigned char* output)
+{
+	const unsigned char*	start = input;
+	uint8x16x4_t			in;
+	uint8x16x3_t			out;
+	uint8x16_t				valid;
+	uint8x8_t				mask;
+	
+	while(length >= 64) {
+		in = vld4q_u8(input);
+		valid = vdupq_n_u8(0xFF);
+		in.val[0] = _DecodeCharacters(in.val[0], &valid);
+		in.val[1] = _DecodeCharacters(in.val[1], &valid);
+		in.val[2] = _DecodeCharacters(in.val[2], &valid);
+		in.val[3] = _DecodeCharacters(in.val[3], &valid);
+		mask = vand_u8(vget_low_u8(valid), vget_high_u8(valid));
+		mask = vpmin_u8(mask, mask);
+		mask = vpmin_u8(mask, mask);
+		mask = vpmin_u8(mask, mask);
+		if(vget_lane_u8(mask, 0) != 0xFF)
+		break;
+		
+		out.val[0] = vorrq_u8(vshlq_n_u8(in.val[0], 2), vshrq_n_u8(in.val[1], 4));
+		out.val[1] = vorrq_u8(vshlq_n_u8(in.val[1], 4), vshrq_n_u8(in.val[2], 2));
+		out.val[2] = vorrq_u8(vshlq_n_u8(in.val[2], 6), in.val[3]);
+		vst3q_u8(output, out);
+		input += 64;
+		length -= 64;
+		output += 48;
+	}
+	
+	return input - start;
+}
+
+#else
+
+static NSUInteger _EncodeBlocks(const unsigned char* input, NSUInteger length, char* output)
+{
+	const char*				start = output;
+	
+	for(; length; length -= 3, input += 3, output += 4)
+	_EncodeQuantum(input, output);
+	
+	return output - start;
+}
+
+#endif
+
+void Base64EncoderInit(Base64Encoder* encoder)
+{
+	bzero(encoder, sizeof(Base64Encoder));
+}
+
+NSUInteger Base64EncoderUpdate(Base64Encoder* encoder, const void* bytes, NSUInteger length, char* output)
+{
+	const unsigned char*	input = (const unsigned char*)bytes;
+	const char*				start = output;
+	NSUInteger				count;
+	
+	if(encoder->count) {
+		while(length && (encoder->count < 3)) {
+			encoder->bytes[encoder->count++] = *input++;
+			length -= 1;
+		}
+		if(encoder->count < 3)
+		return 0;
+		_EncodeQuantum(encoder->bytes, output);
+		output += 4;
+		encoder->count = 0;
+	}
+	
+	count = length / 3 * 3;
+	output += _EncodeBlocks(input, count, output);
+	input += count;
+	length -= count;
+	
+	while(length) {
+		encoder->bytes[encoder->count++] = *input++;
+		length -= 1;
+	}
+	
+	return output - start;
+}
+
+NSUInteger Base64EncoderFinal(Base64Encoder* encoder, char* output)
+{
+	NSUInteger				count = encoder->count;
+	
+	if(count) {
+		if(count == 1)
+		encoder->bytes[1] = 0;
+		encoder->bytes[2] = 0;
+		_EncodeQuantum(encoder->bytes, output);
+		output[3] = '=';
+		if(count == 1)
+		output[2] = '=';
+	}
+	encoder->count = 0;
+	
+	return (count ? 4 : 0);
+}
+
+void Base64DecoderInit(Base64Decoder* decoder)
+{
+	bzero(decoder, sizeof(Base64Decoder));
+}
+
+static inline unsigned char* _DecodeBits(UInt32 bits, NSUInteger count, unsigned char* output)
+{
+	if(count == 4) {
+		*output++ = bits >> 16;
+		*output++ = bits >> 8;
+		*output++ = bits;
+	}
+	else if(count == 3) {
+		*output++ = bits >> 10;
+		*output++ = bits >> 2;
+	}
+	else if(count == 2)
+	*output++ = bits >> 4;
+	
+	return output;
+}
+
+NSInteger Base64DecoderUpdate(Base64Decoder* decoder, const char* string, NSUInteger length, void* output)
+{
+	const unsigned char*	input = (const unsigned char*)string;
+	unsigned char*			start = (unsigned char*)output;
+	unsigned char*			bytes = start;
+	unsigned char			value;
+#if defined(__SSSE3__) || defined(__ARM_NEON__)
+	NSUInteger				count;
+#endif
+	
+	while(length && !decoder->failed) {
+#if defined(__SSSE3__) || defined(__ARM_NEON__)
+		if((decoder->count == 0) && !decoder->padding) {
+			count = _DecodeBlocks(input, length, bytes);
+			input += count;
+			length -= count;
+			bytes += count / 4 * 3;
+			if(length == 0)
+			break;
+		}
+#endif
+		
+		value = _decodeTable[*input++];
+		length -= 1;
+		if(value == WS)
+		continue;
+		
+		if(value == PD) {
+			if((decoder->count < 2) || (decoder->count + decoder->padding >= 4))
+			decoder->failed = YES;
+			else if(decoder->count + ++decoder->padding == 4) {
+				bytes = _DecodeBits(decoder->bits, decoder->count, bytes);
+				decoder->bits = 0;
+				decoder->count = 0;
+			}
+		}
+		else if((value == IV) || decoder->padding) //NOTE: Nothing is allowed after padding
+		decoder->failed = YES;
+		else {
+			decoder->bits = (decoder->bits << 6) | value;
+			if(++decoder->count == 4) {
+				bytes = _DecodeBits(decoder->bits, 4, bytes);
+				decoder->bits = 0;
+				decoder->count = 0;
+			}
+		}
+	}
+	
+	return (decoder->failed ? -1 : bytes - start);
+}
+
+/* Incomplete padding is tolerated but not a single dangling character */
+NSInteger Base64DecoderFinal(Base64Decoder* decoder, void* output)
+{
+	NSInteger				result = -1;
+	
+	if(!decoder->failed && (decoder->count != 1))
+	result = _DecodeBits(decoder->bits, decoder->count, (unsigned char*)output) - (unsigned char*)output;
+	Base64DecoderInit(decoder);
+	
+	return result;
+}
+
+NSUInteger Base64EncodeBytes(const void* bytes, NSUInteger length, char* output)
+{
+	Base64Encoder			encoder;
+	NSUInteger				count;
+	
+	Base64EncoderInit(&encoder);
+	count = Base64EncoderUpdate(&encoder, bytes, length, output);
+	
+	return count + Base64EncoderFinal(&encoder, output + count);
+}
+
+NSInteger Base64DecodeBytes(const char* string, NSUInteger length, void* output)
+{
+	Base64Decoder			decoder;
+	NSInteger				count,
+							result;
+	
+	Base64DecoderInit(&decoder);
+	count = Base64DecoderUpdate(&decoder, string, length, output);
+	result = Base64DecoderFinal(&decoder, (unsigned char*)output + MAX(count, 0));
+	
+	return ((count >= 0) && (result >= 0) ? count + result : -1);
+}
+
+NSString* Base64EncodeData(NSData* data)
+{
+	NSUInteger				length = Base64EncodedLength([data length]);
+	char*					buffer;
+	
+	if(data == nil)
+	return nil;
+	
+	buffer = malloc(length);
+	if(buffer == NULL)
+	return nil;
+	Base64EncodeBytes([data bytes], [data length], buffer);
+	
+	return [[[NSString alloc] initWithBytesNoCopy:buffer length:length encoding:NSASCIIStringEncoding freeWhenDone:YES] autorelease];
+}
+
+NSData* Base64DecodeString(NSString* string)
+{
+	NSData*					data = [string dataUsingEncoding:NSASCIIStringEncoding];
+	NSMutableData*			result;
+	NSInteger				length;
+	
+	if(data == nil)
+	return nil;
+	
+	result = [NSMutableData dataWithLength:Base64DecodedMaximumLength([data length])];
+	length = Base64DecodeBytes([data bytes], [data length], [result mutableBytes]);
+	if(length < 0)
+	return nil;
+	[result setLength:length];
+	
+	return result;
+}
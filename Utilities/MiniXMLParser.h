@@ -56,3 +56,34 @@
 - (MiniXMLNode*) firstNodeAtSubpath:(NSString*)path;
 - (NSArray*) childrenWithName:(NSString*)name;
 @end
+
+/* Streaming parser built on top of the libxml2 push parser: data can be passed as it is received and no tree is built */
+/* Each time an element matching a watched path ends, the target is called with the text values of its descendant leaf elements keyed by subpath (the first occurrence wins, empty elements have an empty value and nested watched paths are ignored) */
+@interface MiniXMLStreamParser : NSObject
+{
+@private
+	void*					_context;
+	void*					_namespace;
+	id						_target;
+	SEL						_selector;
+	IMP						_method;
+	NSMutableSet*			_watchedPaths;
+	NSMutableArray*			_elements;
+	NSString*				_rootName;
+	NSString*				_matchedPath;
+	NSUInteger				_matchedDepth;
+	NSMutableDictionary*	_values;
+	NSMutableData*			_text; //Raw UTF-8 bytes of the current leaf element
+	BOOL					_leaf;
+	BOOL					_failed;
+}
+- (id) initWithNodeNamespace:(NSString*)namespace target:(id)target selector:(SEL)selector; //Selector must be of the form "- (void) parser:(MiniXMLStreamParser*)parser didEndElementAtPath:(NSString*)path values:(NSDictionary*)values"
+@property(nonatomic, readonly) NSString* nodeNamespace;
+
+- (void) watchPath:(NSString*)path; //Same syntax as -[MiniXMLParser firstNodeAtPath:]
+@property(nonatomic, readonly) NSString* rootName; //nil until the root element has been parsed
+
+- (BOOL) parseBytes:(const void*)bytes length:(NSUInteger)length; //Returns NO on error
+- (BOOL) parseData:(NSData*)data;
+- (BOOL) finishParsing; //Returns NO if the document is invalid or incomplete
+@end
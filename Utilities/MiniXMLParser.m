@@ -21,6 +21,7 @@
 #import "MiniXMLParser.h"
 
 #define kPathSeparator			':'
+#define kPathSeparatorString	@":"
 
 @interface MiniXMLParser ()
 @property(nonatomic, readonly) void* _namespace;
@@ -283,3 +284,195 @@ static void _AppendNodeDescription(xmlNodePtr node, NSMutableString* string, NSS
 }
 
 @end
+
+@interface MiniXMLStreamParser ()
+- (void) _startElement:(const xmlChar*)name namespace:(const xmlChar*)URI;
+- (void) _endElement;
+- (void) _appendCharacters:(const xmlChar*)characters length:(int)length;
+@end
+
+static void _StartElementNs(void* context, const xmlChar* localname, const xmlChar* prefix, const xmlChar* URI, int nb_namespaces, const xmlChar** namespaces, int nb_attributes, int nb_defaulted, const xmlChar** attributes)
+{
+	[(MiniXMLStreamParser*)context _startElement:localname namespace:URI];
+}
+
+static void _EndElementNs(void* context, const xmlChar* localname, const xmlChar* prefix, const xmlChar* URI)
+{
+	[(MiniXMLStreamParser*)context _endElement];
+}
+
+static void _Characters(void* context, const xmlChar* characters, int length)
+{
+	[(MiniXMLStreamParser*)context _appendCharacters:characters length:length];
+}
+
+@implementation MiniXMLStreamParser
+
+@synthesize rootName=_rootName;
+
+- (id) initWithNodeNamespace:(NSString*)namespace target:(id)target selector:(SEL)selector
+{
+	const char*			string = [namespace UTF8String];
+	xmlSAXHandler		handler;
+	size_t				length;
+	
+	if((self = [super init])) {
+		bzero(&handler, sizeof(xmlSAXHandler));
+		handler.initialized = XML_SAX2_MAGIC;
+		handler.startElementNs = _StartElementNs;
+		handler.endElementNs = _EndElementNs;
+		handler.characters = _Characters;
+		handler.cdataBlock = _Characters;
+		_context = xmlCreatePushParserCtxt(&handler, self, NULL, 0, NULL);
+		if((_context == NULL) || ![target respondsToSelector:selector]) {
+			[self release];
+			return nil;
+		}
+		
+		if(string && (length = strlen(string))) {
+			_namespace = malloc(length + 1);
+			bcopy(string, _namespace, length + 1);
+		}
+		
+		_target = target;
+		_selector = selector;
+		_method = [target methodForSelector:selector];
+		_watchedPaths = [NSMutableSet new];
+		_elements = [NSMutableArray new];
+		_values = [NSMutableDictionary new];
+		_text = [NSMutableData new];
+	}
+	
+	return self;
+}
+
+- (void) _cleanUp_MiniXMLStreamParser
+{
+	if(_namespace)
+	free(_namespace);
+	if(_context)
+	xmlFreeParserCtxt(_context);
+}
+
+- (void) finalize
+{
+	[self _cleanUp_MiniXMLStreamParser];
+	
+	[super finalize];
+}
+
+- (void) dealloc
+{
+	[self _cleanUp_MiniXMLStreamParser];
+	
+	[_text release];
+	[_values release];
+	[_matchedPath release];
+	[_rootName release];
+	[_elements release];
+	[_watchedPaths release];
+	
+	[super dealloc];
+}
+
+- (NSString*) nodeNamespace
+{
+	return (_namespace ? [NSString stringWithUTF8String:_namespace] : nil);
+}
+
+- (void) watchPath:(NSString*)path
+{
+	if([path length])
+	[_watchedPaths addObject:path];
+}
+
+/* Elements outside of the namespace are recorded as NSNull so that paths going through them never match */
+- (void) _startElement:(const xmlChar*)name namespace:(const xmlChar*)URI
+{
+	BOOL				valid = (!_namespace || (URI && !xmlStrcmp(URI, _namespace)));
+	id					element = (valid ? [[NSString alloc] initWithUTF8String:(const char*)name] : [NSNull null]);
+	NSString*			path;
+	
+	[_elements addObject:element];
+	if(valid)
+	[element release];
+	
+	if([_elements count] == 1)
+	_rootName = (valid ? [element copy] : nil);
+	
+	if(_matchedDepth == 0) {
+		if(valid && ![_elements containsObject:[NSNull null]]) {
+			path = [_elements componentsJoinedByString:kPathSeparatorString];
+			if([_watchedPaths containsObject:path]) {
+				_matchedPath = [path copy];
+				_matchedDepth = [_elements count];
+			}
+		}
+	}
+	
+	_leaf = YES;
+	[_text setLength:0];
+}
+
+- (void) _endElement
+{
+	NSUInteger			depth = [_elements count];
+	NSArray*			subpath;
+	NSString*			path;
+	NSString*			string;
+	
+	//NOTE: The text is only decoded once the element ends as libxml2 may split it in several chunks
+	if(_matchedDepth && _leaf) {
+		subpath = [_elements subarrayWithRange:NSMakeRange(_matchedDepth, depth - _matchedDepth)];
+		if(![subpath containsObject:[NSNull null]]) {
+			path = [subpath componentsJoinedByString:kPathSeparatorString];
+			if(![_values objectForKey:path]) {
+				string = [[NSString alloc] initWithBytes:[_text bytes] length:[_text length] encoding:NSUTF8StringEncoding];
+				if(string)
+				[_values setObject:string forKey:path];
+				[string release];
+			}
+		}
+	}
+	
+	if(_matchedDepth == depth) {
+		(*(void(*)(id, SEL, MiniXMLStreamParser*, NSString*, NSDictionary*))_method)(_target, _selector, self, _matchedPath, _values);
+		[_values removeAllObjects];
+		[_matchedPath release];
+		_matchedPath = nil;
+		_matchedDepth = 0;
+	}
+	
+	[_elements removeLastObject];
+	_leaf = NO;
+	[_text setLength:0];
+}
+
+- (void) _appendCharacters:(const xmlChar*)characters length:(int)length
+{
+	if(_matchedDepth && _leaf)
+	[_text appendBytes:characters length:length];
+}
+
+- (BOOL) parseBytes:(const void*)bytes length:(NSUInteger)length
+{
+	if(!_failed && length && (xmlParseChunk(_context, bytes, length, 0) != XML_ERR_OK))
+	_failed = YES;
+	
+	return !_failed;
+}
+
+- (BOOL) parseData:(NSData*)data
+{
+	return [self parseBytes:[data bytes] length:[data length]];
+}
+
+- (BOOL) finishParsing
+{
+	if(!_failed && (xmlParseChunk(_context, NULL, 0, 1) != XML_ERR_OK))
+	_failed = YES;
+	
+	return !_failed;
+}
+
+@end
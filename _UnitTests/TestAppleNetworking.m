@@ -0,0 +1,734 @@
+/*
+	This file is part of the PolKit library.
+	Copyright (C) 2008-2009 Pierre-Olivier Latour <info@pol-online.net>
+	
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#import <sys/socket.h>
+#import <sys/resource.h>
+#import <netinet/in.h>
+#import <fcntl.h>
+#import <libkern/OSAtomic.h>
+#import <pthread.h>
+
+#import "UnitTesting.h"
+#import "GameChannel.h"
+#import "GameTelemetry.h"
+#import "Game_Internal.h"
+#import "NetUtilities.h"
+#import "TCPConnection.h"
+#import "TCPServer.h"
+
+#define kChannelTestDatagrams		500
+#define kChannelLossPercentage		10
+#define kChannelDuplicatePercentage	5
+#define kChannelMaxDelay			40 //Milliseconds
+#define kServerWorkerThreads		4
+#define kServerTestConnections		1000
+#define kHandshakeIterations		10000
+#define kLegacyGamePeerMagic		0xABCD1234
+#define kConnectionMessages			20000
+#define kConnectionMessageSize		64
+#define kConnectionBatchSize		16
+#define kConnectionHeaderSize		(2 * sizeof(NSUInteger)) //NOTE: Same as the TCPConnection frame header i.e. magic number and length
+#define kConnectionMagic			0x1234ABCD
+#define kMallocLogTypeAllocate		2
+
+extern void (*malloc_logger)(uint32_t type, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3, uintptr_t result, uint32_t numHotFramesToSkip); //NOTE: Hook used by malloc stack logging which is called for every allocation and de-allocation
+
+static NSUInteger _mallocCount = 0;
+
+/* Only counts allocations made on the main thread as the benchmarks run there */
+static void _MallocLogger(uint32_t type, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3, uintptr_t result, uint32_t numHotFramesToSkip)
+{
+	if((type & kMallocLogTypeAllocate) && pthread_main_np())
+	_mallocCount += 1;
+}
+
+@interface UnitTests_AppleNetworking : UnitTest <GameChannelDelegate, TCPServerDelegate, TCPConnectionDelegate>
+{
+@private
+	GameChannel*			_channels[2];
+	NSMutableArray*			_pendingDatagrams;
+	NSUInteger				_lossPercentage;
+	NSUInteger				_sentDatagrams;
+	NSUInteger				_droppedDatagrams;
+	NSMutableArray*			_receivedData;
+	BOOL					_channelTimedOut;
+	
+	NSMutableSet*			_serverThreads;
+	volatile int32_t		_stopServerFromWorker;
+	volatile BOOL			_serverStoppedFromWorker;
+	
+	BOOL					_connectionOpened;
+	NSUInteger				_drainLength;
+	volatile NSUInteger		_drainedBytes;
+	volatile BOOL			_drainDone;
+}
+@end
+
+@interface UnitTests_ShardedTCPServer : TCPServer
+@end
+
+@interface GamePeer (UnitTests)
+- (NSData*) _handshakeData;
+- (BOOL) _readHandshakeData:(NSData*)data;
+@end
+
+@implementation UnitTests_ShardedTCPServer
+
++ (NSUInteger) connectionWorkerThreads
+{
+	return kServerWorkerThreads;
+}
+
+@end
+
+@implementation UnitTests_AppleNetworking
+
+/* Simulates a lossy network that also delays, reorders and duplicates datagrams */
+- (BOOL) gameChannel:(GameChannel*)channel sendDatagram:(NSData*)datagram
+{
+	GameChannel*			destination = (channel == _channels[0] ? _channels[1] : _channels[0]);
+	NSUInteger				count,
+							i;
+	
+	_sentDatagrams += 1;
+	if(random() % 100 < _lossPercentage) {
+		_droppedDatagrams += 1;
+		return YES;
+	}
+	
+	count = (random() % 100 < kChannelDuplicatePercentage ? 2 : 1);
+	for(i = 0; i < count; ++i)
+	[_pendingDatagrams addObject:[NSArray arrayWithObjects:datagram, destination, [NSNumber numberWithDouble:(CFAbsoluteTimeGetCurrent() + (double)(random() % kChannelMaxDelay) / 1000.0)], nil]];
+	
+	return YES;
+}
+
+- (void) gameChannel:(GameChannel*)channel didReceiveData:(NSData*)data
+{
+	if(channel == _channels[1])
+	[_receivedData addObject:data];
+}
+
+- (void) gameChannel:(GameChannel*)channel didReceiveProbeReply:(UInt32)sequence sendTime:(CFAbsoluteTime)sendTime
+{
+	;
+}
+
+- (void) gameChannel:(GameChannel*)channel didReceiveSnapshotData:(NSData*)data
+{
+	;
+}
+
+- (void) gameChannel:(GameChannel*)channel didReceiveSnapshotAck:(UInt32)identifier
+{
+	;
+}
+
+- (void) gameChannelDidTimeOut:(GameChannel*)channel
+{
+	_channelTimedOut = YES;
+}
+
+- (void) _deliverDatagrams
+{
+	CFAbsoluteTime			now = CFAbsoluteTimeGetCurrent();
+	NSArray*				entry;
+	
+	for(entry in [NSArray arrayWithArray:_pendingDatagrams]) {
+		if([[entry objectAtIndex:2] doubleValue] <= now) {
+			[_pendingDatagrams removeObjectIdenticalTo:entry];
+			[[entry objectAtIndex:1] receiveDatagram:[entry objectAtIndex:0]];
+		}
+	}
+}
+
+- (void) _runChannels
+{
+	NSAutoreleasePool*		localPool = [NSAutoreleasePool new];
+	
+	[[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.001]];
+	[self _deliverDatagrams];
+	
+	[localPool release];
+}
+
+- (void) testGameChannel
+{
+	NSUInteger				i;
+	UInt32					value;
+	CFAbsoluteTime			time;
+	
+	srandom(1);
+	_pendingDatagrams = [NSMutableArray new];
+	_receivedData = [NSMutableArray new];
+	for(i = 0; i < 2; ++i) {
+		_channels[i] = [GameChannel new];
+		AssertNotNil(_channels[i], nil);
+		[_channels[i] setDelegate:self];
+	}
+	
+	_lossPercentage = kChannelLossPercentage;
+	for(i = 0; i < kChannelTestDatagrams; ++i) {
+		value = i;
+		AssertTrue([_channels[0] sendData:[NSData dataWithBytes:&value length:sizeof(value)] mode:kGameDeliveryMode_ReliableOrdered], nil);
+	}
+	time = CFAbsoluteTimeGetCurrent();
+	while((([_receivedData count] < kChannelTestDatagrams) || [_channels[0] pendingReliableCount]) && !_channelTimedOut && (CFAbsoluteTimeGetCurrent() - time < 60.0))
+	[self _runChannels];
+	[self logMessage:@"GameChannel: %i reliable datagrams delivered in %.1f seconds using %i datagrams (%i dropped)", (int)[_receivedData count], CFAbsoluteTimeGetCurrent() - time, (int)_sentDatagrams, (int)_droppedDatagrams];
+	AssertFalse(_channelTimedOut, nil);
+	AssertTrue(_droppedDatagrams > 0, nil);
+	AssertEquals([_receivedData count], (NSUInteger)kChannelTestDatagrams, nil);
+	for(i = 0; i < [_receivedData count]; ++i) {
+		memcpy(&value, [[_receivedData objectAtIndex:i] bytes], sizeof(value));
+		AssertEquals(value, (UInt32)i, nil);
+	}
+	AssertEquals([_channels[0] pendingReliableCount], (NSUInteger)0, nil);
+	
+	//NOTE: Let the remaining duplicates arrive and check they are not delivered again
+	time = CFAbsoluteTimeGetCurrent();
+	while(CFAbsoluteTimeGetCurrent() - time < 0.2)
+	[self _runChannels];
+	AssertEquals([_receivedData count], (NSUInteger)kChannelTestDatagrams, nil);
+	
+	_lossPercentage = 100;
+	for(i = 0; i < 4096; ++i) {
+		value = i;
+		if(![_channels[0] sendData:[NSData dataWithBytes:&value length:sizeof(value)] mode:kGameDeliveryMode_ReliableOrdered])
+		break;
+	}
+	AssertTrue((i > 0) && (i < 4096), nil);
+	AssertEquals([_channels[0] pendingReliableCount], i, nil);
+	time = CFAbsoluteTimeGetCurrent();
+	while(!_channelTimedOut && (CFAbsoluteTimeGetCurrent() - time < 30.0))
+	[self _runChannels];
+	[self logMessage:@"GameChannel: gave up on unreachable peer after %.1f seconds", CFAbsoluteTimeGetCurrent() - time];
+	AssertTrue(_channelTimedOut, nil);
+	AssertEquals([_channels[0] pendingReliableCount], (NSUInteger)0, nil);
+	AssertFalse([_channels[0] sendData:[NSData data] mode:kGameDeliveryMode_ReliableOrdered], nil);
+	
+	[_pendingDatagrams removeAllObjects];
+	for(i = 0; i < 2; ++i) {
+		[_channels[i] invalidate];
+		[_channels[i] release];
+		_channels[i] = nil;
+	}
+	[_receivedData release];
+	_receivedData = nil;
+	[_pendingDatagrams release];
+	_pendingDatagrams = nil;
+}
+
+/* Called on the worker threads */
+- (void) server:(TCPServer*)server didOpenConnection:(TCPServerConnection*)connection
+{
+	@synchronized(self) {
+		[_serverThreads addObject:[NSThread currentThread]];
+	}
+	
+	if(OSAtomicCompareAndSwap32Barrier(1, 0, &_stopServerFromWorker)) {
+		[server stop];
+		_serverStoppedFromWorker = YES;
+	}
+}
+
+- (NSUInteger) _connectSockets:(int*)sockets count:(NSUInteger)count toPort:(UInt16)port
+{
+	struct sockaddr_in		address;
+	NSUInteger				i;
+	
+	bzero(&address, sizeof(address));
+	address.sin_len = sizeof(address);
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	for(i = 0; i < count; ++i) {
+		sockets[i] = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if(sockets[i] < 0)
+		break;
+		if(connect(sockets[i], (struct sockaddr*)&address, sizeof(address))) {
+			close(sockets[i]);
+			break;
+		}
+		[[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate date]]; //NOTE: Let the server accept the connection so the listen backlog never fills up
+	}
+	
+	return i;
+}
+
+- (void) _waitForServer:(TCPServer*)server connectionCount:(NSUInteger)count
+{
+	CFAbsoluteTime			time = CFAbsoluteTimeGetCurrent();
+	
+	while(([[server allConnections] count] != count) && (CFAbsoluteTimeGetCurrent() - time < 10.0))
+	[[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+}
+
+- (void) testTCPServerWorkerThreads
+{
+	int*					sockets;
+	struct rlimit			limit;
+	NSUInteger				maxCount,
+							count,
+							i;
+	TCPServer*				server;
+	CFAbsoluteTime			time;
+	
+	//NOTE: Each loopback connection uses 2 file descriptors in this process
+	getrlimit(RLIMIT_NOFILE, &limit);
+	if(limit.rlim_cur < 2 * kServerTestConnections + 256) {
+		limit.rlim_cur = MIN(MIN(2 * kServerTestConnections + 256, limit.rlim_max), OPEN_MAX);
+		setrlimit(RLIMIT_NOFILE, &limit);
+		getrlimit(RLIMIT_NOFILE, &limit);
+	}
+	maxCount = MIN(kServerTestConnections, (limit.rlim_cur - 256) / 2);
+	sockets = malloc(maxCount * sizeof(int));
+	_serverThreads = [NSMutableSet new];
+	
+	server = [[UnitTests_ShardedTCPServer alloc] initWithPort:0];
+	AssertNotNil(server, nil);
+	[server setDelegate:self];
+	AssertTrue([server startUsingRunLoop:[NSRunLoop currentRunLoop]], nil);
+	time = CFAbsoluteTimeGetCurrent();
+	count = [self _connectSockets:sockets count:maxCount toPort:[server localPort]];
+	AssertEquals(count, maxCount, nil);
+	[self _waitForServer:server connectionCount:count];
+	[self logMessage:@"TCPServer: %i connections opened on %i worker threads in %.2f seconds", (int)count, (int)[_serverThreads count], CFAbsoluteTimeGetCurrent() - time];
+	AssertEquals([[server allConnections] count], count, nil);
+	AssertEquals([_serverThreads count], (NSUInteger)kServerWorkerThreads, nil);
+	AssertFalse([_serverThreads containsObject:[NSThread currentThread]], nil);
+	[server stop];
+	AssertFalse([server isRunning], nil);
+	AssertEquals([[server allConnections] count], (NSUInteger)0, nil);
+	[server release];
+	for(i = 0; i < count; ++i)
+	close(sockets[i]);
+	
+	server = [[UnitTests_ShardedTCPServer alloc] initWithPort:0];
+	AssertNotNil(server, nil);
+	[server setDelegate:self];
+	AssertTrue([server startUsingRunLoop:[NSRunLoop currentRunLoop]], nil);
+	count = [self _connectSockets:sockets count:(2 * kServerWorkerThreads) toPort:[server localPort]];
+	AssertEquals(count, (NSUInteger)(2 * kServerWorkerThreads), nil);
+	[self _waitForServer:server connectionCount:count];
+	AssertEquals([[server allConnections] count], count, nil);
+	_serverStoppedFromWorker = NO;
+	_stopServerFromWorker = 1;
+	count += [self _connectSockets:&sockets[count] count:1 toPort:[server localPort]];
+	time = CFAbsoluteTimeGetCurrent();
+	while(!_serverStoppedFromWorker && (CFAbsoluteTimeGetCurrent() - time < 10.0))
+	[[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+	AssertTrue(_serverStoppedFromWorker, nil);
+	AssertFalse([server isRunning], nil);
+	AssertEquals([[server allConnections] count], (NSUInteger)0, nil);
+	[server release];
+	for(i = 0; i < count; ++i)
+	close(sockets[i]);
+	
+	[_serverThreads release];
+	_serverThreads = nil;
+	free(sockets);
+}
+
+- (void) _recordRoundTripTime:(NSTimeInterval)time telemetry:(GameTelemetry*)telemetry
+{
+	[telemetry recordReplyForProbe:[telemetry nextProbeSequence] sendTime:(CFAbsoluteTimeGetCurrent() - time)];
+}
+
+- (void) testGameTelemetry
+{
+	GameTelemetry*			telemetry;
+	GameTelemetry*			otherTelemetry;
+	GameLinkStatistics		statistics;
+	UInt32					sequence;
+	NSUInteger				i;
+	
+	telemetry = [GameTelemetry new];
+	statistics = [telemetry statistics];
+	AssertEquals(statistics.lossRate, 0.0, nil);
+	AssertEquals([telemetry roundTripTimeAtPercentile:50.0], 0.0, nil);
+	for(i = 0; i < 10; ++i)
+	[telemetry nextProbeSequence];
+	statistics = [telemetry statistics];
+	AssertEquals(statistics.probesSent, (NSUInteger)10, nil);
+	AssertEquals(statistics.repliesReceived, (NSUInteger)0, nil);
+	AssertEquals(statistics.lossRate, 1.0, nil);
+	[telemetry release];
+	
+	//NOTE: Reply to even probes only - The latest 2 probes are considered in flight and not lost yet
+	telemetry = [GameTelemetry new];
+	for(i = 0; i < 2 * kGameTelemetryWindow; ++i) {
+		sequence = [telemetry nextProbeSequence];
+		if(sequence % 2 == 0)
+		[telemetry recordReplyForProbe:sequence sendTime:CFAbsoluteTimeGetCurrent()];
+	}
+	statistics = [telemetry statistics];
+	AssertEquals(statistics.probesSent, (NSUInteger)(2 * kGameTelemetryWindow), nil);
+	AssertEquals(statistics.repliesReceived, (NSUInteger)kGameTelemetryWindow, nil);
+	AssertEquals(statistics.lossRate, 0.5, nil);
+	[telemetry recordReplyForProbe:sequence sendTime:CFAbsoluteTimeGetCurrent()]; //In flight so not part of the loss rate
+	AssertEquals([telemetry statistics].lossRate, 0.5, nil);
+	[telemetry recordReplyForProbe:(sequence - 2) sendTime:CFAbsoluteTimeGetCurrent()];
+	AssertEquals([telemetry statistics].lossRate, 30.0 / 62.0, nil);
+	[telemetry recordReplyForProbe:(sequence - 2) sendTime:CFAbsoluteTimeGetCurrent()]; //Duplicate
+	[telemetry recordReplyForProbe:(sequence - kGameTelemetryWindow) sendTime:CFAbsoluteTimeGetCurrent()]; //Too old
+	[telemetry recordReplyForProbe:(sequence + 1) sendTime:CFAbsoluteTimeGetCurrent()]; //Not sent yet
+	[telemetry recordReplyForProbe:(sequence - 4) sendTime:(CFAbsoluteTimeGetCurrent() + 1.0)]; //Sent in the future
+	AssertEquals([telemetry statistics].repliesReceived, (NSUInteger)(kGameTelemetryWindow + 2), nil);
+	AssertEquals([telemetry statistics].lossRate, 30.0 / 62.0, nil);
+	[telemetry release];
+	
+	//NOTE: Buckets have a precision of 12.5%
+	telemetry = [GameTelemetry new];
+	for(i = 1; i <= 100; ++i)
+	[self _recordRoundTripTime:((double)i / 1000.0) telemetry:telemetry];
+	statistics = [telemetry statistics];
+	AssertTrue(fabs(statistics.medianRoundTripTime - 0.050) <= 0.050 / 8.0, nil);
+	AssertTrue(fabs(statistics.percentile99RoundTripTime - 0.099) <= 0.099 / 8.0, nil);
+	AssertTrue(fabs([telemetry roundTripTimeAtPercentile:0.0] - 0.001) <= 0.001 / 8.0, nil);
+	AssertTrue(fabs([telemetry roundTripTimeAtPercentile:100.0] - 0.100) <= 0.100 / 8.0, nil);
+	AssertTrue((statistics.minimumRoundTripTime >= 0.001) && (statistics.minimumRoundTripTime < 0.002), nil);
+	AssertTrue((statistics.maximumRoundTripTime >= 0.100) && (statistics.maximumRoundTripTime < 0.101), nil);
+	AssertTrue(statistics.jitter > 0.0, nil);
+	
+	otherTelemetry = [GameTelemetry new];
+	for(i = 0; i < 300; ++i)
+	[self _recordRoundTripTime:0.5 telemetry:otherTelemetry];
+	[self _recordRoundTripTime:1000.0 telemetry:otherTelemetry];
+	AssertTrue([otherTelemetry roundTripTimeAtPercentile:100.0] > 100.0, nil); //NOTE: Samples are clamped to the last bucket
+	AssertTrue([otherTelemetry roundTripTimeAtPercentile:100.0] < 150.0, nil);
+	[telemetry mergeHistogramFromTelemetry:otherTelemetry];
+	AssertTrue(fabs([telemetry roundTripTimeAtPercentile:20.0] - 0.080) <= 0.080 / 8.0, nil);
+	AssertTrue(fabs([telemetry roundTripTimeAtPercentile:50.0] - 0.5) <= 0.5 / 8.0, nil);
+	AssertTrue(fabs([telemetry statistics].medianRoundTripTime - 0.5) <= 0.5 / 8.0, nil);
+	[otherTelemetry release];
+	[telemetry release];
+}
+
+- (NSString*) gamePeerWillSendName:(GamePeer*)peer
+{
+	return @"Unit Tests Player";
+}
+
+- (id) gamePeerWillSendInfoPlist:(GamePeer*)peer
+{
+	return [NSDictionary dictionaryWithObjectsAndKeys:@"1.0", @"version", [NSNumber numberWithInt:3], @"level", nil];
+}
+
+/* Previous GamePeer control message format: a magic number followed by a binary plist */
+- (NSData*) _legacyDataFromDictionary:(NSDictionary*)dictionary
+{
+	NSMutableData*			data = [NSMutableData data];
+	int						magic = NSSwapHostIntToBig(kLegacyGamePeerMagic);
+	
+	[data appendBytes:&magic length:sizeof(int)];
+	[data appendData:[NSPropertyListSerialization dataFromPropertyList:dictionary format:NSPropertyListBinaryFormat_v1_0 errorDescription:NULL]];
+	
+	return data;
+}
+
+- (NSDictionary*) _legacyDictionaryFromData:(NSData*)data
+{
+	int						magic;
+	
+	if([data length] <= sizeof(int))
+	return nil;
+	bcopy([data bytes], &magic, sizeof(int));
+	if(NSSwapBigIntToHost(magic) != kLegacyGamePeerMagic)
+	return nil;
+	
+	return [NSPropertyListSerialization propertyListFromData:[data subdataWithRange:NSMakeRange(sizeof(int), [data length] - sizeof(int))] mutabilityOption:NSPropertyListImmutable format:NULL errorDescription:NULL];
+}
+
+- (void) testGamePeerHandshake
+{
+	struct sockaddr_in		address;
+	GamePeer*				peer;
+	NSData*					data;
+	NSData*					legacyData;
+	NSMutableData*			pingData;
+	NSData*					legacyPingData;
+	NSDictionary*			dictionary;
+	NSAutoreleasePool*		localPool;
+	CFAbsoluteTime			time;
+	double					legacyDuration,
+							duration;
+	NSUInteger				i;
+	
+	bzero(&address, sizeof(address));
+	address.sin_len = sizeof(address);
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	peer = [[GamePeer alloc] initWithName:nil address:(struct sockaddr*)&address];
+	AssertNotNil(peer, nil);
+	[peer setDelegate:(id<GamePeerDelegate>)self];
+	
+	data = [peer _handshakeData];
+	AssertNotNil(data, nil);
+	AssertTrue([peer _readHandshakeData:data], nil);
+	AssertEqualObjects([peer uniqueID], HostGetUniqueID(), nil);
+	AssertEqualObjects([peer name], [self gamePeerWillSendName:peer], nil);
+	AssertEqualObjects([peer infoPlist], [self gamePeerWillSendInfoPlist:peer], nil);
+	AssertFalse([peer _readHandshakeData:[data subdataWithRange:NSMakeRange(0, [data length] - 1)]], nil);
+	legacyData = [self _legacyDataFromDictionary:[NSDictionary dictionaryWithObjectsAndKeys:HostGetUniqueID(), @"id", [self gamePeerWillSendName:peer], @"name", [self gamePeerWillSendInfoPlist:peer], @"info", nil]];
+	AssertFalse([peer _readHandshakeData:legacyData], nil);
+	[self logMessage:@"GamePeer: handshake is %i bytes (previously %i bytes)", (int)[data length], (int)[legacyData length]];
+	
+	localPool = [NSAutoreleasePool new];
+	time = CFAbsoluteTimeGetCurrent();
+	for(i = 0; i < kHandshakeIterations; ++i) {
+		dictionary = [self _legacyDictionaryFromData:legacyData];
+		if(![[dictionary objectForKey:@"id"] length] || ![[dictionary objectForKey:@"name"] length])
+		break;
+	}
+	legacyDuration = CFAbsoluteTimeGetCurrent() - time;
+	[localPool release];
+	AssertEquals(i, (NSUInteger)kHandshakeIterations, nil);
+	localPool = [NSAutoreleasePool new];
+	time = CFAbsoluteTimeGetCurrent();
+	for(i = 0; i < kHandshakeIterations; ++i) {
+		if(![peer _readHandshakeData:data])
+		break;
+	}
+	duration = CFAbsoluteTimeGetCurrent() - time;
+	[localPool release];
+	AssertEquals(i, (NSUInteger)kHandshakeIterations, nil);
+	[self logMessage:@"GamePeer: handshake decoded in %.2f us (previously %.2f us)", duration / kHandshakeIterations * 1000000.0, legacyDuration / kHandshakeIterations * 1000000.0];
+	
+	//NOTE: A ping is rejected as a handshake by its message type alone so this measures the header check done for every received message
+	legacyPingData = [self _legacyDataFromDictionary:[NSDictionary dictionary]];
+	localPool = [NSAutoreleasePool new];
+	time = CFAbsoluteTimeGetCurrent();
+	for(i = 0; i < kHandshakeIterations; ++i) {
+		if([[self _legacyDictionaryFromData:legacyPingData] count])
+		break;
+	}
+	legacyDuration = CFAbsoluteTimeGetCurrent() - time;
+	[localPool release];
+	AssertEquals(i, (NSUInteger)kHandshakeIterations, nil);
+	pingData = [NSMutableData dataWithData:[data subdataWithRange:NSMakeRange(0, 5)]]; //NOTE: Same magic number followed by the ping message type
+	((UInt8*)[pingData mutableBytes])[4] = 1;
+	localPool = [NSAutoreleasePool new];
+	time = CFAbsoluteTimeGetCurrent();
+	for(i = 0; i < kHandshakeIterations; ++i) {
+		if([peer _readHandshakeData:pingData])
+		break;
+	}
+	duration = CFAbsoluteTimeGetCurrent() - time;
+	[localPool release];
+	AssertEquals(i, (NSUInteger)kHandshakeIterations, nil);
+	[self logMessage:@"GamePeer: ping classified in %.3f us (previously %.3f us)", duration / kHandshakeIterations * 1000000.0, legacyDuration / kHandshakeIterations * 1000000.0];
+	
+	[peer setDelegate:nil];
+	[peer release];
+}
+
+- (void) connectionDidOpen:(TCPConnection*)connection
+{
+	_connectionOpened = YES;
+}
+
+/* Returns a TCPConnection over loopback along with the plain socket for the other end */
+- (TCPConnection*) _openLoopbackConnection:(int*)peerSocket
+{
+	struct sockaddr_in		address;
+	socklen_t				length = sizeof(address);
+	int						listenSocket,
+							value = 1;
+	TCPConnection*			connection;
+	CFAbsoluteTime			time;
+	
+	listenSocket = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if(listenSocket < 0)
+	return nil;
+	bzero(&address, sizeof(address));
+	address.sin_len = sizeof(address);
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(bind(listenSocket, (struct sockaddr*)&address, sizeof(address)) || listen(listenSocket, 1) || getsockname(listenSocket, (struct sockaddr*)&address, &length)) {
+		close(listenSocket);
+		return nil;
+	}
+	fcntl(listenSocket, F_SETFL, O_NONBLOCK);
+	
+	connection = [[TCPConnection alloc] initWithRemoteIPv4Address:INADDR_LOOPBACK port:ntohs(address.sin_port)];
+	[connection setDelegate:self];
+	_connectionOpened = NO;
+	*peerSocket = -1;
+	time = CFAbsoluteTimeGetCurrent();
+	while(((*peerSocket < 0) || !_connectionOpened) && [connection isValid] && (CFAbsoluteTimeGetCurrent() - time < 10.0)) {
+		[[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+		if(*peerSocket < 0)
+		*peerSocket = accept(listenSocket, NULL, NULL);
+	}
+	[connection setDelegate:nil];
+	close(listenSocket);
+	if((*peerSocket < 0) || !_connectionOpened) {
+		if(*peerSocket >= 0)
+		close(*peerSocket);
+		[connection release];
+		return nil;
+	}
+	fcntl(*peerSocket, F_SETFL, 0); //NOTE: The accepted socket inherits the non-blocking mode of the listening one
+	setsockopt(*peerSocket, SOL_SOCKET, SO_NOSIGPIPE, &value, sizeof(value));
+	
+	return [connection autorelease];
+}
+
+/* Reads and discards everything sent to the socket until the expected amount is reached */
+- (void) _drainSocketThread:(NSNumber*)socket
+{
+	NSAutoreleasePool*		localPool = [NSAutoreleasePool new];
+	char					buffer[32 * 1024];
+	ssize_t					result;
+	
+	while(_drainedBytes < _drainLength) {
+		result = read([socket intValue], buffer, sizeof(buffer));
+		if(result <= 0)
+		break;
+		_drainedBytes += result;
+	}
+	_drainDone = YES;
+	
+	[localPool release];
+}
+
+- (void) testTCPConnectionBatchSending
+{
+	TCPConnection*			connection;
+	NSData*					data;
+	int						peerSocket;
+	CFAbsoluteTime			time;
+	double					duration;
+	NSUInteger				pass,
+							i;
+	
+	connection = [[self _openLoopbackConnection:&peerSocket] retain];
+	AssertNotNil(connection, nil);
+	data = [NSMutableData dataWithLength:kConnectionMessageSize];
+	
+	//NOTE: The first pass sends every message on its own and the second one sends them in batches
+	for(pass = 0; pass < 2; ++pass) {
+		_drainLength = kConnectionMessages * (kConnectionHeaderSize + kConnectionMessageSize);
+		_drainedBytes = 0;
+		_drainDone = NO;
+		[NSThread detachNewThreadSelector:@selector(_drainSocketThread:) toTarget:self withObject:[NSNumber numberWithInt:peerSocket]];
+		
+		time = CFAbsoluteTimeGetCurrent();
+		for(i = 0; i < kConnectionMessages; ++i) {
+			if(pass && (i % kConnectionBatchSize == 0))
+			[connection beginBatchSending];
+			if(![connection sendData:data])
+			break;
+			if(pass && (i % kConnectionBatchSize == kConnectionBatchSize - 1) && ![connection endBatchSending])
+			break;
+		}
+		while(!_drainDone && (CFAbsoluteTimeGetCurrent() - time < 30.0))
+		usleep(1000);
+		duration = CFAbsoluteTimeGetCurrent() - time;
+		AssertEquals(i, (NSUInteger)kConnectionMessages, nil);
+		AssertTrue(_drainDone, nil);
+		AssertEquals((NSUInteger)_drainedBytes, _drainLength, nil);
+		[self logMessage:@"TCPConnection: %i messages of %i bytes sent %s in %.2f seconds (%.0f messages per second)", kConnectionMessages, kConnectionMessageSize, (pass ? "in batches" : "one by one"), duration, (double)kConnectionMessages / duration];
+	}
+	
+	[connection invalidate];
+	[connection release];
+	close(peerSocket);
+}
+
+/* Writes the frames to the socket then closes it */
+- (void) _feedSocketThread:(NSArray*)arguments
+{
+	NSAutoreleasePool*		localPool = [NSAutoreleasePool new];
+	NSData*					data = [arguments objectAtIndex:1];
+	int						socket = [[arguments objectAtIndex:0] intValue];
+	NSUInteger				offset = 0;
+	ssize_t					result;
+	
+	while(offset < [data length]) {
+		result = write(socket, (const char*)[data bytes] + offset, [data length] - offset);
+		if(result <= 0)
+		break;
+		offset += result;
+	}
+	close(socket);
+	
+	[localPool release];
+}
+
+- (void) testTCPConnectionReceiving
+{
+	TCPConnection*			connection;
+	NSMutableData*			frames;
+	NSData*					data;
+	NSAutoreleasePool*		localPool;
+	NSUInteger				header[2];
+	UInt32					value;
+	int						peerSocket;
+	CFAbsoluteTime			time;
+	double					duration;
+	NSUInteger				baseline,
+							i;
+	
+	connection = [[self _openLoopbackConnection:&peerSocket] retain];
+	AssertNotNil(connection, nil);
+	frames = [NSMutableData dataWithCapacity:(kConnectionMessages * (kConnectionHeaderSize + kConnectionMessageSize))];
+	header[0] = NSSwapHostIntToBig(kConnectionMagic);
+	header[1] = NSSwapHostIntToBig(kConnectionMessageSize);
+	for(i = 0; i < kConnectionMessages; ++i) {
+		[frames appendBytes:header length:kConnectionHeaderSize];
+		value = i;
+		[frames appendBytes:&value length:sizeof(value)];
+		[frames increaseLengthBy:(kConnectionMessageSize - sizeof(value))];
+	}
+	
+	//NOTE: Measure the allocations made by the per-message autorelease pools alone so they can be excluded
+	_mallocCount = 0;
+	malloc_logger = _MallocLogger;
+	for(i = 0; i < kConnectionMessages; ++i) {
+		localPool = [NSAutoreleasePool new];
+		[localPool release];
+	}
+	malloc_logger = NULL;
+	baseline = _mallocCount;
+	
+	[NSThread detachNewThreadSelector:@selector(_feedSocketThread:) toTarget:self withObject:[NSArray arrayWithObjects:[NSNumber numberWithInt:peerSocket], frames, nil]];
+	_mallocCount = 0;
+	malloc_logger = _MallocLogger;
+	time = CFAbsoluteTimeGetCurrent();
+	for(i = 0; i < kConnectionMessages; ++i) {
+		localPool = [NSAutoreleasePool new];
+		data = [connection receiveData];
+		if([data length] == kConnectionMessageSize)
+		bcopy([data bytes], &value, sizeof(value));
+		[localPool release];
+		if(([data length] != kConnectionMessageSize) || (value != i))
+		break;
+	}
+	duration = CFAbsoluteTimeGetCurrent() - time;
+	malloc_logger = NULL;
+	AssertEquals(i, (NSUInteger)kConnectionMessages, nil);
+	AssertNil([connection receiveData], nil);
+	[self logMessage:@"TCPConnection: %i messages of %i bytes received in %.2f seconds (%.0f messages per second) with %.2f allocations per message", kConnectionMessages, kConnectionMessageSize, duration, (double)kConnectionMessages / duration, (double)(_mallocCount > baseline ? _mallocCount - baseline : 0) / (double)kConnectionMessages];
+	
+	[connection invalidate];
+	[connection release];
+}
+
+@end
@@ -22,8 +22,19 @@
 #import "UnitTesting.h"
 #import "HIDController.h"
 #import "MidiController.h"
+#import "OSCController.h"
+
+#define kOSCBenchmarkPackets	20000
+#define kOSCTargetMessageRate	1000000 //Messages per second
 
 @interface UnitTests_Devices : UnitTest
+{
+@private
+	NSUInteger				_oscVolumeCount;
+	NSUInteger				_oscOtherCount;
+	NSUInteger				_oscBlobLength;
+	float					_oscVolume;
+}
 @end
 
 @implementation UnitTests_Devices
@@ -70,4 +81,257 @@
 	[controller release];
 }
 
+- (void) testOSC
+{
+	static const unsigned char	message[] = {'/', 'f', 'o', 'o', 0, 0, 0, 0, ',', 'i', 'f', 's', 0, 0, 0, 0, 0x00, 0x00, 0x03, 0xE8, 0x3F, 0x00, 0x00, 0x00, 'b', 'a', 'r', 0};
+	char						buffer[1472];
+	OSCEncoder					encoder,
+								savedEncoder;
+	OSCController*				controller;
+	OSCReceiver*				receiver;
+	NSMutableArray*				array;
+	NSUInteger					count,
+								i;
+	CFAbsoluteTime				time;
+	UInt64						timeTag;
+	UInt32						size;
+	
+	OSCEncoderInit(&encoder, buffer, sizeof(buffer));
+	AssertTrue(OSCEncoderBeginMessage(&encoder, "/foo", "ifs"), nil);
+	AssertTrue(OSCEncoderAppendInt(&encoder, 1000), nil);
+	AssertTrue(OSCEncoderAppendFloat(&encoder, 0.5), nil);
+	AssertTrue(OSCEncoderAppendString(&encoder, "bar"), nil);
+	AssertTrue(OSCEncoderEndMessage(&encoder), nil);
+	AssertEquals(encoder.length, sizeof(message), nil);
+	AssertTrue(memcmp(buffer, message, sizeof(message)) == 0, nil);
+	
+	OSCEncoderReset(&encoder);
+	AssertTrue([[OSCMessage messageWithAddress:@"/foo" arguments:'i', 1000, 'f', 0.5, 's', "bar", 0] appendToEncoder:&encoder], nil);
+	AssertEquals(encoder.length, sizeof(message), nil);
+	AssertTrue(memcmp(buffer, message, sizeof(message)) == 0, nil);
+	
+	OSCEncoderReset(&encoder);
+	AssertTrue(OSCEncoderBeginBundle(&encoder, OSCTimeTagFromAbsoluteTime(0.0)), nil);
+	for(i = 0; i < 2; ++i) {
+		AssertTrue(OSCEncoderBeginMessage(&encoder, "/foo", "ifs"), nil);
+		AssertTrue(OSCEncoderAppendInt(&encoder, 1000), nil);
+		AssertTrue(OSCEncoderAppendFloat(&encoder, 0.5), nil);
+		AssertTrue(OSCEncoderAppendString(&encoder, "bar"), nil);
+		AssertTrue(OSCEncoderEndMessage(&encoder), nil);
+	}
+	AssertTrue(OSCEncoderEndBundle(&encoder), nil);
+	AssertEquals(encoder.length, 16 + 2 * (4 + sizeof(message)), nil);
+	AssertTrue(memcmp(buffer, "#bundle", 8) == 0, nil);
+	bcopy(&buffer[8], &timeTag, sizeof(UInt64)); //NOTE: The buffer is not guaranteed to be aligned
+	AssertEquals(OSCAbsoluteTimeFromTimeTag(CFSwapInt64BigToHost(timeTag)), 0.0, nil);
+	bcopy(&buffer[16], &size, sizeof(UInt32));
+	AssertEquals(CFSwapInt32BigToHost(size), (UInt32)sizeof(message), nil);
+	AssertTrue(memcmp(&buffer[20], message, sizeof(message)) == 0, nil);
+	AssertTrue(memcmp(&buffer[20 + sizeof(message) + 4], message, sizeof(message)) == 0, nil);
+	
+	OSCEncoderReset(&encoder);
+	AssertTrue(OSCEncoderBeginMessage(&encoder, "/foo", "i"), nil);
+	AssertFalse(OSCEncoderAppendFloat(&encoder, 0.5), nil);
+	AssertFalse(OSCEncoderEndMessage(&encoder), nil);
+	OSCEncoderInit(&encoder, buffer, 8);
+	AssertFalse(OSCEncoderBeginMessage(&encoder, "/foobar", ""), nil);
+	
+	//NOTE: Benchmark against our own receiver on an ephemeral port so that no other OSC application on this machine gets flooded
+	receiver = [[OSCReceiver alloc] initWithPort:0];
+	AssertNotNil(receiver, nil);
+	controller = [OSCController new];
+	AssertNotNil(controller, nil);
+	[controller setDestinationAddress:@"127.0.0.1"];
+	[controller setDestinationPort:[receiver port]];
+	
+	time = CFAbsoluteTimeGetCurrent();
+	for(i = 0; i < kOSCBenchmarkPackets; ++i) {
+		OSCEncoderInit(&encoder, buffer, sizeof(buffer));
+		OSCEncoderBeginMessage(&encoder, "/foo", "ifs");
+		OSCEncoderAppendInt(&encoder, i);
+		OSCEncoderAppendFloat(&encoder, 0.5);
+		OSCEncoderAppendString(&encoder, "bar");
+		OSCEncoderEndMessage(&encoder);
+		[controller sendPacketWithEncoder:&encoder];
+	}
+	[self logMessage:@"OSC messages: %.0f messages/s", (double)kOSCBenchmarkPackets / (CFAbsoluteTimeGetCurrent() - time)];
+	
+	count = 0;
+	time = CFAbsoluteTimeGetCurrent();
+	for(i = 0; i < kOSCBenchmarkPackets; ++i) {
+		OSCEncoderInit(&encoder, buffer, sizeof(buffer));
+		OSCEncoderBeginBundle(&encoder, kOSCTimeTagImmediately);
+		while(1) {
+			savedEncoder = encoder;
+			if(!OSCEncoderBeginMessage(&encoder, "/foo", "ifs") || !OSCEncoderAppendInt(&encoder, count) || !OSCEncoderAppendFloat(&encoder, 0.5) || !OSCEncoderAppendString(&encoder, "bar") || !OSCEncoderEndMessage(&encoder))
+			break;
+			count += 1;
+		}
+		encoder = savedEncoder;
+		OSCEncoderEndBundle(&encoder);
+		[controller sendPacketWithEncoder:&encoder];
+	}
+	[self logMessage:@"OSC bundles: %.0f messages/s", (double)count / (CFAbsoluteTimeGetCurrent() - time)];
+	[[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.5]]; //NOTE: Drain the benchmark packets before installing handlers
+	
+	AssertTrue([receiver addHandler:self action:@selector(_oscReceiver:didReceiveMessage:) forAddress:@"/foo"], nil);
+	AssertTrue([receiver addHandler:self action:@selector(_oscReceiver:didReceiveBlob:) forAddress:@"/blob"], nil);
+	array = [NSMutableArray array];
+	for(i = 0; i < 3; ++i)
+	[array addObject:[OSCMessage messageWithAddress:@"/foo" arguments:'i', 1000, 'f', 0.5, 's', "bar", 0]];
+	[array addObject:[OSCMessage messageWithAddress:@"/blob" arguments:'b', [NSMutableData dataWithLength:4000], 0]]; //NOTE: Larger than a single Ethernet frame
+	[array addObject:[OSCMessage messageWithAddress:@"/foo" arguments:'i', 1000, 'f', 0.5, 's', "bar", 0]];
+	_oscOtherCount = 0;
+	_oscBlobLength = 0;
+	[controller sendMessages:array timeTag:kOSCTimeTagImmediately];
+	[[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.5]];
+	AssertEquals(_oscOtherCount, (NSUInteger)4, nil);
+	AssertEquals(_oscBlobLength, (NSUInteger)4000, nil);
+	[receiver invalidate];
+	[receiver release];
+	
+	[controller release];
+}
+
+- (void) _oscReceiver:(OSCReceiver*)receiver didReceiveVolume:(const OSCParsedMessage*)message
+{
+	OSCArgumentReader			reader;
+	
+	OSCArgumentReaderInit(&reader, message);
+	if(OSCArgumentReaderReadFloat(&reader, &_oscVolume))
+	_oscVolumeCount += 1;
+}
+
+- (void) _oscReceiver:(OSCReceiver*)receiver didReceiveMessage:(const OSCParsedMessage*)message
+{
+	_oscOtherCount += 1;
+}
+
+- (void) _oscReceiver:(OSCReceiver*)receiver didReceiveBlob:(const OSCParsedMessage*)message
+{
+	OSCArgumentReader			reader;
+	const void*					bytes;
+	NSUInteger					length;
+	
+	OSCArgumentReaderInit(&reader, message);
+	if(OSCArgumentReaderReadBlob(&reader, &bytes, &length))
+	_oscBlobLength = length;
+}
+
+- (NSUInteger) _oscReceiver:(OSCReceiver*)receiver processMessage:(const char*)address
+{
+	char						buffer[256];
+	OSCEncoder					encoder;
+	
+	OSCEncoderInit(&encoder, buffer, sizeof(buffer));
+	OSCEncoderBeginMessage(&encoder, address, "f");
+	OSCEncoderAppendFloat(&encoder, 0.5);
+	OSCEncoderEndMessage(&encoder);
+	
+	return [receiver processPacketBytes:encoder.bytes length:encoder.length];
+}
+
+- (void) testOSCReceiver
+{
+	char						buffer[1472];
+	OSCEncoder					encoder;
+	OSCReceiver*				receiver;
+	OSCController*				controller;
+	NSUInteger					count,
+								i;
+	CFAbsoluteTime				time;
+	
+	receiver = [[OSCReceiver alloc] initWithPort:0];
+	AssertNotNil(receiver, nil);
+	AssertTrue([receiver port] > 0, nil);
+	AssertTrue([receiver addHandler:self action:@selector(_oscReceiver:didReceiveVolume:) forAddress:@"/mixer/1/volume"], nil);
+	AssertTrue([receiver addHandler:self action:@selector(_oscReceiver:didReceiveVolume:) forAddress:@"/mixer/2/volume"], nil);
+	AssertTrue([receiver addHandler:self action:@selector(_oscReceiver:didReceiveMessage:) forAddress:@"/mixer/10/mute"], nil);
+	AssertTrue([receiver addHandler:self action:@selector(_oscReceiver:didReceiveMessage:) forAddress:@"/transport/play"], nil);
+	AssertFalse([receiver addHandler:self action:@selector(_oscReceiver:didReceiveMessage:) forAddress:@"/mixer/*"], nil);
+	AssertFalse([receiver addHandler:self action:@selector(_oscReceiver:didReceiveMessage:) forAddress:@"mixer"], nil);
+	
+	AssertEquals([self _oscReceiver:receiver processMessage:"/mixer/1/volume"], (NSUInteger)1, nil);
+	AssertEquals(_oscVolumeCount, (NSUInteger)1, nil);
+	AssertEquals(_oscVolume, 0.5f, nil);
+	AssertEquals([self _oscReceiver:receiver processMessage:"/mixer/*/volume"], (NSUInteger)2, nil);
+	AssertEquals([self _oscReceiver:receiver processMessage:"/mixer/[1-2]/volume"], (NSUInteger)2, nil);
+	AssertEquals([self _oscReceiver:receiver processMessage:"/mixer/{1,10}/*"], (NSUInteger)2, nil);
+	AssertEquals([self _oscReceiver:receiver processMessage:"/mixer/?/volume"], (NSUInteger)2, nil);
+	AssertEquals([self _oscReceiver:receiver processMessage:"/*/play"], (NSUInteger)1, nil);
+	AssertEquals([self _oscReceiver:receiver processMessage:"/transport/stop"], (NSUInteger)0, nil);
+	AssertEquals(_oscVolumeCount, (NSUInteger)8, nil);
+	AssertEquals(_oscOtherCount, (NSUInteger)2, nil);
+	AssertEquals([receiver processPacketBytes:"/foo" length:3], (NSUInteger)0, nil);
+	
+	//NOTE: Matching this pattern by backtracking would take hundreds of millions of steps
+	AssertTrue([receiver addHandler:self action:@selector(_oscReceiver:didReceiveMessage:) forAddress:@"/aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"], nil);
+	AssertEquals([self _oscReceiver:receiver processMessage:"/*a*a"], (NSUInteger)1, nil);
+	time = CFAbsoluteTimeGetCurrent();
+	AssertEquals([self _oscReceiver:receiver processMessage:"/*a*a*a*a*a*a*a*a*a*a*b"], (NSUInteger)0, nil);
+	AssertTrue(CFAbsoluteTimeGetCurrent() - time < 0.1, nil);
+	[receiver removeHandlerForAddress:@"/aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"];
+	
+	[receiver removeHandlerForAddress:@"/mixer/2/volume"];
+	AssertEquals([self _oscReceiver:receiver processMessage:"/mixer/*/volume"], (NSUInteger)1, nil);
+	AssertTrue([receiver addHandler:self action:@selector(_oscReceiver:didReceiveVolume:) forAddress:@"/mixer/2/volume"], nil);
+	
+	_oscVolumeCount = 0;
+	OSCEncoderInit(&encoder, buffer, sizeof(buffer));
+	OSCEncoderBeginBundle(&encoder, OSCTimeTagFromAbsoluteTime(CFAbsoluteTimeGetCurrent() + 0.2));
+	OSCEncoderBeginMessage(&encoder, "/mixer/*/volume", "f");
+	OSCEncoderAppendFloat(&encoder, 0.25);
+	OSCEncoderEndMessage(&encoder);
+	OSCEncoderEndBundle(&encoder);
+	AssertEquals([receiver processPacketBytes:encoder.bytes length:encoder.length], (NSUInteger)1, nil);
+	AssertEquals(_oscVolumeCount, (NSUInteger)0, nil);
+	[[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.5]];
+	AssertEquals(_oscVolumeCount, (NSUInteger)2, nil);
+	AssertEquals(_oscVolume, 0.25f, nil);
+	
+	controller = [OSCController new];
+	AssertNotNil(controller, nil);
+	[controller setDestinationAddress:@"127.0.0.1"];
+	[controller setDestinationPort:[receiver port]];
+	_oscVolumeCount = 0;
+	[controller sendMessages:[NSArray arrayWithObjects:[OSCMessage messageWithAddress:@"/mixer/1/volume" arguments:'f', 0.75, 0], [OSCMessage messageWithAddress:@"/mixer/2/volume" arguments:'f', 0.75, 0], nil] timeTag:kOSCTimeTagImmediately];
+	[[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.5]];
+	AssertEquals(_oscVolumeCount, (NSUInteger)2, nil);
+	AssertEquals(_oscVolume, 0.75f, nil);
+	[controller release];
+	
+	count = 0;
+	OSCEncoderInit(&encoder, buffer, sizeof(buffer));
+	OSCEncoderBeginMessage(&encoder, "/mixer/1/volume", "f");
+	OSCEncoderAppendFloat(&encoder, 0.5);
+	AssertTrue(OSCEncoderEndMessage(&encoder), nil);
+	time = CFAbsoluteTimeGetCurrent();
+	for(i = 0; i < 50 * kOSCBenchmarkPackets; ++i)
+	count += [receiver processPacketBytes:encoder.bytes length:encoder.length];
+	time = CFAbsoluteTimeGetCurrent() - time;
+	[self logMessage:@"OSC receiving: %.0f messages/s (target is %i messages/s)", (double)count / time, kOSCTargetMessageRate];
+	AssertEquals(count, (NSUInteger)(50 * kOSCBenchmarkPackets), nil);
+	if((double)count / time < kOSCTargetMessageRate)
+	[self logMessage:@"WARNING: OSC receiving is below target"];
+	
+	count = 0;
+	OSCEncoderInit(&encoder, buffer, sizeof(buffer));
+	OSCEncoderBeginBundle(&encoder, kOSCTimeTagImmediately);
+	for(i = 0; i < 32; ++i) {
+		OSCEncoderBeginMessage(&encoder, (i % 2 ? "/mixer/1/volume" : "/mixer/[1-2]/volume"), "f");
+		OSCEncoderAppendFloat(&encoder, 0.5);
+		OSCEncoderEndMessage(&encoder);
+	}
+	AssertTrue(OSCEncoderEndBundle(&encoder), nil);
+	time = CFAbsoluteTimeGetCurrent();
+	for(i = 0; i < kOSCBenchmarkPackets; ++i)
+	count += [receiver processPacketBytes:encoder.bytes length:encoder.length];
+	[self logMessage:@"OSC dispatching: %.0f messages/s", (double)count / (CFAbsoluteTimeGetCurrent() - time)];
+	AssertEquals(count, (NSUInteger)(48 * kOSCBenchmarkPackets), nil);
+	
+	[receiver invalidate];
+	AssertFalse([receiver isValid], nil);
+	[receiver release];
+}
+
 @end
@@ -16,8 +16,12 @@
 	along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#import <zlib.h>
+#import <sys/sysctl.h>
+
 #import "UnitTesting.h"
 #import "NSData+Encryption.h"
+#import "Base64.h"
 #import "NSData+GZip.h"
 #import "NSURL+Parameters.h"
 #import "NSFileManager+LockedItems.h"
@@ -106,6 +110,12 @@
 	NSString*				string1;
 	NSString*				string2;
 	NSError*				error;
+	Base64Encoder			encoder;
+	unsigned char			bytes[51];
+	char*					buffer;
+	NSUInteger				length,
+							offset;
+	CFAbsoluteTime			time;
 	
 	data1 = [[NSData alloc] initWithContentsOfFile:@"Resources/Image.jpg"];
 	AssertNotNil(data1, nil);
@@ -120,6 +130,52 @@
 	
 	data2 = [string1 decodeBase64];
 	AssertEqualObjects(data2, data1, nil);
+	AssertEqualObjects([string2 decodeBase64], data1, nil);
+	
+	AssertNil([@"Zm9v!mFy" decodeBase64], nil);
+	AssertNil([@"Zm9vY" decodeBase64], nil);
+	AssertNil([@"Zm9=vYmFy" decodeBase64], nil);
+	AssertEqualObjects([@"" decodeBase64], [NSData data], nil);
+	AssertEqualObjects([[@"foobar" dataUsingEncoding:NSASCIIStringEncoding] encodeBase64], @"Zm9vYmFy", nil);
+	AssertEqualObjects([[@"fooba" dataUsingEncoding:NSASCIIStringEncoding] encodeBase64], @"Zm9vYmE=", nil);
+	AssertEqualObjects([[@"foob" dataUsingEncoding:NSASCIIStringEncoding] encodeBase64], @"Zm9vYg==", nil);
+	
+	//Generated with 'openssl base64 -A' which is the encoder -encodeBase64 used previously - Long enough for the vectorized paths with 0, 1 and 2 trailing bytes
+	for(length = 0; length < sizeof(bytes); ++length)
+	bytes[length] = (length * 167 + 13) & 0xFF;
+	AssertEqualObjects([[NSData dataWithBytes:bytes length:49] encodeBase64], @"DbRbAqlQ955F7JM64Ygv1n0ky3IZwGcOtVwDqlH4n0btlDviiTDXfiXMcxrBaA+2XQ==", nil);
+	AssertEqualObjects([[NSData dataWithBytes:bytes length:50] encodeBase64], @"DbRbAqlQ955F7JM64Ygv1n0ky3IZwGcOtVwDqlH4n0btlDviiTDXfiXMcxrBaA+2XQQ=", nil);
+	AssertEqualObjects([[NSData dataWithBytes:bytes length:51] encodeBase64], @"DbRbAqlQ955F7JM64Ygv1n0ky3IZwGcOtVwDqlH4n0btlDviiTDXfiXMcxrBaA+2XQSr", nil);
+	AssertEqualObjects(Base64EncodeData([NSData dataWithBytes:bytes length:50]), @"DbRbAqlQ955F7JM64Ygv1n0ky3IZwGcOtVwDqlH4n0btlDviiTDXfiXMcxrBaA+2XQQ=", nil);
+	AssertEqualObjects([@"DbRbAqlQ955F7JM64Ygv1n0ky3IZwGcOtVwDqlH4n0btlDviiTDXfiXMcxrBaA+2XQ==" decodeBase64], [NSData dataWithBytes:bytes length:49], nil);
+	AssertEqualObjects([@"DbRbAqlQ955F7JM64Ygv1n0ky3IZwGcOtVwDqlH4n0btlDviiTDXfiXMcxrBaA+2XQQ=" decodeBase64], [NSData dataWithBytes:bytes length:50], nil);
+	AssertEqualObjects([@"DbRbAqlQ955F7JM64Ygv1n0ky3IZwGcOtVwDqlH4n0btlDviiTDXfiXMcxrBaA+2XQSr" decodeBase64], [NSData dataWithBytes:bytes length:51], nil);
+	AssertEqualObjects([[NSData dataWithBytes:"\xFF" length:1] encodeBase64], @"/w==", nil);
+	AssertEqualObjects([[NSData dataWithBytes:"\xFB\xFF" length:2] encodeBase64], @"+/8=", nil);
+	AssertEqualObjects([[NSData dataWithBytes:"\xFB\xFF\xBF" length:3] encodeBase64], @"+/+/", nil);
+	
+	for(length = 0; length < 200; ++length) {
+		data2 = [data1 subdataWithRange:NSMakeRange(length, length)];
+		AssertEqualObjects([[data2 encodeBase64] decodeBase64], data2, nil);
+	}
+	
+	buffer = malloc(Base64EncodedLength([data1 length] + 2));
+	Base64EncoderInit(&encoder);
+	offset = 0;
+	for(length = 0; length < [data1 length]; length += 37)
+	offset += Base64EncoderUpdate(&encoder, (const char*)[data1 bytes] + length, MIN(37, [data1 length] - length), buffer + offset);
+	offset += Base64EncoderFinal(&encoder, buffer + offset);
+	AssertEquals(offset, [string1 length], nil);
+	AssertTrue(memcmp(buffer, [string1 UTF8String], offset) == 0, nil);
+	free(buffer);
+	
+	data2 = [NSMutableData dataWithLength:(64 * 1024 * 1024)];
+	time = CFAbsoluteTimeGetCurrent();
+	string1 = [data2 encodeBase64];
+	[self logMessage:@"Base64 encoding: %.2f GB/s", (double)[data2 length] / (CFAbsoluteTimeGetCurrent() - time) / (1024.0 * 1024.0 * 1024.0)];
+	time = CFAbsoluteTimeGetCurrent();
+	AssertEqualObjects([string1 decodeBase64], data2, nil);
+	[self logMessage:@"Base64 decoding: %.2f GB/s", (double)[data2 length] / (CFAbsoluteTimeGetCurrent() - time) / (1024.0 * 1024.0 * 1024.0)];
 	
 	[data1 release];
 }
@@ -226,6 +282,45 @@
 	[data1 release];
 }
 
+- (void) testEncryptionStreaming
+{
+	NSString*				path1 = [@"/tmp" stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	NSString*				path2 = [@"/tmp" stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	NSData*					data1;
+	NSMutableData*			data2;
+	NSOutputStream*			stream;
+	CFAbsoluteTime			time;
+	NSError*				error;
+	
+	data1 = [NSData dataWithContentsOfFile:@"Resources/Image.jpg"];
+	AssertNotNil(data1, nil);
+	AssertEqualObjects([NSData md5DigestOfFile:@"Resources/Image.jpg"], [data1 md5Digest], nil);
+	AssertEqualObjects([NSData sha1DigestFromStream:[NSInputStream inputStreamWithData:data1]], [data1 sha1Digest], nil);
+	
+	AssertTrue([NSData encryptAES256File:@"Resources/Image.jpg" toFile:path1 password:@"info@pol-online.net" useSalt:NO], nil);
+	AssertEqualObjects([NSData dataWithContentsOfFile:path1], [NSData dataWithContentsOfFile:@"Resources/Image.aes256"], nil);
+	AssertTrue([NSData decryptAES256File:@"Resources/Image.aes256-salted" toFile:path2 password:@"info@pol-online.net" useSalt:YES], nil);
+	AssertEqualObjects([NSData dataWithContentsOfFile:path2], data1, nil);
+	AssertFalse([NSData decryptAES256File:path1 toFile:path2 password:@"info@pol-online.net" useSalt:YES], nil);
+	AssertFalse([[NSFileManager defaultManager] fileExistsAtPath:path2], nil);
+	
+	AssertTrue([NSData encryptBlowfishFile:@"Resources/Image.jpg" toFile:path1 password:@"info@pol-online.net" useSalt:NO], nil);
+	AssertEqualObjects([NSData dataWithContentsOfFile:path1], [NSData dataWithContentsOfFile:@"Resources/Image.bf"], nil);
+	AssertTrue([NSData encryptAES128File:@"Resources/Image.jpg" toFile:path1 password:@"info@pol-online.net" useSalt:YES], nil);
+	AssertEqualObjects([[NSData dataWithContentsOfFile:path1] decryptAES128WithPassword:@"info@pol-online.net" useSalt:YES], data1, nil);
+	
+	stream = [NSOutputStream outputStreamToMemory];
+	AssertTrue([NSData encryptAES256FromStream:[NSInputStream inputStreamWithData:data1] toStream:stream password:@"info@pol-online.net" useSalt:YES], nil);
+	AssertEqualObjects([[stream propertyForKey:NSStreamDataWrittenToMemoryStreamKey] decryptAES256WithPassword:@"info@pol-online.net" useSalt:YES], data1, nil);
+	
+	data2 = [NSMutableData dataWithLength:(256 * 1024 * 1024)];
+	time = CFAbsoluteTimeGetCurrent();
+	AssertTrue([NSData encryptAES256FromStream:[NSInputStream inputStreamWithData:data2] toStream:[NSOutputStream outputStreamToFileAtPath:@"/dev/null" append:NO] password:@"info@pol-online.net" useSalt:YES], nil);
+	[self logMessage:@"AES-256 streaming encryption: %.2f GB/s", (double)[data2 length] / (CFAbsoluteTimeGetCurrent() - time) / (1024.0 * 1024.0 * 1024.0)];
+	
+	AssertTrue([[NSFileManager defaultManager] removeItemAtPath:path1 error:&error], [error localizedDescription]);
+}
+
 - (void) testGZip
 {
 	NSString*				path1 = [@"/tmp" stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
@@ -255,9 +350,50 @@
 	[data2 release];
 	AssertTrue([[NSFileManager defaultManager] removeItemAtPath:path2 error:&error], [error localizedDescription]);
 	
+	AssertEqualObjects(data1, [[data1 compressGZipWithLevel:Z_BEST_SPEED] decompressGZip], nil);
 	[data1 release];
 }
 
+- (void) testGZipStreaming
+{
+	NSString*				path1 = [@"/tmp" stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	NSString*				path2 = [@"/tmp" stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	NSString*				path3 = [@"/tmp" stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	NSMutableData*			data1;
+	NSData*					data2;
+	NSError*				error;
+	NSUInteger				i;
+	int						cpuCount = 1;
+	size_t					size = sizeof(cpuCount);
+	char					line[64];
+	
+	//NOTE: Parallel compression reads 4 blocks of 512 KB per CPU in each round so make sure there are several rounds whose checksums must be combined
+	if((sysctlbyname("hw.activecpu", &cpuCount, &size, NULL, 0) != 0) || (cpuCount < 1))
+	cpuCount = 1;
+	data1 = [NSMutableData data];
+	for(i = 0; [data1 length] < 2 * cpuCount * 4 * 512 * 1024 + 100000; ++i)
+	[data1 appendBytes:line length:snprintf(line, sizeof(line), "Line %lu: %li\n", (unsigned long)i, random())];
+	AssertTrue([data1 writeToFile:path1 atomically:YES], nil);
+	
+	AssertTrue([NSData compressGZipFile:path1 toFile:path2 level:Z_DEFAULT_COMPRESSION parallel:NO], nil);
+	AssertTrue([NSData decompressGZipFile:path2 toFile:path3], nil);
+	AssertEqualObjects([NSData dataWithContentsOfFile:path3], data1, nil);
+	
+	AssertTrue([NSData compressGZipFile:path1 toFile:path2 level:Z_DEFAULT_COMPRESSION parallel:YES], nil);
+	AssertEqualObjects([[NSData dataWithContentsOfFile:path2] decompressGZip], data1, nil);
+	data2 = [[NSData alloc] initWithGZipFile:path2];
+	AssertEqualObjects(data2, data1, nil);
+	[data2 release];
+	AssertTrue([NSData decompressGZipFile:path2 toFile:path3], nil);
+	AssertEqualObjects([NSData dataWithContentsOfFile:path3], data1, nil);
+	
+	AssertFalse([NSData decompressGZipFile:path1 toFile:path3], nil);
+	AssertFalse([[NSFileManager defaultManager] fileExistsAtPath:path3], nil);
+	
+	AssertTrue([[NSFileManager defaultManager] removeItemAtPath:path2 error:&error], [error localizedDescription]);
+	AssertTrue([[NSFileManager defaultManager] removeItemAtPath:path1 error:&error], [error localizedDescription]);
+}
+
 - (void) testURL
 {
 	NSURL*					url;
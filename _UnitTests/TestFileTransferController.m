@@ -16,15 +16,50 @@
 	along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#import <sys/resource.h>
+#import <sys/socket.h>
+#import <netinet/in.h>
+#import <sys/xattr.h>
+#import <libkern/OSAtomic.h>
+
 #import "UnitTesting.h"
 #import "FileTransferController.h"
+#import "FileTransferController_Internal.h"
 #import "NSURL+Parameters.h"
+#import "NSData+GZip.h"
+#import "NSData+Encryption.h"
 
 #define kTimeOut				30.0
+#define kFTPBenchmarkFiles		100
 
 @interface UnitTests_FileTransferController : UnitTest <FileTransferControllerDelegate>
 @end
 
+@interface UnitTests_DeltaLocalTransferController : LocalTransferController
+{
+@public
+	NSUInteger					deltaCount,
+								literalLength;
+}
+@end
+
+@implementation UnitTests_DeltaLocalTransferController
+
+- (BOOL) _applyDeltaOperations:(const DeltaOperation*)operations count:(NSUInteger)count fromBytes:(const void*)bytes length:(NSUInteger)length digest:(const unsigned char*)digest toPath:(NSString*)remotePath
+{
+	NSUInteger					i;
+	
+	deltaCount += 1;
+	for(i = 0; i < count; ++i) {
+		if(!operations[i].copy)
+		literalLength += operations[i].length;
+	}
+	
+	return [super _applyDeltaOperations:operations count:count fromBytes:bytes length:length digest:digest toPath:remotePath];
+}
+
+@end
+
 @implementation UnitTests_FileTransferController
 
 - (NSURL*) _testURLForProtocol:(NSString*)protocol
@@ -289,6 +324,391 @@ Exit:
 	[controller setDelegate:nil];
 }
 
+- (void) testCompression
+{
+	NSString*					path = [@"/tmp" stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	NSString*					localPath = [@"/tmp" stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	FileTransferController*		controller;
+	NSMutableData*				data;
+	NSData*						digestData;
+	NSError*					error;
+	NSUInteger					i;
+	
+	AssertTrue([[NSFileManager defaultManager] createDirectoryAtPath:path withIntermediateDirectories:YES attributes:nil error:&error], [error localizedDescription]);
+	controller = [FileTransferController fileTransferControllerWithURL:[NSURL fileURLWithPath:path]];
+	AssertNotNil(controller, nil);
+	[controller setDelegate:self];
+	[controller setCompressionEnabled:YES];
+	[controller setDigestComputation:YES];
+	
+	data = [NSMutableData data];
+	for(i = 0; i < 100000; ++i)
+	[data appendData:[[NSString stringWithFormat:@"%i: The quick brown fox jumps over the lazy dog\n", i] dataUsingEncoding:NSUTF8StringEncoding]];
+	AssertTrue([data writeToFile:localPath atomically:NO], nil);
+	
+	AssertTrue([controller uploadFileFromPath:localPath toPath:@"Test.gz"], nil);
+	AssertEquals([controller transferSize], [data length], nil);
+	AssertTrue([controller lastTransferSize] < [data length] / 4, nil);
+	AssertEquals([controller lastTransferSize], [[[NSFileManager defaultManager] attributesOfItemAtPath:[path stringByAppendingPathComponent:@"Test.gz"] error:NULL] fileSize], nil);
+	digestData = [controller lastTransferDigestData];
+	AssertNotNil(digestData, nil);
+	AssertEqualObjects([[NSData dataWithContentsOfFile:[path stringByAppendingPathComponent:@"Test.gz"]] decompressGZip], data, nil);
+	AssertEqualObjects([controller downloadFileFromPathToData:@"Test.gz"], data, nil);
+	AssertEqualObjects([controller lastTransferDigestData], digestData, nil);
+	
+	[controller setEncryptionPassword:@"info@pol-online.net"];
+	AssertTrue([controller uploadFileFromPath:localPath toPath:@"Test.data"], nil);
+	AssertTrue([controller lastTransferSize] < [data length] / 4, nil);
+	AssertEqualObjects([controller lastTransferDigestData], digestData, nil);
+	AssertEqualObjects([controller downloadFileFromPathToData:@"Test.data"], data, nil);
+	AssertEqualObjects([controller lastTransferDigestData], digestData, nil);
+	[controller setEncryptionPassword:nil];
+	
+	[controller setDigestComputation:NO];
+	[controller setCompressionEnabled:NO];
+	[controller setDelegate:nil];
+	AssertTrue([[NSFileManager defaultManager] removeItemAtPath:localPath error:&error], [error localizedDescription]);
+	AssertTrue([[NSFileManager defaultManager] removeItemAtPath:path error:&error], [error localizedDescription]);
+}
+
+- (void) testDeltaTransfer
+{
+	NSString*					path = [@"/tmp" stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	NSString*					cachePath = [path stringByAppendingPathComponent:@"Cache"];
+	NSString*					localPath = [@"/tmp" stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	UnitTests_DeltaLocalTransferController*	controller;
+	NSMutableData*				data;
+	NSError*					error;
+	NSUInteger					i;
+	
+	AssertTrue([[NSFileManager defaultManager] createDirectoryAtPath:cachePath withIntermediateDirectories:YES attributes:nil error:&error], [error localizedDescription]);
+	controller = [[[UnitTests_DeltaLocalTransferController alloc] initWithBaseURL:[NSURL fileURLWithPath:path]] autorelease];
+	AssertNotNil(controller, nil);
+	[controller setDelegate:self];
+	[controller setDigestComputation:YES];
+	
+	data = [NSMutableData dataWithLength:(4 * 1024 * 1024)];
+	srandom(0);
+	for(i = 0; i < [data length] / sizeof(long); ++i)
+	((long*)[data mutableBytes])[i] = random();
+	AssertTrue([data writeToFile:localPath atomically:NO], nil);
+	AssertTrue([controller uploadFileFromPath:localPath toPath:@"Test.data" signatureCachePath:cachePath], nil);
+	AssertEqualObjects([NSData dataWithContentsOfFile:[path stringByAppendingPathComponent:@"Test.data"]], data, nil);
+	AssertEquals(controller->deltaCount, (NSUInteger)0, nil);
+	
+	memset((char*)[data mutableBytes] + 1000000, 0, 12345);
+	[data replaceBytesInRange:NSMakeRange(3000000, 0) withBytes:"PolKit" length:6];
+	[data setLength:([data length] - 54321)];
+	AssertTrue([data writeToFile:localPath atomically:NO], nil);
+	AssertTrue([controller uploadFileFromPath:localPath toPath:@"Test.data" signatureCachePath:cachePath], nil);
+	AssertEqualObjects([NSData dataWithContentsOfFile:[path stringByAppendingPathComponent:@"Test.data"]], data, nil);
+	AssertEquals(controller->deltaCount, (NSUInteger)1, nil);
+	AssertTrue(controller->literalLength > 12345, nil);
+	AssertTrue(controller->literalLength < 64 * 1024, nil);
+	AssertEqualObjects([controller lastTransferDigestData], [data md5Digest], nil);
+	
+	controller->literalLength = 0;
+	[data replaceBytesInRange:NSMakeRange(0, 0) withBytes:"PolKit" length:6];
+	AssertTrue([data writeToFile:localPath atomically:NO], nil);
+	AssertTrue([controller uploadFileFromPath:localPath toPath:@"Test.data" signatureCachePath:nil], nil);
+	AssertEqualObjects([NSData dataWithContentsOfFile:[path stringByAppendingPathComponent:@"Test.data"]], data, nil);
+	AssertEquals(controller->deltaCount, (NSUInteger)2, nil);
+	AssertTrue(controller->literalLength < 64 * 1024, nil);
+	AssertEqualObjects([controller lastTransferDigestData], [data md5Digest], nil);
+	
+	[controller setDelegate:nil];
+	AssertTrue([[NSFileManager defaultManager] removeItemAtPath:localPath error:&error], [error localizedDescription]);
+	AssertTrue([[NSFileManager defaultManager] removeItemAtPath:path error:&error], [error localizedDescription]);
+}
+
+- (void) fileTransferController:(FileTransferController*)controller didCompleteTransfer:(BOOL)success context:(void*)context
+{
+	NSUInteger*					counts = (NSUInteger*)context;
+	
+	AssertFalse([controller isTransferringAsynchronously], nil);
+	counts[0] += 1;
+	if(success)
+	counts[1] += 1;
+}
+
+- (void) testAsynchronous
+{
+	NSString*					path = [@"/tmp" stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	NSString*					localPath = [@"/tmp" stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	NSMutableArray*				controllers = [NSMutableArray array];
+	NSUInteger					counts[2] = {0, 0};
+	FileTransferController*		controller;
+	NSMutableData*				data;
+	NSError*					error;
+	NSUInteger					i;
+	
+	AssertTrue([[NSFileManager defaultManager] createDirectoryAtPath:path withIntermediateDirectories:YES attributes:nil error:&error], [error localizedDescription]);
+	data = [NSMutableData dataWithLength:(4 * 1024 * 1024)];
+	srandom(0);
+	for(i = 0; i < [data length] / sizeof(long); ++i)
+	((long*)[data mutableBytes])[i] = random();
+	AssertTrue([data writeToFile:localPath atomically:NO], nil);
+	
+	for(i = 0; i < 8; ++i) {
+		controller = [FileTransferController fileTransferControllerWithURL:[NSURL fileURLWithPath:path]];
+		AssertNotNil(controller, nil);
+		[controller setDelegate:self];
+		[controller setTimeOut:kTimeOut];
+		AssertTrue([controller uploadFileFromPath:localPath toPath:[NSString stringWithFormat:@"Test-%i.data", i] target:self selector:@selector(fileTransferController:didCompleteTransfer:context:) context:counts], nil);
+		[controllers addObject:controller];
+	}
+	while(counts[0] < [controllers count])
+	[[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:kTimeOut]];
+	AssertEquals(counts[1], [controllers count], nil);
+	for(i = 0; i < [controllers count]; ++i)
+	AssertEqualObjects([NSData dataWithContentsOfFile:[path stringByAppendingPathComponent:[NSString stringWithFormat:@"Test-%i.data", i]]], data, nil);
+	
+	counts[0] = counts[1] = 0;
+	for(i = 0; i < [controllers count]; ++i)
+	AssertTrue([[controllers objectAtIndex:i] downloadFileFromPath:[NSString stringWithFormat:@"Test-%i.data", i] toPath:[NSString stringWithFormat:@"%@-%i", localPath, i] target:self selector:@selector(fileTransferController:didCompleteTransfer:context:) context:counts], nil);
+	while(counts[0] < [controllers count])
+	[[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:kTimeOut]];
+	AssertEquals(counts[1], [controllers count], nil);
+	for(i = 0; i < [controllers count]; ++i) {
+		AssertEqualObjects([NSData dataWithContentsOfFile:[NSString stringWithFormat:@"%@-%i", localPath, i]], data, nil);
+		AssertTrue([[NSFileManager defaultManager] removeItemAtPath:[NSString stringWithFormat:@"%@-%i", localPath, i] error:&error], [error localizedDescription]);
+	}
+	
+	controller = [controllers objectAtIndex:0];
+	counts[0] = counts[1] = 0;
+	AssertTrue([controller downloadFileFromPath:@"Missing.data" toPath:[localPath stringByAppendingString:@"-Missing"] target:self selector:@selector(fileTransferController:didCompleteTransfer:context:) context:counts], nil);
+	while(counts[0] < 1)
+	[[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:kTimeOut]];
+	AssertEquals(counts[1], (NSUInteger)0, nil);
+	AssertFalse([[NSFileManager defaultManager] fileExistsAtPath:[localPath stringByAppendingString:@"-Missing"]], nil);
+	
+	[controllers makeObjectsPerformSelector:@selector(setDelegate:) withObject:nil];
+	AssertTrue([[NSFileManager defaultManager] removeItemAtPath:localPath error:&error], [error localizedDescription]);
+	AssertTrue([[NSFileManager defaultManager] removeItemAtPath:path error:&error], [error localizedDescription]);
+}
+
+static double _CPUTime()
+{
+	struct rusage				usage;
+	
+	getrusage(RUSAGE_SELF, &usage);
+	
+	return (double)usage.ru_utime.tv_sec + (double)usage.ru_utime.tv_usec / 1000000.0 + (double)usage.ru_stime.tv_sec + (double)usage.ru_stime.tv_usec / 1000000.0;
+}
+
+- (void) testSynchronousStreams
+{
+	NSString*					path = [@"/tmp" stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	FileTransferController*		controller;
+	NSMutableData*				data;
+	NSError*					error;
+	NSUInteger					i;
+	double						time;
+	CFAbsoluteTime				startTime;
+	struct sockaddr_in			address;
+	socklen_t					length = sizeof(address);
+	CFReadStreamRef				readStream;
+	int							listener;
+	
+	AssertTrue([[NSFileManager defaultManager] createDirectoryAtPath:path withIntermediateDirectories:YES attributes:nil error:&error], [error localizedDescription]);
+	controller = [[LocalTransferController alloc] initWithBaseURL:[NSURL fileURLWithPath:path]];
+	AssertNotNil(controller, nil);
+	AssertFalse([LocalTransferController useAsyncStreams], nil); //NOTE: Local transfers always run their streams synchronously
+	[controller setDelegate:self];
+	[controller setTimeOut:kTimeOut];
+	
+	data = [NSMutableData dataWithLength:(64 * 1024 * 1024)];
+	srandom(0);
+	for(i = 0; i < [data length] / sizeof(long); ++i)
+	((long*)[data mutableBytes])[i] = random();
+	
+	time = _CPUTime();
+	AssertTrue([controller uploadFileFromData:data toPath:@"Test.data"], nil);
+	AssertEquals([controller lastTransferSize], [data length], nil);
+	AssertEqualObjects([controller downloadFileFromPathToData:@"Test.data"], data, nil);
+	AssertEquals([controller lastTransferSize], [data length], nil); //NOTE: The download must have reached the end of the file
+	[self logMessage:@"Synchronous streams: %.2f CPU seconds per GB transferred", (_CPUTime() - time) / ((double)(2 * [data length]) / (1024.0 * 1024.0 * 1024.0))];
+	
+	//NOTE: A socket that never delivers data must time out without spinning the CPU while waiting
+	listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	AssertTrue(listener >= 0, nil);
+	bzero(&address, sizeof(address));
+	address.sin_len = sizeof(address);
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	AssertEquals(bind(listener, (struct sockaddr*)&address, sizeof(address)), 0, nil);
+	AssertEquals(listen(listener, 1), 0, nil);
+	AssertEquals(getsockname(listener, (struct sockaddr*)&address, &length), 0, nil);
+	CFStreamCreatePairWithSocketToHost(kCFAllocatorDefault, CFSTR("127.0.0.1"), ntohs(address.sin_port), &readStream, NULL);
+	AssertTrue(readStream != NULL, nil);
+	[controller setDelegate:nil];
+	[controller setTimeOut:2.0];
+	startTime = CFAbsoluteTimeGetCurrent();
+	time = _CPUTime();
+	AssertNil([(StreamTransferController*)controller runReadStream:readStream dataStream:nil userInfo:nil isFileTransfer:NO], nil);
+	startTime = CFAbsoluteTimeGetCurrent() - startTime;
+	time = _CPUTime() - time;
+	AssertTrue(startTime >= 2.0, nil);
+	AssertTrue(startTime < 4.0, nil);
+	AssertTrue(time < 0.5, nil);
+	close(listener);
+	
+	[controller release];
+	AssertTrue([[NSFileManager defaultManager] removeItemAtPath:path error:&error], [error localizedDescription]);
+}
+
+- (void) testListingCache
+{
+	NSString*					path = [@"/tmp" stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	FileTransferController*		controller;
+	NSError*					error;
+	
+	AssertTrue([[NSFileManager defaultManager] createDirectoryAtPath:[path stringByAppendingPathComponent:@"Folder"] withIntermediateDirectories:YES attributes:nil error:&error], [error localizedDescription]);
+	controller = [[LocalTransferController alloc] initWithBaseURL:[NSURL fileURLWithPath:path]];
+	AssertNotNil(controller, nil);
+	[controller setDelegate:self];
+	[controller setListingCacheTimeOut:60.0];
+	
+	AssertEquals([[controller contentsOfDirectoryAtPath:@"/"] count], (NSUInteger)1, nil);
+	AssertEquals([[controller contentsOfDirectoryAtPath:@"Folder"] count], (NSUInteger)0, nil);
+	AssertTrue([[NSData data] writeToFile:[path stringByAppendingPathComponent:@"Outside.data"] atomically:NO], nil);
+	AssertEquals([[controller contentsOfDirectoryAtPath:@"/"] count], (NSUInteger)1, nil);
+	
+	AssertTrue([controller uploadFileFromData:[NSData data] toPath:@"Folder/Test.data"], nil);
+	AssertEquals([[controller contentsOfDirectoryAtPath:@"Folder/"] count], (NSUInteger)1, nil);
+	AssertEquals([[controller contentsOfDirectoryAtPath:@"/"] count], (NSUInteger)2, nil);
+	AssertTrue([controller deleteFileAtPath:@"Folder/Test.data"], nil);
+	AssertEquals([[controller contentsOfDirectoryAtPath:@"Folder"] count], (NSUInteger)0, nil);
+	AssertEquals([[controller contentsOfDirectoryAtPath:@"/"] count], (NSUInteger)2, nil);
+	
+	AssertTrue([[NSData data] writeToFile:[path stringByAppendingPathComponent:@"Outside2.data"] atomically:NO], nil);
+	AssertEquals([[controller contentsOfDirectoryAtPath:@"/"] count], (NSUInteger)2, nil);
+	[controller invalidateListingCache];
+	AssertEquals([[controller contentsOfDirectoryAtPath:@"/"] count], (NSUInteger)3, nil);
+	
+	[controller setDelegate:nil];
+	[controller release];
+	AssertTrue([[NSFileManager defaultManager] removeItemAtPath:path error:&error], [error localizedDescription]);
+}
+
+static NSDate* _DateFromComponents(int year, int month, int day, int hour, int minute, int second, BOOL utc)
+{
+	struct tm					date;
+	
+	bzero(&date, sizeof(struct tm));
+	date.tm_year = year - 1900;
+	date.tm_mon = month - 1;
+	date.tm_mday = day;
+	date.tm_hour = hour;
+	date.tm_min = minute;
+	date.tm_sec = second;
+	date.tm_isdst = -1;
+	
+	return [NSDate dateWithTimeIntervalSince1970:(utc ? timegm(&date) : mktime(&date))];
+}
+
+- (NSDictionary*) _parseFTPListing:(const char*)string machineListing:(BOOL)flag
+{
+	NSData*						data = [NSData dataWithBytes:string length:strlen(string)];
+	NSDictionary*				contents;
+	
+	//NOTE: Lines split across data callbacks must give the same result as complete lines
+	contents = [FTPTransferController _contentsOfDirectoryFromListingData:data machineListing:flag encoding:NSISOLatin1StringEncoding chunkSize:[data length]];
+	AssertEqualObjects([FTPTransferController _contentsOfDirectoryFromListingData:data machineListing:flag encoding:NSISOLatin1StringEncoding chunkSize:7], contents, nil);
+	
+	return contents;
+}
+
+- (void) testFTPListingParsing
+{
+	NSDictionary*				contents;
+	NSDictionary*				attributes;
+	NSDate*						date;
+	
+	contents = [self _parseFTPListing:"type=cdir;modify=20090101000000; .\r\n"
+									"type=pdir;modify=20090101000000; ..\r\n"
+									"type=file;size=1024;modify=20090215123456;perm=r; Report 2009.pdf\r\n"
+									"type=dir;modify=20080704080910;perm=flcdmpe; Photos\r\n"
+									"Type=File;Size=0;Modify=20100101000000.123; empty\r\n"
+									"type=OS.unix=symlink;size=9; link"
+							machineListing:YES];
+	AssertEquals([contents count], (NSUInteger)4, nil);
+	attributes = [contents objectForKey:@"Report 2009.pdf"];
+	AssertEqualObjects([attributes objectForKey:NSFileType], NSFileTypeRegular, nil);
+	AssertEqualObjects([attributes objectForKey:NSFileSize], [NSNumber numberWithUnsignedLongLong:1024], nil);
+	AssertEqualObjects([attributes objectForKey:NSFileModificationDate], _DateFromComponents(2009, 2, 15, 12, 34, 56, YES), nil);
+	attributes = [contents objectForKey:@"Photos"];
+	AssertEqualObjects([attributes objectForKey:NSFileType], NSFileTypeDirectory, nil);
+	AssertNil([attributes objectForKey:NSFileSize], nil);
+	AssertEqualObjects([attributes objectForKey:NSFileModificationDate], _DateFromComponents(2008, 7, 4, 8, 9, 10, YES), nil);
+	attributes = [contents objectForKey:@"empty"];
+	AssertEqualObjects([attributes objectForKey:NSFileType], NSFileTypeRegular, nil);
+	AssertEqualObjects([attributes objectForKey:NSFileSize], [NSNumber numberWithUnsignedLongLong:0], nil);
+	AssertEqualObjects([attributes objectForKey:NSFileModificationDate], _DateFromComponents(2010, 1, 1, 0, 0, 0, YES), nil);
+	attributes = [contents objectForKey:@"link"];
+	AssertNotNil(attributes, nil);
+	AssertNil([attributes objectForKey:NSFileType], nil);
+	
+	contents = [self _parseFTPListing:"total 24\r\n"
+									"drwxr-xr-x   5 user  staff     170 Jan 15  2008 .\r\n"
+									"drwxr-xr-x  12 user  staff     408 Jan 15  2008 ..\r\n"
+									"drwxr-xr-x   2 user  staff      68 Jan 15  2008 Folder\r\n"
+									"-rw-r--r--   1 user  staff   12345 Mar  3 14:07 File With Spaces.txt\r\n"
+									"lrwxr-xr-x   1 user  staff      10 Feb 28  2009 Link -> Target.txt\r\n"
+									"crw-rw-rw-   1 root  wheel    3,   2 Dec 31  2007 null\r\n"
+									"brw-r-----   1 root  operator 1,   0 Jun 10  2007 disk0\r\n"
+									"-rw-r--r-- 1 may jun 512 Oct  5  2006 Tricky\r\n"
+									"-rw-r--r-- 1 42 Apr  1  2009 NoGroup\n"
+							machineListing:NO];
+	AssertEquals([contents count], (NSUInteger)7, nil);
+	attributes = [contents objectForKey:@"Folder"];
+	AssertEqualObjects([attributes objectForKey:NSFileType], NSFileTypeDirectory, nil);
+	AssertEqualObjects([attributes objectForKey:NSFileModificationDate], _DateFromComponents(2008, 1, 15, 0, 0, 0, NO), nil);
+	attributes = [contents objectForKey:@"File With Spaces.txt"];
+	AssertEqualObjects([attributes objectForKey:NSFileType], NSFileTypeRegular, nil);
+	AssertEqualObjects([attributes objectForKey:NSFileSize], [NSNumber numberWithUnsignedLongLong:12345], nil);
+	date = [attributes objectForKey:NSFileModificationDate];
+	AssertNotNil(date, nil);
+	AssertTrue([date timeIntervalSinceNow] < 2.0 * 24.0 * 60.0 * 60.0, nil); //NOTE: Entries with a time instead of a year are recent
+	AssertTrue([date timeIntervalSinceNow] > -366.0 * 24.0 * 60.0 * 60.0, nil);
+	AssertEqualObjects([date descriptionWithCalendarFormat:@"%m-%d %H:%M" timeZone:nil locale:nil], @"03-03 14:07", nil);
+	attributes = [contents objectForKey:@"Link"];
+	AssertNotNil(attributes, nil);
+	AssertNil([attributes objectForKey:NSFileType], nil);
+	AssertEqualObjects([attributes objectForKey:NSFileModificationDate], _DateFromComponents(2009, 2, 28, 0, 0, 0, NO), nil);
+	AssertNil([contents objectForKey:@"Link -> Target.txt"], nil);
+	attributes = [contents objectForKey:@"null"];
+	AssertNotNil(attributes, nil);
+	AssertNil([attributes objectForKey:NSFileType], nil);
+	AssertEqualObjects([attributes objectForKey:NSFileModificationDate], _DateFromComponents(2007, 12, 31, 0, 0, 0, NO), nil);
+	AssertNotNil([contents objectForKey:@"disk0"], nil);
+	attributes = [contents objectForKey:@"Tricky"];
+	AssertEqualObjects([attributes objectForKey:NSFileSize], [NSNumber numberWithUnsignedLongLong:512], nil);
+	AssertEqualObjects([attributes objectForKey:NSFileModificationDate], _DateFromComponents(2006, 10, 5, 0, 0, 0, NO), nil);
+	attributes = [contents objectForKey:@"NoGroup"];
+	AssertEqualObjects([attributes objectForKey:NSFileSize], [NSNumber numberWithUnsignedLongLong:42], nil);
+	AssertEqualObjects([attributes objectForKey:NSFileModificationDate], _DateFromComponents(2009, 4, 1, 0, 0, 0, NO), nil);
+	
+	contents = [self _parseFTPListing:"02-15-09  01:30PM       <DIR>          Documents\r\n"
+									"12-31-1999  11:59AM            4096 Old File.txt\r\n"
+									"07-04-08  12:05AM               7 midnight.txt\r\n"
+									"03-01-10  18:45                 123 24h.log"
+							machineListing:NO];
+	AssertEquals([contents count], (NSUInteger)4, nil);
+	attributes = [contents objectForKey:@"Documents"];
+	AssertEqualObjects([attributes objectForKey:NSFileType], NSFileTypeDirectory, nil);
+	AssertEqualObjects([attributes objectForKey:NSFileModificationDate], _DateFromComponents(2009, 2, 15, 13, 30, 0, NO), nil);
+	attributes = [contents objectForKey:@"Old File.txt"];
+	AssertEqualObjects([attributes objectForKey:NSFileType], NSFileTypeRegular, nil);
+	AssertEqualObjects([attributes objectForKey:NSFileSize], [NSNumber numberWithUnsignedLongLong:4096], nil);
+	AssertEqualObjects([attributes objectForKey:NSFileModificationDate], _DateFromComponents(1999, 12, 31, 11, 59, 0, NO), nil);
+	attributes = [contents objectForKey:@"midnight.txt"];
+	AssertEqualObjects([attributes objectForKey:NSFileModificationDate], _DateFromComponents(2008, 7, 4, 0, 5, 0, NO), nil);
+	attributes = [contents objectForKey:@"24h.log"];
+	AssertEqualObjects([attributes objectForKey:NSFileSize], [NSNumber numberWithUnsignedLongLong:123], nil);
+	AssertEqualObjects([attributes objectForKey:NSFileModificationDate], _DateFromComponents(2010, 3, 1, 18, 45, 0, NO), nil);
+}
+
 - (void) testLocal
 {
 	NSString*					path = [@"/tmp" stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
@@ -299,6 +719,58 @@ Exit:
 	AssertTrue([[NSFileManager defaultManager] removeItemAtPath:path error:&error], [error localizedDescription]);
 }
 
+- (void) testLocalCopy
+{
+	NSString*					path = [@"/tmp" stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	NSString*					sourcePath = [path stringByAppendingPathComponent:@"Source.data"];
+	NSString*					copyPath = [path stringByAppendingPathComponent:@"Copy.data"];
+	NSString*					largePath = [@"/tmp" stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	NSDate*						date = [NSDate dateWithTimeIntervalSinceReferenceDate:100000000.0];
+	const char*					attribute = "net.pol-online.polkit.test";
+	char						buffer[32];
+	FileTransferController*		controller;
+	NSDictionary*				attributes;
+	NSMutableData*				data;
+	NSError*					error;
+	NSUInteger					i;
+	
+	AssertTrue([[NSFileManager defaultManager] createDirectoryAtPath:path withIntermediateDirectories:NO attributes:nil error:&error], [error localizedDescription]);
+	controller = [FileTransferController fileTransferControllerWithURL:[NSURL fileURLWithPath:path]];
+	AssertNotNil(controller, nil);
+	[controller setDelegate:self];
+	
+	//NOTE: Copies must preserve the metadata of the source file
+	AssertTrue([[NSData dataWithContentsOfFile:@"Resources/Image.jpg"] writeToFile:sourcePath atomically:NO], nil);
+	AssertEquals(setxattr([sourcePath fileSystemRepresentation], attribute, "PolKit", 6, 0, 0), 0, nil);
+	AssertEquals(setxattr([sourcePath fileSystemRepresentation], XATTR_RESOURCEFORK_NAME, "Resource", 8, 0, 0), 0, nil);
+	attributes = [NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithUnsignedShort:0640], NSFilePosixPermissions, date, NSFileModificationDate, nil];
+	AssertTrue([[NSFileManager defaultManager] setAttributes:attributes ofItemAtPath:sourcePath error:&error], [error localizedDescription]);
+	AssertTrue([controller copyPath:@"Source.data" toPath:@"Copy.data"], nil);
+	AssertEqualObjects([NSData dataWithContentsOfFile:copyPath], [NSData dataWithContentsOfFile:sourcePath], nil);
+	attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:copyPath error:&error];
+	AssertNotNil(attributes, [error localizedDescription]);
+	AssertEquals([[attributes objectForKey:NSFilePosixPermissions] unsignedShortValue], (unsigned short)0640, nil);
+	AssertEqualObjects([attributes objectForKey:NSFileModificationDate], date, nil);
+	AssertEquals(getxattr([copyPath fileSystemRepresentation], attribute, buffer, sizeof(buffer), 0, 0), (ssize_t)6, nil);
+	AssertTrue(!memcmp(buffer, "PolKit", 6), nil);
+	AssertEquals(getxattr([copyPath fileSystemRepresentation], XATTR_RESOURCEFORK_NAME, buffer, sizeof(buffer), 0, 0), (ssize_t)8, nil);
+	AssertTrue(!memcmp(buffer, "Resource", 8), nil);
+	
+	//NOTE: Files large enough to bypass the buffer cache must still be transferred intact
+	data = [NSMutableData dataWithLength:(20 * 1024 * 1024 + 12345)];
+	srandom(0);
+	for(i = 0; i < [data length] / sizeof(long); ++i)
+	((long*)[data mutableBytes])[i] = random();
+	AssertTrue([data writeToFile:largePath atomically:NO], nil);
+	AssertTrue([controller uploadFileFromPath:largePath toPath:@"Large.data"], nil);
+	AssertEqualObjects([NSData dataWithContentsOfFile:[path stringByAppendingPathComponent:@"Large.data"]], data, nil);
+	AssertTrue([controller copyPath:@"Large.data" toPath:@"Copy.data"], nil);
+	AssertEqualObjects([NSData dataWithContentsOfFile:copyPath], data, nil);
+	
+	AssertTrue([[NSFileManager defaultManager] removeItemAtPath:largePath error:&error], [error localizedDescription]);
+	AssertTrue([[NSFileManager defaultManager] removeItemAtPath:path error:&error], [error localizedDescription]);
+}
+
 - (void) testAFP
 {
 	NSURL*						url;
@@ -323,6 +795,97 @@ Exit:
 	[self _testURL:url flag:NO];
 }
 
+- (void) _testFTPBatch:(NSURL*)url
+{
+	NSString*					imagePath = @"Resources/Image.jpg";
+	NSMutableArray*				localPaths = [NSMutableArray array];
+	NSMutableArray*				remotePaths = [NSMutableArray array];
+	NSMutableArray*				tmpPaths = [NSMutableArray array];
+	FTPTransferController*		controller;
+	NSData*						data;
+	NSError*					error;
+	NSUInteger					i;
+	
+	controller = (FTPTransferController*)[FileTransferController fileTransferControllerWithURL:url];
+	AssertNotNil(controller, nil);
+	[controller setDelegate:self];
+	[controller setTimeOut:kTimeOut];
+	[controller setKeepConnectionAlive:YES];
+	[controller setMaximumConcurrentConnections:3];
+	
+	for(i = 0; i < 10; ++i) {
+		[localPaths addObject:imagePath];
+		[remotePaths addObject:[NSString stringWithFormat:@"Batch/Test-%i.jpg", i]];
+		[tmpPaths addObject:[@"/tmp" stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]]];
+	}
+	AssertTrue([controller uploadFilesFromPaths:localPaths toPaths:remotePaths], nil);
+	AssertEquals([[controller contentsOfDirectoryAtPath:@"Batch"] count], (NSUInteger)10, nil);
+	AssertTrue([controller downloadFilesFromPaths:remotePaths toPaths:tmpPaths], nil);
+	data = [NSData dataWithContentsOfFile:imagePath];
+	for(i = 0; i < 10; ++i) {
+		AssertEqualObjects([NSData dataWithContentsOfFile:[tmpPaths objectAtIndex:i]], data, nil);
+		AssertTrue([[NSFileManager defaultManager] removeItemAtPath:[tmpPaths objectAtIndex:i] error:&error], [error localizedDescription]);
+	}
+	for(i = 0; i < 10; ++i)
+	[tmpPaths replaceObjectAtIndex:i withObject:[NSString stringWithFormat:@"Batch/Renamed-%i.jpg", i]];
+	AssertTrue([controller movePaths:remotePaths toPaths:tmpPaths], nil);
+	AssertNotNil([[controller contentsOfDirectoryAtPath:@"Batch"] objectForKey:@"Renamed-0.jpg"], nil);
+	AssertTrue([controller deleteFilesAtPaths:tmpPaths], nil);
+	AssertEquals([[controller contentsOfDirectoryAtPath:@"Batch"] count], (NSUInteger)0, nil);
+	[controller setDelegate:nil];
+	AssertFalse([controller deleteFilesAtPaths:tmpPaths], nil);
+	[controller setDelegate:self];
+	for(i = 0; i < 10; ++i)
+	[remotePaths replaceObjectAtIndex:i withObject:[NSString stringWithFormat:@"Batch/Folder-%i", i]];
+	AssertTrue([controller createDirectoriesAtPaths:remotePaths], nil);
+	AssertEquals([[controller contentsOfDirectoryAtPath:@"Batch"] count], (NSUInteger)10, nil);
+	for(i = 0; i < 10; ++i)
+	AssertTrue([controller deleteDirectoryAtPath:[remotePaths objectAtIndex:i]], nil);
+	AssertTrue([controller deleteDirectoryAtPath:@"Batch"], nil);
+}
+
+- (void) _benchmarkFTPBatch:(NSURL*)url
+{
+	NSString*					imagePath = @"Resources/Image.jpg";
+	NSMutableArray*				localPaths = [NSMutableArray array];
+	NSMutableArray*				remotePaths = [NSMutableArray array];
+	NSMutableArray*				movedPaths = [NSMutableArray array];
+	FTPTransferController*		controller;
+	CFAbsoluteTime				serialTime,
+								batchTime;
+	NSUInteger					i;
+	
+	controller = (FTPTransferController*)[FileTransferController fileTransferControllerWithURL:url];
+	AssertNotNil(controller, nil);
+	[controller setTimeOut:kTimeOut];
+	[controller setKeepConnectionAlive:YES];
+	[controller setMaximumConcurrentConnections:8];
+	for(i = 0; i < kFTPBenchmarkFiles; ++i) {
+		[localPaths addObject:imagePath];
+		[remotePaths addObject:[NSString stringWithFormat:@"Benchmark/File-%i.jpg", i]];
+		[movedPaths addObject:[NSString stringWithFormat:@"Benchmark/Moved-%i.jpg", i]];
+	}
+	AssertTrue([controller createDirectoryAtPath:@"Benchmark"], nil);
+	
+	serialTime = CFAbsoluteTimeGetCurrent();
+	for(i = 0; i < kFTPBenchmarkFiles; ++i)
+	AssertTrue([controller uploadFileFromPath:imagePath toPath:[remotePaths objectAtIndex:i]], nil);
+	for(i = 0; i < kFTPBenchmarkFiles; ++i)
+	AssertTrue([controller movePath:[remotePaths objectAtIndex:i] toPath:[movedPaths objectAtIndex:i]], nil);
+	for(i = 0; i < kFTPBenchmarkFiles; ++i)
+	AssertTrue([controller deleteFileAtPath:[movedPaths objectAtIndex:i]], nil);
+	serialTime = CFAbsoluteTimeGetCurrent() - serialTime;
+	
+	batchTime = CFAbsoluteTimeGetCurrent();
+	AssertTrue([controller uploadFilesFromPaths:localPaths toPaths:remotePaths], nil);
+	AssertTrue([controller movePaths:remotePaths toPaths:movedPaths], nil);
+	AssertTrue([controller deleteFilesAtPaths:movedPaths], nil);
+	batchTime = CFAbsoluteTimeGetCurrent() - batchTime;
+	
+	AssertTrue([controller deleteDirectoryAtPath:@"Benchmark"], nil);
+	[self logMessage:@"Uploading, renaming and deleting %i files: %.3f seconds serially, %.3f seconds in batches (%.1fx)", kFTPBenchmarkFiles, serialTime, batchTime, serialTime / batchTime];
+}
+
 - (void) testFTP
 {
 	NSURL*						url;
@@ -330,6 +893,8 @@ Exit:
 	if((url = [self _testURLForProtocol:@"FTP"])) {
 		[self _testURL:url flag:NO];
 		[self _testURL:url flag:YES];
+		[self _testFTPBatch:url];
+		[self _benchmarkFTPBatch:url];
 	}
 }
 
@@ -340,6 +905,7 @@ Exit:
 	if((url = [self _testURLForProtocol:@"FTPS"])) {
 		[self _testURL:url flag:NO];
 		[self _testURL:url flag:YES];
+		[self _testFTPBatch:url];
 	}
 }
 
@@ -367,12 +933,117 @@ Exit:
 	[self _testURL:url flag:YES];
 }
 
+- (void) testPersistentConnections
+{
+	NSData*						data = [NSData dataWithContentsOfFile:@"Resources/Image.jpg"];
+	HTTPTransferController*		controller1;
+	HTTPTransferController*		controller2;
+	volatile int32_t			counts[3] = {0, 0, 0};
+	NSUInteger					asyncCounts[2] = {0, 0};
+	NSMutableArray*				controllers = [NSMutableArray array];
+	NSURL*						url;
+	CFAbsoluteTime				time;
+	NSUInteger					maximum,
+								count,
+								i,
+								j;
+	
+	if((url = [self _testURLForProtocol:@"WebDAV"])) {
+		for(i = 0; i < 2; ++i) {
+			controller1 = [[WebDAVTransferController alloc] initWithBaseURL:url];
+			AssertNotNil(controller1, nil);
+			[controller1 setDelegate:self];
+			[controller1 setKeepConnectionAlive:(i ? YES : NO)];
+			controller2 = [[WebDAVTransferController alloc] initWithBaseURL:url];
+			AssertNotNil(controller2, nil);
+			[controller2 setDelegate:self];
+			[controller2 setKeepConnectionAlive:(i ? YES : NO)];
+			
+			time = CFAbsoluteTimeGetCurrent();
+			for(j = 0; j < 20; ++j) {
+				AssertTrue([(j % 2 ? controller1 : controller2) uploadFileFromData:data toPath:@"Test.jpg"], nil);
+				AssertNotNil([(j % 2 ? controller2 : controller1) contentsOfDirectoryAtPath:nil], nil);
+			}
+			[self logMessage:@"%i requests with persistent connections %@ in %.3f seconds", 2 * j, (i ? @"enabled" : @"disabled"), CFAbsoluteTimeGetCurrent() - time];
+			
+			AssertTrue([controller1 deleteFileAtPath:@"Test.jpg"], nil);
+			AssertEquals([HTTPTransferController _activePersistentConnectionCountForURL:url], (NSUInteger)0, nil);
+			[controller2 release];
+			[controller1 release];
+		}
+		
+		AssertTrue([[[[WebDAVTransferController alloc] initWithBaseURL:url] autorelease] uploadFileFromData:data toPath:@"Test.jpg"], nil);
+		maximum = [HTTPTransferController maximumPersistentConnectionsPerHost];
+		[HTTPTransferController setMaximumPersistentConnectionsPerHost:2];
+		for(i = 0; i < 6; ++i) {
+			controller1 = [[WebDAVTransferController alloc] initWithBaseURL:url];
+			[controller1 setKeepConnectionAlive:YES];
+			[controller1 setTimeOut:kTimeOut];
+			[NSThread detachNewThreadSelector:@selector(_persistentConnectionsThread:) toTarget:self withObject:[NSArray arrayWithObjects:controller1, [NSValue valueWithPointer:(void*)counts], nil]];
+			[controller1 release];
+		}
+		while(counts[0] < 6) {
+			count = [HTTPTransferController _activePersistentConnectionCountForURL:url];
+			AssertTrue(count <= 2, nil);
+			counts[2] = MAX(counts[2], (int32_t)count);
+			usleep(1000);
+		}
+		AssertEquals(counts[1], (int32_t)6, nil);
+		AssertTrue(counts[2] > 0, nil);
+		AssertEquals([HTTPTransferController _activePersistentConnectionCountForURL:url], (NSUInteger)0, nil);
+		
+		//NOTE: Asynchronous transfers multiplexed on the shared I/O thread must be queued instead of exceeding the limit
+		for(i = 0; i < 6; ++i) {
+			controller1 = [[[WebDAVTransferController alloc] initWithBaseURL:url] autorelease];
+			[controller1 setKeepConnectionAlive:YES];
+			[controller1 setTimeOut:kTimeOut];
+			[controllers addObject:controller1];
+			AssertTrue([controller1 downloadFileFromPath:@"Test.jpg" toStream:[NSOutputStream outputStreamToMemory] target:self selector:@selector(fileTransferController:didCompleteTransfer:context:) context:asyncCounts], nil);
+		}
+		while(asyncCounts[0] < [controllers count]) {
+			AssertTrue([HTTPTransferController _activePersistentConnectionCountForURL:url] <= 2, nil);
+			[[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.001]];
+		}
+		AssertEquals(asyncCounts[1], [controllers count], nil);
+		AssertEquals([HTTPTransferController _activePersistentConnectionCountForURL:url], (NSUInteger)0, nil);
+		[HTTPTransferController setMaximumPersistentConnectionsPerHost:maximum];
+		AssertTrue([[[[WebDAVTransferController alloc] initWithBaseURL:url] autorelease] deleteFileAtPath:@"Test.jpg"], nil);
+	}
+}
+
+- (void) _persistentConnectionsThread:(NSArray*)arguments
+{
+	NSAutoreleasePool*			pool = [NSAutoreleasePool new];
+	HTTPTransferController*		controller = [arguments objectAtIndex:0];
+	volatile int32_t*			counts = [[arguments objectAtIndex:1] pointerValue];
+	BOOL						success = YES;
+	NSUInteger					i;
+	
+	for(i = 0; i < 10; ++i) {
+		if(![controller downloadFileFromPathToNull:@"Test.jpg"])
+		success = NO;
+	}
+	if(success)
+	OSAtomicIncrement32Barrier(&counts[1]);
+	OSAtomicIncrement32Barrier(&counts[0]);
+	
+	[pool drain];
+}
+
+- (BOOL) _bucketKeys:(NSDictionary*)keys context:(void*)context
+{
+	*((NSUInteger*)context) += [keys count];
+	
+	return YES;
+}
+
 - (void) _testAmazonS3:(BOOL)secure
 {
 	NSString*					imagePath = @"Resources/Image.jpg";
 	AmazonS3TransferController*	controller;
 	NSURL*						url;
 	NSString*					name;
+	NSUInteger					count;
 	
 	if((url = [self _testURLForProtocol:(secure ? @"SecureAmazonS3" : @"AmazonS3")])) {
 		controller = [[(secure ? [SecureAmazonS3TransferController class] : [AmazonS3TransferController class]) alloc] initWithAccessKeyID:[url user] secretAccessKey:[url passwordByReplacingPercentEscapes] bucket:nil];
@@ -412,6 +1083,9 @@ Exit:
 		AssertNotNil([controller contentsOfDirectoryAtPath:nil], nil);
 		AssertTrue([controller uploadFileFromPath:imagePath toPath:@"Test.jpg"], nil);
 		AssertTrue([controller downloadFileFromPathToNull:@"Test.jpg"], nil);
+		count = 0;
+		AssertTrue([controller enumerateBucketKeysForPath:nil withPrefix:nil delimiter:nil target:self selector:@selector(_bucketKeys:context:) context:&count], nil);
+		AssertEquals(count, [[controller contentsOfDirectoryAtPath:nil] count], nil);
 		AssertTrue([controller copyPath:@"Test.jpg" toPath:@"Test-copy.jpg"], nil);
 		AssertTrue([controller deleteFileAtPath:@"Test-copy.jpg"], nil);
 		AssertTrue([controller deleteFileAtPath:@"Test.jpg"], nil);
@@ -429,4 +1103,51 @@ Exit:
 	[self _testAmazonS3:YES];
 }
 
+- (void) testAmazonS3Multipart
+{
+	NSString*					localPath = [@"/tmp" stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	NSString*					tmpPath = [@"/tmp" stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	AmazonS3TransferController*	controller;
+	NSMutableData*				data;
+	NSError*					error;
+	NSURL*						url;
+	NSUInteger					i;
+	
+	if((url = [self _testURLForProtocol:@"AmazonS3"])) {
+		data = [NSMutableData dataWithLength:(12 * 1024 * 1024 + 12345)];
+		srandom(0);
+		for(i = 0; i < [data length] / sizeof(long); ++i)
+		((long*)[data mutableBytes])[i] = random();
+		AssertTrue([data writeToFile:localPath atomically:NO], nil);
+		
+		controller = [[AmazonS3TransferController alloc] initWithBaseURL:url];
+		AssertNotNil(controller, nil);
+		[controller setDelegate:self];
+		[controller setTimeOut:kTimeOut];
+		[controller setMultipartUploadPartSize:(5 * 1024 * 1024)];
+		[controller setMultipartUploadConcurrency:3];
+		
+		AssertTrue([controller uploadFileFromPath:localPath toPath:@"Test.data"], nil);
+		AssertTrue([controller downloadFileFromPath:@"Test.data" toPath:tmpPath], nil);
+		AssertEqualObjects([NSData dataWithContentsOfFile:tmpPath], data, nil);
+		AssertTrue([[NSFileManager defaultManager] removeItemAtPath:tmpPath error:&error], [error localizedDescription]);
+		
+		[controller setDigestComputation:YES];
+		[controller setEncryptionPassword:@"info@pol-online.net"];
+		AssertTrue([controller uploadFileFromPath:localPath toPath:@"Test.data"], nil);
+		AssertNotNil([controller lastTransferDigestData], nil);
+		AssertTrue([controller downloadFileFromPath:@"Test.data" toPath:tmpPath], nil);
+		AssertNotNil([controller lastTransferDigestData], nil);
+		AssertEqualObjects([NSData dataWithContentsOfFile:tmpPath], data, nil);
+		AssertTrue([[NSFileManager defaultManager] removeItemAtPath:tmpPath error:&error], [error localizedDescription]);
+		[controller setEncryptionPassword:nil];
+		[controller setDigestComputation:NO];
+		
+		AssertTrue([controller deleteFileAtPath:@"Test.data"], nil);
+		[controller release];
+		
+		AssertTrue([[NSFileManager defaultManager] removeItemAtPath:localPath error:&error], [error localizedDescription]);
+	}
+}
+
 @end